@@ -1,10 +1,12 @@
 #include "avx_cruncher.h"
 #include "os.h"
 #include "task_buffers.h"
+#include "word_table.h"
 #include "md5_avx2.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #if defined(__x86_64__) || defined(_M_AMD64)
 static bool cpu_has_avx512f(void) {
@@ -15,15 +17,44 @@ static bool cpu_has_avx512f(void) {
 /* Which SIMD path to use for MD5 hashing */
 typedef enum { SIMD_AVX512, SIMD_AVX2, SIMD_SCALAR } simd_mode;
 
+/*
+ * Target-side tables, built once per cruncher_config and version of its active
+ * target set, and shared by all of its crunchers (one per core). Crunchers
+ * move to the tables of a new version between buffers; the old ones are freed
+ * with their last user. Below AVX_TARGETS_INDEX_MIN targets the kernels
+ * broadcast-compare every reversed target (rev_cmp[r]); from there on they
+ * probe a Bloom filter over them (rev_filter[r]) and candidates are confirmed
+ * in the Eytzinger table. Reversals are through zero words only (r from
+ * md5_reversible_steps(nw), at most 3 distinct).
+ */
+#define AVX_TARGETS_INDEX_MIN 32
+
+typedef struct avx_targets_s {
+    cruncher_config *cfg;
+    uint32_t version;        // of snap, 0 without cfg->targets
+    target_snapshot *snap;   // NULL without cfg->targets
+    int refs;
+    bool indexed;
+    avx_target_list list;
+    target_table table;
+    uint32_t *rev_cmp[MD5_MAX_REV + 1];
+    target_filter rev_filter[MD5_MAX_REV + 1];
+    struct avx_targets_s *next;
+} avx_targets;
+
 /* Context for one CPU cruncher thread */
 typedef struct {
     cruncher_config *cfg;
     simd_mode mode;
+    uint32_t id;
     volatile bool is_running;
     volatile uint64_t consumed_bufs;
     volatile uint64_t consumed_anas;
     uint64_t task_time_start;
     uint64_t task_time_end;
+    avx_targets *targets;
+    /* Interleaved MD5 chains per SIMD batch, see avx_md5_chains */
+    int chains;
 } avx_cruncher_ctx;
 
 /* ---------- PUTCHAR_SCALAR: same byte-packing as the OpenCL kernel's PUTCHAR ---------- */
@@ -217,18 +248,50 @@ static bool heap_next(permut_task *task) {
     return false;
 }
 
+/*
+ * Multiset tasks instead step through a[] in lexicographic order (Knuth's
+ * Algorithm L), which never produces the same ordering of equal words twice:
+ * a[] starts ascending and the task is exhausted (i = n, as after Heap's) once
+ * it is descending.
+ */
+static bool multiset_next(permut_task *task) {
+    int j = task->n - 2;
+    while (j >= 0 && task->a[j] >= task->a[j + 1]) j--;
+    if (j < 0) {
+        task->i = task->n;
+        return false;
+    }
+    int l = task->n - 1;
+    while (task->a[j] >= task->a[l]) l--;
+    uint8_t tmp = task->a[j];
+    task->a[j] = task->a[l];
+    task->a[l] = tmp;
+    for (int lo = j + 1, hi = task->n - 1; lo < hi; lo++, hi--) {
+        tmp = task->a[lo];
+        task->a[lo] = task->a[hi];
+        task->a[hi] = tmp;
+    }
+    return true;
+}
+
+static inline bool permut_next(permut_task *task) {
+    return task->multiset ? multiset_next(task) : heap_next(task);
+}
+
 /* ---------- GPU-9: OR-based string construction ---------- */
 
 /*
  * Precompute each word's bytes as packed uint32s with trailing space.
  * Indexed by byte offset in all_strs. Only computes for offsets actually used.
+ * Returns the candidate string length, shared by all permutations of the task.
  */
-static void precompute_word_images(permut_task *task,
-                                    uint32_t wimg[][11],
-                                    uint8_t *wlen_sp,
-                                    int *num_offsets_out) {
+static int precompute_word_images(permut_task *task,
+                                   uint32_t wimg[][11],
+                                   uint8_t *wlen_sp,
+                                   int *num_offsets_out) {
     memset(wlen_sp, 0, MAX_STR_LENGTH);
     int num_offsets = 0;
+    int pos = 0;
     for (int io = 0; task->offsets[io]; io++) {
         int8_t off = task->offsets[io];
         int byte_off = (off < 0) ? (-off - 1) : (task->a[off - 1] - 1);
@@ -245,9 +308,11 @@ static void precompute_word_images(permut_task *task,
             wimg[byte_off][len >> 2] |= ((uint32_t)' ') << ((len & 3) << 3);
             wlen_sp[byte_off] = len + 1;
         }
+        pos += wlen_sp[byte_off];
         num_offsets = io + 1;
     }
     *num_offsets_out = num_offsets;
+    return pos - 1;  /* no trailing space after the last word */
 }
 
 /*
@@ -293,284 +358,594 @@ static int construct_string_or(permut_task *task, uint32_t *key,
 
 /* ---------- Process one task (all permutations) ---------- */
 
-void avx_check_hashes(cruncher_config *cfg, uint32_t *hash, uint32_t *key, int wcs) {
-    for (uint32_t ih = 0; ih < cfg->hashes_num; ih++) {
-        if (hash[0] == cfg->hashes[4 * ih] &&
-            hash[1] == cfg->hashes[4 * ih + 1] &&
-            hash[2] == cfg->hashes[4 * ih + 2] &&
-            hash[3] == cfg->hashes[4 * ih + 3]) {
-            PUTCHAR_SCALAR(key, wcs, 0);
-            memcpy(cfg->hashes_reversed + ih * MAX_STR_LENGTH / 4,
-                   key, MAX_STR_LENGTH);
-        }
+static void avx_check_target(cruncher_config *cfg, uint32_t ih,
+                             uint32_t *hash, uint32_t *key, int wcs) {
+    if (hash[0] == cfg->hashes[4 * ih] &&
+        hash[1] == cfg->hashes[4 * ih + 1] &&
+        hash[2] == cfg->hashes[4 * ih + 2] &&
+        hash[3] == cfg->hashes[4 * ih + 3]) {
+        PUTCHAR_SCALAR(key, wcs, 0);
+        memcpy(cfg->hashes_reversed + ih * MAX_STR_LENGTH / 4,
+               key, MAX_STR_LENGTH);
+        if (cfg->targets) target_set_mark_found(cfg->targets, ih);
     }
 }
 
+void avx_check_hashes(cruncher_config *cfg, const avx_target_list *targets,
+                      uint32_t *hash, uint32_t *key, int wcs) {
+    const target_table *table = targets->table;
+    if (table) {
+        for (uint32_t k = target_table_lower(table, hash[0]);
+             k && table->keys[k] == hash[0]; k = target_table_next(table, k))
+            avx_check_target(cfg, table->ids[k], hash, key, wcs);
+        return;
+    }
+    for (uint32_t i = 0; i < targets->num; i++)
+        avx_check_target(cfg, targets->ids ? targets->ids[i] : i, hash, key, wcs);
+}
+
 #if defined(__x86_64__) || defined(_M_AMD64)
 /*
- * Combined AVX2 MD5 (8-lane) + early-exit hash check.
- * Computes only 61 of 64 MD5 rounds. hash[0] (a) is finalized after round 60.
- * SIMD-checks a against all targets; skips last 3 rounds (~5% MD5 savings)
- * for the ~100% case where no hash[0] matches.
+ * Marks in hit[j] the lanes of chain j whose x may equal a reversed target:
+ * exact broadcast compares for small target sets, one gather into the Bloom
+ * filter per chain for large ones. Returns whether any lane is marked.
  */
-static void md5_check_avx2(cruncher_config *cfg,
-                            uint32_t keys[16][8], int wcs_arr[8], int count) {
-    __m256i k[16];
-    for (int w = 0; w < 16; w++) {
-        k[w] = _mm256_load_si256((__m256i *)keys[w]);
+static inline __attribute__((always_inline))
+uint32_t md5_avx2_match(const __m256i *x, const int X,
+                        const md5_batch_args *args, uint32_t *hit) {
+    __m256i m[MD5_MAX_CHAINS];
+    if (args->filter) {
+        const __m256i one = _mm256_set1_epi32(1), low5 = _mm256_set1_epi32(31);
+        const __m128i shift = _mm_cvtsi32_si128((int)args->filter->shift);
+        for (int j = 0; j < X; j++) {
+            __m256i idx = _mm256_srl_epi32(
+                _mm256_mullo_epi32(x[j], _mm256_set1_epi32((int32_t)TARGET_FILTER_MUL)), shift);
+            __m256i w = _mm256_i32gather_epi32((const int *)args->filter->words, idx, 4);
+            __m256i bits = _mm256_or_si256(
+                _mm256_sllv_epi32(one, _mm256_and_si256(x[j], low5)),
+                _mm256_sllv_epi32(one, _mm256_and_si256(_mm256_srli_epi32(x[j], 5), low5)));
+            m[j] = _mm256_cmpeq_epi32(_mm256_and_si256(w, bits), bits);
+        }
+    } else {
+        for (int j = 0; j < X; j++) m[j] = _mm256_setzero_si256();
+        for (uint32_t i = 0; i < args->targets->num; i++) {
+            __m256i t = _mm256_set1_epi32((int32_t)args->cmp[i]);
+            for (int j = 0; j < X; j++)
+                m[j] = _mm256_or_si256(m[j], _mm256_cmpeq_epi32(x[j], t));
+        }
+    }
+    uint32_t any = 0;
+    for (int j = 0; j < X; j++) {
+        hit[j] = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(m[j]));
+        any |= hit[j];
     }
+    return any;
+}
 
-    __m256i a = _mm256_set1_epi32(0x67452301);
-    __m256i b = _mm256_set1_epi32((int32_t)0xefcdab89);
-    __m256i c = _mm256_set1_epi32((int32_t)0x98badcfe);
-    __m256i d = _mm256_set1_epi32(0x10325476);
+/*
+ * Early exit after step 60 - r when the targets were reversed by r steps:
+ * return unless some lane of x may equal a reversed target.
+ */
+#define MD5_AVX2_EXIT(r, x) do { \
+    if (args->rev == (r) && !md5_avx2_match(x, X, args, hit)) \
+        return; \
+} while (0)
 
-    /* Round 1 */
-    MD5_AVX2_STEP(MD5_AVX2_F, a, b, c, d, k[ 0], 0xd76aa478,  7);
-    MD5_AVX2_STEP(MD5_AVX2_F, d, a, b, c, k[ 1], 0xe8c7b756, 12);
-    MD5_AVX2_STEP(MD5_AVX2_F, c, d, a, b, k[ 2], 0x242070db, 17);
-    MD5_AVX2_STEP(MD5_AVX2_F, b, c, d, a, k[ 3], 0xc1bdceee, 22);
-    MD5_AVX2_STEP(MD5_AVX2_F, a, b, c, d, k[ 4], 0xf57c0faf,  7);
-    MD5_AVX2_STEP(MD5_AVX2_F, d, a, b, c, k[ 5], 0x4787c62a, 12);
-    MD5_AVX2_STEP(MD5_AVX2_F, c, d, a, b, k[ 6], 0xa8304613, 17);
-    MD5_AVX2_STEP(MD5_AVX2_F, b, c, d, a, k[ 7], 0xfd469501, 22);
-    MD5_AVX2_STEP(MD5_AVX2_F, a, b, c, d, k[ 8], 0x698098d8,  7);
-    MD5_AVX2_STEP(MD5_AVX2_F, d, a, b, c, k[ 9], 0x8b44f7af, 12);
-    MD5_AVX2_STEP(MD5_AVX2_F, c, d, a, b, k[10], 0xffff5bb1, 17);
-    MD5_AVX2_STEP(MD5_AVX2_F, b, c, d, a, k[11], 0x895cd7be, 22);
-    MD5_AVX2_STEP(MD5_AVX2_F, a, b, c, d, k[12], 0x6b901122,  7);
-    MD5_AVX2_STEP(MD5_AVX2_F, d, a, b, c, k[13], 0xfd987193, 12);
-    MD5_AVX2_STEP(MD5_AVX2_F, c, d, a, b, k[14], 0xa679438e, 17);
-    MD5_AVX2_STEP(MD5_AVX2_F, b, c, d, a, k[15], 0x49b40821, 22);
+/*
+ * Combined AVX2 MD5 (8-lane) + early-exit hash check.
+ * Stops after step 60 - args->rev, when one register of the state is final,
+ * and SIMD-checks it against the reversed targets; the remaining steps only
+ * run for the ~0% of batches where some lane matches.
+ *
+ * Always inlined into one wrapper per length class: nw is the number of key
+ * words holding message bytes or the 0x80 pad, all lanes of a batch share it
+ * (see md5_check_avx2_for). X independent 8-lane chains are interleaved step
+ * by step to hide the add/rotate latency; chain j covers lanes j*8..j*8+7.
+ *
+ * Starts at round-1 step args->start from the broadcast state args->mid; key
+ * words below it must be identical across lanes (see md5_prefix_cache).
+ */
+static inline __attribute__((always_inline))
+void md5_check_avx2_body(cruncher_config *cfg, uint32_t *keys,
+                         int *wcs_arr, int count,
+                         const md5_batch_args *args, const int nw, const int X) {
+    const uint32_t len_bits = (uint32_t)wcs_arr[0] << 3;
+    __m256i a[MD5_MAX_CHAINS], b[MD5_MAX_CHAINS], c[MD5_MAX_CHAINS], d[MD5_MAX_CHAINS];
+    for (int j = 0; j < X; j++) {
+        a[j] = _mm256_set1_epi32((int32_t)args->mid[0]);
+        b[j] = _mm256_set1_epi32((int32_t)args->mid[1]);
+        c[j] = _mm256_set1_epi32((int32_t)args->mid[2]);
+        d[j] = _mm256_set1_epi32((int32_t)args->mid[3]);
+    }
+    uint32_t hit[MD5_MAX_CHAINS] = {0};  /* candidate lanes per chain, see MD5_AVX2_EXIT */
+
+    /* Round 1, entered at step args->start */
+    switch (args->start) {
+    case  0: MD5_AVX2_STEP_X(MD5_AVX2_F, a, b, c, d,  0, 0xd76aa478,  7);  /* fallthrough */
+    case  1: MD5_AVX2_STEP_X(MD5_AVX2_F, d, a, b, c,  1, 0xe8c7b756, 12);  /* fallthrough */
+    case  2: MD5_AVX2_STEP_X(MD5_AVX2_F, c, d, a, b,  2, 0x242070db, 17);  /* fallthrough */
+    case  3: MD5_AVX2_STEP_X(MD5_AVX2_F, b, c, d, a,  3, 0xc1bdceee, 22);  /* fallthrough */
+    case  4: MD5_AVX2_STEP_X(MD5_AVX2_F, a, b, c, d,  4, 0xf57c0faf,  7);  /* fallthrough */
+    case  5: MD5_AVX2_STEP_X(MD5_AVX2_F, d, a, b, c,  5, 0x4787c62a, 12);  /* fallthrough */
+    case  6: MD5_AVX2_STEP_X(MD5_AVX2_F, c, d, a, b,  6, 0xa8304613, 17);  /* fallthrough */
+    case  7: MD5_AVX2_STEP_X(MD5_AVX2_F, b, c, d, a,  7, 0xfd469501, 22);  /* fallthrough */
+    case  8: MD5_AVX2_STEP_X(MD5_AVX2_F, a, b, c, d,  8, 0x698098d8,  7);  /* fallthrough */
+    case  9: MD5_AVX2_STEP_X(MD5_AVX2_F, d, a, b, c,  9, 0x8b44f7af, 12);  /* fallthrough */
+    case 10: MD5_AVX2_STEP_X(MD5_AVX2_F, c, d, a, b, 10, 0xffff5bb1, 17);  /* fallthrough */
+    case 11: MD5_AVX2_STEP_X(MD5_AVX2_F, b, c, d, a, 11, 0x895cd7be, 22);  /* fallthrough */
+    case 12: MD5_AVX2_STEP_X(MD5_AVX2_F, a, b, c, d, 12, 0x6b901122,  7);  /* fallthrough */
+    case 13: MD5_AVX2_STEP_X(MD5_AVX2_F, d, a, b, c, 13, 0xfd987193, 12);  /* fallthrough */
+    case 14: MD5_AVX2_STEP_X(MD5_AVX2_F, c, d, a, b, 14, 0xa679438e, 17);  /* fallthrough */
+    case 15: MD5_AVX2_STEP_X(MD5_AVX2_F, b, c, d, a, 15, 0x49b40821, 22);
+    }
     /* Round 2 */
-    MD5_AVX2_STEP(MD5_AVX2_G, a, b, c, d, k[ 1], 0xf61e2562,  5);
-    MD5_AVX2_STEP(MD5_AVX2_G, d, a, b, c, k[ 6], 0xc040b340,  9);
-    MD5_AVX2_STEP(MD5_AVX2_G, c, d, a, b, k[11], 0x265e5a51, 14);
-    MD5_AVX2_STEP(MD5_AVX2_G, b, c, d, a, k[ 0], 0xe9b6c7aa, 20);
-    MD5_AVX2_STEP(MD5_AVX2_G, a, b, c, d, k[ 5], 0xd62f105d,  5);
-    MD5_AVX2_STEP(MD5_AVX2_G, d, a, b, c, k[10], 0x02441453,  9);
-    MD5_AVX2_STEP(MD5_AVX2_G, c, d, a, b, k[15], 0xd8a1e681, 14);
-    MD5_AVX2_STEP(MD5_AVX2_G, b, c, d, a, k[ 4], 0xe7d3fbc8, 20);
-    MD5_AVX2_STEP(MD5_AVX2_G, a, b, c, d, k[ 9], 0x21e1cde6,  5);
-    MD5_AVX2_STEP(MD5_AVX2_G, d, a, b, c, k[14], 0xc33707d6,  9);
-    MD5_AVX2_STEP(MD5_AVX2_G, c, d, a, b, k[ 3], 0xf4d50d87, 14);
-    MD5_AVX2_STEP(MD5_AVX2_G, b, c, d, a, k[ 8], 0x455a14ed, 20);
-    MD5_AVX2_STEP(MD5_AVX2_G, a, b, c, d, k[13], 0xa9e3e905,  5);
-    MD5_AVX2_STEP(MD5_AVX2_G, d, a, b, c, k[ 2], 0xfcefa3f8,  9);
-    MD5_AVX2_STEP(MD5_AVX2_G, c, d, a, b, k[ 7], 0x676f02d9, 14);
-    MD5_AVX2_STEP(MD5_AVX2_G, b, c, d, a, k[12], 0x8d2a4c8a, 20);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, a, b, c, d,  1, 0xf61e2562,  5);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, d, a, b, c,  6, 0xc040b340,  9);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, c, d, a, b, 11, 0x265e5a51, 14);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, b, c, d, a,  0, 0xe9b6c7aa, 20);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, a, b, c, d,  5, 0xd62f105d,  5);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, d, a, b, c, 10, 0x02441453,  9);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, c, d, a, b, 15, 0xd8a1e681, 14);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, b, c, d, a,  4, 0xe7d3fbc8, 20);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, a, b, c, d,  9, 0x21e1cde6,  5);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, d, a, b, c, 14, 0xc33707d6,  9);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, c, d, a, b,  3, 0xf4d50d87, 14);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, b, c, d, a,  8, 0x455a14ed, 20);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, a, b, c, d, 13, 0xa9e3e905,  5);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, d, a, b, c,  2, 0xfcefa3f8,  9);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, c, d, a, b,  7, 0x676f02d9, 14);
+    MD5_AVX2_STEP_X(MD5_AVX2_G, b, c, d, a, 12, 0x8d2a4c8a, 20);
     /* Round 3 */
-    MD5_AVX2_STEP(MD5_AVX2_H, a, b, c, d, k[ 5], 0xfffa3942,  4);
-    MD5_AVX2_STEP(MD5_AVX2_H, d, a, b, c, k[ 8], 0x8771f681, 11);
-    MD5_AVX2_STEP(MD5_AVX2_H, c, d, a, b, k[11], 0x6d9d6122, 16);
-    MD5_AVX2_STEP(MD5_AVX2_H, b, c, d, a, k[14], 0xfde5380c, 23);
-    MD5_AVX2_STEP(MD5_AVX2_H, a, b, c, d, k[ 1], 0xa4beea44,  4);
-    MD5_AVX2_STEP(MD5_AVX2_H, d, a, b, c, k[ 4], 0x4bdecfa9, 11);
-    MD5_AVX2_STEP(MD5_AVX2_H, c, d, a, b, k[ 7], 0xf6bb4b60, 16);
-    MD5_AVX2_STEP(MD5_AVX2_H, b, c, d, a, k[10], 0xbebfbc70, 23);
-    MD5_AVX2_STEP(MD5_AVX2_H, a, b, c, d, k[13], 0x289b7ec6,  4);
-    MD5_AVX2_STEP(MD5_AVX2_H, d, a, b, c, k[ 0], 0xeaa127fa, 11);
-    MD5_AVX2_STEP(MD5_AVX2_H, c, d, a, b, k[ 3], 0xd4ef3085, 16);
-    MD5_AVX2_STEP(MD5_AVX2_H, b, c, d, a, k[ 6], 0x04881d05, 23);
-    MD5_AVX2_STEP(MD5_AVX2_H, a, b, c, d, k[ 9], 0xd9d4d039,  4);
-    MD5_AVX2_STEP(MD5_AVX2_H, d, a, b, c, k[12], 0xe6db99e5, 11);
-    MD5_AVX2_STEP(MD5_AVX2_H, c, d, a, b, k[15], 0x1fa27cf8, 16);
-    MD5_AVX2_STEP(MD5_AVX2_H, b, c, d, a, k[ 2], 0xc4ac5665, 23);
-    /* Round 4 — steps 48..60 (a is finalized after step 60) */
-    MD5_AVX2_STEP(MD5_AVX2_I, a, b, c, d, k[ 0], 0xf4292244,  6);
-    MD5_AVX2_STEP(MD5_AVX2_I, d, a, b, c, k[ 7], 0x432aff97, 10);
-    MD5_AVX2_STEP(MD5_AVX2_I, c, d, a, b, k[14], 0xab9423a7, 15);
-    MD5_AVX2_STEP(MD5_AVX2_I, b, c, d, a, k[ 5], 0xfc93a039, 21);
-    MD5_AVX2_STEP(MD5_AVX2_I, a, b, c, d, k[12], 0x655b59c3,  6);
-    MD5_AVX2_STEP(MD5_AVX2_I, d, a, b, c, k[ 3], 0x8f0ccc92, 10);
-    MD5_AVX2_STEP(MD5_AVX2_I, c, d, a, b, k[10], 0xffeff47d, 15);
-    MD5_AVX2_STEP(MD5_AVX2_I, b, c, d, a, k[ 1], 0x85845dd1, 21);
-    MD5_AVX2_STEP(MD5_AVX2_I, a, b, c, d, k[ 8], 0x6fa87e4f,  6);
-    MD5_AVX2_STEP(MD5_AVX2_I, d, a, b, c, k[15], 0xfe2ce6e0, 10);
-    MD5_AVX2_STEP(MD5_AVX2_I, c, d, a, b, k[ 6], 0xa3014314, 15);
-    MD5_AVX2_STEP(MD5_AVX2_I, b, c, d, a, k[13], 0x4e0811a1, 21);
-    MD5_AVX2_STEP(MD5_AVX2_I, a, b, c, d, k[ 4], 0xf7537e82,  6);  /* step 60: a final */
-
-    /* --- Early exit: check hash[0] before computing last 3 rounds --- */
-    __m256i ha = _mm256_add_epi32(a, _mm256_set1_epi32(0x67452301));
-    int any_match = 0;
-    for (uint32_t ih = 0; ih < cfg->hashes_num; ih++) {
-        __m256i cmp = _mm256_cmpeq_epi32(ha,
-                          _mm256_set1_epi32((int32_t)cfg->hashes[4 * ih]));
-        any_match |= _mm256_movemask_epi8(cmp);
-    }
-    if (!any_match) return;  /* fast path: skip last 3 rounds */
-
-    /* Rare path: finish rounds 61-63 */
-    MD5_AVX2_STEP(MD5_AVX2_I, d, a, b, c, k[11], 0xbd3af235, 10);
-    MD5_AVX2_STEP(MD5_AVX2_I, c, d, a, b, k[ 2], 0x2ad7d2bb, 15);
-    MD5_AVX2_STEP(MD5_AVX2_I, b, c, d, a, k[ 9], 0xeb86d391, 21);
-
-    __m256i hb = _mm256_add_epi32(b, _mm256_set1_epi32((int32_t)0xefcdab89));
-    __m256i hc = _mm256_add_epi32(c, _mm256_set1_epi32((int32_t)0x98badcfe));
-    __m256i hd = _mm256_add_epi32(d, _mm256_set1_epi32(0x10325476));
-
-    uint32_t a_vals[8], b_vals[8], c_vals[8], d_vals[8];
-    _mm256_storeu_si256((__m256i *)a_vals, ha);
-    _mm256_storeu_si256((__m256i *)b_vals, hb);
-    _mm256_storeu_si256((__m256i *)c_vals, hc);
-    _mm256_storeu_si256((__m256i *)d_vals, hd);
-
-    for (int lane = 0; lane < count; lane++) {
-        uint32_t hash[4] = {a_vals[lane], b_vals[lane], c_vals[lane], d_vals[lane]};
-        /* Reconstruct this lane's key from SoA layout (rare path) */
-        uint32_t lane_key[16];
-        for (int w = 0; w < 16; w++) lane_key[w] = keys[w][lane];
-        avx_check_hashes(cfg, hash, lane_key, wcs_arr[lane]);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, a, b, c, d,  5, 0xfffa3942,  4);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, d, a, b, c,  8, 0x8771f681, 11);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, c, d, a, b, 11, 0x6d9d6122, 16);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, b, c, d, a, 14, 0xfde5380c, 23);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, a, b, c, d,  1, 0xa4beea44,  4);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, d, a, b, c,  4, 0x4bdecfa9, 11);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, c, d, a, b,  7, 0xf6bb4b60, 16);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, b, c, d, a, 10, 0xbebfbc70, 23);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, a, b, c, d, 13, 0x289b7ec6,  4);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, d, a, b, c,  0, 0xeaa127fa, 11);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, c, d, a, b,  3, 0xd4ef3085, 16);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, b, c, d, a,  6, 0x04881d05, 23);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, a, b, c, d,  9, 0xd9d4d039,  4);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, d, a, b, c, 12, 0xe6db99e5, 11);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, c, d, a, b, 15, 0x1fa27cf8, 16);
+    MD5_AVX2_STEP_X(MD5_AVX2_H, b, c, d, a,  2, 0xc4ac5665, 23);
+    /* Round 4. The last args->rev steps are reversed out of the targets, so
+     * the register written at step 60 - rev is final: compare it and leave on
+     * the ~100% no-match path. */
+    MD5_AVX2_STEP_X(MD5_AVX2_I, a, b, c, d,  0, 0xf4292244,  6);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, d, a, b, c,  7, 0x432aff97, 10);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, c, d, a, b, 14, 0xab9423a7, 15);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, b, c, d, a,  5, 0xfc93a039, 21);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, a, b, c, d, 12, 0x655b59c3,  6);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, d, a, b, c,  3, 0x8f0ccc92, 10);
+    MD5_AVX2_EXIT(7, d);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, c, d, a, b, 10, 0xffeff47d, 15);
+    MD5_AVX2_EXIT(6, c);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, b, c, d, a,  1, 0x85845dd1, 21);
+    MD5_AVX2_EXIT(5, b);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, a, b, c, d,  8, 0x6fa87e4f,  6);
+    MD5_AVX2_EXIT(4, a);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, d, a, b, c, 15, 0xfe2ce6e0, 10);
+    MD5_AVX2_EXIT(3, d);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, c, d, a, b,  6, 0xa3014314, 15);
+    MD5_AVX2_EXIT(2, c);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, b, c, d, a, 13, 0x4e0811a1, 21);
+    MD5_AVX2_EXIT(1, b);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, a, b, c, d,  4, 0xf7537e82,  6);
+    MD5_AVX2_EXIT(0, a);
+
+    /* Rare path: some lane may match, finish the hash */
+    MD5_AVX2_STEP_X(MD5_AVX2_I, d, a, b, c, 11, 0xbd3af235, 10);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, c, d, a, b,  2, 0x2ad7d2bb, 15);
+    MD5_AVX2_STEP_X(MD5_AVX2_I, b, c, d, a,  9, 0xeb86d391, 21);
+
+    for (int j = 0; j < X; j++) {
+        uint32_t a_vals[8], b_vals[8], c_vals[8], d_vals[8];
+        _mm256_storeu_si256((__m256i *)a_vals, _mm256_add_epi32(a[j], _mm256_set1_epi32(0x67452301)));
+        _mm256_storeu_si256((__m256i *)b_vals, _mm256_add_epi32(b[j], _mm256_set1_epi32((int32_t)0xefcdab89)));
+        _mm256_storeu_si256((__m256i *)c_vals, _mm256_add_epi32(c[j], _mm256_set1_epi32((int32_t)0x98badcfe)));
+        _mm256_storeu_si256((__m256i *)d_vals, _mm256_add_epi32(d[j], _mm256_set1_epi32(0x10325476)));
+
+        for (uint32_t h = hit[j]; h; h &= h - 1) {
+            int l = __builtin_ctz(h), lane = j * 8 + l;
+            if (lane >= count) break;
+            uint32_t hash[4] = {a_vals[l], b_vals[l], c_vals[l], d_vals[l]};
+            /* Reconstruct this lane's key from SoA layout (rare path) */
+            uint32_t lane_key[16];
+            for (int w = 0; w < 16; w++) lane_key[w] = keys[w * X * 8 + lane];
+            avx_check_hashes(cfg, args->targets, hash, lane_key, wcs_arr[lane]);
+        }
     }
 }
+
+#define MD5_CHECK_AVX2(NW, X) \
+static void md5_check_avx2_nw##NW##_x##X(cruncher_config *cfg, uint32_t *keys, \
+                                         int *wcs_arr, int count, \
+                                         const md5_batch_args *args) { \
+    md5_check_avx2_body(cfg, keys, wcs_arr, count, args, NW, X); \
+}
+#define MD5_CHECK_AVX2_ROW(X) \
+    MD5_CHECK_AVX2(1, X)  MD5_CHECK_AVX2(2, X)  MD5_CHECK_AVX2(3, X) \
+    MD5_CHECK_AVX2(4, X)  MD5_CHECK_AVX2(5, X)  MD5_CHECK_AVX2(6, X) \
+    MD5_CHECK_AVX2(7, X)  MD5_CHECK_AVX2(8, X)  MD5_CHECK_AVX2(9, X) \
+    MD5_CHECK_AVX2(10, X)
+MD5_CHECK_AVX2_ROW(1)
+MD5_CHECK_AVX2_ROW(2)
+MD5_CHECK_AVX2_ROW(3)
+#undef MD5_CHECK_AVX2_ROW
+#undef MD5_CHECK_AVX2
+#undef MD5_AVX2_EXIT
+
+#define MD5_CHECK_AVX2_FNS(X) { NULL, \
+    md5_check_avx2_nw1_x##X, md5_check_avx2_nw2_x##X, md5_check_avx2_nw3_x##X, \
+    md5_check_avx2_nw4_x##X, md5_check_avx2_nw5_x##X, md5_check_avx2_nw6_x##X, \
+    md5_check_avx2_nw7_x##X, md5_check_avx2_nw8_x##X, md5_check_avx2_nw9_x##X, \
+    md5_check_avx2_nw10_x##X }
+
+static md5_check_fn md5_check_avx2_for(int wcs, int chains) {
+    static const md5_check_fn by_chains_nw[MD5_MAX_CHAINS + 1][MD5_MAX_NW + 1] = {
+        { NULL },
+        MD5_CHECK_AVX2_FNS(1), MD5_CHECK_AVX2_FNS(2), MD5_CHECK_AVX2_FNS(3),
+    };
+    return by_chains_nw[chains][MD5_NW(wcs)];
+}
+#undef MD5_CHECK_AVX2_FNS
 #endif
 
-#if defined(__x86_64__) || defined(_M_AMD64)
 /*
  * OR-based string construction into SoA key layout.
- * Writes precomputed word images directly into keys[word_pos][lane],
- * where the first index is the uint32 position in the MD5 block (0-15)
- * and the second index is the SIMD lane.
+ * Writes precomputed word images directly into keys[word_pos * lanes + lane],
+ * where word_pos is the uint32 position in the MD5 block (0-15) and lane the
+ * SIMD lane across all interleaved chains of a batch.
  * keys must be zeroed before calling (once per batch, not per lane).
  */
-static int construct_string_or_soa_16(permut_task *task,
-                                       uint32_t keys[][16],
-                                       int lane,
-                                       const uint32_t wimg[][11],
-                                       const uint8_t *wlen_sp,
-                                       int num_offsets) {
+static int construct_string_or_soa(permut_task *task, uint32_t *keys,
+                                   int lanes, int lane,
+                                   const uint32_t wimg[][11],
+                                   const uint8_t *wlen_sp,
+                                   int num_offsets) {
     int pos = 0;
     for (int io = 0; io < num_offsets; io++) {
         int8_t off = task->offsets[io];
         int byte_off = (off < 0) ? (-off - 1) : (task->a[off - 1] - 1);
-        int idx = pos >> 2;
+        uint32_t *col = keys + (pos >> 2) * lanes + lane;
         int shift = (pos & 3) << 3;
         int len_sp = wlen_sp[byte_off];
         int nw = (len_sp + 3) >> 2;
         if (shift == 0) {
             for (int j = 0; j < nw; j++)
-                keys[idx + j][lane] |= wimg[byte_off][j];
+                col[j * lanes] |= wimg[byte_off][j];
         } else {
             for (int j = 0; j < nw; j++) {
-                keys[idx + j][lane] |= wimg[byte_off][j] << shift;
-                keys[idx + j + 1][lane] |= wimg[byte_off][j] >> (32 - shift);
+                col[j * lanes] |= wimg[byte_off][j] << shift;
+                col[(j + 1) * lanes] |= wimg[byte_off][j] >> (32 - shift);
             }
         }
         pos += len_sp;
     }
     int wcs = pos - 1;
-    /* MD5 padding: 0x80 byte after message, length in bits at offset 56 */
-    ((char *)&keys[wcs >> 2][lane])[(wcs & 3)] = (char)0x80;
-    keys[14][lane] = (uint32_t)(wcs << 3);
+    /* MD5 padding: 0x80 byte after message. The length word 14 is left zero,
+     * the length-specialized kernels fold it into the round constants. */
+    ((char *)&keys[(wcs >> 2) * lanes + lane])[(wcs & 3)] = (char)0x80;
     return wcs;
 }
-#endif
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+/* ---------- Round-1 midstates for shared key prefixes ---------- */
 
 /*
- * OR-based string construction into SoA key layout (8-lane variant for AVX2).
+ * The key words covered by the leftmost permutable word are constant for each
+ * of its runs: tasks_buffer_add_task maps that slot to a[n-1], which Heap's
+ * algorithm only swaps every (n-1)! permutations (a[0] of a multiset task,
+ * changed as seldom by Algorithm L). The round-1 steps over those
+ * words are computed once per group in scalar code and the SIMD kernels start
+ * from the cached state. Groups are keyed by the byte offset of the leftmost
+ * permutable word, so correctness does not depend on the slot order. The
+ * enumerators permute every word; fixed words before it (hand-built tasks)
+ * just extend each group's prefix.
  */
-static int construct_string_or_soa_8(permut_task *task,
-                                      uint32_t keys[][8],
-                                      int lane,
-                                      const uint32_t wimg[][11],
-                                      const uint8_t *wlen_sp,
-                                      int num_offsets) {
-    int pos = 0;
-    for (int io = 0; io < num_offsets; io++) {
-        int8_t off = task->offsets[io];
-        int byte_off = (off < 0) ? (-off - 1) : (task->a[off - 1] - 1);
-        int idx = pos >> 2;
-        int shift = (pos & 3) << 3;
-        int len_sp = wlen_sp[byte_off];
-        int nw = (len_sp + 3) >> 2;
-        if (shift == 0) {
-            for (int j = 0; j < nw; j++)
-                keys[idx + j][lane] |= wimg[byte_off][j];
-        } else {
-            for (int j = 0; j < nw; j++) {
-                keys[idx + j][lane] |= wimg[byte_off][j] << shift;
-                keys[idx + j + 1][lane] |= wimg[byte_off][j] >> (32 - shift);
-            }
+typedef struct {
+    const uint8_t *wlen_sp;
+    int first_slot;    /* index in offsets[] of the first permutable slot */
+    int fixed_bytes;   /* bytes taken by the fixed words before it */
+    uint32_t len_bits;
+    /* Per group: steps covered (-1 = not computed yet) and the state after them */
+    int8_t steps[MAX_STR_LENGTH];
+    uint32_t st[MAX_STR_LENGTH][4];
+} md5_prefix_cache;
+
+/* Shorter prefixes are not worth the mispredicted kernel entry */
+#define MD5_PREFIX_MIN_STEPS 3
+
+static const uint32_t md5_round1_t[16] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+};
+
+static void md5_prefix_init(md5_prefix_cache *pc, const permut_task *task,
+                            const uint8_t *wlen_sp, int wcs) {
+    int io = 0;
+    pc->wlen_sp = wlen_sp;
+    pc->fixed_bytes = 0;
+    for (; task->offsets[io] < 0; io++)
+        pc->fixed_bytes += wlen_sp[-task->offsets[io] - 1];
+    pc->first_slot = io;
+    pc->len_bits = (uint32_t)wcs << 3;
+    memset(pc->steps, -1, sizeof(pc->steps));
+}
+
+/* Prefix group of the permutation currently in task->a */
+static inline int md5_prefix_group(const md5_prefix_cache *pc,
+                                   const permut_task *task) {
+    return task->a[task->offsets[pc->first_slot] - 1] - 1;
+}
+
+/*
+ * Entry step and state for a batch whose lanes all belong to group g; batches
+ * spanning several groups (g < 0) start from the IV. Computed on first use
+ * from the SoA column `key` (stride `lanes`) of any lane in the batch.
+ */
+static const uint32_t *md5_prefix_batch(md5_prefix_cache *pc, int g,
+                                        const uint32_t *key, int lanes,
+                                        int *start) {
+    static const uint32_t iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    if (g < 0) {
+        *start = 0;
+        return iv;
+    }
+    if (pc->steps[g] < 0) {
+        int bytes = pc->fixed_bytes + pc->wlen_sp[g];
+        int steps = bytes >> 2;
+        if (steps > MD5_MAX_NW) steps = MD5_MAX_NW;
+        if (steps < MD5_PREFIX_MIN_STEPS) steps = 0;
+        uint32_t v[4];
+        memcpy(v, iv, sizeof(v));
+        static const int rot[4] = {7, 12, 17, 22};
+        for (int j = 0; j < steps; j++) {
+            /* Step j updates a, d, c, b in turn, like the unrolled kernels */
+            int t = (4 - (j & 3)) & 3;
+            uint32_t x = v[(t + 1) & 3], y = v[(t + 2) & 3], z = v[(t + 3) & 3];
+            uint32_t w = (j == 14) ? pc->len_bits : key[j * lanes];
+            uint32_t r = v[t] + (z ^ (x & (y ^ z))) + w + md5_round1_t[j];
+            v[t] = ((r << rot[j & 3]) | (r >> (32 - rot[j & 3]))) + x;
         }
-        pos += len_sp;
+        memcpy(pc->st[g], v, sizeof(v));
+        pc->steps[g] = (int8_t)steps;
     }
-    int wcs = pos - 1;
-    ((char *)&keys[wcs >> 2][lane])[(wcs & 3)] = (char)0x80;
-    keys[14][lane] = (uint32_t)(wcs << 3);
-    return wcs;
+    *start = pc->steps[g];
+    return pc->st[g];
 }
 
-static void process_task(avx_cruncher_ctx *actx, permut_task *task) {
-    if (task->i >= task->n) return;
-    cruncher_config *cfg = actx->cfg;
+/* ---------- Step reversal against the targets ---------- */
 
-#if defined(__x86_64__) || defined(_M_AMD64)
-    if (actx->mode == SIMD_AVX512) {
-        /* --- AVX-512 path (16-lane, SoA key layout) --- */
-        uint32_t wimg[MAX_STR_LENGTH][11];
-        uint8_t wlen_sp[MAX_STR_LENGTH];
-        int num_offsets;
-        precompute_word_images(task, wimg, wlen_sp, &num_offsets);
+/*
+ * Round-4 step s = 48 + i reads key word md5_round4_w[i]. Walking a target
+ * digest back through the trailing steps needs only their key words, so for
+ * every step whose word is zero (past the 0x80 pad) the kernel can stop one
+ * step earlier and compare an intermediate register with the reversed target
+ * instead.
+ */
+static const uint8_t md5_round4_w[16] = {
+    0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9,
+};
+static const uint32_t md5_round4_t[16] = {
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
 
-        uint32_t keys[16][16] __attribute__((aligned(64)));  /* keys[word][lane] */
-        memset(keys, 0, sizeof(keys));
-        int wcs_arr[16];
-        int batch = 0;
+/*
+ * For targets first..first+num-1 of the list, undo the last `rev` steps (using
+ * key words `words`) and store the raw register written at step 60 - rev, as
+ * the kernels hold it.
+ */
+static void md5_reverse_targets(const uint32_t *hashes, const avx_target_list *targets,
+                                uint32_t first, uint32_t num,
+                                int rev, const uint32_t words[16],
+                                uint32_t *out) {
+    static const int rot[4] = {6, 10, 15, 21};
+    for (uint32_t i = 0; i < num; i++) {
+        uint32_t ih = targets->ids ? targets->ids[first + i] : first + i;
+        uint32_t v[4] = {
+            hashes[4 * ih]     - 0x67452301, hashes[4 * ih + 1] - 0xefcdab89,
+            hashes[4 * ih + 2] - 0x98badcfe, hashes[4 * ih + 3] - 0x10325476,
+        };
+        for (int s = 15; s > 15 - rev; s--) {
+            /* Step s wrote v[t] = x + rotl(v[t] + I(x, y, z) + k + T, r) */
+            int t = (4 - (s & 3)) & 3;
+            uint32_t x = v[(t + 1) & 3], y = v[(t + 2) & 3], z = v[(t + 3) & 3];
+            uint32_t r = v[t] - x;
+            r = (r >> rot[s & 3]) | (r << (32 - rot[s & 3]));
+            v[t] = r - (y ^ (x | ~z)) - words[md5_round4_w[s]] - md5_round4_t[s];
+        }
+        int s = 12 - rev;
+        out[i] = v[(4 - (s & 3)) & 3];
+    }
+}
 
-        do {
-            wcs_arr[batch] = construct_string_or_soa_16(task, keys, batch,
-                                                         wimg, wlen_sp, num_offsets);
-            batch++;
+/* Trailing steps whose key words are zero (>= nw) */
+static int md5_reversible_steps(int nw) {
+    int rev = 0;
+    while (rev < MD5_MAX_REV && md5_round4_w[15 - rev] >= nw) rev++;
+    return rev;
+}
 
-            if (batch == 16) {
-                avx512_md5_check(cfg, keys, wcs_arr, 16);
-                batch = 0;
-                memset(keys, 0, sizeof(keys));
-            }
-        } while (heap_next(task));
+/*
+ * Points args at the targets reversed for keys of length wcs. The reversals
+ * only depend on the targets and are shared (see avx_targets).
+ */
+static void md5_rev_task_init(avx_cruncher_ctx *actx, int wcs, md5_batch_args *args) {
+    avx_targets *t = actx->targets;
+    int rev = md5_reversible_steps(MD5_NW(wcs));
+    args->rev = rev;
+    args->cmp = t->rev_cmp[rev];
+    args->filter = t->indexed ? &t->rev_filter[rev] : NULL;
+    args->targets = &t->list;
+}
+#endif
 
-        if (batch > 0) {
-            /* Duplicate last lane into remaining slots */
-            for (int w = 0; w < 16; w++)
-                for (int i = batch; i < 16; i++)
-                    keys[w][i] = keys[w][batch - 1];
-            avx512_md5_check(cfg, keys, wcs_arr, batch);
+/* ---------- Shared target tables ---------- */
+
+static avx_targets *avx_targets_list = NULL;
+static pthread_mutex_t avx_targets_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void avx_targets_free(avx_targets *t) {
+    if (t->snap) target_set_release(t->cfg->targets, t->snap);
+    target_table_free(&t->table);
+    for (int r = 0; r <= MD5_MAX_REV; r++) {
+        free(t->rev_cmp[r]);
+        target_filter_free(&t->rev_filter[r]);
+    }
+    free(t);
+}
+
+/* Builds the tables for the targets of snap (all of cfg's if NULL), taking
+ * over the reference to snap */
+static avx_targets *avx_targets_build(cruncher_config *cfg, target_snapshot *snap) {
+    avx_targets *t = calloc(1, sizeof(avx_targets));
+    if (!t) {
+        if (snap) target_set_release(cfg->targets, snap);
+        return NULL;
+    }
+    t->cfg = cfg;
+    t->snap = snap;
+    t->version = snap ? snap->version : 0;
+    t->list.num = snap ? snap->num : cfg->hashes_num;
+    t->list.ids = snap ? snap->ids : NULL;
+    t->indexed = t->list.num >= AVX_TARGETS_INDEX_MIN;
+    if (t->indexed) {
+        if (target_table_init(&t->table, cfg->hashes, t->list.ids, t->list.num)) {
+            avx_targets_free(t);
+            return NULL;
+        }
+        t->list.table = &t->table;
+    }
+#if defined(__x86_64__) || defined(_M_AMD64)
+    static const uint32_t zero_words[16] = {0};
+    uint32_t chunk[1024];
+    for (int nw = 1; nw <= MD5_MAX_NW; nw++) {
+        int r = md5_reversible_steps(nw);
+        if (t->rev_cmp[r] || t->rev_filter[r].words) continue;
+        if (!t->indexed) {
+            t->rev_cmp[r] = malloc(sizeof(uint32_t) * (t->list.num + 1));
+            if (!t->rev_cmp[r]) {
+                avx_targets_free(t);
+                return NULL;
+            }
+            md5_reverse_targets(cfg->hashes, &t->list, 0, t->list.num, r, zero_words,
+                                t->rev_cmp[r]);
+            continue;
+        }
+        if (target_filter_init(&t->rev_filter[r], t->list.num)) {
+            avx_targets_free(t);
+            return NULL;
+        }
+        for (uint32_t first = 0; first < t->list.num; first += 1024) {
+            uint32_t num = t->list.num - first < 1024 ? t->list.num - first : 1024;
+            md5_reverse_targets(cfg->hashes, &t->list, first, num, r, zero_words, chunk);
+            for (uint32_t i = 0; i < num; i++) target_filter_add(&t->rev_filter[r], chunk[i]);
         }
-        return;
     }
 #endif
+    return t;
+}
+
+/* Returns the tables for the current targets of cfg, building them for the
+ * first cruncher asking */
+static avx_targets *avx_targets_acquire(cruncher_config *cfg) {
+    pthread_mutex_lock(&avx_targets_mutex);
+    target_snapshot *snap = cfg->targets ? target_set_acquire(cfg->targets) : NULL;
+    uint32_t version = snap ? snap->version : 0;
+    avx_targets *t = avx_targets_list;
+    while (t && (t->cfg != cfg || t->version != version)) t = t->next;
+    if (t) {
+        if (snap) target_set_release(cfg->targets, snap);
+    } else {
+        t = avx_targets_build(cfg, snap);
+        if (t) {
+            t->next = avx_targets_list;
+            avx_targets_list = t;
+        }
+    }
+    if (t) t->refs++;
+    pthread_mutex_unlock(&avx_targets_mutex);
+    return t;
+}
+
+static void avx_targets_release(avx_targets *t) {
+    pthread_mutex_lock(&avx_targets_mutex);
+    if (--t->refs == 0) {
+        avx_targets **p = &avx_targets_list;
+        while (*p != t) p = &(*p)->next;
+        *p = t->next;
+        avx_targets_free(t);
+    }
+    pthread_mutex_unlock(&avx_targets_mutex);
+}
+
+static void process_task(avx_cruncher_ctx *actx, permut_task *task) {
+    if (task->i >= task->n) return;
+    cruncher_config *cfg = actx->cfg;
+
 #if defined(__x86_64__) || defined(_M_AMD64)
-    /* --- AVX2 path (8-lane, SoA key layout) --- */
-    if (actx->mode == SIMD_AVX2) {
+    if (actx->mode == SIMD_AVX512 || actx->mode == SIMD_AVX2) {
+        /* --- AVX-512 (16-lane) / AVX2 (8-lane) path, SoA key layout --- */
         uint32_t wimg[MAX_STR_LENGTH][11];
         uint8_t wlen_sp[MAX_STR_LENGTH];
         int num_offsets;
-        precompute_word_images(task, wimg, wlen_sp, &num_offsets);
-
-        uint32_t keys[16][8] __attribute__((aligned(32)));  /* keys[word][lane] */
-        memset(keys, 0, sizeof(keys));
-        int wcs_arr[8];
+        int wcs = precompute_word_images(task, wimg, wlen_sp, &num_offsets);
+
+        /* Fewer chains for tasks too small to fill the interleaved batch */
+        int vec = actx->mode == SIMD_AVX512 ? 16 : 8;
+        int chains = actx->chains;
+        uint64_t perms = permut_task_perms(task);
+        while (chains > 1 && perms < (uint64_t)(vec * chains)) chains--;
+        int lanes = vec * chains;
+        md5_check_fn md5_check = actx->mode == SIMD_AVX512
+            ? avx512_md5_check_for(wcs, chains) : md5_check_avx2_for(wcs, chains);
+
+        md5_prefix_cache pc;
+        md5_prefix_init(&pc, task, wlen_sp, wcs);
+        md5_batch_args args;
+        md5_rev_task_init(actx, wcs, &args);
+
+        /* keys[word * lanes + lane] */
+        uint32_t keys[16 * 16 * MD5_MAX_CHAINS] __attribute__((aligned(64)));
+        size_t keys_size = (size_t)16 * lanes * sizeof(uint32_t);
+        memset(keys, 0, keys_size);
+        int wcs_arr[16 * MD5_MAX_CHAINS];
         int batch = 0;
+        int batch_g = -1;
 
         do {
-            wcs_arr[batch] = construct_string_or_soa_8(task, keys, batch,
-                                                        wimg, wlen_sp, num_offsets);
+            wcs_arr[batch] = construct_string_or_soa(task, keys, lanes, batch,
+                                                     wimg, wlen_sp, num_offsets);
+            int g = md5_prefix_group(&pc, task);
+            if (batch == 0) batch_g = g;
+            else if (g != batch_g) batch_g = -1;
             batch++;
 
-            if (batch == 8) {
-                md5_check_avx2(cfg, keys, wcs_arr, 8);
+            if (batch == lanes) {
+                args.mid = md5_prefix_batch(&pc, batch_g, keys, lanes, &args.start);
+                md5_check(cfg, keys, wcs_arr, lanes, &args);
                 batch = 0;
-                memset(keys, 0, sizeof(keys));
+                memset(keys, 0, keys_size);
             }
-        } while (heap_next(task));
+        } while (permut_next(task));
 
         if (batch > 0) {
             /* Duplicate last lane into remaining slots */
             for (int w = 0; w < 16; w++)
-                for (int i = batch; i < 8; i++)
-                    keys[w][i] = keys[w][batch - 1];
-            md5_check_avx2(cfg, keys, wcs_arr, batch);
+                for (int i = batch; i < lanes; i++)
+                    keys[w * lanes + i] = keys[w * lanes + batch - 1];
+            args.mid = md5_prefix_batch(&pc, batch_g, keys, lanes, &args.start);
+            md5_check(cfg, keys, wcs_arr, batch, &args);
         }
         return;
     }
@@ -581,8 +956,90 @@ static void process_task(avx_cruncher_ctx *actx, permut_task *task) {
         int wcs = construct_string(task, key);
         uint32_t hash[4];
         md5_scalar(key, hash);
-        avx_check_hashes(cfg, hash, key, wcs);
-    } while (heap_next(task));
+        avx_check_hashes(cfg, &actx->targets->list, hash, key, wcs);
+    } while (permut_next(task));
+}
+
+/* ---------- Interleaved-chain calibration ---------- */
+
+double avx_md5_chains_rate(int vec_lanes, int chains, uint64_t micros) {
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (chains < 1 || chains > MD5_MAX_CHAINS) return 0;
+    if (vec_lanes == 16 && !cpu_has_avx512f()) return 0;
+    /* One target nothing matches in practice (a hit would only cost the rare
+     * path), a typical 20-byte key and the plain rev 0 exit */
+    uint32_t hashes[4] = {0}, reversed[MAX_STR_LENGTH / 4], cmp[1] = {0};
+    cruncher_config cfg = {.hashes = hashes, .hashes_num = 1, .hashes_reversed = reversed};
+    static const uint32_t iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    avx_target_list targets = {.num = 1};
+    md5_batch_args args = {.mid = iv, .cmp = cmp, .targets = &targets};
+    const int wcs = 19;
+    int lanes = vec_lanes * chains;
+    md5_check_fn check = vec_lanes == 16 ? avx512_md5_check_for(wcs, chains)
+                                         : md5_check_avx2_for(wcs, chains);
+
+    uint32_t keys[16 * 16 * MD5_MAX_CHAINS] __attribute__((aligned(64)));
+    int wcs_arr[16 * MD5_MAX_CHAINS];
+    memset(keys, 0, sizeof(keys));
+    for (int l = 0; l < lanes; l++) {
+        wcs_arr[l] = wcs;
+        for (int w = 0; w < MD5_NW(wcs); w++) keys[w * lanes + l] = 0x61616161u + w + l;
+    }
+
+    uint64_t hashes_done = 0, start = current_micros(), elapsed;
+    do {
+        for (int it = 0; it < 64; it++) {
+            keys[0]++;
+            check(&cfg, keys, wcs_arr, lanes, &args);
+        }
+        hashes_done += (uint64_t)64 * lanes;
+        elapsed = current_micros() - start;
+    } while (elapsed < micros);
+    return (double)hashes_done * 1e6 / (double)(elapsed ? elapsed : 1);
+#else
+    return 0;
+#endif
+}
+
+/* Extra chains must beat fewer by this much, they cost tail lanes per task */
+#define MD5_CHAINS_MIN_GAIN 1.03
+#define MD5_CHAINS_CALIB_MICROS 2000
+
+static int md5_chains_pick(int vec_lanes) {
+    int best = 1;
+    double best_rate = 0;
+    for (int x = 1; x <= MD5_MAX_CHAINS; x++) {
+        double rate = 0;
+        for (int run = 0; run < 3; run++) {
+            double r = avx_md5_chains_rate(vec_lanes, x, MD5_CHAINS_CALIB_MICROS);
+            if (r > rate) rate = r;
+        }
+        if (rate > best_rate * MD5_CHAINS_MIN_GAIN) {
+            best = x;
+            best_rate = rate;
+        }
+    }
+    return best;
+}
+
+static int md5_chains_avx2 = 1, md5_chains_avx512 = 1;
+static pthread_once_t md5_chains_avx2_once = PTHREAD_ONCE_INIT;
+static pthread_once_t md5_chains_avx512_once = PTHREAD_ONCE_INIT;
+static void md5_chains_avx2_init(void) { md5_chains_avx2 = md5_chains_pick(8); }
+static void md5_chains_avx512_init(void) { md5_chains_avx512 = md5_chains_pick(16); }
+
+int avx_md5_chains(int vec_lanes) {
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (vec_lanes == 16) {
+        if (!cpu_has_avx512f()) return 1;
+        pthread_once(&md5_chains_avx512_once, md5_chains_avx512_init);
+        return md5_chains_avx512;
+    }
+    pthread_once(&md5_chains_avx2_once, md5_chains_avx2_init);
+    return md5_chains_avx2;
+#else
+    return 1;
+#endif
 }
 
 /* ---------- Vtable functions ---------- */
@@ -615,15 +1072,29 @@ static uint32_t scalar_probe(void) {
     return cores;
 }
 
+/* Switches actx to tables t (holding a reference) */
+static void avx_use_targets(avx_cruncher_ctx *actx, avx_targets *t) {
+    if (actx->targets) avx_targets_release(actx->targets);
+    actx->targets = t;
+}
+
 static int avx_create_with_mode(void *ctx, cruncher_config *cfg, uint32_t instance_id, simd_mode mode) {
     avx_cruncher_ctx *actx = ctx;
     actx->cfg = cfg;
     actx->mode = mode;
+    actx->id = instance_id;
     actx->is_running = false;
     actx->consumed_bufs = 0;
     actx->consumed_anas = 0;
     actx->task_time_start = 0;
     actx->task_time_end = 0;
+
+    actx->targets = NULL;
+    avx_targets *t = avx_targets_acquire(cfg);
+    ret_iferr(!t, "failed to build target tables");
+    avx_use_targets(actx, t);
+    actx->chains = mode == SIMD_AVX512 ? avx_md5_chains(16)
+                 : mode == SIMD_AVX2 ? avx_md5_chains(8) : 1;
     return 0;
 }
 
@@ -646,14 +1117,33 @@ static void *avx_run(void *ctx) {
 
     tasks_buffer *buf;
     while (1) {
+        if (actx->cfg->split) hybrid_cruncher_wait(actx->cfg->split, actx->id);
         tasks_buffers_get_buffer(actx->cfg->tasks_buffs, &buf);
         if (buf == NULL) break;
 
-        for (uint32_t i = 0; i < buf->num_tasks; i++) {
-            process_task(actx, &buf->permut_tasks[i]);
+        /* Drop found targets; on failure keep comparing against the old ones */
+        target_set *set = actx->cfg->targets;
+        if (set && set->version != actx->targets->version) {
+            avx_targets *t = avx_targets_acquire(actx->cfg);
+            if (t) avx_use_targets(actx, t);
         }
 
-        actx->consumed_anas += buf->num_anas;
+        /* Compact tasks are expanded one at a time against the shared table */
+        const word_table *words = actx->cfg->tasks_buffs->words;
+        uint32_t i;
+        for (i = 0; i < buf->num_tasks; i++) {
+            if (actx->cfg->tasks_buffs->is_cancelled) break;
+            if (buf->compact_tasks) {
+                permut_task task;
+                word_table_expand(words, &buf->compact_tasks[i], &task);
+                process_task(actx, &task);
+            } else {
+                process_task(actx, &buf->permut_tasks[i]);
+            }
+        }
+
+        /* A buffer cut short by cancellation is left out of the count */
+        if (i == buf->num_tasks) actx->consumed_anas += buf->num_anas;
         actx->consumed_bufs++;
         tasks_buffers_recycle(actx->cfg->tasks_buffs, buf);
     }
@@ -694,6 +1184,9 @@ static bool avx_is_running(void *ctx) {
 }
 
 static int avx_destroy(void *ctx) {
+    avx_cruncher_ctx *actx = ctx;
+    if (actx->targets) avx_targets_release(actx->targets);
+    actx->targets = NULL;
     return 0;
 }
 
@@ -706,6 +1199,7 @@ cruncher_ops avx512_cruncher_ops = {
     .get_total_anas = avx_get_total_anas,
     .is_running = avx_is_running,
     .destroy = avx_destroy,
+    .compact_tasks = true,
     .ctx_size = sizeof(avx_cruncher_ctx),
 };
 
@@ -718,6 +1212,7 @@ cruncher_ops avx2_cruncher_ops = {
     .get_total_anas = avx_get_total_anas,
     .is_running = avx_is_running,
     .destroy = avx_destroy,
+    .compact_tasks = true,
     .ctx_size = sizeof(avx_cruncher_ctx),
 };
 
@@ -730,6 +1225,7 @@ cruncher_ops scalar_cruncher_ops = {
     .get_total_anas = avx_get_total_anas,
     .is_running = avx_is_running,
     .destroy = avx_destroy,
+    .compact_tasks = true,
     .ctx_size = sizeof(avx_cruncher_ctx),
 };
 
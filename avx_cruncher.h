@@ -2,6 +2,7 @@
 #define ANABRUTE_AVX_CRUNCHER_H
 
 #include "cruncher.h"
+#include "targets.h"
 
 extern cruncher_ops avx512_cruncher_ops;
 extern cruncher_ops avx2_cruncher_ops;
@@ -11,8 +12,72 @@ extern cruncher_ops scalar_cruncher_ops;
 #define PUTCHAR_SCALAR(buf, index, val) \
     (buf)[(index) >> 2] = ((buf)[(index) >> 2] & ~(0xffU << (((index) & 3) << 3))) + ((uint32_t)(val) << (((index) & 3) << 3))
 
-void avx_check_hashes(cruncher_config *cfg, uint32_t *hash, uint32_t *key, int wcs);
-void avx512_md5_check(cruncher_config *cfg,
-                      uint32_t keys[16][16], int wcs_arr[16], int count);
+/*
+ * MD5 length class: number of key words holding message bytes or the 0x80 pad.
+ * All permutations of a task share it; words past it are zero. wcs is at most
+ * MAX_STR_LENGTH-1, so there are MD5_MAX_NW classes.
+ */
+#define MD5_NW(wcs) (((wcs) >> 2) + 1)
+#define MD5_MAX_NW (MAX_STR_LENGTH / 4)
+
+/*
+ * Targets a cruncher currently compares against: ids[0..num) into cfg->hashes
+ * (0..num-1 when ids is NULL, the full list), indexed by table for large sets.
+ */
+typedef struct {
+    uint32_t num;
+    const uint32_t *ids;
+    const target_table *table;
+} avx_target_list;
+
+/*
+ * Stores key as the reversal of every target in targets equal to hash and
+ * marks it found in cfg->targets. Large lists are searched through their
+ * table, small ones scanned linearly.
+ */
+void avx_check_hashes(cruncher_config *cfg, const avx_target_list *targets,
+                      uint32_t *hash, uint32_t *key, int wcs);
+
+/*
+ * Per-batch parameters of the AVX MD5 kernels.
+ * start/mid: resume round 1 at step `start` from MD5 state mid = {a, b, c, d};
+ * start 0 with the MD5 IV hashes from scratch.
+ * rev/cmp: the last `rev` steps were reversed out of the targets (their key
+ * words are zero past the pad), so the register written at step 60 - rev
+ * is already final; the kernel compares it with cmp[i], one per entry of
+ * targets, and only finishes the hash on a match. rev 0 is the plain "skip
+ * last 3 steps".
+ * filter: for large target sets the register is probed in a Bloom filter over
+ * the reversed targets instead (cmp is unused).
+ * targets: the active targets, candidate lanes are confirmed against them.
+ */
+#define MD5_MAX_REV 7
+typedef struct {
+    int start;
+    const uint32_t *mid;
+    int rev;
+    const uint32_t *cmp;
+    const target_filter *filter;
+    const avx_target_list *targets;
+} md5_batch_args;
+
+/*
+ * Batch kernel: hashes `count` lanes of a batch of chains * vector-width lanes
+ * (duplicated lanes fill the rest). keys is SoA, keys[w * lanes + lane], so
+ * interleaved chain j owns lanes j * width .. (j + 1) * width - 1.
+ */
+#define MD5_MAX_CHAINS 3
+typedef void (*md5_check_fn)(cruncher_config *cfg, uint32_t *keys,
+                             int *wcs_arr, int count, const md5_batch_args *args);
+md5_check_fn avx512_md5_check_for(int wcs, int chains);
+
+/*
+ * Interleaved-chain calibration. avx_md5_chains_rate() measures the batch
+ * kernel throughput (hashes/s) for `chains` chains of vec_lanes (8 = AVX2,
+ * 16 = AVX-512) over roughly `micros`; avx_md5_chains() returns the chain
+ * count picked from it once per process.
+ */
+double avx_md5_chains_rate(int vec_lanes, int chains, uint64_t micros);
+int avx_md5_chains(int vec_lanes);
 
 #endif //ANABRUTE_AVX_CRUNCHER_H
@@ -11,125 +11,202 @@
 #include <string.h>
 #include <stdint.h>
 
+/* Candidate lanes of x per chain, see md5_avx2_match in avx_cruncher.c */
+static inline __attribute__((always_inline))
+uint32_t avx512_md5_match(const __m512i *x, const int X,
+                          const md5_batch_args *args, uint32_t *hit) {
+    uint32_t any = 0;
+    if (args->filter) {
+        const __m512i one = _mm512_set1_epi32(1), low5 = _mm512_set1_epi32(31);
+        const __m128i shift = _mm_cvtsi32_si128((int)args->filter->shift);
+        for (int j = 0; j < X; j++) {
+            __m512i idx = _mm512_srl_epi32(
+                _mm512_mullo_epi32(x[j], _mm512_set1_epi32((int32_t)TARGET_FILTER_MUL)), shift);
+            __m512i w = _mm512_i32gather_epi32(idx, (const void *)args->filter->words, 4);
+            __m512i bits = _mm512_or_si512(
+                _mm512_sllv_epi32(one, _mm512_and_si512(x[j], low5)),
+                _mm512_sllv_epi32(one, _mm512_and_si512(_mm512_srli_epi32(x[j], 5), low5)));
+            hit[j] = _mm512_cmpeq_epi32_mask(_mm512_and_si512(w, bits), bits);
+            any |= hit[j];
+        }
+        return any;
+    }
+    __mmask16 m[MD5_MAX_CHAINS] = {0};
+    for (uint32_t i = 0; i < args->targets->num; i++) {
+        __m512i t = _mm512_set1_epi32((int32_t)args->cmp[i]);
+        for (int j = 0; j < X; j++)
+            m[j] |= _mm512_cmpeq_epi32_mask(x[j], t);
+    }
+    for (int j = 0; j < X; j++) {
+        hit[j] = m[j];
+        any |= hit[j];
+    }
+    return any;
+}
+
+/* Early exit after step 60 - r, see MD5_AVX2_EXIT in avx_cruncher.c */
+#define MD5_512_EXIT(r, x) do { \
+    if (args->rev == (r) && !avx512_md5_match(x, X, args, hit)) \
+        return; \
+} while (0)
+
 /*
  * Combined AVX-512 MD5 (16-lane) + early-exit hash check.
- * Computes only 61 of 64 MD5 rounds. hash[0] (a) is finalized after step 60.
- * SIMD-checks a against all targets using _mm512_cmpeq_epi32_mask;
- * skips last 3 rounds (~5% MD5 savings) for the ~100% case where no
- * hash[0] matches.
+ * Stops after step 60 - args->rev and checks the register that is final there
+ * against the reversed targets using _mm512_cmpeq_epi32_mask; the hash is
+ * only finished for the ~0% of batches where some lane matches.
  * Keys are in SoA layout: keys[word_pos][lane] — enables aligned loads.
+ * X independent 16-lane chains are interleaved step by step to hide the
+ * add/rotate latency; chain j covers lanes j*16..j*16+15.
+ *
+ * Always inlined into one wrapper per length class nw (see MD5_NW), so the
+ * adds of always-zero key words are dropped at compile time.
+ * Round 1 starts at step args->start from the broadcast midstate args->mid.
  */
-void avx512_md5_check(cruncher_config *cfg,
-                      uint32_t keys[16][16], int wcs_arr[16], int count) {
-    __m512i k[16];
-    for (int w = 0; w < 16; w++) {
-        k[w] = _mm512_load_si512((__m512i *)keys[w]);
+static inline __attribute__((always_inline))
+void avx512_md5_check_body(cruncher_config *cfg, uint32_t *keys,
+                           int *wcs_arr, int count,
+                           const md5_batch_args *args, const int nw, const int X) {
+    const uint32_t len_bits = (uint32_t)wcs_arr[0] << 3;
+    __m512i a[MD5_MAX_CHAINS], b[MD5_MAX_CHAINS], c[MD5_MAX_CHAINS], d[MD5_MAX_CHAINS];
+    for (int j = 0; j < X; j++) {
+        a[j] = _mm512_set1_epi32((int32_t)args->mid[0]);
+        b[j] = _mm512_set1_epi32((int32_t)args->mid[1]);
+        c[j] = _mm512_set1_epi32((int32_t)args->mid[2]);
+        d[j] = _mm512_set1_epi32((int32_t)args->mid[3]);
     }
+    uint32_t hit[MD5_MAX_CHAINS] = {0};  /* candidate lanes per chain, see MD5_512_EXIT */
 
-    __m512i a = _mm512_set1_epi32(0x67452301);
-    __m512i b = _mm512_set1_epi32((int32_t)0xefcdab89);
-    __m512i c = _mm512_set1_epi32((int32_t)0x98badcfe);
-    __m512i d = _mm512_set1_epi32(0x10325476);
-
-    /* Round 1 */
-    MD5_512_STEP(MD5_512_F, a, b, c, d, k[ 0], 0xd76aa478,  7);
-    MD5_512_STEP(MD5_512_F, d, a, b, c, k[ 1], 0xe8c7b756, 12);
-    MD5_512_STEP(MD5_512_F, c, d, a, b, k[ 2], 0x242070db, 17);
-    MD5_512_STEP(MD5_512_F, b, c, d, a, k[ 3], 0xc1bdceee, 22);
-    MD5_512_STEP(MD5_512_F, a, b, c, d, k[ 4], 0xf57c0faf,  7);
-    MD5_512_STEP(MD5_512_F, d, a, b, c, k[ 5], 0x4787c62a, 12);
-    MD5_512_STEP(MD5_512_F, c, d, a, b, k[ 6], 0xa8304613, 17);
-    MD5_512_STEP(MD5_512_F, b, c, d, a, k[ 7], 0xfd469501, 22);
-    MD5_512_STEP(MD5_512_F, a, b, c, d, k[ 8], 0x698098d8,  7);
-    MD5_512_STEP(MD5_512_F, d, a, b, c, k[ 9], 0x8b44f7af, 12);
-    MD5_512_STEP(MD5_512_F, c, d, a, b, k[10], 0xffff5bb1, 17);
-    MD5_512_STEP(MD5_512_F, b, c, d, a, k[11], 0x895cd7be, 22);
-    MD5_512_STEP(MD5_512_F, a, b, c, d, k[12], 0x6b901122,  7);
-    MD5_512_STEP(MD5_512_F, d, a, b, c, k[13], 0xfd987193, 12);
-    MD5_512_STEP(MD5_512_F, c, d, a, b, k[14], 0xa679438e, 17);
-    MD5_512_STEP(MD5_512_F, b, c, d, a, k[15], 0x49b40821, 22);
+    /* Round 1, entered at step args->start */
+    switch (args->start) {
+    case  0: MD5_512_STEP_X(MD5_512_F, a, b, c, d,  0, 0xd76aa478,  7);  /* fallthrough */
+    case  1: MD5_512_STEP_X(MD5_512_F, d, a, b, c,  1, 0xe8c7b756, 12);  /* fallthrough */
+    case  2: MD5_512_STEP_X(MD5_512_F, c, d, a, b,  2, 0x242070db, 17);  /* fallthrough */
+    case  3: MD5_512_STEP_X(MD5_512_F, b, c, d, a,  3, 0xc1bdceee, 22);  /* fallthrough */
+    case  4: MD5_512_STEP_X(MD5_512_F, a, b, c, d,  4, 0xf57c0faf,  7);  /* fallthrough */
+    case  5: MD5_512_STEP_X(MD5_512_F, d, a, b, c,  5, 0x4787c62a, 12);  /* fallthrough */
+    case  6: MD5_512_STEP_X(MD5_512_F, c, d, a, b,  6, 0xa8304613, 17);  /* fallthrough */
+    case  7: MD5_512_STEP_X(MD5_512_F, b, c, d, a,  7, 0xfd469501, 22);  /* fallthrough */
+    case  8: MD5_512_STEP_X(MD5_512_F, a, b, c, d,  8, 0x698098d8,  7);  /* fallthrough */
+    case  9: MD5_512_STEP_X(MD5_512_F, d, a, b, c,  9, 0x8b44f7af, 12);  /* fallthrough */
+    case 10: MD5_512_STEP_X(MD5_512_F, c, d, a, b, 10, 0xffff5bb1, 17);  /* fallthrough */
+    case 11: MD5_512_STEP_X(MD5_512_F, b, c, d, a, 11, 0x895cd7be, 22);  /* fallthrough */
+    case 12: MD5_512_STEP_X(MD5_512_F, a, b, c, d, 12, 0x6b901122,  7);  /* fallthrough */
+    case 13: MD5_512_STEP_X(MD5_512_F, d, a, b, c, 13, 0xfd987193, 12);  /* fallthrough */
+    case 14: MD5_512_STEP_X(MD5_512_F, c, d, a, b, 14, 0xa679438e, 17);  /* fallthrough */
+    case 15: MD5_512_STEP_X(MD5_512_F, b, c, d, a, 15, 0x49b40821, 22);
+    }
     /* Round 2 */
-    MD5_512_STEP(MD5_512_G, a, b, c, d, k[ 1], 0xf61e2562,  5);
-    MD5_512_STEP(MD5_512_G, d, a, b, c, k[ 6], 0xc040b340,  9);
-    MD5_512_STEP(MD5_512_G, c, d, a, b, k[11], 0x265e5a51, 14);
-    MD5_512_STEP(MD5_512_G, b, c, d, a, k[ 0], 0xe9b6c7aa, 20);
-    MD5_512_STEP(MD5_512_G, a, b, c, d, k[ 5], 0xd62f105d,  5);
-    MD5_512_STEP(MD5_512_G, d, a, b, c, k[10], 0x02441453,  9);
-    MD5_512_STEP(MD5_512_G, c, d, a, b, k[15], 0xd8a1e681, 14);
-    MD5_512_STEP(MD5_512_G, b, c, d, a, k[ 4], 0xe7d3fbc8, 20);
-    MD5_512_STEP(MD5_512_G, a, b, c, d, k[ 9], 0x21e1cde6,  5);
-    MD5_512_STEP(MD5_512_G, d, a, b, c, k[14], 0xc33707d6,  9);
-    MD5_512_STEP(MD5_512_G, c, d, a, b, k[ 3], 0xf4d50d87, 14);
-    MD5_512_STEP(MD5_512_G, b, c, d, a, k[ 8], 0x455a14ed, 20);
-    MD5_512_STEP(MD5_512_G, a, b, c, d, k[13], 0xa9e3e905,  5);
-    MD5_512_STEP(MD5_512_G, d, a, b, c, k[ 2], 0xfcefa3f8,  9);
-    MD5_512_STEP(MD5_512_G, c, d, a, b, k[ 7], 0x676f02d9, 14);
-    MD5_512_STEP(MD5_512_G, b, c, d, a, k[12], 0x8d2a4c8a, 20);
+    MD5_512_STEP_X(MD5_512_G, a, b, c, d,  1, 0xf61e2562,  5);
+    MD5_512_STEP_X(MD5_512_G, d, a, b, c,  6, 0xc040b340,  9);
+    MD5_512_STEP_X(MD5_512_G, c, d, a, b, 11, 0x265e5a51, 14);
+    MD5_512_STEP_X(MD5_512_G, b, c, d, a,  0, 0xe9b6c7aa, 20);
+    MD5_512_STEP_X(MD5_512_G, a, b, c, d,  5, 0xd62f105d,  5);
+    MD5_512_STEP_X(MD5_512_G, d, a, b, c, 10, 0x02441453,  9);
+    MD5_512_STEP_X(MD5_512_G, c, d, a, b, 15, 0xd8a1e681, 14);
+    MD5_512_STEP_X(MD5_512_G, b, c, d, a,  4, 0xe7d3fbc8, 20);
+    MD5_512_STEP_X(MD5_512_G, a, b, c, d,  9, 0x21e1cde6,  5);
+    MD5_512_STEP_X(MD5_512_G, d, a, b, c, 14, 0xc33707d6,  9);
+    MD5_512_STEP_X(MD5_512_G, c, d, a, b,  3, 0xf4d50d87, 14);
+    MD5_512_STEP_X(MD5_512_G, b, c, d, a,  8, 0x455a14ed, 20);
+    MD5_512_STEP_X(MD5_512_G, a, b, c, d, 13, 0xa9e3e905,  5);
+    MD5_512_STEP_X(MD5_512_G, d, a, b, c,  2, 0xfcefa3f8,  9);
+    MD5_512_STEP_X(MD5_512_G, c, d, a, b,  7, 0x676f02d9, 14);
+    MD5_512_STEP_X(MD5_512_G, b, c, d, a, 12, 0x8d2a4c8a, 20);
     /* Round 3 */
-    MD5_512_STEP(MD5_512_H, a, b, c, d, k[ 5], 0xfffa3942,  4);
-    MD5_512_STEP(MD5_512_H, d, a, b, c, k[ 8], 0x8771f681, 11);
-    MD5_512_STEP(MD5_512_H, c, d, a, b, k[11], 0x6d9d6122, 16);
-    MD5_512_STEP(MD5_512_H, b, c, d, a, k[14], 0xfde5380c, 23);
-    MD5_512_STEP(MD5_512_H, a, b, c, d, k[ 1], 0xa4beea44,  4);
-    MD5_512_STEP(MD5_512_H, d, a, b, c, k[ 4], 0x4bdecfa9, 11);
-    MD5_512_STEP(MD5_512_H, c, d, a, b, k[ 7], 0xf6bb4b60, 16);
-    MD5_512_STEP(MD5_512_H, b, c, d, a, k[10], 0xbebfbc70, 23);
-    MD5_512_STEP(MD5_512_H, a, b, c, d, k[13], 0x289b7ec6,  4);
-    MD5_512_STEP(MD5_512_H, d, a, b, c, k[ 0], 0xeaa127fa, 11);
-    MD5_512_STEP(MD5_512_H, c, d, a, b, k[ 3], 0xd4ef3085, 16);
-    MD5_512_STEP(MD5_512_H, b, c, d, a, k[ 6], 0x04881d05, 23);
-    MD5_512_STEP(MD5_512_H, a, b, c, d, k[ 9], 0xd9d4d039,  4);
-    MD5_512_STEP(MD5_512_H, d, a, b, c, k[12], 0xe6db99e5, 11);
-    MD5_512_STEP(MD5_512_H, c, d, a, b, k[15], 0x1fa27cf8, 16);
-    MD5_512_STEP(MD5_512_H, b, c, d, a, k[ 2], 0xc4ac5665, 23);
-    /* Round 4 — steps 48..60 (a is finalized after step 60) */
-    MD5_512_STEP(MD5_512_I, a, b, c, d, k[ 0], 0xf4292244,  6);
-    MD5_512_STEP(MD5_512_I, d, a, b, c, k[ 7], 0x432aff97, 10);
-    MD5_512_STEP(MD5_512_I, c, d, a, b, k[14], 0xab9423a7, 15);
-    MD5_512_STEP(MD5_512_I, b, c, d, a, k[ 5], 0xfc93a039, 21);
-    MD5_512_STEP(MD5_512_I, a, b, c, d, k[12], 0x655b59c3,  6);
-    MD5_512_STEP(MD5_512_I, d, a, b, c, k[ 3], 0x8f0ccc92, 10);
-    MD5_512_STEP(MD5_512_I, c, d, a, b, k[10], 0xffeff47d, 15);
-    MD5_512_STEP(MD5_512_I, b, c, d, a, k[ 1], 0x85845dd1, 21);
-    MD5_512_STEP(MD5_512_I, a, b, c, d, k[ 8], 0x6fa87e4f,  6);
-    MD5_512_STEP(MD5_512_I, d, a, b, c, k[15], 0xfe2ce6e0, 10);
-    MD5_512_STEP(MD5_512_I, c, d, a, b, k[ 6], 0xa3014314, 15);
-    MD5_512_STEP(MD5_512_I, b, c, d, a, k[13], 0x4e0811a1, 21);
-    MD5_512_STEP(MD5_512_I, a, b, c, d, k[ 4], 0xf7537e82,  6);  /* step 60: a final */
+    MD5_512_STEP_X(MD5_512_H, a, b, c, d,  5, 0xfffa3942,  4);
+    MD5_512_STEP_X(MD5_512_H, d, a, b, c,  8, 0x8771f681, 11);
+    MD5_512_STEP_X(MD5_512_H, c, d, a, b, 11, 0x6d9d6122, 16);
+    MD5_512_STEP_X(MD5_512_H, b, c, d, a, 14, 0xfde5380c, 23);
+    MD5_512_STEP_X(MD5_512_H, a, b, c, d,  1, 0xa4beea44,  4);
+    MD5_512_STEP_X(MD5_512_H, d, a, b, c,  4, 0x4bdecfa9, 11);
+    MD5_512_STEP_X(MD5_512_H, c, d, a, b,  7, 0xf6bb4b60, 16);
+    MD5_512_STEP_X(MD5_512_H, b, c, d, a, 10, 0xbebfbc70, 23);
+    MD5_512_STEP_X(MD5_512_H, a, b, c, d, 13, 0x289b7ec6,  4);
+    MD5_512_STEP_X(MD5_512_H, d, a, b, c,  0, 0xeaa127fa, 11);
+    MD5_512_STEP_X(MD5_512_H, c, d, a, b,  3, 0xd4ef3085, 16);
+    MD5_512_STEP_X(MD5_512_H, b, c, d, a,  6, 0x04881d05, 23);
+    MD5_512_STEP_X(MD5_512_H, a, b, c, d,  9, 0xd9d4d039,  4);
+    MD5_512_STEP_X(MD5_512_H, d, a, b, c, 12, 0xe6db99e5, 11);
+    MD5_512_STEP_X(MD5_512_H, c, d, a, b, 15, 0x1fa27cf8, 16);
+    MD5_512_STEP_X(MD5_512_H, b, c, d, a,  2, 0xc4ac5665, 23);
+    /* Round 4. The last args->rev steps are reversed out of the targets, so
+     * the register written at step 60 - rev is final: compare it and leave on
+     * the ~100% no-match path. */
+    MD5_512_STEP_X(MD5_512_I, a, b, c, d,  0, 0xf4292244,  6);
+    MD5_512_STEP_X(MD5_512_I, d, a, b, c,  7, 0x432aff97, 10);
+    MD5_512_STEP_X(MD5_512_I, c, d, a, b, 14, 0xab9423a7, 15);
+    MD5_512_STEP_X(MD5_512_I, b, c, d, a,  5, 0xfc93a039, 21);
+    MD5_512_STEP_X(MD5_512_I, a, b, c, d, 12, 0x655b59c3,  6);
+    MD5_512_STEP_X(MD5_512_I, d, a, b, c,  3, 0x8f0ccc92, 10);
+    MD5_512_EXIT(7, d);
+    MD5_512_STEP_X(MD5_512_I, c, d, a, b, 10, 0xffeff47d, 15);
+    MD5_512_EXIT(6, c);
+    MD5_512_STEP_X(MD5_512_I, b, c, d, a,  1, 0x85845dd1, 21);
+    MD5_512_EXIT(5, b);
+    MD5_512_STEP_X(MD5_512_I, a, b, c, d,  8, 0x6fa87e4f,  6);
+    MD5_512_EXIT(4, a);
+    MD5_512_STEP_X(MD5_512_I, d, a, b, c, 15, 0xfe2ce6e0, 10);
+    MD5_512_EXIT(3, d);
+    MD5_512_STEP_X(MD5_512_I, c, d, a, b,  6, 0xa3014314, 15);
+    MD5_512_EXIT(2, c);
+    MD5_512_STEP_X(MD5_512_I, b, c, d, a, 13, 0x4e0811a1, 21);
+    MD5_512_EXIT(1, b);
+    MD5_512_STEP_X(MD5_512_I, a, b, c, d,  4, 0xf7537e82,  6);
+    MD5_512_EXIT(0, a);
 
-    /* --- Early exit: check hash[0] before computing last 3 rounds --- */
-    __m512i ha = _mm512_add_epi32(a, _mm512_set1_epi32(0x67452301));
-    __mmask16 any_match = 0;
-    for (uint32_t ih = 0; ih < cfg->hashes_num; ih++) {
-        any_match |= _mm512_cmpeq_epi32_mask(ha,
-                         _mm512_set1_epi32((int32_t)cfg->hashes[4 * ih]));
-    }
-    if (!any_match) return;  /* fast path: skip last 3 rounds */
+    /* Rare path: some lane may match, finish the hash */
+    MD5_512_STEP_X(MD5_512_I, d, a, b, c, 11, 0xbd3af235, 10);
+    MD5_512_STEP_X(MD5_512_I, c, d, a, b,  2, 0x2ad7d2bb, 15);
+    MD5_512_STEP_X(MD5_512_I, b, c, d, a,  9, 0xeb86d391, 21);
 
-    /* Rare path: finish rounds 61-63 */
-    MD5_512_STEP(MD5_512_I, d, a, b, c, k[11], 0xbd3af235, 10);
-    MD5_512_STEP(MD5_512_I, c, d, a, b, k[ 2], 0x2ad7d2bb, 15);
-    MD5_512_STEP(MD5_512_I, b, c, d, a, k[ 9], 0xeb86d391, 21);
+    for (int j = 0; j < X; j++) {
+        uint32_t a_vals[16], b_vals[16], c_vals[16], d_vals[16];
+        _mm512_storeu_si512(a_vals, _mm512_add_epi32(a[j], _mm512_set1_epi32(0x67452301)));
+        _mm512_storeu_si512(b_vals, _mm512_add_epi32(b[j], _mm512_set1_epi32((int32_t)0xefcdab89)));
+        _mm512_storeu_si512(c_vals, _mm512_add_epi32(c[j], _mm512_set1_epi32((int32_t)0x98badcfe)));
+        _mm512_storeu_si512(d_vals, _mm512_add_epi32(d[j], _mm512_set1_epi32(0x10325476)));
 
-    __m512i hb = _mm512_add_epi32(b, _mm512_set1_epi32((int32_t)0xefcdab89));
-    __m512i hc = _mm512_add_epi32(c, _mm512_set1_epi32((int32_t)0x98badcfe));
-    __m512i hd = _mm512_add_epi32(d, _mm512_set1_epi32(0x10325476));
+        for (uint32_t h = hit[j]; h; h &= h - 1) {
+            int l = __builtin_ctz(h), lane = j * 16 + l;
+            if (lane >= count) break;
+            uint32_t hash[4] = {a_vals[l], b_vals[l], c_vals[l], d_vals[l]};
+            /* Reconstruct this lane's key from SoA layout (rare path) */
+            uint32_t lane_key[16];
+            for (int w = 0; w < 16; w++) lane_key[w] = keys[w * X * 16 + lane];
+            avx_check_hashes(cfg, args->targets, hash, lane_key, wcs_arr[lane]);
+        }
+    }
+}
 
-    /* Extract and do full 4-word comparison for matching lanes */
-    uint32_t a_vals[16], b_vals[16], c_vals[16], d_vals[16];
-    _mm512_storeu_si512(a_vals, ha);
-    _mm512_storeu_si512(b_vals, hb);
-    _mm512_storeu_si512(c_vals, hc);
-    _mm512_storeu_si512(d_vals, hd);
+#define AVX512_MD5_CHECK(NW, X) \
+static void avx512_md5_check_nw##NW##_x##X(cruncher_config *cfg, uint32_t *keys, \
+                                           int *wcs_arr, int count, \
+                                           const md5_batch_args *args) { \
+    avx512_md5_check_body(cfg, keys, wcs_arr, count, args, NW, X); \
+}
+#define AVX512_MD5_CHECK_ROW(X) \
+    AVX512_MD5_CHECK(1, X)  AVX512_MD5_CHECK(2, X)  AVX512_MD5_CHECK(3, X) \
+    AVX512_MD5_CHECK(4, X)  AVX512_MD5_CHECK(5, X)  AVX512_MD5_CHECK(6, X) \
+    AVX512_MD5_CHECK(7, X)  AVX512_MD5_CHECK(8, X)  AVX512_MD5_CHECK(9, X) \
+    AVX512_MD5_CHECK(10, X)
+AVX512_MD5_CHECK_ROW(1)
+AVX512_MD5_CHECK_ROW(2)
+AVX512_MD5_CHECK_ROW(3)
+#undef AVX512_MD5_CHECK_ROW
+#undef AVX512_MD5_CHECK
+#undef MD5_512_EXIT
 
-    __mmask16 remaining = any_match & (((uint32_t)1 << count) - 1);
-    while (remaining) {
-        int lane = __builtin_ctz(remaining);
-        remaining &= remaining - 1;
-        uint32_t hash[4] = {a_vals[lane], b_vals[lane], c_vals[lane], d_vals[lane]};
-        /* Reconstruct this lane's key from SoA layout (rare path) */
-        uint32_t lane_key[16];
-        for (int w = 0; w < 16; w++) lane_key[w] = keys[w][lane];
-        avx_check_hashes(cfg, hash, lane_key, wcs_arr[lane]);
-    }
+#define AVX512_MD5_CHECK_FNS(X) { NULL, \
+    avx512_md5_check_nw1_x##X, avx512_md5_check_nw2_x##X, avx512_md5_check_nw3_x##X, \
+    avx512_md5_check_nw4_x##X, avx512_md5_check_nw5_x##X, avx512_md5_check_nw6_x##X, \
+    avx512_md5_check_nw7_x##X, avx512_md5_check_nw8_x##X, avx512_md5_check_nw9_x##X, \
+    avx512_md5_check_nw10_x##X }
+
+md5_check_fn avx512_md5_check_for(int wcs, int chains) {
+    static const md5_check_fn by_chains_nw[MD5_MAX_CHAINS + 1][MD5_MAX_NW + 1] = {
+        { NULL },
+        AVX512_MD5_CHECK_FNS(1), AVX512_MD5_CHECK_FNS(2), AVX512_MD5_CHECK_FNS(3),
+    };
+    return by_chains_nw[chains][MD5_NW(wcs)];
 }
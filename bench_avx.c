@@ -12,6 +12,7 @@
  * Benchmark: measures AVX/scalar cruncher throughput.
  * Creates N buffers of tasks with varying n values (2-5 words),
  * runs them through the cruncher with configurable thread count.
+ * Usage: bench_avx [-avx512|-avx2|-scalar] [threads] [buffers] [n] [target hashes]
  */
 
 static void fill_buffer_with_tasks(tasks_buffer *buf, int n_words) {
@@ -22,29 +23,20 @@ static void fill_buffer_with_tasks(tasks_buffer *buf, int n_words) {
     const char *sample_words[] = {"tyranous", "pluto", "twits", "put", "lot"};
 
     for (uint32_t t = 0; t < PERMUT_TASKS_IN_KERNEL_TASK && t < 256*1024; t++) {
-        permut_task *task = &buf->permut_tasks[t];
-        memset(task, 0, sizeof(permut_task));
+        char all_strs[MAX_STR_LENGTH] = {0};
+        int8_t offsets[MAX_OFFSETS_LENGTH] = {0};
 
+        /* Same slot numbering as production tasks (tasks_buffer_add_task) */
         uint8_t off = 0;
         int words_to_use = n_words > 5 ? 5 : n_words;
         for (int i = 0; i < words_to_use; i++) {
-            task->a[i] = off + 1;
+            offsets[i] = off + 1;
             int len = strlen(sample_words[i % 5]);
-            memcpy(task->all_strs + off, sample_words[i % 5], len + 1);
+            memcpy(all_strs + off, sample_words[i % 5], len + 1);
             off += len + 1;
         }
 
-        for (int i = 0; i < words_to_use; i++) {
-            task->offsets[i] = i + 1;
-        }
-        task->offsets[words_to_use] = 0;
-        task->n = words_to_use;
-        task->i = 0;
-        task->iters_done = 0;
-        memset(task->c, 0, MAX_OFFSETS_LENGTH);
-
-        buf->num_tasks++;
-        buf->num_anas += fact(words_to_use);
+        tasks_buffer_add_task(buf, all_strs, offsets);
     }
 }
 
@@ -52,6 +44,7 @@ int main(int argc, char **argv) {
     int num_threads = 7;
     int num_buffers = 4;
     int n_words = 4;
+    uint32_t num_target_hashes = 19;  /* production list size */
 
     const char *backend_name = NULL;
     if (argc > 1 && argv[1][0] == '-') {
@@ -61,18 +54,20 @@ int main(int argc, char **argv) {
     if (argc > 1) num_threads = atoi(argv[1]);
     if (argc > 2) num_buffers = atoi(argv[2]);
     if (argc > 3) n_words = atoi(argv[3]);
+    if (argc > 4) num_target_hashes = (uint32_t)atol(argv[4]);
 
     printf("AVX Cruncher Benchmark\n");
     printf("  Threads: %d\n", num_threads);
     printf("  Buffers: %d (each %d tasks)\n", num_buffers, PERMUT_TASKS_IN_KERNEL_TASK);
     printf("  Words per task (n): %d → %lu permutations/task\n", n_words, (unsigned long)fact(n_words));
 
-    /* Dummy target hashes (won't match anything) — use 19 to match production */
-    #define NUM_TARGET_HASHES 19
-    uint32_t hashes[4 * NUM_TARGET_HASHES];
-    for (int i = 0; i < 4 * NUM_TARGET_HASHES; i++) hashes[i] = 0xdeadbe00 + i;
-    uint32_t hashes_reversed[NUM_TARGET_HASHES * MAX_STR_LENGTH / 4];
-    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+    printf("  Target hashes: %u\n", num_target_hashes);
+
+    /* Dummy target hashes (won't match anything) */
+    uint32_t *hashes = malloc(16 * (size_t)num_target_hashes);
+    uint32_t *hashes_reversed = calloc(num_target_hashes, MAX_STR_LENGTH);
+    if (!hashes || !hashes_reversed) { fprintf(stderr, "failed to allocate hashes\n"); return 1; }
+    for (uint32_t i = 0; i < 4 * num_target_hashes; i++) hashes[i] = 0xdeadbe00 + i;
 
     tasks_buffers tasks_buffs;
     tasks_buffers_create(&tasks_buffs);
@@ -80,7 +75,7 @@ int main(int argc, char **argv) {
     cruncher_config cfg = {
         .tasks_buffs = &tasks_buffs,
         .hashes = hashes,
-        .hashes_num = NUM_TARGET_HASHES,
+        .hashes_num = num_target_hashes,
         .hashes_reversed = hashes_reversed,
     };
 
@@ -148,6 +143,8 @@ int main(int argc, char **argv) {
     free(ctxs);
     free(threads);
     tasks_buffers_free(&tasks_buffs);
+    free(hashes);
+    free(hashes_reversed);
 
     return 0;
 }
@@ -4,6 +4,7 @@
 #include "os.h"
 #include "md5_avx2.h"
 #include "md5_avx512.h"
+#include "avx_cruncher.h"
 
 /* Copy PUTCHAR_SCALAR and md5_scalar from avx_cruncher.c for isolated testing */
 #define PUTCHAR_SCALAR(buf, index, val) \
@@ -177,6 +178,21 @@ int main(void) {
     printf("String memcpy:  %d strings in %.3fs = %.1f M/s (%.1fx PUTCHAR)\n",
            N, str_fast_sec, N / str_fast_sec / 1e6, str_sec / str_fast_sec);
 
+    /* === Test 6: batch kernels, single vs interleaved chains === */
+    for (int vec = 8; vec <= 16; vec += 8) {
+        if (vec == 16 && !__builtin_cpu_supports("avx512f")) {
+            printf("AVX512 chains: (not available on this CPU)\n");
+            continue;
+        }
+        double rate1 = avx_md5_chains_rate(vec, 1, 200000);
+        printf("%-6s chains: 1x %.1f M/s", vec == 16 ? "AVX512" : "AVX2", rate1 / 1e6);
+        for (int x = 2; x <= MD5_MAX_CHAINS; x++) {
+            double rate = avx_md5_chains_rate(vec, x, 200000);
+            printf(", %dx %.1f M/s (%+.0f%%)", x, rate / 1e6, (rate / rate1 - 1) * 100);
+        }
+        printf(", calibrated %dx\n", avx_md5_chains(vec));
+    }
+
     printf("\nBottleneck: PUTCHAR string is %.1fx slower than scalar MD5\n", str_sec / scalar_sec);
     printf("            memcpy  string is %.1fx slower than scalar MD5\n", str_fast_sec / scalar_sec);
     printf("(sink=%u)\n", sink);
@@ -49,18 +49,21 @@
 // cpu<->gpu tasks buffers length, main RAM consumer
 #define TASKS_BUFFERS_SIZE 64
 
-// defines task size for gpu cruncher
-// peak at ~256-512K, try lowering if kernel times out
+// defines task size for gpu cruncher; OpenCL launches take at most as many as
+// the autotuner picked per device (see gpu_tuning), this sizes the buffers
 #define PERMUT_TASKS_IN_KERNEL_TASK 256*1024
-// peak at ~512, try lowering if kernel times out
-#define MAX_ITERS_IN_KERNEL_TASK 512
+// a work item runs min(fact(n) - iters_done, MAX_ITERS_IN_KERNEL_TASK) permutations,
+// so tasks up to n=8 finish in one launch and longer ones are split across launches;
+// also the upper bound of the tuned OpenCL iterations per task
+#define MAX_ITERS_IN_KERNEL_TASK 65536
+// time budget of one launch in permutations (tasks * iters), try lowering if kernel times out
+#define MAX_ANAS_IN_KERNEL_LAUNCH (1u << 30)
 
 // has to be in sync with constants in permut.cl
 #define MAX_STR_LENGTH 40
 #define MAX_OFFSETS_LENGTH 16 // should always have 1 extra for 0-terminated
 
 #define TIMES_WINDOW_LENGTH 32
-#define REFRESH_INTERVAL_HASHES_REVERSED_MILLIS 10000
 
 #define ret_iferr(val, msg) \
 if (val) {\
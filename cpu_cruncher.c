@@ -1,5 +1,4 @@
 #include "cpu_cruncher.h"
-#include "fact.h"
 #include "os.h"
 
 void cpu_cruncher_ctx_create(cpu_cruncher_ctx* cruncher, uint32_t cpu_cruncher_id, uint32_t num_cpu_crunchers,
@@ -21,6 +20,13 @@ void cpu_cruncher_ctx_create(cpu_cruncher_ctx* cruncher, uint32_t cpu_cruncher_i
     }
     cruncher->local_free_count = 0;
     cruncher->tasks_buffs = tasks_buffs;
+    cruncher->split = NULL;
+}
+
+// Helper: queues a buffer of N permutable words
+static int cpu_queue_buffer(cpu_cruncher_ctx *ctx, int n, tasks_buffer *buf) {
+    tasks_buffers *dst = ctx->split ? hybrid_route(ctx->split, n) : ctx->tasks_buffs;
+    return tasks_buffers_add_buffer(dst, buf);
 }
 
 static tasks_buffer* cpu_obtain_buffer(cpu_cruncher_ctx *ctx) {
@@ -45,10 +51,13 @@ static tasks_buffer* cpu_obtain_buffer(cpu_cruncher_ctx *ctx) {
     }
 
     // Nothing available — allocate fresh
-    return tasks_buffer_allocate();
+    return tasks_buffers_allocate(ctx->tasks_buffs);
 }
 
 int submit_tasks(cpu_cruncher_ctx* ctx, int8_t permut[], int permut_len, char *all_strs) {
+    // Unwinds the whole recursion once the pipeline is stopped early
+    if (ctx->tasks_buffs->is_cancelled) return ECANCELED;
+
     permut[permut_len] = 0;
 
     // Count permutable words to determine N for buffer routing
@@ -62,9 +71,10 @@ int submit_tasks(cpu_cruncher_ctx* ctx, int8_t permut[], int permut_len, char *a
 
     int errcode = 0;
     if (*bufp != NULL && tasks_buffer_isfull(*bufp)) {
-        errcode = tasks_buffers_add_buffer(ctx->tasks_buffs, *bufp);
+        errcode = cpu_queue_buffer(ctx, n, *bufp);
         ret_iferr(errcode, "cpu cruncher failed to pass buffer to gpu crunchers");
         *bufp = NULL;
+        if (ctx->split) hybrid_enumerator_wait(ctx->split, ctx->cpu_cruncher_id);
     }
 
     if (*bufp == NULL) {
@@ -72,98 +82,48 @@ int submit_tasks(cpu_cruncher_ctx* ctx, int8_t permut[], int permut_len, char *a
         ret_iferr(!*bufp, "cpu cruncher failed to allocate local buffer");
     }
 
-    tasks_buffer_add_task(*bufp, all_strs, permut);
-    __sync_fetch_and_add(ctx->shared_anas_produced, fact(n));
-
-    return 0;
-}
-
-int recurse_combs(cpu_cruncher_ctx* ctx, char *all_strs, string_idx_and_count sics[], int sics_len, int sics_idx, int8_t permut[], int permut_len, int start_idx) {
-    int errcode=0;
-
-    if (sics_idx >= sics_len) {
-        int si, di=0;
-        for (si = 0; si < sics_len; si++) {
-            if (sics[si].count) {
-                for (;permut[di];di++);
-                permut[di] = sics[si].offset+1;
-            }
-        }
-
-        if(errcode = submit_tasks(ctx, permut, permut_len, all_strs)) {
-            return errcode;
-        }
-
-        for (di=0; di<permut_len; di++) {
-            if (permut[di] > 0) {
-                permut[di] = 0;
-            }
-        }
-    } else if (start_idx > permut_len && sics[sics_idx].count > 0) {
-        // failsafe
-    } else if (sics[sics_idx].count > 1 || start_idx > 0) {
-        for (int i=start_idx; i<permut_len; i++) {
-            if (permut[i] == 0) {
-                permut[i] = -sics[sics_idx].offset-1;
-                sics[sics_idx].count--;
-
-                if (sics[sics_idx].count == 0) {
-                    errcode = recurse_combs(ctx, all_strs, sics, sics_len, sics_idx+1, permut, permut_len, 0);
-                } else if (sics[sics_idx].count <= permut_len-i-1) {
-                    errcode = recurse_combs(ctx, all_strs, sics, sics_len, sics_idx, permut, permut_len, i+1);
-                }
-
-                if (errcode) return errcode;
-
-                sics[sics_idx].count++;
-                permut[i] = 0;
-            }
-        }
+    const uint64_t anas = (*bufp)->num_anas;
+    if ((*bufp)->compact_tasks) {
+        tasks_buffer_add_compact_task(*bufp, ctx->word_ids, permut);
     } else {
-        return recurse_combs(ctx, all_strs, sics, sics_len, sics_idx+1, permut, permut_len, 0);
+        tasks_buffer_add_task(*bufp, all_strs, permut);
     }
+    __sync_fetch_and_add(ctx->shared_anas_produced, (*bufp)->num_anas - anas);
 
-    return errcode;
+    return 0;
 }
 
 int recurse_string_combs(cpu_cruncher_ctx* ctx, stack_item *stack, int stack_len, int stack_idx, int string_idx, string_and_count *scs, int scs_idx) {
     int errcode=0;
     if (stack_idx >= stack_len) {
-        string_idx_and_count sics[scs_idx > 0 ? scs_idx : 1];
-
-        uint8_t strs_count = 0;
-        for (int i=0; i<scs_idx; i++) {
-            if (scs[i].count) {
-                strs_count += strlen(scs[i].str)+1;
-            }
-        }
-
-        uint8_t word_count = 0;
+        // One task per multiset: each string goes into all_strs once and takes
+        // a permutable slot per copy, the cruncher steps over equal orderings
         char all_strs[MAX_STR_LENGTH];
         memset(all_strs, 0, MAX_STR_LENGTH);
+        int8_t permut[MAX_OFFSETS_LENGTH];
+        memset(permut, 0, MAX_OFFSETS_LENGTH);
         int8_t all_offs=0;
-        int sics_len=0;
+        int word_count=0;
         for (int i=0; i<scs_idx; i++) {
             if (scs[i].count) {
-                word_count += scs[i].count;
-                sics[sics_len].count = scs[i].count;
-                sics[sics_len].offset = all_offs;
-                sics_len++;
                 int slen = strlen(scs[i].str) + 1;  /* include null terminator */
                 memcpy(all_strs + all_offs, scs[i].str, slen);
+                ctx->word_ids[all_offs] = scs[i].word_id;
+                for (int c=0; c<scs[i].count; c++) {
+                    permut[word_count++] = all_offs+1;
+                }
                 all_offs += slen;
             }
         }
 
-        int8_t permut[MAX_OFFSETS_LENGTH];
-        memset(permut, 0, MAX_OFFSETS_LENGTH);
-        return recurse_combs(ctx, all_strs, sics, sics_len, 0, permut, word_count, 0);
+        return submit_tasks(ctx, permut, word_count, all_strs);
     } else if (stack[stack_idx].ccs->strings_len > string_idx+1) {
         const uint8_t orig_count = stack[stack_idx].count;
         for (uint8_t i=0; i <= orig_count; i++) {
             stack[stack_idx].count = orig_count-i;
 
             scs[scs_idx].str = stack[stack_idx].ccs->strings[string_idx];
+            scs[scs_idx].word_id = stack[stack_idx].ccs->word_id + string_idx;
             scs[scs_idx].count = i;
             errcode=recurse_string_combs(ctx, stack, stack_len, stack_idx, string_idx + 1, scs, scs_idx + 1);
             if (errcode) return errcode;
@@ -171,6 +131,7 @@ int recurse_string_combs(cpu_cruncher_ctx* ctx, stack_item *stack, int stack_len
         stack[stack_idx].count = orig_count;
     } else {
         scs[scs_idx].str = stack[stack_idx].ccs->strings[string_idx];
+        scs[scs_idx].word_id = stack[stack_idx].ccs->word_id + string_idx;
         scs[scs_idx].count = stack[stack_idx].count;
         return recurse_string_combs(ctx, stack, stack_len, stack_idx + 1, 0, scs, scs_idx + 1);
     }
@@ -272,12 +233,15 @@ void* run_cpu_cruncher_thread(void *ptr) {
     stack_item stack[20];
     string_and_count scs[120];
 
+    if (ctx->split) hybrid_enumerator_wait(ctx->split, ctx->cpu_cruncher_id);
+
     int errcode = recurse_dict_words(ctx, &local_remainder, 0, 0, stack, 0, scs);
+    if (errcode == ECANCELED) errcode = 0;  // stopped early, flushed buffers get dropped
 
     // Flush all per-N buffers that have remaining tasks
     for (int n = 0; n <= MAX_WORD_LENGTH; n++) {
         if (ctx->local_buffers[n] != NULL && ctx->local_buffers[n]->num_tasks > 0) {
-            errcode = tasks_buffers_add_buffer(ctx->tasks_buffs, ctx->local_buffers[n]);
+            errcode = cpu_queue_buffer(ctx, n, ctx->local_buffers[n]);
             ret_iferr(errcode, "cpu cruncher failed to pass last buffer to gpu crunchers");
             ctx->local_buffers[n] = NULL;
         }
@@ -290,6 +254,7 @@ void* run_cpu_cruncher_thread(void *ptr) {
     ctx->local_free_count = 0;
 
     ctx->progress_l0_index = ctx->dict_by_char_len[0]; // mark this cpu cruncher as done
+    if (ctx->split) hybrid_enumerator_done(ctx->split, ctx->cpu_cruncher_id);
 
     if (errcode) fprintf(stderr, "[cpucruncher %d] errcode %d\n", ctx->cpu_cruncher_id, errcode);
     return NULL;
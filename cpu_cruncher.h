@@ -1,6 +1,7 @@
 #ifndef ANABRUTE_CRUNCHER_TYPES_H
 #define ANABRUTE_CRUNCHER_TYPES_H
 
+#include "hybrid.h"
 #include "permut_types.h"
 #include "task_buffers.h"
 
@@ -25,6 +26,7 @@ typedef struct cpu_cruncher_ctx_s {
     volatile int progress_l0_index;
 
     tasks_buffer* local_buffers[MAX_WORD_LENGTH+1];  // per-N buffers for uniform SIMD group dispatch
+    uint16_t word_ids[MAX_STR_LENGTH];  // compact tasks: word_table ids of the words in all_strs, by offset
 
     // per-thread buffer free-list (avoids global mutex for obtain)
     #define LOCAL_FREE_CAP 4
@@ -33,6 +35,7 @@ typedef struct cpu_cruncher_ctx_s {
 
     // output
     tasks_buffers* tasks_buffs;
+    hybrid_split *split;  // hybrid runs: routes buffers by N and parks this thread, NULL: off
 
 } cpu_cruncher_ctx;
 
@@ -40,6 +43,8 @@ void cpu_cruncher_ctx_create(cpu_cruncher_ctx* cruncher, uint32_t cpu_cruncher_i
                              char_counts* seed_phrase, char_counts_strings* (*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE], int* dict_by_char_len,
                              tasks_buffers* tasks_buffs, volatile uint32_t *shared_l0_counter, volatile uint64_t *shared_anas_produced);
 
+// Queues one task; ECANCELED once tasks_buffs is cancelled
+int submit_tasks(cpu_cruncher_ctx* ctx, int8_t permut[], int permut_len, char *all_strs);
 void* run_cpu_cruncher_thread(void *ptr);
 
 #endif //ANABRUTE_CRUNCHER_TYPES_H
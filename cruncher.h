@@ -3,12 +3,23 @@
 
 #include "common.h"
 #include "task_buffers.h"
+#include "targets.h"
+#include "enum_tasks.h"
+#include "hybrid.h"
 
 typedef struct cruncher_config_s {
     tasks_buffers *tasks_buffs;
     uint32_t *hashes;
     uint32_t hashes_num;
     uint32_t *hashes_reversed;  // shared output buffer (hashes_num * MAX_STR_LENGTH bytes)
+    target_set *targets;        // targets not found yet, NULL: always compare all
+    // on-device enumeration (OpenCL): the backend walks the L0 words handed out
+    // by enum_l0_counter itself instead of reading tasks_buffs, NULL: off
+    const enum_dict *enum_dict;
+    volatile uint32_t *enum_l0_counter;
+    // hybrid runs (CPU backends): instance k only crunches while core k is
+    // not enumerating, tasks_buffs being the CPU queue; NULL: off
+    hybrid_split *split;
 } cruncher_config;
 
 typedef struct cruncher_ops_s {
@@ -20,6 +31,8 @@ typedef struct cruncher_ops_s {
     uint64_t (*get_total_anas)(void *ctx);
     bool (*is_running)(void *ctx);
     int (*destroy)(void *ctx);
+    void (*print_timings)(void *ctx);  // optional: per-stage device times, with the final stats
+    bool compact_tasks;                // also reads queues of compact tasks (tasks_buffers.words)
     size_t ctx_size;
 } cruncher_ops;
 
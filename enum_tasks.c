@@ -0,0 +1,123 @@
+#include "enum_tasks.h"
+
+int enum_dict_create(enum_dict *d, char_counts *seed, char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE],
+                     int *dict_by_char_len) {
+    memset(d, 0, sizeof(enum_dict));
+    char_counts_copy(seed, &d->seed);
+    while (d->l0_char < CHARCOUNT - 1 && !seed->counts[d->l0_char]) d->l0_char++;
+
+    uint32_t max_strings = 0;
+    for (int c = 0; c < CHARCOUNT; c++) {
+        d->bucket[c] = (uint16_t) d->entries_num;
+        for (int i = 0; i < dict_by_char_len[c]; i++) {
+            const char_counts_strings *ccs = (*dict_by_char)[c][i];
+            d->entries_num++;
+            d->strings_size += ccs->strings_len * (ccs->counts.length + 1);
+            if ((uint32_t) ccs->strings_len > max_strings) max_strings = ccs->strings_len;
+        }
+    }
+    d->bucket[CHARCOUNT] = (uint16_t) d->entries_num;
+
+    // every word of a multiset may come with all its anagrams
+    if (max_strings * MAX_WORD_LENGTH > ENUM_MAX_STRINGS || d->strings_size > UINT16_MAX) return -1;
+
+    d->entries = malloc(sizeof(enum_entry) * (d->entries_num ? d->entries_num : 1));
+    d->strings = malloc(d->strings_size ? d->strings_size : 1);
+    if (!d->entries || !d->strings) {
+        enum_dict_free(d);
+        return -1;
+    }
+
+    uint32_t ei = 0, off = 0;
+    for (int c = 0; c < CHARCOUNT; c++) {
+        for (int i = 0; i < dict_by_char_len[c]; i++) {
+            const char_counts_strings *ccs = (*dict_by_char)[c][i];
+            enum_entry *e = d->entries + ei++;
+            memcpy(e->counts, ccs->counts.counts, CHARCOUNT);
+            e->length = ccs->counts.length;
+            e->strings_num = (uint8_t) ccs->strings_len;
+            e->strings_off = (uint16_t) off;
+            for (int s = 0; s < ccs->strings_len; s++) {
+                memcpy(d->strings + off, ccs->strings[s], e->length + 1);
+                off += e->length + 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void enum_dict_free(enum_dict *d) {
+    free(d->entries);
+    free(d->strings);
+    d->entries = NULL;
+    d->strings = NULL;
+    d->entries_num = 0;
+    d->strings_size = 0;
+}
+
+// Takes entry e once more from the letters left, false if they run short
+static bool enum_take(uint8_t *rem, const enum_entry *e) {
+    if (rem[CHARCOUNT] < e->length) return false;
+    for (int i = 0; i < CHARCOUNT; i++) {
+        if (rem[i] < e->counts[i]) return false;
+    }
+    for (int i = 0; i < CHARCOUNT; i++) {
+        rem[i] -= e->counts[i];
+    }
+    rem[CHARCOUNT] -= e->length;
+    return true;
+}
+
+static int enum_push(const enum_state *st, enum_state **states, uint32_t *num, uint32_t *cap) {
+    if (*num == *cap) {
+        uint32_t grown = *cap ? 2 * *cap : 1024;
+        enum_state *p = realloc(*states, sizeof(enum_state) * grown);
+        if (!p) return -1;
+        *states = p;
+        *cap = grown;
+    }
+    (*states)[(*num)++] = *st;
+    return 0;
+}
+
+int enum_dict_prefixes(const enum_dict *d, uint32_t l0, enum_state **states, uint32_t *num, uint32_t *cap) {
+    const uint32_t e0 = d->bucket[d->l0_char] + l0;
+    enum_state st;
+    memset(&st, 0, sizeof(enum_state));
+    memcpy(st.rem, d->seed.counts, CHARCOUNT);
+    st.rem[CHARCOUNT] = d->seed.length;
+    st.chr[0] = (uint8_t) d->l0_char;
+    st.idx[0] = (uint16_t) e0;
+    st.status = ENUM_DESCEND;
+
+    // the L0 and L1 levels of recurse_dict_words
+    for (uint8_t cnt0 = 1; enum_take(st.rem, d->entries + e0); cnt0++) {
+        if (cnt0 > MAX_WORD_LENGTH) break;
+        st.cnt[0] = cnt0;
+        st.words = cnt0;
+        if (!st.rem[CHARCOUNT]) {
+            st.depth = st.prefix_depth = 1;
+            if (enum_push(&st, states, num, cap)) return -1;
+            continue;
+        }
+
+        uint32_t c = d->l0_char, start = e0 + 1;
+        if (!st.rem[c]) {
+            while (!st.rem[c]) c++;
+            start = d->bucket[c];
+        }
+        for (uint32_t e1 = start; e1 < d->bucket[c + 1]; e1++) {
+            enum_state st1 = st;
+            st1.depth = st1.prefix_depth = 2;
+            st1.chr[1] = (uint8_t) c;
+            st1.idx[1] = (uint16_t) e1;
+            for (uint8_t cnt1 = 1; enum_take(st1.rem, d->entries + e1); cnt1++) {
+                if (cnt0 + cnt1 > MAX_WORD_LENGTH) break;
+                st1.cnt[1] = cnt1;
+                st1.words = cnt0 + cnt1;
+                if (enum_push(&st1, states, num, cap)) return -1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef ANABRUTE_ENUM_TASKS_H
+#define ANABRUTE_ENUM_TASKS_H
+
+#include "common.h"
+#include "permut_types.h"
+
+/*
+ * On-device task generation: instead of a stream of permut_tasks from the CPU
+ * enumerators, the dictionary is uploaded once and the device is handed
+ * subtrees of recurse_dict_words, one enum_state per (L0, L1) prefix. The
+ * enum_tasks kernel (permut.cl) walks the rest of each subtree and writes the
+ * permut_tasks the CPU enumerator would have queued for it, a few per state
+ * and launch. Layouts are shared with permut.cl.
+ */
+#define ENUM_MAX_FRAMES 12     // dictionary words of a multiset: MAX_WORD_LENGTH + 1 being pruned
+#define ENUM_MAX_STRINGS 48    // anagram strings of the words of a multiset
+
+typedef struct {
+    uint8_t counts[CHARCOUNT];
+    uint8_t length;
+    uint8_t strings_num;
+    uint16_t strings_off;      // strings_num strings of length+1 bytes in enum_dict.strings
+} enum_entry;
+
+// enum_state.status: what the next step of the walk is
+#define ENUM_DESCEND 0         // add a word below the top frame (a fresh prefix)
+#define ENUM_EXPAND 1          // write the tasks of the multiset on the frames
+#define ENUM_ADVANCE 2         // move the top frame to its next count or word
+#define ENUM_DONE 3
+
+/*
+ * Resumable walk of one subtree. Frame k is dictionary entry idx[k] (bucket
+ * chr[k]) taken cnt[k] times; frames below prefix_depth are the prefix and
+ * never change. While a multiset is expanded, dist holds how many times each
+ * of its strings is used (frame by frame), one task per way to spread them.
+ */
+typedef struct {
+    uint8_t depth;
+    uint8_t prefix_depth;
+    uint8_t status;
+    uint8_t words;
+    uint8_t rem[16];           // letters left; rem[CHARCOUNT] is their number
+    uint8_t chr[ENUM_MAX_FRAMES];
+    uint8_t cnt[ENUM_MAX_FRAMES];
+    uint16_t idx[ENUM_MAX_FRAMES];
+    uint8_t dist[ENUM_MAX_STRINGS];
+    uint32_t tasks;            // written so far
+} enum_state;
+
+typedef struct {
+    enum_entry *entries;       // dict_by_char order: bucket c is entries bucket[c]..bucket[c+1]-1
+    uint16_t bucket[CHARCOUNT + 1];
+    uint32_t entries_num;
+    char *strings;
+    uint32_t strings_size;
+    char_counts seed;
+    uint32_t l0_char;          // bucket the L0 words come from
+} enum_dict;
+
+// Flattens dict_by_char; -1 if it does not fit the device layouts
+int enum_dict_create(enum_dict *d, char_counts *seed, char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE],
+                     int *dict_by_char_len);
+void enum_dict_free(enum_dict *d);
+
+static inline uint32_t enum_dict_l0_num(const enum_dict *d) {
+    return d->bucket[d->l0_char + 1] - d->bucket[d->l0_char];
+}
+
+/*
+ * Appends the subtrees below L0 word l0 (index in its bucket) to states,
+ * growing it as needed: one per count of it and L1 word and count, or one per
+ * count alone when that already uses up the seed. -1 on allocation failure.
+ */
+int enum_dict_prefixes(const enum_dict *d, uint32_t l0, enum_state **states, uint32_t *num, uint32_t *cap);
+
+#endif //ANABRUTE_ENUM_TASKS_H
@@ -3,11 +3,14 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "gpu_cruncher.h"
 #include "hashes.h"
 #include "fact.h"
 #include "os.h"
+#include "word_table.h"
+#include "permut_cl.h"  // generated, see CMakeLists.txt
 
 // private stuff
 
@@ -33,6 +36,358 @@ char* read_file(const char* filename) {
     return buf;
 }
 
+// === program binary cache ===
+// Building permut.cl takes seconds on some drivers, so built binaries are kept in
+// $ANABRUTE_CACHE_DIR (default $XDG_CACHE_HOME/anabrute or ~/.cache/anabrute),
+// keyed by everything that can change the result: device, driver, options, source.
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t fnv1a_device_info(uint64_t h, cl_device_id device_id, cl_device_info param) {
+    char info[256] = {0};
+    clGetDeviceInfo(device_id, param, sizeof(info)-1, info, NULL);
+    return fnv1a(h, info, strlen(info)+1);
+}
+
+// Cache directory, created if needed; false if caching is disabled or impossible
+static bool cache_dir(char *dir, size_t dir_size) {
+    const char *env = getenv("ANABRUTE_CACHE_DIR");
+    if (env) {
+        if (!*env) return false;  // set but empty: caching disabled
+        snprintf(dir, dir_size, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        snprintf(dir, dir_size, "%s/anabrute", env);
+    } else if ((env = getenv("HOME")) && *env) {
+        snprintf(dir, dir_size, "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, dir_size, "%s/.cache/anabrute", env);
+    } else {
+        return false;
+    }
+    return !mkdir(dir, 0755) || errno == EEXIST;
+}
+
+// Device and driver part of the cache keys, chained with the embedded source
+static uint64_t cache_key(cl_device_id device_id) {
+    uint64_t key = 0xcbf29ce484222325ULL;
+    key = fnv1a_device_info(key, device_id, CL_DEVICE_NAME);
+    key = fnv1a_device_info(key, device_id, CL_DEVICE_VENDOR);
+    key = fnv1a_device_info(key, device_id, CL_DEVICE_VERSION);
+    key = fnv1a_device_info(key, device_id, CL_DRIVER_VERSION);
+    return fnv1a(key, permut_cl_source, sizeof(permut_cl_source));
+}
+
+static bool program_cache_path(cl_device_id device_id, const char *options, char *path, size_t path_size) {
+    char dir[512];
+    if (!cache_dir(dir, sizeof(dir))) return false;
+    uint64_t key = fnv1a(cache_key(device_id), options, strlen(options)+1);
+    return snprintf(path, path_size, "%s/permut-%016llx.clbin", dir, (unsigned long long) key) < (int) path_size;
+}
+
+static unsigned char *program_cache_load(const char *path, size_t *size) {
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL) {
+        return NULL;
+    }
+    fseek(fd, 0L, SEEK_END);
+    long filesize = ftell(fd);
+    rewind(fd);
+    unsigned char *buf = filesize > 0 ? (unsigned char *) malloc((size_t) filesize) : NULL;
+    if (buf && fread(buf, 1, (size_t) filesize, fd) != (size_t) filesize) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fd);
+    *size = (size_t) filesize;
+    return buf;
+}
+
+// best effort: a failed save only means the next start builds from source again
+static void program_cache_save(cl_program program, const char *path) {
+    size_t size = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) || !size) return;
+    unsigned char *binary = (unsigned char *) malloc(size);
+    if (!binary) return;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) == CL_SUCCESS) {
+        // write-then-rename so concurrent runs never load a half-written file
+        char tmp_path[1024];
+        int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int) getpid());
+        FILE *fd = len < (int) sizeof(tmp_path) ? fopen(tmp_path, "wb") : NULL;
+        if (fd) {
+            bool ok = fwrite(binary, 1, size, fd) == size;
+            ok = !fclose(fd) && ok;
+            if (!ok || rename(tmp_path, path)) remove(tmp_path);
+        }
+    }
+    free(binary);
+}
+
+static void print_build_log(cl_program program, cl_device_id device_id) {
+    // Determine the size of the log
+    size_t log_size;
+    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+    // Allocate memory for the log
+    char *log = (char *) malloc(log_size);
+    // Get the log
+    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+    // Print the log
+    fprintf(stderr, "kernel compilation failed, see compiler output below\n------\n%s\n------\n", log);
+    free(log);
+}
+
+// Builds the embedded permut.cl with options, from the binary cache when possible
+static cl_int gpu_build_program(gpu_cruncher_ctx *ctx, const char *options, cl_program *program) {
+    cl_int errcode;
+    char path[1024];
+    const bool cacheable = program_cache_path(ctx->device_id, options, path, sizeof(path));
+
+    if (cacheable) {
+        size_t size;
+        const unsigned char *binary = program_cache_load(path, &size);
+        if (binary) {
+            cl_int status = CL_SUCCESS;
+            *program = clCreateProgramWithBinary(ctx->cl_ctx, 1, &ctx->device_id, &size, &binary, &status, &errcode);
+            free((void *) binary);
+            if (errcode == CL_SUCCESS && status == CL_SUCCESS) {
+                errcode = clBuildProgram(*program, 1, &ctx->device_id, options, NULL, NULL);
+                if (errcode == CL_SUCCESS) return CL_SUCCESS;
+                clReleaseProgram(*program);
+            }
+            // stale or foreign binary (e.g. after a driver update): rebuild and overwrite it
+        }
+    }
+
+    const char *sources[] = {permut_cl_source};
+    size_t lengths[] = {sizeof(permut_cl_source)-1};
+    *program = clCreateProgramWithSource(ctx->cl_ctx, 1, sources, lengths, &errcode);
+    ret_iferr(errcode, "failed to create program");
+    errcode = clBuildProgram(*program, 1, &ctx->device_id, options, NULL, NULL);
+    if (errcode == CL_BUILD_PROGRAM_FAILURE) {
+        print_build_log(*program, ctx->device_id);
+    }
+    if (errcode != CL_SUCCESS) {
+        clReleaseProgram(*program);
+        *program = NULL;
+    }
+    ret_iferr(errcode, "failed to build program");
+
+    if (cacheable) program_cache_save(*program, path);
+    return CL_SUCCESS;
+}
+
+// Offset of the permutation table for n: tables for 1..n-1 hold k! rows of k bytes
+static uint32_t perms_base(uint32_t n) {
+    uint32_t base = 0;
+    for (uint32_t k = 1; k < n; k++) base += (uint32_t) fact(k) * k;
+    return base;
+}
+
+// All tables for n = 1..GPU_FLAT_MAX_N, rows in lexicographic order
+static void fill_permutation_tables(uint8_t *perms) {
+    for (uint32_t n = 1; n <= GPU_FLAT_MAX_N; n++) {
+        uint8_t *row = perms + perms_base(n);
+        for (uint32_t i = 0; i < n; i++) row[i] = (uint8_t) i;
+        for (uint64_t r = 1; r < fact(n); r++, row += n) {
+            uint8_t *next = row + n;
+            memcpy(next, row, n);
+            // next permutation: swap the last ascent with its smallest larger
+            // successor, then reverse the tail
+            int i = (int) n - 2;
+            while (next[i] > next[i + 1]) i--;
+            int j = (int) n - 1;
+            while (next[j] < next[i]) j--;
+            uint8_t t = next[i]; next[i] = next[j]; next[j] = t;
+            for (int l = i + 1, h = (int) n - 1; l < h; l++, h--) {
+                t = next[l]; next[l] = next[h]; next[h] = t;
+            }
+        }
+    }
+}
+
+// === dispatch autotuner ===
+// The geometry that peaks differs from card to card, so it is measured once per
+// device and kept as text ("local_size tasks iters") next to the program cache,
+// keyed like it: a new driver or kernel can move the peak.
+
+static bool tune_cache_path(cl_device_id device_id, char *path, size_t path_size) {
+    char dir[512];
+    if (!cache_dir(dir, sizeof(dir))) return false;
+    uint64_t key = cache_key(device_id);
+    return snprintf(path, path_size, "%s/tune-%016llx.txt", dir, (unsigned long long) key) < (int) path_size;
+}
+
+// Powers of two within the compile-time limits, so tasks is always a multiple
+// of local_size (GPU_TUNE_MAX_LOCAL <= GPU_TUNE_MIN_TASKS)
+static bool tune_valid(const gpu_tuning *t, size_t max_local) {
+    if ((t->local_size & (t->local_size - 1)) || t->local_size > GPU_TUNE_MAX_LOCAL || t->local_size > max_local) {
+        return false;
+    }
+    if ((t->tasks & (t->tasks - 1)) || t->tasks < GPU_TUNE_MIN_TASKS || t->tasks > PERMUT_TASKS_IN_KERNEL_TASK) {
+        return false;
+    }
+    return !(t->iters & (t->iters - 1)) && t->iters >= GPU_TUNE_MIN_ITERS && t->iters <= MAX_ITERS_IN_KERNEL_TASK;
+}
+
+static bool tune_cache_load(const char *path, gpu_tuning *t) {
+    FILE *fd = fopen(path, "r");
+    if (fd == NULL) {
+        return false;
+    }
+    bool ok = fscanf(fd, "%u %u %u", &t->local_size, &t->tasks, &t->iters) == 3;
+    fclose(fd);
+    return ok;
+}
+
+// best effort, like program_cache_save
+static void tune_cache_save(const gpu_tuning *t, const char *path) {
+    char tmp_path[1024];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int) getpid());
+    FILE *fd = len < (int) sizeof(tmp_path) ? fopen(tmp_path, "w") : NULL;
+    if (fd) {
+        bool ok = fprintf(fd, "%u %u %u\n", t->local_size, t->tasks, t->iters) > 0;
+        ok = !fclose(fd) && ok;
+        if (!ok || rename(tmp_path, path)) remove(tmp_path);
+    }
+}
+
+// Word xi of task t in mem_tasks, as TASK_WORD in permut.cl
+static size_t task_word(const gpu_cruncher_ctx *ctx, uint32_t t, uint32_t xi) {
+    if (!ctx->use_tiles) return (size_t) t * GPU_TASK_WORDS + xi;
+    return ((size_t) (t / GPU_TASK_TILE) * GPU_TASK_WORDS + xi) * GPU_TASK_TILE + t % GPU_TASK_TILE;
+}
+
+// Bytes at the front of mem_tasks holding tasks [0, num): whole tiles
+static size_t tasks_bytes(const gpu_cruncher_ctx *ctx, uint32_t num) {
+    if (ctx->use_tiles) num = (num + GPU_TASK_TILE - 1) / GPU_TASK_TILE * GPU_TASK_TILE;
+    return (size_t) num * sizeof(permut_task);
+}
+
+// Shortest of two permut launches with geometry t on the synthetic tasks in
+// mem_tasks[0], in micros. Silent on errors: a work-group size the runtime
+// rejects is just skipped.
+static cl_int tune_measure(gpu_cruncher_ctx *ctx, const gpu_tuning *t, uint64_t *micros) {
+    const cl_uint zero = 0;
+    cl_int errcode = clSetKernelArg(ctx->kernel, 0, sizeof(cl_mem), &ctx->mem_tasks[0]);
+    errcode |= clSetKernelArg(ctx->kernel, 1, sizeof(t->iters), &t->iters);
+    errcode |= clSetKernelArg(ctx->kernel, 2, sizeof(cl_mem), &ctx->mem_hashes);
+    errcode |= clSetKernelArg(ctx->kernel, 3, sizeof(ctx->active_num), &ctx->active_num);
+    errcode |= clSetKernelArg(ctx->kernel, 4, sizeof(cl_mem), &ctx->mem_hashes_reversed);
+    errcode |= clSetKernelArg(ctx->kernel, 5, sizeof(cl_mem), &ctx->mem_tasks[1]);
+    errcode |= clSetKernelArg(ctx->kernel, 6, sizeof(cl_mem), &ctx->mem_counters[0]);
+    if (errcode != CL_SUCCESS) return errcode;
+
+    const size_t global_size = t->tasks, local_size = t->local_size;
+    *micros = UINT64_MAX;
+    for (int rep = 0; rep < 2; rep++) {
+        errcode = clEnqueueFillBuffer(ctx->queue, ctx->mem_counters[0], &zero, sizeof(zero), 0,
+                                      GPU_COUNTERS * sizeof(cl_uint), 0, NULL, NULL);
+        errcode |= clFinish(ctx->queue);
+        if (errcode != CL_SUCCESS) return errcode;
+
+        uint64_t start = current_micros();
+        errcode = clEnqueueNDRangeKernel(ctx->queue, ctx->kernel, 1, NULL, &global_size,
+                                         local_size ? &local_size : NULL, 0, NULL, NULL);
+        if (errcode != CL_SUCCESS) return errcode;
+        errcode = clFinish(ctx->queue);
+        if (errcode != CL_SUCCESS) return errcode;
+        uint64_t elapsed = current_micros() - start;
+        if (elapsed < *micros) *micros = elapsed;
+    }
+    return CL_SUCCESS;
+}
+
+// Permutations per micro; a larger setting has to beat the best so far by 5%,
+// so noise does not push launches longer than they need to be
+static bool tune_faster(const gpu_tuning *t, uint64_t micros, double *best_rate) {
+    double rate = (double) t->tasks * t->iters / (micros ? micros : 1);
+    if (rate <= *best_rate * 1.05) return false;
+    *best_rate = rate;
+    return true;
+}
+
+// Coordinate sweep on tasks of 10 permutable words, which no launch finishes,
+// so every work item runs exactly iters permutations. The launch is grown until
+// it is long enough to time, work-group sizes are compared on it, then tasks
+// and iters are doubled from their minimum until a launch takes too long.
+static cl_int tune_sweep(gpu_cruncher_ctx *ctx, size_t max_local, gpu_tuning *best, double *best_rate) {
+    cl_int errcode;
+    permut_task *tasks = calloc(PERMUT_TASKS_IN_KERNEL_TASK, sizeof(permut_task));
+    ret_iferr(!tasks, "failed to malloc tuning tasks");
+    for (int w = 0; w < 10; w++) {
+        // digits: never an anagram of the seed phrase, so no target can match
+        tasks->all_strs[3 * w] = (char) ('0' + w);
+        tasks->all_strs[3 * w + 1] = (char) ('9' - w);
+        tasks->offsets[w] = (int8_t) (w + 1);
+        tasks->a[w] = (uint8_t) (3 * w + 1);
+    }
+    tasks->n = 10;
+    uint32_t *words = (uint32_t *) tasks;  // laid out in place: every task is the same
+    uint32_t first[GPU_TASK_WORDS];
+    memcpy(first, tasks, sizeof(first));
+    for (uint32_t i = 0; i < PERMUT_TASKS_IN_KERNEL_TASK; i++) {
+        for (uint32_t xi = 0; xi < GPU_TASK_WORDS; xi++) words[task_word(ctx, i, xi)] = first[xi];
+    }
+    errcode = clEnqueueWriteBuffer(ctx->queue, ctx->mem_tasks[0], CL_TRUE, 0,
+                                   PERMUT_TASKS_IN_KERNEL_TASK * sizeof(permut_task), tasks, 0, NULL, NULL);
+    free(tasks);
+    ret_iferr(errcode, "failed to upload tuning tasks");
+
+    gpu_tuning t = {0, GPU_TUNE_MIN_TASKS, GPU_TUNE_MIN_ITERS};
+    uint64_t micros;
+    errcode = tune_measure(ctx, &t, &micros);
+    ret_iferr(errcode, "failed to run tuning kernel");
+    while (micros < GPU_TUNE_MIN_MILLIS * 1000 && (t.tasks < PERMUT_TASKS_IN_KERNEL_TASK || t.iters < MAX_ITERS_IN_KERNEL_TASK)) {
+        if (t.tasks < PERMUT_TASKS_IN_KERNEL_TASK) t.tasks <<= 1;
+        else t.iters <<= 1;
+        errcode = tune_measure(ctx, &t, &micros);
+        ret_iferr(errcode, "failed to run tuning kernel");
+    }
+
+    *best = t;
+    *best_rate = 0;
+    tune_faster(&t, micros, best_rate);
+    for (t.local_size = 32; t.local_size <= GPU_TUNE_MAX_LOCAL && t.local_size <= max_local; t.local_size <<= 1) {
+        if (tune_measure(ctx, &t, &micros) == CL_SUCCESS && tune_faster(&t, micros, best_rate)) *best = t;
+    }
+
+    // rates at other sizes are compared among themselves
+    t = *best;
+    *best_rate = 0;
+    for (t.tasks = GPU_TUNE_MIN_TASKS; t.tasks <= PERMUT_TASKS_IN_KERNEL_TASK; t.tasks <<= 1) {
+        errcode = tune_measure(ctx, &t, &micros);
+        ret_iferr(errcode, "failed to run tuning kernel");
+        if (*best_rate && micros > GPU_TUNE_MAX_MILLIS * 1000) break;
+        if (tune_faster(&t, micros, best_rate)) best->tasks = t.tasks;
+    }
+
+    t = *best;
+    *best_rate = 0;
+    for (t.iters = GPU_TUNE_MIN_ITERS; t.iters <= MAX_ITERS_IN_KERNEL_TASK; t.iters <<= 1) {
+        errcode = tune_measure(ctx, &t, &micros);
+        ret_iferr(errcode, "failed to run tuning kernel");
+        if (*best_rate && micros > GPU_TUNE_MAX_MILLIS * 1000) break;
+        if (tune_faster(&t, micros, best_rate)) best->iters = t.iters;
+    }
+    return CL_SUCCESS;
+}
+
+// Work-group size of a permut launch over *global_size tasks: the tuned one,
+// with the launch rounded up to a multiple of it; NULL leaves it to the runtime.
+// The rounded-up slots have to hold empty tasks (n = 0).
+static const size_t *gpu_local_size(const gpu_cruncher_ctx *ctx, size_t *global_size, size_t *local_size) {
+    if (!ctx->tune.local_size) return NULL;
+    *local_size = ctx->tune.local_size;
+    *global_size = (*global_size + *local_size - 1) / *local_size * *local_size;
+    return local_size;
+}
+
 // public stuff
 
 cl_int gpu_cruncher_ctx_create(gpu_cruncher_ctx *ctx, cl_platform_id platform_id, cl_device_id device_id,
@@ -42,16 +397,32 @@ cl_int gpu_cruncher_ctx_create(gpu_cruncher_ctx *ctx, cl_platform_id platform_id
     ctx->device_id = device_id;
 
     ctx->tasks_buffs = tasks_buffs;
+    ctx->share = NULL;
+    ctx->share_idx = -1;
+    ctx->taken_anas = 0;
 
     ctx->cfg = NULL;
 
+    ctx->kernel_expand = NULL;
+    ctx->mem_words[0] = ctx->mem_words[1] = NULL;
+    ctx->kernel_enum = NULL;
+    for (int i = 0; i < 3; i++) {
+        ctx->mem_enum_dict[i] = NULL;
+    }
+    ctx->mem_enum_states = NULL;
+    ctx->enum_states = NULL;
+    ctx->enum_pending = NULL;
+    ctx->enum_pending_cap = 0;
+
     ctx->is_running = true;
     ctx->consumed_bufs = 0;
     ctx->consumed_anas = 0L;
 
     ctx->hashes = hashes;
     ctx->hashes_num = hashes_num;
-    ctx->last_refresh_hashes_reversed_millis = current_micros()/1000;
+    ctx->snap = NULL;
+    ctx->active_num = hashes_num;
+    ctx->active_hashes = NULL;
 
     for (int i = 0; i < TIMES_WINDOW_LENGTH; i++) {
         ctx->task_times_starts[i] = 0;
@@ -60,35 +431,33 @@ cl_int gpu_cruncher_ctx_create(gpu_cruncher_ctx *ctx, cl_platform_id platform_id
     }
     ctx->times_idx = 0;
 
+    const char *variants = getenv("ANABRUTE_OPENCL_VARIANTS");
+    ctx->use_variants = !variants || !*variants || strcmp(variants, "0");
+    ctx->variants_num = 0;
+    const char *flat = getenv("ANABRUTE_OPENCL_FLAT");
+    ctx->use_flat = !flat || !*flat || strcmp(flat, "0");
+    const char *tiles = getenv("ANABRUTE_OPENCL_TILES");
+    ctx->use_tiles = !tiles || !*tiles || strcmp(tiles, "0");
+    const char *in_flight = getenv("ANABRUTE_OPENCL_INFLIGHT");
+    ctx->in_flight = in_flight && *in_flight ? (uint32_t) atoi(in_flight) : GPU_DEFAULT_IN_FLIGHT;
+    if (ctx->in_flight < 1) ctx->in_flight = 1;
+    if (ctx->in_flight > GPU_MAX_IN_FLIGHT) ctx->in_flight = GPU_MAX_IN_FLIGHT;
+    ctx->trace = NULL;
+    for (int i = 0; i < GPU_STAGES; i++) ctx->stage_samples[i] = 0;
+
     cl_int errcode;
     const cl_context_properties ctx_props [] = { CL_CONTEXT_PLATFORM, platform_id, 0, 0 };
     ctx->cl_ctx = clCreateContext(ctx_props, 1, &device_id, NULL, NULL, &errcode);
     ret_iferr(errcode, "failed to create context");
 
-    char *const kernel_source = read_file("kernels/permut.cl");
-    ret_iferr(!kernel_source, "failed to read kernel source");
-    size_t lengths[] = {strlen(kernel_source)};
-    const char *sources[] = {kernel_source};
-    ctx->program = clCreateProgramWithSource(ctx->cl_ctx, 1, sources, lengths, &errcode);
-    free(kernel_source);
-    ret_iferr(errcode, "failed to create program");
-    errcode = clBuildProgram(ctx->program, 0, NULL, NULL, NULL, NULL);
-    if (errcode == CL_BUILD_PROGRAM_FAILURE) {
-        // Determine the size of the log
-        size_t log_size;
-        clGetProgramBuildInfo(ctx->program, ctx->device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        // Allocate memory for the log
-        char *log = (char *) malloc(log_size);
-        // Get the log
-        clGetProgramBuildInfo(ctx->program, ctx->device_id, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-        // Print the log
-        fprintf(stderr, "kernel compilation failed, see compiler output below\n------\n%s\n------\n", log);
-    }
-    ret_iferr(errcode, "failed to build program");
+    errcode = gpu_build_program(ctx, ctx->use_tiles ? "-D PERMUT_TILED" : "", &ctx->program);
+    if (errcode != CL_SUCCESS) return errcode;
 
-    cl_queue_properties queue_props[] = {0};
+    cl_queue_properties queue_props[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
     ctx->queue = clCreateCommandQueueWithProperties(ctx->cl_ctx, ctx->device_id, queue_props, &errcode);
     ret_iferr(errcode, "failed to create queue");
+    ctx->transfer_queue = clCreateCommandQueueWithProperties(ctx->cl_ctx, ctx->device_id, queue_props, &errcode);
+    ret_iferr(errcode, "failed to create transfer queue");
 
     ctx->local_hashes_reversed = malloc(hashes_num * MAX_STR_LENGTH);
     ret_iferr(!ctx->local_hashes_reversed, "failed to malloc local_hashes_reversed");
@@ -103,52 +472,162 @@ cl_int gpu_cruncher_ctx_create(gpu_cruncher_ctx *ctx, cl_platform_id platform_id
     // Create persistent kernel
     ctx->kernel = clCreateKernel(ctx->program, "permut", &errcode);
     ret_iferr(errcode, "failed to create permut kernel");
+    ctx->kernel_flat = clCreateKernel(ctx->program, "permut_flat", &errcode);
+    ret_iferr(errcode, "failed to create permut_flat kernel");
+    ctx->kernel_load = clCreateKernel(ctx->program, "load_tasks", &errcode);
+    ret_iferr(errcode, "failed to create load_tasks kernel");
 
-    // Allocate triple-buffered task memory
+    uint8_t *perms = malloc(perms_base(GPU_FLAT_MAX_N + 1));
+    ret_iferr(!perms, "failed to malloc permutation tables");
+    fill_permutation_tables(perms);
+    ctx->mem_perms = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    perms_base(GPU_FLAT_MAX_N + 1), perms, &errcode);
+    free(perms);
+    ret_iferr(errcode, "failed to create mem_perms");
+
+    // Allocate double-buffered task memory and the launch slots
     size_t tasks_buf_size = PERMUT_TASKS_IN_KERNEL_TASK * sizeof(permut_task);
-    for (int i = 0; i < 3; i++) {
+    for (int i = 0; i < 2; i++) {
         ctx->mem_tasks[i] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_WRITE, tasks_buf_size, NULL, &errcode);
         ret_iferr(errcode, "failed to create mem_tasks buffer");
-        ctx->host_tasks[i] = tasks_buffer_allocate();
-        ret_iferr(!ctx->host_tasks[i], "failed to allocate host_tasks buffer");
-        memset(ctx->host_tasks[i]->permut_tasks, 0, tasks_buf_size);
     }
+    for (uint32_t i = 0; i < GPU_MAX_IN_FLIGHT; i++) {
+        ctx->mem_uploads[i] = NULL;
+        if (i < ctx->in_flight) {
+            ctx->mem_uploads[i] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY, tasks_buf_size, NULL, &errcode);
+            ret_iferr(errcode, "failed to create mem_uploads buffer");
+        }
+        ctx->mem_counters[i] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_WRITE,
+                                              GPU_COUNTERS * sizeof(cl_uint) + sizeof(ctx->matches), NULL, &errcode);
+        ret_iferr(errcode, "failed to create mem_counters buffer");
+    }
+
+    return gpu_cruncher_ctx_autotune(ctx);
+}
+
+cl_int gpu_cruncher_ctx_autotune(gpu_cruncher_ctx *ctx) {
+    const gpu_tuning defaults = {0, PERMUT_TASKS_IN_KERNEL_TASK, MAX_ITERS_IN_KERNEL_TASK};
+    ctx->tune = defaults;
+    const char *env = getenv("ANABRUTE_OPENCL_TUNE");
+    if (env && *env && !strcmp(env, "0")) return CL_SUCCESS;
 
+    size_t max_local = 0;
+    cl_int errcode = clGetKernelWorkGroupInfo(ctx->kernel, ctx->device_id, CL_KERNEL_WORK_GROUP_SIZE,
+                                              sizeof(max_local), &max_local, NULL);
+    ret_iferr(errcode, "failed to get kernel work-group size");
+
+    char path[1024];
+    const bool cacheable = tune_cache_path(ctx->device_id, path, sizeof(path));
+    gpu_tuning tune;
+    if (cacheable && tune_cache_load(path, &tune) && tune_valid(&tune, max_local)) {
+        ctx->tune = tune;
+        return CL_SUCCESS;
+    }
+
+    char name[256] = {0};
+    clGetDeviceInfo(ctx->device_id, CL_DEVICE_NAME, sizeof(name)-1, name, NULL);
+    printf("  opencl: tuning launches for %s...\n", name);
+    double rate;
+    errcode = tune_sweep(ctx, max_local, &tune, &rate);
+    if (errcode != CL_SUCCESS) return errcode;
+    if (tune.local_size) {
+        printf("  opencl: local size %u, %u tasks x %u iters per launch, %.1f Manas/s\n",
+               tune.local_size, tune.tasks, tune.iters, rate);
+    } else {
+        printf("  opencl: runtime local size, %u tasks x %u iters per launch, %.1f Manas/s\n",
+               tune.tasks, tune.iters, rate);
+    }
+
+    ctx->tune = tune;
+    if (cacheable) tune_cache_save(&tune, path);
     return CL_SUCCESS;
 }
 
+// Merges the find of device target i (in local_hashes_reversed) to the shared
+// buffer. No lock needed: each slot is written only with the correct match
+// data, so concurrent writes from multiple backends are idempotent. The reader
+// (main thread) may see a partial write briefly, which is harmless for display
+// purposes.
+static void merge_found(gpu_cruncher_ctx *ctx, uint32_t i) {
+    if (!ctx->cfg) return;
+    uint32_t ih = ctx->snap ? target_snapshot_id(ctx->snap, i) : i;
+    memcpy(ctx->cfg->hashes_reversed + ih * MAX_STR_LENGTH / 4,
+           ctx->local_hashes_reversed + i * MAX_STR_LENGTH / 4,
+           MAX_STR_LENGTH);
+    if (ctx->cfg->targets) target_set_mark_found(ctx->cfg->targets, ih);
+}
+
 cl_int gpu_cruncher_ctx_read_hashes_reversed(gpu_cruncher_ctx *ctx) {
+    if (!ctx->active_num) return CL_SUCCESS;
     cl_int err = clEnqueueReadBuffer(ctx->queue, ctx->mem_hashes_reversed, CL_TRUE, 0,
-        ctx->hashes_num * MAX_STR_LENGTH, ctx->local_hashes_reversed, 0, NULL, NULL);
+        ctx->active_num * MAX_STR_LENGTH, ctx->local_hashes_reversed, 0, NULL, NULL);
     if (err != CL_SUCCESS) return err;
 
-    // Merge to shared buffer. No lock needed: each slot is written only with
-    // the correct match data, so concurrent writes from multiple backends are
-    // idempotent. The reader (main thread) may see a partial write briefly,
-    // which is harmless for display purposes.
-    if (ctx->cfg) {
-        for (uint32_t i = 0; i < ctx->hashes_num; i++) {
-            if (ctx->local_hashes_reversed[i * MAX_STR_LENGTH / 4]) {
-                memcpy(ctx->cfg->hashes_reversed + i * MAX_STR_LENGTH / 4,
-                       ctx->local_hashes_reversed + i * MAX_STR_LENGTH / 4,
-                       MAX_STR_LENGTH);
-            }
-        }
+    for (uint32_t i = 0; i < ctx->active_num; i++) {
+        if (ctx->local_hashes_reversed[i * MAX_STR_LENGTH / 4]) merge_found(ctx, i);
     }
     return CL_SUCCESS;
 }
 
-cl_int gpu_cruncher_ctx_refresh_hashes_reversed(gpu_cruncher_ctx *ctx) {
-    uint64_t cur_millis = current_micros()/1000;
-    if (cur_millis - ctx->last_refresh_hashes_reversed_millis > REFRESH_INTERVAL_HASHES_REVERSED_MILLIS) {
-        ctx->last_refresh_hashes_reversed_millis = cur_millis;
-        return gpu_cruncher_ctx_read_hashes_reversed(ctx);
+cl_int gpu_cruncher_ctx_read_matches(gpu_cruncher_ctx *ctx, cl_mem mem_counters, cl_uint matches) {
+    if (!matches) return CL_SUCCESS;
+    if (matches > GPU_MAX_MATCHES) return gpu_cruncher_ctx_read_hashes_reversed(ctx);  // ring overflowed
+
+    cl_int err = clEnqueueReadBuffer(ctx->transfer_queue, mem_counters, CL_TRUE, GPU_COUNTERS * sizeof(cl_uint),
+                                     matches * sizeof(gpu_match), ctx->matches, 0, NULL, NULL);
+    if (err != CL_SUCCESS) return err;
+    for (cl_uint m = 0; m < matches; m++) {
+        const gpu_match *match = ctx->matches + m;
+        if (match->ih >= ctx->active_num) continue;  // never written, but keep out of bounds
+        memcpy(ctx->local_hashes_reversed + match->ih * MAX_STR_LENGTH / 4, match->str, MAX_STR_LENGTH);
+        merge_found(ctx, match->ih);
     }
+    return CL_SUCCESS;
+}
+
+// Replaces the device targets by the current active set once found targets
+// were dropped from it. Only call while no kernel is in flight and after the
+// matches of the last launch were read (gpu_cruncher_ctx_read_matches), so no
+// find of the old layout is lost; mem_hashes and mem_hashes_reversed are then
+// rewritten compacted.
+cl_int gpu_cruncher_ctx_update_targets(gpu_cruncher_ctx *ctx) {
+    target_set *set = ctx->cfg ? ctx->cfg->targets : NULL;
+    if (!set || set->version == (ctx->snap ? ctx->snap->version : 0)) return CL_SUCCESS;
+    cl_int err = CL_SUCCESS;
 
-    return 0;
+    if (!ctx->active_hashes) {
+        ctx->active_hashes = malloc(ctx->hashes_num * 16);
+        if (!ctx->active_hashes) return CL_OUT_OF_HOST_MEMORY;
+    }
+    target_snapshot *snap = target_set_acquire(set);
+    for (uint32_t i = 0; i < snap->num; i++) {
+        memcpy(ctx->active_hashes + 4 * i, ctx->hashes + 4 * target_snapshot_id(snap, i), 16);
+    }
+    memset(ctx->local_hashes_reversed, 0, ctx->active_num * MAX_STR_LENGTH);
+    if (snap->num) {
+        err = clEnqueueWriteBuffer(ctx->queue, ctx->mem_hashes, CL_TRUE, 0, snap->num * 16,
+                                   ctx->active_hashes, 0, NULL, NULL);
+        err |= clEnqueueWriteBuffer(ctx->queue, ctx->mem_hashes_reversed, CL_TRUE, 0,
+                                    snap->num * MAX_STR_LENGTH, ctx->local_hashes_reversed, 0, NULL, NULL);
+    }
+    if (err != CL_SUCCESS) {
+        target_set_release(set, snap);
+        return err;
+    }
+
+    if (ctx->snap) target_set_release(set, ctx->snap);
+    ctx->snap = snap;
+    ctx->active_num = snap->num;
+    return CL_SUCCESS;
 }
 
 cl_int gpu_cruncher_ctx_free(gpu_cruncher_ctx *ctx) {
+    if (ctx->snap) {
+        target_set_release(ctx->cfg->targets, ctx->snap);
+        ctx->snap = NULL;
+    }
+    free(ctx->active_hashes);
+    ctx->active_hashes = NULL;
     if (ctx->local_hashes_reversed) {
         free(ctx->local_hashes_reversed);
         ctx->local_hashes_reversed = NULL;
@@ -156,16 +635,39 @@ cl_int gpu_cruncher_ctx_free(gpu_cruncher_ctx *ctx) {
     }
 
     cl_int errcode = CL_SUCCESS;
-    errcode |= clReleaseKernel(ctx->kernel);
+    for (uint32_t i = 0; i < ctx->variants_num; i++) {
+        if (ctx->variants[i].kernel) errcode |= clReleaseKernel(ctx->variants[i].kernel);
+        if (ctx->variants[i].kernel_flat) errcode |= clReleaseKernel(ctx->variants[i].kernel_flat);
+        if (ctx->variants[i].program) errcode |= clReleaseProgram(ctx->variants[i].program);
+    }
+    ctx->variants_num = 0;
+    if (ctx->kernel_expand) errcode |= clReleaseKernel(ctx->kernel_expand);
+    for (int i = 0; i < 2; i++) {
+        if (ctx->mem_words[i]) errcode |= clReleaseMemObject(ctx->mem_words[i]);
+    }
+    if (ctx->kernel_enum) errcode |= clReleaseKernel(ctx->kernel_enum);
     for (int i = 0; i < 3; i++) {
+        if (ctx->mem_enum_dict[i]) errcode |= clReleaseMemObject(ctx->mem_enum_dict[i]);
+    }
+    if (ctx->mem_enum_states) errcode |= clReleaseMemObject(ctx->mem_enum_states);
+    free(ctx->enum_states);
+    free(ctx->enum_pending);
+    ctx->enum_states = NULL;
+    ctx->enum_pending = NULL;
+    errcode |= clReleaseKernel(ctx->kernel);
+    errcode |= clReleaseKernel(ctx->kernel_flat);
+    errcode |= clReleaseKernel(ctx->kernel_load);
+    errcode |= clReleaseMemObject(ctx->mem_perms);
+    for (int i = 0; i < 2; i++) {
         errcode |= clReleaseMemObject(ctx->mem_tasks[i]);
-        if (ctx->host_tasks[i]) {
-            free(ctx->host_tasks[i]);
-            ctx->host_tasks[i] = NULL;
-        }
+    }
+    for (int i = 0; i < GPU_MAX_IN_FLIGHT; i++) {
+        if (ctx->mem_uploads[i]) errcode |= clReleaseMemObject(ctx->mem_uploads[i]);
+        errcode |= clReleaseMemObject(ctx->mem_counters[i]);
     }
     errcode |= clReleaseMemObject(ctx->mem_hashes);
     errcode |= clReleaseMemObject(ctx->mem_hashes_reversed);
+    errcode |= clReleaseCommandQueue(ctx->transfer_queue);
     errcode |= clReleaseCommandQueue(ctx->queue);
     errcode |= clReleaseProgram(ctx->program);
     errcode |= clReleaseContext(ctx->cl_ctx);
@@ -193,168 +695,915 @@ void gpu_cruncher_get_stats(gpu_cruncher_ctx *ctx, float* busy_percentage, float
         }
     }
 
+    // nothing finished yet, or a single launch too short for the clock
+    if (max_time_ends <= min_time_start) {
+        *busy_percentage = 0.0f;
+        *anas_per_sec = 0.0f;
+        return;
+    }
     *busy_percentage = (float) micros_in_kernel / (max_time_ends-min_time_start) * 100.0f;
-    *anas_per_sec = (float) (calculated_anas) / ((max_time_ends-min_time_start)/1000000.0f); // this is imprecise
+    if (*busy_percentage > 100.0f) *busy_percentage = 100.0f;  // host-timed launches may overlap
+    *anas_per_sec = (float) (calculated_anas) / ((max_time_ends-min_time_start)/1000000.0f);
 }
 
-// Helper: prepare a task buffer with carry-over and new tasks from input queue
-// Returns number of tasks prepared, 0 if no more work available
-static uint32_t prepare_task_buffer(gpu_cruncher_ctx *ctx, tasks_buffer *buf,
-                                     tasks_buffer **src_buf, uint32_t *src_idx) {
-    int errcode;
-    buf->num_tasks = 0;
-    buf->num_anas = 0;
+void gpu_cruncher_get_stage_stats(gpu_cruncher_ctx *ctx, gpu_stage stage, gpu_stage_stats *stats) {
+    float sorted[TIMES_WINDOW_LENGTH];
+    uint32_t num = ctx->stage_samples[stage] < TIMES_WINDOW_LENGTH ? ctx->stage_samples[stage] : TIMES_WINDOW_LENGTH;
+    memset(stats, 0, sizeof(gpu_stage_stats));
+    stats->samples = num;
+    if (!num) return;
 
-    for (uint32_t i = 0; i < PERMUT_TASKS_IN_KERNEL_TASK; i++) {
-        permut_task *task = buf->permut_tasks + i;
-
-        if (task->i >= task->n) {
-            // Task finished or empty slot - try to fill with new task
-            task->n = 0;
-
-            if (*src_buf == NULL) break;  // permanently out of input
-
-            // Need new source buffer?
-            while (*src_idx >= (*src_buf)->num_tasks) {
-                ctx->consumed_bufs++;
-                tasks_buffers_recycle(ctx->tasks_buffs, *src_buf);
-                errcode = tasks_buffers_get_buffer(ctx->tasks_buffs, src_buf);
-                if (errcode || *src_buf == NULL) {
-                    *src_buf = NULL;
-                    break;
-                }
-                *src_idx = 0;
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < num; i++) {
+        float v = ctx->stage_micros[stage][i];
+        uint32_t j = i;
+        for (; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+        sum += v;
+    }
+    // nearest rank
+    stats->mean_micros = sum / (float) num;
+    stats->p50_micros = sorted[(num * 50 + 99) / 100 - 1];
+    stats->p95_micros = sorted[(num * 95 + 99) / 100 - 1];
+    stats->max_micros = sorted[num - 1];
+}
+
+void gpu_cruncher_print_stage_stats(gpu_cruncher_ctx *ctx) {
+    static const char *names[GPU_STAGES] = {"upload", "load", "kernel", "readback"};
+    char device_name[128] = "";
+    clGetDeviceInfo(ctx->device_id, CL_DEVICE_NAME, sizeof(device_name) - 1, device_name, NULL);
+    printf("  %s, last launches in ms (mean/p50/p95/max):\n", device_name);
+    for (int i = 0; i < GPU_STAGES; i++) {
+        gpu_stage_stats st;
+        gpu_cruncher_get_stage_stats(ctx, (gpu_stage) i, &st);
+        if (!st.samples) continue;
+        printf("    %-8s %8.3f %8.3f %8.3f %8.3f  (%u)\n", names[i], st.mean_micros / 1000.0f,
+               st.p50_micros / 1000.0f, st.p95_micros / 1000.0f, st.max_micros / 1000.0f, st.samples);
+    }
+}
+
+int gpu_share_join(gpu_share *share) {
+    int idx = -1;
+    pthread_mutex_lock(&share->mutex);
+    for (int i = 0; i < GPU_MAX_DEVICES && idx < 0; i++) {
+        if (share->used[i]) continue;
+        share->used[i] = true;
+        share->rates[i] = 0.0f;
+        share->held[i] = 0;
+        idx = i;
+    }
+    pthread_mutex_unlock(&share->mutex);
+    return idx;
+}
+
+void gpu_share_leave(gpu_share *share, int idx) {
+    pthread_mutex_lock(&share->mutex);
+    share->rates[idx] = 0.0f;
+    share->held[idx] = 0;
+    share->used[idx] = false;
+    pthread_mutex_unlock(&share->mutex);
+}
+
+uint64_t gpu_share_launch_anas(gpu_share *share, int idx, uint64_t launch_anas) {
+    float fastest = 0.0f;
+    for (int i = 0; i < GPU_MAX_DEVICES; i++) {
+        if (share->rates[i] > fastest) fastest = share->rates[i];
+    }
+    float rate = share->rates[idx];
+    if (rate <= 0.0f || rate >= fastest) return launch_anas;
+    uint64_t scaled = (uint64_t) ((double) launch_anas * rate / fastest);
+    uint64_t min_anas = launch_anas / GPU_SHARE_MIN_LAUNCH_DIV;
+    return scaled > min_anas ? scaled : min_anas;
+}
+
+uint64_t gpu_share_tail_anas(gpu_share *share, int idx, uint64_t queued_anas) {
+    float rate = share->rates[idx];
+    if (rate <= 0.0f) return UINT64_MAX;
+    double rates = 0.0, left = (double) queued_anas;
+    for (int i = 0; i < GPU_MAX_DEVICES; i++) {
+        if (share->rates[i] > 0.0f) rates += share->rates[i];
+        left += (double) share->held[i];
+    }
+    double part = left * rate / rates - (double) share->held[idx];
+    return part >= 1.0 ? (uint64_t) part : 0;
+}
+
+// Pinned host memory: CL_MEM_ALLOC_HOST_PTR buffers, mapped for as long as
+// they live. Drivers DMA from it directly, where a pageable pointer is first
+// copied into a pinned bounce buffer; devices with host-unified memory (iGPUs,
+// PoCL) read it in place.
+typedef struct {
+    tasks_buffer_allocator allocator;
+    cl_context cl_ctx;
+    cl_command_queue queue;
+} gpu_pinned_pool;
+
+static void *gpu_pinned_alloc(void *ctx, size_t size, void **handle) {
+    gpu_pinned_pool *pool = ctx;
+    cl_int errcode;
+    cl_mem mem = clCreateBuffer(pool->cl_ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, &errcode);
+    if (errcode != CL_SUCCESS) return NULL;
+    void *ptr = clEnqueueMapBuffer(pool->queue, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size,
+                                   0, NULL, NULL, &errcode);
+    if (errcode != CL_SUCCESS) {
+        clReleaseMemObject(mem);
+        return NULL;
+    }
+    *handle = mem;
+    return ptr;
+}
+
+static void gpu_pinned_release(void *ctx, void *ptr, void *handle) {
+    gpu_pinned_pool *pool = ctx;
+    clEnqueueUnmapMemObject(pool->queue, handle, ptr, 0, NULL, NULL);
+    clFinish(pool->queue);
+    clReleaseMemObject(handle);
+}
+
+tasks_buffer_allocator *gpu_pinned_allocator_create(cl_platform_id platform_id, cl_device_id device_id) {
+    gpu_pinned_pool *pool = calloc(1, sizeof(gpu_pinned_pool));
+    if (!pool) return NULL;
+    cl_int errcode;
+    const cl_context_properties ctx_props [] = { CL_CONTEXT_PLATFORM, platform_id, 0, 0 };
+    pool->cl_ctx = clCreateContext(ctx_props, 1, &device_id, NULL, NULL, &errcode);
+    if (errcode == CL_SUCCESS) {
+        cl_queue_properties queue_props[] = {0};
+        pool->queue = clCreateCommandQueueWithProperties(pool->cl_ctx, device_id, queue_props, &errcode);
+        if (errcode != CL_SUCCESS) clReleaseContext(pool->cl_ctx);
+    }
+    if (errcode != CL_SUCCESS) {
+        fprintf(stderr, "failed to set up pinned task buffers (%d), using the heap\n", errcode);
+        free(pool);
+        return NULL;
+    }
+    pool->allocator.alloc = gpu_pinned_alloc;
+    pool->allocator.free = gpu_pinned_release;
+    pool->allocator.ctx = pool;
+    return &pool->allocator;
+}
+
+void gpu_pinned_allocator_free(tasks_buffer_allocator *allocator) {
+    if (!allocator) return;
+    gpu_pinned_pool *pool = allocator->ctx;
+    clReleaseCommandQueue(pool->queue);
+    clReleaseContext(pool->cl_ctx);
+    free(pool);
+}
+
+// Launch plan of one task buffer: `carried` tasks the previous launch may append
+// at its front (at most; the rest of those slots is zeroed, i.e. empty), then
+// the new ones. carried_left bounds the permutations those have left.
+typedef struct {
+    uint32_t carried;
+    uint64_t carried_left;
+    uint32_t iters;
+    uint32_t may_carry;      // tasks this launch may leave unfinished
+    uint64_t may_carry_left; // bound on permutations those have left
+    uint32_t n;              // shared by all tasks, 0 if mixed
+    uint32_t nw;             // max key words of a task, 0 if too long to specialize
+    bool flat;               // one work item per permutation, see permut_flat
+    cl_kernel kernel;
+} gpu_launch;
+
+// Key words holding the candidate string or its 0x80 pad (PERMUT_NW)
+static uint32_t task_key_words(const permut_task *task) {
+    uint32_t str_len = 0;
+    for (int io = 0; task->offsets[io]; io++) {
+        int off = task->offsets[io];
+        off = off < 0 ? -off - 1 : task->a[off - 1] - 1;
+        str_len += (uint32_t) strlen(task->all_strs + off) + 1;  // word + space
+    }
+    return (str_len + 3) / 4;  // the last space is where the pad goes
+}
+
+// Kernel for a launch: the variant specialized on n, nw and the target count,
+// built on first use (and from then on loaded from the binary cache). Falls back
+// to the generic kernel when variants are off, the table is full or a build fails.
+// The hash bucket only has to be >= active_num, which never grows, so a kernel
+// picked while the previous launch runs stays valid.
+static cl_kernel gpu_kernel_for(gpu_cruncher_ctx *ctx, uint32_t n, uint32_t nw, bool flat) {
+    cl_kernel generic = flat ? ctx->kernel_flat : ctx->kernel;
+    if (!ctx->use_variants) return generic;
+    uint32_t hashes = 0;
+    if (ctx->active_num <= GPU_MAX_LOCAL_HASHES) {
+        for (hashes = 1; hashes < ctx->active_num; hashes <<= 1);
+    }
+    if (nw >= 14) nw = 0;  // nothing to fold
+
+    for (uint32_t i = 0; i < ctx->variants_num; i++) {
+        const gpu_kernel_variant *v = ctx->variants + i;
+        if (v->n == n && v->nw == nw && v->hashes == hashes) {
+            cl_kernel kernel = flat ? v->kernel_flat : v->kernel;
+            return kernel ? kernel : generic;
+        }
+    }
+    if (ctx->variants_num == GPU_MAX_KERNEL_VARIANTS) return generic;
+
+    gpu_kernel_variant *v = ctx->variants + ctx->variants_num++;
+    v->n = n;
+    v->nw = nw;
+    v->hashes = hashes;
+    v->program = NULL;
+    v->kernel = NULL;
+    v->kernel_flat = NULL;
+
+    char options[128] = "";
+    int len = 0;
+    if (ctx->use_tiles) len += snprintf(options + len, sizeof(options) - len, "-D PERMUT_TILED ");
+    if (n) len += snprintf(options + len, sizeof(options) - len, "-D PERMUT_N=%u ", n);
+    if (nw) len += snprintf(options + len, sizeof(options) - len, "-D PERMUT_NW=%u ", nw);
+    if (hashes) snprintf(options + len, sizeof(options) - len, "-D PERMUT_HASHES=%u", hashes);
+
+    cl_int errcode = gpu_build_program(ctx, options, &v->program);
+    if (errcode == CL_SUCCESS) {
+        v->kernel = clCreateKernel(v->program, "permut", &errcode);
+        if (errcode != CL_SUCCESS) v->kernel = NULL;
+        v->kernel_flat = clCreateKernel(v->program, "permut_flat", &errcode);
+        if (errcode != CL_SUCCESS) v->kernel_flat = NULL;
+    }
+    if (!v->kernel || !v->kernel_flat) {
+        fprintf(stderr, "failed to build kernel variant '%s', using the generic kernels\n", options);
+    }
+    cl_kernel kernel = flat ? v->kernel_flat : v->kernel;
+    return kernel ? kernel : generic;
+}
+
+// A launch in flight: its plan, the events chaining its commands across the
+// two queues, and the input buffers its preparation used up, which go back to
+// the producers once it is done (and with it every write reading them)
+typedef struct {
+    uint64_t number;
+    gpu_launch plan;
+    uint32_t tasks;            // launch size: carried + new
+    cl_uint counters[GPU_COUNTERS];
+    cl_event upload_start;     // transfer queue: first write of the new tasks
+    cl_event uploaded;         // transfer queue: new tasks staged in mem_uploads
+    cl_event loaded;           // compute queue: staged tasks behind the carry slots (load_tasks)
+    cl_event kernel;
+    cl_event done;             // compute queue: counters read back
+    uint64_t enqueued;         // host micros
+    tasks_buffer *retired[TASKS_BUFFERS_SIZE];
+    uint32_t retired_num;
+} gpu_slot;
+
+static void recycle_retired(gpu_cruncher_ctx *ctx, gpu_slot *slot) {
+    for (uint32_t i = 0; i < slot->retired_num; i++) {
+        tasks_buffers_recycle(ctx->tasks_buffs, slot->retired[i]);
+    }
+    slot->retired_num = 0;
+}
+
+static cl_int retire_buffer(gpu_cruncher_ctx *ctx, gpu_slot *slot, tasks_buffer *buf) {
+    if (slot->retired_num == TASKS_BUFFERS_SIZE) {
+        cl_int errcode = clFinish(ctx->transfer_queue);
+        ret_iferr(errcode, "failed to wait for uploads");
+        recycle_retired(ctx, slot);
+    }
+    ctx->consumed_bufs++;
+    slot->retired[slot->retired_num++] = buf;
+    return CL_SUCCESS;
+}
+
+// Uploads tasks [from, from+num) of buf to mem_uploads[s] from slot `at` on,
+// as they are queued (compact ones stay compact until expand_tasks)
+static cl_int upload_tasks(gpu_cruncher_ctx *ctx, uint32_t s, gpu_slot *slot, uint32_t at,
+                           const tasks_buffer *buf, uint32_t from, uint32_t num) {
+    if (!num) return CL_SUCCESS;
+    cl_event *event = slot->upload_start ? NULL : &slot->upload_start;
+    size_t task_size = buf->compact_tasks ? sizeof(compact_task) : sizeof(permut_task);
+    const void *src = buf->compact_tasks ? (const void *) (buf->compact_tasks + from)
+                                         : (const void *) (buf->permut_tasks + from);
+    cl_int errcode = clEnqueueWriteBuffer(ctx->transfer_queue, ctx->mem_uploads[s], CL_FALSE,
+                                          at * task_size, num * task_size, src, 0, NULL, event);
+    ret_iferr(errcode, "failed to upload tasks");
+    return CL_SUCCESS;
+}
+
+// Helper: the next input buffer, only this device's part of what is left once
+// the queue is closed and it shares it with other devices (gpu_share)
+static int next_buffer(gpu_cruncher_ctx *ctx, tasks_buffer **buf) {
+    uint64_t max_anas = UINT64_MAX;
+    if (ctx->share) {
+        ctx->share->held[ctx->share_idx] = ctx->taken_anas > ctx->consumed_anas ?
+                                           ctx->taken_anas - ctx->consumed_anas : 0;
+        max_anas = gpu_share_tail_anas(ctx->share, ctx->share_idx, ctx->tasks_buffs->queued_anas);
+        if (!max_anas && ctx->tasks_buffs->is_closed) {
+            *buf = NULL;  // holds its part already, the others take the rest
+            return 0;
+        }
+    }
+    int errcode = tasks_buffers_get_part(ctx->tasks_buffs, buf, max_anas);
+    if (!errcode && *buf) ctx->taken_anas += (*buf)->num_anas;
+    return errcode;
+}
+
+// Helper: takes new tasks from the input queue for the launch in slot s and
+// uploads them to mem_uploads[s] on the transfer queue, one write per run of
+// consecutive tasks straight from the input buffer (pinned when main.c set up
+// opencl_tasks_buffer_allocator_create), so they are not staged on the host.
+// Launches are sized from N: every task gets iters = the most permutations any
+// of them has left (capped at ctx->tune.iters), and tasks are only added while
+// tasks * iters stays within the launch budget: tune.tasks x tune.iters, at
+// most MAX_ANAS_IN_KERNEL_LAUNCH, scaled down on the slower devices of a share.
+// With kernel variants, a launch also ends where N changes (input buffers from
+// the CPU producers are per N, so this rarely splits one).
+// Sets slot->tasks to the launch size (carried + new tasks), 0 if no more work available
+static cl_int prepare_launch(gpu_cruncher_ctx *ctx, uint32_t s, gpu_slot *slot,
+                             tasks_buffer **src_buf, uint32_t *src_idx) {
+    cl_int errcode;
+    gpu_launch *launch = &slot->plan;
+    uint64_t max_left = launch->carried ? launch->carried_left : 0;
+    uint32_t n = launch->carried ? launch->n : 0;    // carried ones inherit n and nw
+    uint32_t nw = launch->carried ? launch->nw : 0;  // of the launch they come from
+    bool same_n = !launch->carried || n;
+    bool fresh = !launch->carried;  // no task has started permuting yet
+    bool distinct = true;           // no multiset task, permut_flat's n! rows cover every task
+    uint32_t num_new = 0;
+    uint32_t over_iters = 0;         // new tasks with more than ctx->tune.iters left
+    uint32_t run_from = *src_idx, run_num = 0;
+    uint64_t budget = (uint64_t) ctx->tune.tasks * ctx->tune.iters;
+    if (budget > MAX_ANAS_IN_KERNEL_LAUNCH) budget = MAX_ANAS_IN_KERNEL_LAUNCH;
+    if (ctx->share) budget = gpu_share_launch_anas(ctx->share, ctx->share_idx, budget);
+
+    while (*src_buf && launch->carried + num_new < ctx->tune.tasks) {
+        // Need new source buffer?
+        if (*src_idx >= (*src_buf)->num_tasks) {
+            errcode = upload_tasks(ctx, s, slot, num_new - run_num, *src_buf, run_from, run_num);
+            if (errcode == CL_SUCCESS) errcode = retire_buffer(ctx, slot, *src_buf);
+            if (errcode != CL_SUCCESS) return errcode;
+            errcode = next_buffer(ctx, src_buf);
+            if (errcode || *src_buf == NULL) {
+                *src_buf = NULL;
+                run_num = 0;
+                break;
+            }
+            *src_idx = run_from = 0;
+            run_num = 0;
+            continue;
+        }
+
+        const permut_task *next = NULL;
+        const compact_task *next_compact = NULL;
+        uint32_t next_n;
+        uint64_t left;
+        if ((*src_buf)->compact_tasks) {
+            next_compact = (*src_buf)->compact_tasks + *src_idx;
+            next_n = next_compact->n;
+            left = compact_task_perms(next_compact);
+        } else {
+            next = (*src_buf)->permut_tasks + *src_idx;
+            next_n = next->n;
+            left = next->i < next->n ? permut_task_perms(next) - next->iters_done : 0;
+        }
+        if (!next_n || (next && next->i >= next->n)) {
+            // nothing to hash, ends the run
+            errcode = upload_tasks(ctx, s, slot, num_new - run_num, *src_buf, run_from, run_num);
+            if (errcode != CL_SUCCESS) return errcode;
+            run_from = ++(*src_idx);
+            run_num = 0;
+            continue;
+        }
+
+        uint64_t task_iters = left > max_left ? left : max_left;
+        if (task_iters > ctx->tune.iters) task_iters = ctx->tune.iters;
+        uint32_t tasks = launch->carried + num_new;
+        if (tasks && (uint64_t)(tasks + 1) * task_iters > budget) {
+            break;  // over budget, stays queued for a later launch
+        }
+
+        if (tasks && next_n != n) {
+            if (ctx->use_variants) break;  // N-homogeneous launches can run a PERMUT_N variant
+            same_n = false;
+        }
+        if (!tasks) n = next_n;
+        if (next && (next->i || next->iters_done)) fresh = false;  // compact ones never started
+        if (next ? next->multiset : next_compact->multiset) distinct = false;
+        uint32_t task_nw = next ? task_key_words(next) : word_table_key_words(ctx->tasks_buffs->words, next_compact);
+        if (task_nw > nw) nw = task_nw;
+
+        num_new++;
+        run_num++;
+        (*src_idx)++;
+        if (left > max_left) max_left = left;
+        if (left > ctx->tune.iters) over_iters++;
+    }
+    if (run_num) {
+        errcode = upload_tasks(ctx, s, slot, num_new - run_num, *src_buf, run_from, run_num);
+        if (errcode != CL_SUCCESS) return errcode;
+    }
+    if (num_new) {
+        errcode = clEnqueueMarkerWithWaitList(ctx->transfer_queue, 0, NULL, &slot->uploaded);
+        ret_iferr(errcode, "failed to mark uploads");
+    }
+
+    launch->n = same_n ? n : 0;
+    launch->nw = nw;
+    launch->flat = ctx->use_flat && fresh && distinct && launch->n && launch->n <= GPU_FLAT_MAX_N;
+    launch->kernel = launch->carried + num_new ? gpu_kernel_for(ctx, launch->n, launch->nw, launch->flat) : NULL;
+
+    // Only tasks with more than ctx->tune.iters left can outlast a launch, and
+    // when there are any, iters is that cap and max_left bounds what they keep
+    launch->iters = max_left > ctx->tune.iters ? ctx->tune.iters : (uint32_t)max_left;
+    launch->may_carry = over_iters;
+    if (launch->carried && launch->carried_left > launch->iters) launch->may_carry += launch->carried;
+    launch->may_carry_left = launch->may_carry ? max_left - launch->iters : 0;
+
+    slot->tasks = launch->carried + num_new;
+    return CL_SUCCESS;
+}
+
+// Writes the num tasks staged in src (compact ones expanded) to slots [base,
+// base + slots) of mem_tasks, in its layout, and clears the slots after them
+static cl_int load_tasks(gpu_cruncher_ctx *ctx, cl_mem src, cl_mem mem_tasks, cl_uint base, cl_uint num,
+                         size_t slots, const cl_event *wait, cl_event *event) {
+    cl_kernel kernel = num && ctx->kernel_expand ? ctx->kernel_expand : ctx->kernel_load;
+    cl_uint arg = 0;
+    cl_int errcode = clSetKernelArg(kernel, arg++, sizeof(cl_mem), &src);
+    if (kernel == ctx->kernel_expand) {
+        errcode |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &ctx->mem_words[0]);
+        errcode |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &ctx->mem_words[1]);
+    }
+    errcode |= clSetKernelArg(kernel, arg++, sizeof(base), &base);
+    errcode |= clSetKernelArg(kernel, arg++, sizeof(num), &num);
+    errcode |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &mem_tasks);
+    ret_iferr(errcode, "failed to set load_tasks args");
+    errcode = clEnqueueNDRangeKernel(ctx->queue, kernel, 1, NULL, &slots, NULL, wait ? 1 : 0, wait, event);
+    ret_iferr(errcode, "failed to load tasks");
+    return CL_SUCCESS;
+}
+
+// Launch number k in slot s, carrying over what `last` may leave unfinished:
+// the new tasks go up on the transfer queue while earlier launches run, the
+// compute queue loads them behind the carry slots once staged (load_tasks),
+// runs the kernel and reads its counters back.
+// slot->tasks is 0 when nothing is left.
+static cl_int enqueue_launch(gpu_cruncher_ctx *ctx, uint32_t s, gpu_slot *slot, uint64_t k,
+                             const gpu_launch *last, tasks_buffer **src_buf, uint32_t *src_idx) {
+    const cl_uint zero = 0;
+    cl_int errcode;
+    cl_mem mem_tasks = ctx->mem_tasks[k & 1], mem_next = ctx->mem_tasks[(k + 1) & 1];
+    gpu_launch *launch = &slot->plan;
+    slot->number = k;
+    launch->carried = last->may_carry;
+    launch->carried_left = last->may_carry_left;
+    launch->n = last->n;
+    launch->nw = last->nw;
+    errcode = prepare_launch(ctx, s, slot, src_buf, src_idx);
+    if (errcode != CL_SUCCESS || !slot->tasks) return errcode;
+
+    const uint32_t launch_tasks = slot->tasks, num_new = launch_tasks - launch->carried;
+
+    // Reserve the front of the next buffer for what this launch may leave
+    // unfinished: empty tasks, the kernel overwrites as many as it carries over
+    if (launch->may_carry) {
+        errcode = clEnqueueFillBuffer(ctx->queue, mem_next, &zero, sizeof(zero), 0,
+                                      tasks_bytes(ctx, launch->may_carry), 0, NULL, NULL);
+        ret_iferr(errcode, "failed to reserve carry-over tasks");
+    }
+    errcode = clEnqueueFillBuffer(ctx->queue, ctx->mem_counters[s], &zero, sizeof(zero), 0,
+                                  sizeof(slot->counters), 0, NULL, NULL);
+    ret_iferr(errcode, "failed to reset counters");
+
+    cl_kernel kernel = launch->kernel;
+    size_t global_size = launch_tasks;
+    if (launch->flat) {
+        const cl_uint base = perms_base(launch->n);
+        const cl_uint perms_num = (cl_uint) fact(launch->n);
+        errcode = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_tasks);
+        errcode |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &ctx->mem_perms);
+        errcode |= clSetKernelArg(kernel, 2, sizeof(base), &base);
+        errcode |= clSetKernelArg(kernel, 3, sizeof(perms_num), &perms_num);
+        errcode |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &ctx->mem_hashes);
+        errcode |= clSetKernelArg(kernel, 5, sizeof(ctx->active_num), &ctx->active_num);
+        errcode |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &ctx->mem_hashes_reversed);
+        errcode |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &ctx->mem_counters[s]);
+        global_size *= perms_num;
+    } else {
+        errcode = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_tasks);
+        errcode |= clSetKernelArg(kernel, 1, sizeof(launch->iters), &launch->iters);
+        errcode |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &ctx->mem_hashes);
+        errcode |= clSetKernelArg(kernel, 3, sizeof(ctx->active_num), &ctx->active_num);
+        errcode |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &ctx->mem_hashes_reversed);
+        errcode |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem_next);
+        errcode |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &ctx->mem_counters[s]);
+    }
+    ret_iferr(errcode, "failed to set kernel args");
+
+    // the flat kernel has no empty slots to pad with, it keeps the runtime's choice
+    size_t local_size;
+    const size_t *local = launch->flat ? NULL : gpu_local_size(ctx, &global_size, &local_size);
+
+    // the new tasks go in behind the carried ones once staged, and the slots
+    // up to the padded size are cleared
+    const uint32_t slots_end = launch->flat ? launch_tasks : (uint32_t) global_size;
+    if (slots_end > launch->carried) {
+        errcode = load_tasks(ctx, ctx->mem_uploads[s], mem_tasks, launch->carried, num_new,
+                             slots_end - launch->carried, num_new ? &slot->uploaded : NULL, &slot->loaded);
+        if (errcode != CL_SUCCESS) return errcode;
+    }
+
+    errcode = clEnqueueNDRangeKernel(ctx->queue, kernel, 1, NULL, &global_size, local, 0, NULL,
+                                     &slot->kernel);
+    ret_iferr(errcode, "failed to enqueue kernel");
+    errcode = clEnqueueReadBuffer(ctx->queue, ctx->mem_counters[s], CL_FALSE, 0, sizeof(slot->counters),
+                                  slot->counters, 0, NULL, &slot->done);
+    ret_iferr(errcode, "failed to start read counters");
+    errcode = clFlush(ctx->transfer_queue);
+    errcode |= clFlush(ctx->queue);
+    ret_iferr(errcode, "failed to flush queues");
+    slot->enqueued = current_micros();
+    return CL_SUCCESS;
+}
+
+// Device time from the start of command `first` to the end of `last`, in ns
+static bool device_span(cl_event first, cl_event last, cl_ulong *start, cl_ulong *end) {
+    if (!first || !last) return false;
+    if (clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START, sizeof(*start), start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END, sizeof(*end), end, NULL) != CL_SUCCESS) return false;
+    if (*end < *start) *end = *start;
+    return true;
+}
+
+static void record_stage(gpu_cruncher_ctx *ctx, gpu_stage stage, cl_event first, cl_event last) {
+    cl_ulong start, end;
+    if (!device_span(first, last, &start, &end)) return;
+    ctx->stage_micros[stage][ctx->stage_samples[stage] % TIMES_WINDOW_LENGTH] = (float) (end - start) / 1000.0f;
+    ctx->stage_samples[stage]++;
+}
+
+// Adds a launch to the window of gpu_cruncher_get_stats, its kernels running
+// from `first` to `last`; host_start and host_end stand in when the device
+// has no times for them
+static void record_launch(gpu_cruncher_ctx *ctx, cl_event first, cl_event last, uint64_t anas,
+                          uint64_t host_start, uint64_t host_end) {
+    cl_ulong start, end;
+    if (device_span(first, last, &start, &end)) {
+        host_start = start / 1000;
+        host_end = end / 1000;
+        record_stage(ctx, GPU_STAGE_KERNEL, first, last);
+    }
+    ctx->task_times_starts[ctx->times_idx] = host_start;
+    ctx->task_times_ends[ctx->times_idx] = host_end;
+    ctx->task_calculated_anas[ctx->times_idx] = anas;
+    ctx->times_idx = (ctx->times_idx + 1) % TIMES_WINDOW_LENGTH;
+}
+
+// One command of a launch in the trace: from the start of `first` to the end of `last`
+static void trace_command(gpu_cruncher_ctx *ctx, const char *name, uint64_t k, int queue,
+                          cl_event first, cl_event last) {
+    cl_ulong start, end;
+    if (!device_span(first, last, &start, &end)) return;
+    if (!ctx->trace_t0) ctx->trace_t0 = start;
+    fprintf(ctx->trace, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"launch\":%llu}}", name, queue,
+            ((double) start - (double) ctx->trace_t0) / 1000.0, (double) (end - start) / 1000.0,
+            (unsigned long long) k);
+}
+
+static void trace_open(gpu_cruncher_ctx *ctx) {
+    static volatile uint32_t trace_files = 0;
+    const char *prefix = getenv("ANABRUTE_OPENCL_TRACE");
+    if (!prefix || !*prefix) return;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%u.json", prefix, __sync_fetch_and_add(&trace_files, 1));
+    ctx->trace = fopen(path, "w");
+    if (!ctx->trace) {
+        fprintf(stderr, "failed to open trace file %s\n", path);
+        return;
+    }
+    ctx->trace_t0 = 0;
+    fprintf(ctx->trace, "{\"traceEvents\":[\n"
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"transfer queue\"}},\n"
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":2,\"args\":{\"name\":\"compute queue\"}}");
+}
+
+static void trace_close(gpu_cruncher_ctx *ctx) {
+    if (!ctx->trace) return;
+    fprintf(ctx->trace, "\n]}\n");
+    fclose(ctx->trace);
+    ctx->trace = NULL;
+}
+
+static void release_event(cl_event *event) {
+    if (*event) clReleaseEvent(*event);
+    *event = NULL;
+}
+
+// Waits for the launch in slot s, merges its matches and gives its input
+// buffers back
+static cl_int finish_launch(gpu_cruncher_ctx *ctx, uint32_t s, gpu_slot *slot, uint64_t *last_end) {
+    cl_int errcode = clWaitForEvents(1, &slot->done);
+    ret_iferr(errcode, "failed to wait for kernel");
+
+    // without device times: launches run back to back, one starts when it
+    // was queued or when the one before it ended
+    uint64_t end_time = current_micros();
+    uint64_t kernel_num_anas = slot->counters[1];
+    ctx->consumed_anas += kernel_num_anas;
+    record_launch(ctx, slot->kernel, slot->kernel, kernel_num_anas,
+                  slot->enqueued > *last_end ? slot->enqueued : *last_end, end_time);
+    record_stage(ctx, GPU_STAGE_UPLOAD, slot->upload_start, slot->uploaded);
+    record_stage(ctx, GPU_STAGE_LOAD, slot->loaded, slot->loaded);
+    record_stage(ctx, GPU_STAGE_READBACK, slot->done, slot->done);
+    *last_end = end_time;
+    if (ctx->share) {
+        float busy, anas_per_sec;
+        gpu_cruncher_get_stats(ctx, &busy, &anas_per_sec);
+        ctx->share->rates[ctx->share_idx] = anas_per_sec;
+        ctx->share->held[ctx->share_idx] = ctx->taken_anas > ctx->consumed_anas ?
+                                           ctx->taken_anas - ctx->consumed_anas : 0;
+    }
+
+    errcode = gpu_cruncher_ctx_read_matches(ctx, ctx->mem_counters[s], slot->counters[2]);
+    ret_iferr(errcode, "failed to read matches");
+
+    if (ctx->trace) {
+        trace_command(ctx, "upload", slot->number, 1, slot->upload_start, slot->uploaded);
+        trace_command(ctx, "load", slot->number, 2, slot->loaded, slot->loaded);
+        trace_command(ctx, slot->plan.flat ? "permut_flat" : "permut", slot->number, 2, slot->kernel, slot->kernel);
+        trace_command(ctx, "counters", slot->number, 2, slot->done, slot->done);
+    }
+    release_event(&slot->upload_start);
+    release_event(&slot->uploaded);
+    release_event(&slot->loaded);
+    release_event(&slot->kernel);
+    release_event(&slot->done);
+    recycle_retired(ctx, slot);
+    return CL_SUCCESS;
+}
+
+static bool targets_changed(gpu_cruncher_ctx *ctx) {
+    target_set *set = ctx->cfg ? ctx->cfg->targets : NULL;
+    return set && set->version != (ctx->snap ? ctx->snap->version : 0);
+}
+
+// On-device enumeration: each round the enum_tasks kernel advances up to
+// GPU_ENUM_STATES subtrees by at most GPU_ENUM_TASKS_PER_STATE tasks and their
+// share of the permutations budget, written densely to mem_tasks[0], and permut
+// hashes all of them; n <= MAX_WORD_LENGTH, so nothing is carried over. The
+// subtrees are read back after every round to drop the finished ones and top
+// up from the L0 words of cfg->enum_l0_counter, which all OpenCL devices
+// share. With collect set, the tasks are read back and appended to *collect
+// instead of being hashed.
+static cl_int gpu_enum_run(gpu_cruncher_ctx *ctx, permut_task **collect, uint32_t *collect_num) {
+    const enum_dict *d = ctx->cfg->enum_dict;
+    const uint32_t l0_num = enum_dict_l0_num(d);
+    if (!l0_num) return CL_SUCCESS;
+    cl_int errcode;
+
+    // the dictionary goes up once
+    ctx->mem_enum_dict[0] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                           d->entries_num * sizeof(enum_entry), d->entries, &errcode);
+    ret_iferr(errcode, "failed to create enum dict entries");
+    ctx->mem_enum_dict[1] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                           sizeof(d->bucket), (void *) d->bucket, &errcode);
+    ret_iferr(errcode, "failed to create enum dict buckets");
+    ctx->mem_enum_dict[2] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                           d->strings_size, d->strings, &errcode);
+    ret_iferr(errcode, "failed to create enum dict strings");
+    ctx->mem_enum_states = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_WRITE, GPU_ENUM_STATES * sizeof(enum_state),
+                                          NULL, &errcode);
+    ret_iferr(errcode, "failed to create enum states");
+    ctx->kernel_enum = clCreateKernel(ctx->program, "enum_tasks", &errcode);
+    ret_iferr(errcode, "failed to create enum_tasks kernel");
+    ctx->enum_states = malloc(GPU_ENUM_STATES * sizeof(enum_state));
+    ret_iferr(!ctx->enum_states, "failed to malloc enum states");
+
+    // key words of the longest candidate: all letters, a space after each word
+    const uint32_t nw = (d->seed.length + MAX_WORD_LENGTH + 3) / 4;
+    const cl_uint tasks_per_state = GPU_ENUM_TASKS_PER_STATE;
+    const cl_uint iters = MAX_ITERS_IN_KERNEL_TASK;
+    const cl_uint zero = 0;
+    cl_uint counters[GPU_COUNTERS];
+    uint32_t active = 0, pending_num = 0, pending_idx = 0;
+
+    while (!ctx->tasks_buffs->is_cancelled) {
+        while (active < GPU_ENUM_STATES) {
+            if (pending_idx == pending_num) {
+                uint32_t l0 = __sync_fetch_and_add(ctx->cfg->enum_l0_counter, 1);
+                if (l0 >= l0_num) break;
+                pending_num = pending_idx = 0;
+                errcode = enum_dict_prefixes(d, l0, &ctx->enum_pending, &pending_num, &ctx->enum_pending_cap);
+                ret_iferr(errcode, "failed to expand L0 word");
+                continue;
             }
+            ctx->enum_states[active++] = ctx->enum_pending[pending_idx++];
+        }
+        if (!active) break;
 
-            if (*src_buf == NULL) break;
+        // >= 8! for up to GPU_ENUM_STATES subtrees: the first task each one
+        // always writes still fits its share
+        const cl_uint anas_per_state = MAX_ANAS_IN_KERNEL_LAUNCH / active;
+        uint64_t kernel_start_time = current_micros();
+        cl_event uploaded = NULL, enumerated = NULL, hashed = NULL, read_back = NULL;
+        errcode = clEnqueueWriteBuffer(ctx->queue, ctx->mem_enum_states, CL_FALSE, 0, active * sizeof(enum_state),
+                                       ctx->enum_states, 0, NULL, &uploaded);
+        errcode |= clEnqueueFillBuffer(ctx->queue, ctx->mem_counters[0], &zero, sizeof(zero), 0,
+                                       sizeof(counters), 0, NULL, NULL);
+        errcode |= clEnqueueFillBuffer(ctx->queue, ctx->mem_counters[1], &zero, sizeof(zero), 0,
+                                       sizeof(counters), 0, NULL, NULL);
+        ret_iferr(errcode, "failed to upload enum states");
 
-            memcpy(task, (*src_buf)->permut_tasks + (*src_idx)++, sizeof(permut_task));
+        errcode = clSetKernelArg(ctx->kernel_enum, 0, sizeof(cl_mem), &ctx->mem_enum_dict[0]);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 1, sizeof(cl_mem), &ctx->mem_enum_dict[1]);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 2, sizeof(cl_mem), &ctx->mem_enum_dict[2]);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 3, sizeof(cl_mem), &ctx->mem_enum_states);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 4, sizeof(tasks_per_state), &tasks_per_state);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 5, sizeof(anas_per_state), &anas_per_state);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 6, sizeof(cl_mem), &ctx->mem_tasks[0]);
+        errcode |= clSetKernelArg(ctx->kernel_enum, 7, sizeof(cl_mem), &ctx->mem_counters[0]);
+        ret_iferr(errcode, "failed to set enum_tasks args");
+
+        size_t global_size = active;
+        errcode = clEnqueueNDRangeKernel(ctx->queue, ctx->kernel_enum, 1, NULL, &global_size, NULL, 0, NULL,
+                                         &enumerated);
+        ret_iferr(errcode, "failed to enqueue enum_tasks");
+        errcode = clEnqueueReadBuffer(ctx->queue, ctx->mem_counters[0], CL_TRUE, 0, sizeof(cl_uint),
+                                      counters, 0, NULL, NULL);
+        ret_iferr(errcode, "failed to read enum_tasks counters");
+        errcode = clEnqueueReadBuffer(ctx->queue, ctx->mem_enum_states, CL_FALSE, 0, active * sizeof(enum_state),
+                                      ctx->enum_states, 0, NULL, NULL);
+        ret_iferr(errcode, "failed to start read enum states");
+
+        counters[1] = counters[2] = 0;
+        if (collect && counters[0]) {
+            permut_task *grown = realloc(*collect, (*collect_num + counters[0]) * sizeof(permut_task));
+            ret_iferr(!grown, "failed to grow collected tasks");
+            *collect = grown;
+            uint32_t *words = malloc(tasks_bytes(ctx, counters[0]));
+            ret_iferr(!words, "failed to malloc collected tasks");
+            errcode = clEnqueueReadBuffer(ctx->queue, ctx->mem_tasks[0], CL_TRUE, 0, tasks_bytes(ctx, counters[0]),
+                                          words, 0, NULL, NULL);
+            for (uint32_t t = 0; errcode == CL_SUCCESS && t < counters[0]; t++) {
+                uint32_t *task = (uint32_t *) (*collect + *collect_num + t);
+                for (uint32_t xi = 0; xi < GPU_TASK_WORDS; xi++) task[xi] = words[task_word(ctx, t, xi)];
+            }
+            free(words);
+            ret_iferr(errcode, "failed to read tasks");
+            *collect_num += counters[0];
+        } else if (counters[0]) {
+            cl_kernel kernel = gpu_kernel_for(ctx, 0, nw, false);
+            errcode = clSetKernelArg(kernel, 0, sizeof(cl_mem), &ctx->mem_tasks[0]);
+            errcode |= clSetKernelArg(kernel, 1, sizeof(iters), &iters);
+            errcode |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &ctx->mem_hashes);
+            errcode |= clSetKernelArg(kernel, 3, sizeof(ctx->active_num), &ctx->active_num);
+            errcode |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &ctx->mem_hashes_reversed);
+            errcode |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &ctx->mem_tasks[1]);  // never written
+            errcode |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &ctx->mem_counters[1]);
+            ret_iferr(errcode, "failed to set kernel args");
+
+            global_size = counters[0];
+            size_t local_size;
+            const size_t *local = gpu_local_size(ctx, &global_size, &local_size);
+            if (global_size > counters[0]) {
+                errcode = load_tasks(ctx, ctx->mem_uploads[0], ctx->mem_tasks[0], counters[0], 0,
+                                     global_size - counters[0], NULL, NULL);
+                if (errcode != CL_SUCCESS) return errcode;
+            }
+            errcode = clEnqueueNDRangeKernel(ctx->queue, kernel, 1, NULL, &global_size, local, 0, NULL, &hashed);
+            ret_iferr(errcode, "failed to enqueue kernel");
+            errcode = clEnqueueReadBuffer(ctx->queue, ctx->mem_counters[1], CL_FALSE, 0, sizeof(counters),
+                                          counters, 0, NULL, &read_back);
+            ret_iferr(errcode, "failed to start read counters");
         }
+        errcode = clFinish(ctx->queue);
+        ret_iferr(errcode, "failed to wait for kernel");
 
-        if (task->i < task->n) {
-            buf->num_tasks = i + 1;
-            uint64_t iters_left = fact(task->n) - task->iters_done;
-            buf->num_anas += iters_left > MAX_ITERS_IN_KERNEL_TASK ? MAX_ITERS_IN_KERNEL_TASK : iters_left;
+        uint64_t end_time = current_micros();
+        ctx->consumed_bufs++;
+        ctx->consumed_anas += counters[1];
+        record_launch(ctx, enumerated, hashed ? hashed : enumerated, counters[1], kernel_start_time, end_time);
+        record_stage(ctx, GPU_STAGE_UPLOAD, uploaded, uploaded);
+        record_stage(ctx, GPU_STAGE_READBACK, read_back, read_back);
+        release_event(&uploaded);
+        release_event(&enumerated);
+        release_event(&hashed);
+        release_event(&read_back);
+
+        errcode = gpu_cruncher_ctx_read_matches(ctx, ctx->mem_counters[1], counters[2]);
+        ret_iferr(errcode, "failed to read matches");
+        errcode = gpu_cruncher_ctx_update_targets(ctx);
+        ret_iferr(errcode, "failed to update targets");
+
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < active; i++) {
+            if (ctx->enum_states[i].status != ENUM_DONE) ctx->enum_states[kept++] = ctx->enum_states[i];
         }
+        active = kept;
     }
 
-    return buf->num_tasks;
+    return CL_SUCCESS;
+}
+
+cl_int gpu_cruncher_ctx_collect_enum_tasks(gpu_cruncher_ctx *ctx, permut_task **tasks, uint32_t *tasks_num) {
+    *tasks = NULL;
+    *tasks_num = 0;
+    return gpu_enum_run(ctx, tasks, tasks_num);
 }
 
 void* run_gpu_cruncher_thread(void *ptr) {
     gpu_cruncher_ctx *ctx = ptr;
     cl_int errcode;
 
+    // Targets found before this cruncher started are not uploaded again
+    errcode = gpu_cruncher_ctx_update_targets(ctx);
+    ret_iferr(errcode, "failed to update targets");
+
+    if (ctx->cfg && ctx->cfg->enum_dict) {
+        errcode = gpu_enum_run(ctx, NULL, NULL);
+        ret_iferr(errcode, "failed to enumerate tasks on the device");
+        ctx->is_running = false;
+        return NULL;
+    }
+
+    // Queues of compact tasks: the word table goes up once
+    const word_table *words = ctx->tasks_buffs->words;
+    if (words) {
+        ctx->mem_words[0] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                           words->num * sizeof(uint32_t), words->entries, &errcode);
+        ret_iferr(errcode, "failed to create word table entries");
+        ctx->mem_words[1] = clCreateBuffer(ctx->cl_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                           words->bytes_size ? words->bytes_size : 1, words->bytes, &errcode);
+        ret_iferr(errcode, "failed to create word table bytes");
+        ctx->kernel_expand = clCreateKernel(ctx->program, "expand_tasks", &errcode);
+        ret_iferr(errcode, "failed to create expand_tasks kernel");
+    }
+
     // Input source
     tasks_buffer *src_buf;
-    errcode = tasks_buffers_get_buffer(ctx->tasks_buffs, &src_buf);
+    errcode = next_buffer(ctx, &src_buf);
     ret_iferr(errcode, "failed to get first buffer");
     uint32_t src_idx = 0;
+    trace_open(ctx);
 
-    // Triple-buffer state:
-    // - gpu_buf: kernel currently running
-    // - read_buf: async read in progress (from previous kernel)
-    // - prep_buf: buffer ready to be prepared (read completed)
-    int gpu_buf = -1;   // no kernel running yet
-    int read_buf = -1;  // no read in progress yet
-    int next_buf = 0;   // next buffer to launch
-
-    cl_event kernel_event = NULL;
-    cl_event read_event = NULL;
-    uint64_t kernel_start_time = 0;
-    uint64_t kernel_num_anas = 0;
-    uint32_t buf_tasks[3] = {0, 0, 0};
-
-    // Bootstrap: prepare all 3 buffers
-    buf_tasks[0] = prepare_task_buffer(ctx, ctx->host_tasks[0], &src_buf, &src_idx);
-    if (buf_tasks[0] == 0) goto done;
-    buf_tasks[1] = prepare_task_buffer(ctx, ctx->host_tasks[1], &src_buf, &src_idx);
-    buf_tasks[2] = prepare_task_buffer(ctx, ctx->host_tasks[2], &src_buf, &src_idx);
-    // buf_tasks[1] and [2] may be 0, that's fine
+    // Launch k runs on mem_tasks[k&1] and appends its unfinished tasks to the
+    // front of mem_tasks[(k+1)&1], so tasks never travel back to the host; only
+    // the counters of each launch are read, and its match ring when it found
+    // something. Up to ctx->in_flight launches are queued at once, each in its
+    // own slot: while the oldest runs, the new tasks of the next ones go up
+    // on the transfer queue and the host prepares more or merges results.
+    gpu_slot slots[GPU_MAX_IN_FLIGHT];
+    memset(slots, 0, sizeof(slots));
+    gpu_launch last = {0};            // the latest launch queued, carries over into the next
+    uint64_t queued = 0, finished = 0;
+    uint64_t last_end = 0;
+    bool exhausted = false;
 
     while (1) {
-        int cur = next_buf;
-
-        // Phase 1: If we have a pending read, wait for it to complete
-        if (read_buf >= 0) {
-            errcode = clWaitForEvents(1, &read_event);
-            ret_iferr(errcode, "failed to wait for read");
-            clReleaseEvent(read_event);
-            read_event = NULL;
-
-            // Prepare read_buf (its data is now available)
-            buf_tasks[read_buf] = prepare_task_buffer(ctx, ctx->host_tasks[read_buf], &src_buf, &src_idx);
-            read_buf = -1;
-        }
-
-        // Phase 2: Upload current buffer (async, while kernel may still run)
-        if (buf_tasks[cur] > 0) {
-            errcode = clEnqueueWriteBuffer(ctx->queue, ctx->mem_tasks[cur], CL_FALSE, 0,
-                                           buf_tasks[cur] * sizeof(permut_task),
-                                           ctx->host_tasks[cur]->permut_tasks, 0, NULL, NULL);
-            ret_iferr(errcode, "failed to upload tasks");
-        }
-
-        // Phase 3: Wait for previous kernel to finish (if any)
-        if (gpu_buf >= 0) {
-            errcode = clFinish(ctx->queue);
-            ret_iferr(errcode, "failed to wait for kernel");
-
-            uint64_t end_time = current_micros();
-            ctx->consumed_anas += kernel_num_anas;
-            ctx->task_times_starts[ctx->times_idx] = kernel_start_time;
-            ctx->task_times_ends[ctx->times_idx] = end_time;
-            ctx->task_calculated_anas[ctx->times_idx] = kernel_num_anas;
-            ctx->times_idx = (ctx->times_idx + 1) % TIMES_WINDOW_LENGTH;
-            clReleaseEvent(kernel_event);
-            kernel_event = NULL;
-
-            errcode = gpu_cruncher_ctx_refresh_hashes_reversed(ctx);
-            ret_iferr(errcode, "failed to refresh hashes_reversed");
-
-            // Phase 4: Start async read of gpu_buf (just finished)
-            uint32_t gpu_tasks = ctx->host_tasks[gpu_buf]->num_tasks;
-            if (gpu_tasks > 0) {
-                errcode = clEnqueueReadBuffer(ctx->queue, ctx->mem_tasks[gpu_buf], CL_FALSE, 0,
-                                              gpu_tasks * sizeof(permut_task),
-                                              ctx->host_tasks[gpu_buf]->permut_tasks, 0, NULL, &read_event);
-                ret_iferr(errcode, "failed to start read tasks");
-                read_buf = gpu_buf;
+        // None left to look for once cancelled, exhausted when nothing was
+        // carried over and the input is
+        while (!exhausted && queued - finished < ctx->in_flight) {
+            if (ctx->tasks_buffs->is_cancelled) {
+                exhausted = true;
+                break;
             }
-        }
-
-        // Check if we have work to do
-        if (buf_tasks[cur] == 0) {
-            // No more work - wait for any pending read
-            if (read_buf >= 0) {
-                clWaitForEvents(1, &read_event);
-                clReleaseEvent(read_event);
+            uint32_t s = (uint32_t) (queued % ctx->in_flight);
+            errcode = enqueue_launch(ctx, s, slots + s, queued, &last, &src_buf, &src_idx);
+            ret_iferr(errcode, "failed to queue launch");
+            if (!slots[s].tasks) {
+                exhausted = true;
+                break;
             }
-            break;
+            last = slots[s].plan;
+            queued++;
         }
+        if (finished == queued) break;
 
-        // Phase 5: Launch kernel on current buffer
-        uint32_t iters = MAX_ITERS_IN_KERNEL_TASK;
-        errcode = clSetKernelArg(ctx->kernel, 0, sizeof(cl_mem), &ctx->mem_tasks[cur]);
-        errcode |= clSetKernelArg(ctx->kernel, 1, sizeof(iters), &iters);
-        errcode |= clSetKernelArg(ctx->kernel, 2, sizeof(cl_mem), &ctx->mem_hashes);
-        errcode |= clSetKernelArg(ctx->kernel, 3, sizeof(ctx->hashes_num), &ctx->hashes_num);
-        errcode |= clSetKernelArg(ctx->kernel, 4, sizeof(cl_mem), &ctx->mem_hashes_reversed);
-        ret_iferr(errcode, "failed to set kernel args");
-
-        size_t global_size = buf_tasks[cur];
-        kernel_start_time = current_micros();
-        errcode = clEnqueueNDRangeKernel(ctx->queue, ctx->kernel, 1, NULL, &global_size, NULL, 0, NULL, &kernel_event);
-        ret_iferr(errcode, "failed to enqueue kernel");
-        kernel_num_anas = ctx->host_tasks[cur]->num_anas;
-        gpu_buf = cur;
+        uint32_t s = (uint32_t) (finished % ctx->in_flight);
+        errcode = finish_launch(ctx, s, slots + s, &last_end);
+        ret_iferr(errcode, "failed to finish launch");
+        finished++;
 
-        // Phase 6: Advance to next buffer
-        next_buf = (next_buf + 1) % 3;
+        // The device targets are compacted once found ones are dropped, which
+        // no launch of the old layout may see: let the queued ones finish first
+        if (targets_changed(ctx)) {
+            for (; finished < queued; finished++) {
+                s = (uint32_t) (finished % ctx->in_flight);
+                errcode = finish_launch(ctx, s, slots + s, &last_end);
+                ret_iferr(errcode, "failed to finish launch");
+            }
+            errcode = gpu_cruncher_ctx_update_targets(ctx);
+            ret_iferr(errcode, "failed to update targets");
+        }
     }
 
-done:
-    gpu_cruncher_ctx_read_hashes_reversed(ctx);
+    // the last preparation may have uploaded nothing, but used up buffers
+    errcode = clFinish(ctx->transfer_queue);
+    errcode |= clFinish(ctx->queue);
+    ret_iferr(errcode, "failed to wait for queues");
+    for (uint32_t s = 0; s < ctx->in_flight; s++) {
+        release_event(&slots[s].upload_start);
+        release_event(&slots[s].uploaded);
+        recycle_retired(ctx, slots + s);
+    }
+    if (src_buf) tasks_buffers_recycle(ctx->tasks_buffs, src_buf);  // left over when cancelled
+    if (ctx->share) {
+        // done: out of the tail shares of the others
+        ctx->share->rates[ctx->share_idx] = 0.0f;
+        ctx->share->held[ctx->share_idx] = 0;
+    }
+    trace_close(ctx);
+    // nothing to read back: every launch's matches were merged when it finished
     ctx->is_running = false;
     return NULL;
 }
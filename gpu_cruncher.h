@@ -6,26 +6,177 @@
 #include "permut_types.h"
 #include "task_buffers.h"
 
+// Kernel variants: permut.cl built with -D PERMUT_N/PERMUT_NW/PERMUT_HASHES
+// for launches where those hold for every task (0 = left to runtime)
+#define GPU_MAX_KERNEL_VARIANTS 32
+#define GPU_MAX_LOCAL_HASHES 64   // MAX_LOCAL_HASHES in permut.cl
+
+// Thread-per-permutation mode (permut_flat) for launches of fresh tasks that
+// all permute the same n <= GPU_FLAT_MAX_N distinct words (no multiset task)
+#define GPU_FLAT_MAX_N 7          // PERMUT_FLAT_MAX_N in permut.cl
+
+// Layout of mem_tasks (TASK_WORD in permut.cl): with ANABRUTE_OPENCL_TILES
+// unset or not 0, tiles of GPU_TASK_TILE tasks stored word by word, so the
+// work items of a wavefront load and store neighbouring words; else an array
+// of permut_task. New tasks go in through load_tasks/expand_tasks either way.
+#define GPU_TASK_TILE 32          // PERMUT_TILE in permut.cl
+#define GPU_TASK_WORDS (sizeof(permut_task) / 4)
+
+// On-device enumeration rounds: subtrees advanced per round and tasks each of
+// them writes at most, which fills mem_tasks. They share MAX_ANAS_IN_KERNEL_LAUNCH
+// evenly; all tasks hash their n! <= 8! permutations in a single permut launch
+#define GPU_ENUM_STATES 16384
+#define GPU_ENUM_TASKS_PER_STATE (PERMUT_TASKS_IN_KERNEL_TASK / GPU_ENUM_STATES)
+
+// Autotuner (gpu_cruncher_ctx_autotune): sweeps permut launches of synthetic
+// tasks, from GPU_TUNE_MIN_TASKS x GPU_TUNE_MIN_ITERS up to the compile-time
+// limits, measuring launches of at least GPU_TUNE_MIN_MILLIS and never picking
+// one that took over GPU_TUNE_MAX_MILLIS (display watchdogs kill long kernels)
+#define GPU_TUNE_MIN_TASKS 1024
+#define GPU_TUNE_MIN_ITERS 256
+#define GPU_TUNE_MAX_LOCAL 1024
+#define GPU_TUNE_MIN_MILLIS 20
+#define GPU_TUNE_MAX_MILLIS 250
+
+// Dispatch geometry of the permut kernel: work-group size (0 = left to the
+// runtime), tasks per launch and permutations per task in a launch. Defaults
+// to no local size, PERMUT_TASKS_IN_KERNEL_TASK and MAX_ITERS_IN_KERNEL_TASK,
+// which also bound what the autotuner picks (buffers are sized for them).
+typedef struct {
+    uint32_t local_size;
+    uint32_t tasks;
+    uint32_t iters;
+} gpu_tuning;
+
+// Launches in flight (ANABRUTE_OPENCL_INFLIGHT=1..GPU_MAX_IN_FLIGHT): each
+// stages its new tasks in its own upload buffer on the transfer queue and has
+// its own counters, so uploads, kernels and readback of consecutive launches
+// overlap instead of taking turns
+#define GPU_MAX_IN_FLIGHT 4
+#define GPU_DEFAULT_IN_FLIGHT 2
+
+// Devices sharing one input queue (gpu_share): each publishes the rate its
+// launches run at and the work it took but has not hashed yet. A device's
+// launches are sized in proportion to its rate against the fastest one's (no
+// less than 1/GPU_SHARE_MIN_LAUNCH_DIV of its own size), so launches take about
+// as long everywhere; once the queue is closed, each takes only its part of
+// what is left, so the devices finish together.
+#define GPU_MAX_DEVICES 16
+#define GPU_SHARE_MIN_LAUNCH_DIV 8
+
+typedef struct {
+    pthread_mutex_t mutex;                     // joining and leaving
+    bool used[GPU_MAX_DEVICES];
+    volatile float rates[GPU_MAX_DEVICES];     // anas per device second, 0 until measured
+    volatile uint64_t held[GPU_MAX_DEVICES];   // anas taken from the queue, not hashed yet
+} gpu_share;
+
+// A slot for one more device, -1 if all are taken
+int gpu_share_join(gpu_share *share);
+void gpu_share_leave(gpu_share *share, int idx);
+// Permutations a launch of device idx may hold, scaled down from its own
+// launch_anas by how much slower than the fastest device it runs
+uint64_t gpu_share_launch_anas(gpu_share *share, int idx, uint64_t launch_anas);
+// What device idx may still take from a closed queue holding queued_anas:
+// its rate's share of everything left, less what it holds (0 when it holds
+// that much already); UINT64_MAX while its rate is unknown
+uint64_t gpu_share_tail_anas(gpu_share *share, int idx, uint64_t queued_anas);
+
+// Per-launch counters in mem_counters: carried tasks, permutations hashed,
+// matches and a pad word, followed by the ring of the first GPU_MAX_MATCHES
+// matches (MATCHES_OFFSET and MAX_MATCHES in permut.cl)
+#define GPU_COUNTERS 4
+#define GPU_MAX_MATCHES 64
+
+typedef struct {
+    cl_uint ih;                        // position in the device targets
+    cl_uint str[MAX_STR_LENGTH / 4];
+} gpu_match;
+
+// Stages of a launch, timed by the device (CL_PROFILING_COMMAND_START/END of
+// their commands) over the last TIMES_WINDOW_LENGTH launches
+typedef enum {
+    GPU_STAGE_UPLOAD,      // new tasks to the upload buffer (transfer queue)
+    GPU_STAGE_LOAD,        // into mem_tasks behind the carry slots (compute queue)
+    GPU_STAGE_KERNEL,
+    GPU_STAGE_READBACK,    // counters
+    GPU_STAGES
+} gpu_stage;
+
+typedef struct {
+    uint32_t samples;
+    float mean_micros, p50_micros, p95_micros, max_micros;
+} gpu_stage_stats;
+
+typedef struct {
+    uint32_t n, nw, hashes;
+    cl_program program;
+    cl_kernel kernel;        // NULL if the build failed, the generic kernels run instead
+    cl_kernel kernel_flat;
+} gpu_kernel_variant;
+
 typedef struct gpu_cruncher_ctx_s {
     // job definition
     uint32_t *hashes;
     uint32_t hashes_num;
     cl_mem mem_hashes;
 
+    // targets on the device: the snapshot's active ones (all while snap is NULL),
+    // mem_hashes and mem_hashes_reversed are indexed by position in it
+    target_snapshot *snap;
+    uint32_t active_num;
+    uint32_t *active_hashes;        // staging copy for uploads
+
     // control stuff
     cl_platform_id platform_id;
     cl_device_id device_id;
     cl_context cl_ctx;
     cl_program program;
-    cl_command_queue queue;
+    cl_command_queue queue;            // compute: staged tasks into mem_tasks, kernels, counters
+    cl_command_queue transfer_queue;   // uploads into mem_uploads, match rings
 
-    // persistent kernel and triple-buffered task memory
+    // persistent kernel and double-buffered task memory; a launch on mem_tasks[k]
+    // appends its unfinished tasks to the front of mem_tasks[k^1], so carry-over
+    // stays on the device. New tasks are uploaded straight from the input buffers
+    // to the launch slot's mem_uploads and loaded behind the carry slots.
     cl_kernel kernel;
-    cl_mem mem_tasks[3];           // rotating GPU buffers
-    tasks_buffer *host_tasks[3];   // rotating host buffers
+    cl_kernel kernel_flat;
+    cl_kernel kernel_load;         // load_tasks: staged tasks into mem_tasks, padding
+    cl_mem mem_perms;              // permutation tables of permut_flat
+    cl_mem mem_tasks[2];           // GPU_TASK_TILE tiles unless use_tiles is off
+    cl_mem mem_uploads[GPU_MAX_IN_FLIGHT];   // per launch slot: its new tasks
+    cl_mem mem_counters[GPU_MAX_IN_FLIGHT];  // per launch slot: GPU_COUNTERS words, then the match ring
+    uint32_t in_flight;
+
+    // queues of compact tasks (tasks_buffs->words): the word table goes up once,
+    // when the thread starts, and expand_tasks stands in for load_tasks
+    cl_kernel kernel_expand;
+    cl_mem mem_words[2];            // entries, bytes
 
-    // input queue
+    // specialized kernels, built on first use (ANABRUTE_OPENCL_VARIANTS=0: generic only)
+    // and thread-per-permutation launches (ANABRUTE_OPENCL_FLAT=0: Heap's loop only)
+    bool use_variants;
+    bool use_flat;
+    bool use_tiles;                 // mem_tasks layout, all programs are built with it
+    uint32_t variants_num;
+    gpu_kernel_variant variants[GPU_MAX_KERNEL_VARIANTS];
+
+    // dispatch geometry, from the tuning cache or the autotuner (ANABRUTE_OPENCL_TUNE=0: defaults)
+    gpu_tuning tune;
+
+    // input queue, and the devices it is shared with (NULL: alone)
     tasks_buffers *tasks_buffs;
+    gpu_share *share;
+    int share_idx;
+    uint64_t taken_anas;            // num_anas of the buffers taken
+
+    // on-device enumeration (cfg->enum_dict), set up when the thread starts
+    cl_kernel kernel_enum;
+    cl_mem mem_enum_dict[3];        // entries, bucket, strings
+    cl_mem mem_enum_states;
+    enum_state *enum_states;        // host copy of the subtrees in flight
+    enum_state *enum_pending;       // subtrees of the L0 words taken, not started yet
+    uint32_t enum_pending_cap;
 
     // cruncher abstraction (NULL when used directly by kernel_debug)
     cruncher_config *cfg;
@@ -41,19 +192,43 @@ typedef struct gpu_cruncher_ctx_s {
     volatile uint64_t consumed_anas;
 
     // misc internal state
-    uint64_t last_refresh_hashes_reversed_millis;
+    gpu_match matches[GPU_MAX_MATCHES];  // staging copy of a match ring
+    // kernels of the last launches in device micros (host micros if the queue cannot profile)
     volatile uint64_t task_times_starts[TIMES_WINDOW_LENGTH];
     volatile uint64_t task_times_ends[TIMES_WINDOW_LENGTH];
     volatile uint64_t task_calculated_anas[TIMES_WINDOW_LENGTH];
     uint32_t times_idx;
+    volatile float stage_micros[GPU_STAGES][TIMES_WINDOW_LENGTH];
+    volatile uint32_t stage_samples[GPU_STAGES];  // all so far, the window holds the last ones
+
+    // ANABRUTE_OPENCL_TRACE=<prefix>: the commands of every launch, timed by
+    // the device, in <prefix>-<n>.json (Chrome trace event format)
+    FILE *trace;
+    cl_ulong trace_t0;
 } gpu_cruncher_ctx;
 
 cl_int gpu_cruncher_ctx_create(gpu_cruncher_ctx *ctx, cl_platform_id platform_id, cl_device_id device_id,
                                tasks_buffers* tasks_buffs, uint32_t *hashes, uint32_t hashes_num);
+// Sets ctx->tune: from the tuning cache next to the program cache (keyed by
+// device, driver and kernel source) or by sweeping and caching it
+cl_int gpu_cruncher_ctx_autotune(gpu_cruncher_ctx *ctx);
 cl_int gpu_cruncher_ctx_read_hashes_reversed(gpu_cruncher_ctx *ctx);
-cl_int gpu_cruncher_ctx_refresh_hashes_reversed(gpu_cruncher_ctx *ctx);
+// Merges the matches a launch counted in mem_counters: reads only its ring,
+// or all of mem_hashes_reversed when more than GPU_MAX_MATCHES were found
+cl_int gpu_cruncher_ctx_read_matches(gpu_cruncher_ctx *ctx, cl_mem mem_counters, cl_uint matches);
+cl_int gpu_cruncher_ctx_update_targets(gpu_cruncher_ctx *ctx);
 void* run_gpu_cruncher_thread(void *ptr);
+// Runs the on-device enumeration of cfg->enum_dict without hashing and reads
+// the tasks back (tests); free(*tasks) after use
+cl_int gpu_cruncher_ctx_collect_enum_tasks(gpu_cruncher_ctx *ctx, permut_task **tasks, uint32_t *tasks_num);
 cl_int gpu_cruncher_ctx_free(gpu_cruncher_ctx *ctx);
 void gpu_cruncher_get_stats(gpu_cruncher_ctx *ctx, float* busy_percentage, float* anas_per_sec);
+void gpu_cruncher_get_stage_stats(gpu_cruncher_ctx *ctx, gpu_stage stage, gpu_stage_stats *stats);
+void gpu_cruncher_print_stage_stats(gpu_cruncher_ctx *ctx);
+
+// Pinned host memory for task buffers, from a context of its own on the device;
+// NULL if it cannot be set up. Free it after every buffer it allocated.
+tasks_buffer_allocator *gpu_pinned_allocator_create(cl_platform_id platform_id, cl_device_id device_id);
+void gpu_pinned_allocator_free(tasks_buffer_allocator *allocator);
 
 #endif //GPU_CRUNCHER_H
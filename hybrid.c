@@ -0,0 +1,110 @@
+#include "hybrid.h"
+
+int hybrid_split_create(hybrid_split *split, uint32_t cores, uint32_t slots, tasks_buffers *gpu_buffs,
+                        tasks_buffers *cpu_buffs, volatile uint32_t *l0_counter, uint32_t l0_num) {
+    if (slots < 2) return -1;
+    if (slots > MAX_HYBRID_THREADS) slots = MAX_HYBRID_THREADS;
+    // with a single core both kinds still need a thread, the OS shares it
+    split->threads = cores < 2 ? 2 : cores > slots ? slots : cores;
+    split->enumerators = split->threads / 2;
+    split->small_n_max = HYBRID_SMALL_N_MAX;
+    split->gpu_buffs = gpu_buffs;
+    split->cpu_buffs = cpu_buffs;
+    split->l0_counter = l0_counter;
+    split->l0_num = l0_num;
+    for (uint32_t i = 0; i < MAX_HYBRID_THREADS; i++) {
+        split->enumerator_done[i] = false;
+    }
+
+    int errcode = tasks_buffers_create(cpu_buffs);
+    ret_iferr(errcode, "failed to create cpu tasks buffers");
+    cpu_buffs->pool = gpu_buffs;
+    errcode = pthread_mutex_init(&split->mutex, NULL);
+    ret_iferr(errcode, "failed to init mutex while creating hybrid split");
+    errcode = pthread_cond_init(&split->changed, NULL);
+    ret_iferr(errcode, "failed to init cond while creating hybrid split");
+    return 0;
+}
+
+void hybrid_split_free(hybrid_split *split) {
+    tasks_buffers_free(split->cpu_buffs);
+    pthread_mutex_destroy(&split->mutex);
+    pthread_cond_destroy(&split->changed);
+}
+
+static bool enumerator_runs(hybrid_split *split, uint32_t id) {
+    return id < split->enumerators || *split->l0_counter >= split->l0_num || split->gpu_buffs->is_closed;
+}
+
+// While the last L0 words are enumerated, the cores past the split run both
+// threads, so a full CPU queue always has a cruncher; once it is closed, all
+// crunchers drain it
+static bool cruncher_runs(hybrid_split *split, uint32_t id) {
+    return id >= split->enumerators || split->enumerator_done[id] || split->cpu_buffs->is_closed;
+}
+
+void hybrid_enumerator_wait(hybrid_split *split, uint32_t id) {
+    if (enumerator_runs(split, id)) return;
+    pthread_mutex_lock(&split->mutex);
+    while (!enumerator_runs(split, id)) {
+        pthread_cond_wait(&split->changed, &split->mutex);
+    }
+    pthread_mutex_unlock(&split->mutex);
+}
+
+void hybrid_enumerator_done(hybrid_split *split, uint32_t id) {
+    pthread_mutex_lock(&split->mutex);
+    split->enumerator_done[id] = true;
+    pthread_cond_broadcast(&split->changed);
+    pthread_mutex_unlock(&split->mutex);
+}
+
+void hybrid_cruncher_wait(hybrid_split *split, uint32_t id) {
+    if (cruncher_runs(split, id)) return;
+    pthread_mutex_lock(&split->mutex);
+    while (!cruncher_runs(split, id)) {
+        pthread_cond_wait(&split->changed, &split->mutex);
+    }
+    pthread_mutex_unlock(&split->mutex);
+}
+
+void hybrid_release(hybrid_split *split) {
+    pthread_mutex_lock(&split->mutex);
+    pthread_cond_broadcast(&split->changed);
+    pthread_mutex_unlock(&split->mutex);
+}
+
+void hybrid_rebalance(hybrid_split *split, const hybrid_rates *rates) {
+    const int64_t threads = split->threads;
+    int64_t e = split->enumerators;
+    int64_t target = e;
+    double denom = rates->produced_per_enumerator + rates->cpu_consumed_per_cruncher;
+    if (rates->produced_per_enumerator > 0 && denom > 0) {
+        double fed = (rates->gpu_consumed + (double) threads * rates->cpu_consumed_per_cruncher) / denom;
+        target = (int64_t) (fed + 0.999);
+    }
+
+    uint32_t gpu_queued = split->gpu_buffs->ring_count, cpu_queued = split->cpu_buffs->ring_count;
+    uint32_t queued = gpu_queued + cpu_queued;
+    if (queued > TASKS_BUFFERS_SIZE) {
+        if (target > e - 1) target = e - 1;   // producers ahead
+    } else if (queued < 2 * TASKS_BUFFERS_SIZE / 8) {
+        if (target < e + 1) target = e + 1;   // crunchers starved
+    }
+
+    int64_t step = threads / 8 > 1 ? threads / 8 : 1;
+    if (target > e + step) target = e + step;
+    if (target < e - step) target = e - step;
+    if (target < 1) target = 1;
+    if (target > threads - 1) target = threads - 1;
+
+    uint32_t cutoff = split->small_n_max;
+    if (cpu_queued > gpu_queued + TASKS_BUFFERS_SIZE / 8 && cutoff > 0) cutoff--;
+    else if (gpu_queued > cpu_queued + TASKS_BUFFERS_SIZE / 8 && cutoff < MAX_WORD_LENGTH) cutoff++;
+
+    pthread_mutex_lock(&split->mutex);
+    split->enumerators = (uint32_t) target;
+    split->small_n_max = cutoff;
+    pthread_cond_broadcast(&split->changed);
+    pthread_mutex_unlock(&split->mutex);
+}
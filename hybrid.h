@@ -0,0 +1,71 @@
+#ifndef ANABRUTE_HYBRID_H
+#define ANABRUTE_HYBRID_H
+
+#include "common.h"
+#include "task_buffers.h"
+
+/*
+ * Hybrid CPU+GPU runs: next to the GPU crunchers, every core has an
+ * enumerator and an AVX cruncher thread, and core k runs one of them at a
+ * time: the enumerator while k < enumerators, the cruncher otherwise (and
+ * either once its enumerator is done). The
+ * enumerators queue buffers of N <= small_n_max for the AVX crunchers
+ * (cpu_buffs) and the rest for the GPUs (gpu_buffs). Once a second,
+ * hybrid_rebalance moves the split and the cutoff from the measured rates and
+ * queue depths.
+ */
+#define MAX_HYBRID_THREADS 64
+#define HYBRID_SMALL_N_MAX 4           // cutoff to start from
+
+typedef struct {
+    uint32_t threads;                  // of either kind, >= 2
+    volatile uint32_t enumerators;     // 1..threads-1
+    volatile uint32_t small_n_max;     // 0..MAX_WORD_LENGTH
+    tasks_buffers *gpu_buffs;
+    tasks_buffers *cpu_buffs;          // recycles into gpu_buffs
+
+    // enumerators never wait once every L0 word is taken: they hold the last ones
+    volatile uint32_t *l0_counter;
+    uint32_t l0_num;
+    volatile bool enumerator_done[MAX_HYBRID_THREADS];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} hybrid_split;
+
+// What the monitor measured over the last interval
+typedef struct {
+    double produced_per_enumerator;    // anas queued per second by one enumerator
+    double gpu_consumed;               // anas per second of all GPU crunchers
+    double cpu_consumed_per_cruncher;  // anas per second of one AVX cruncher
+} hybrid_rates;
+
+// cpu_buffs gets created, its free-list being gpu_buffs'; at most slots (>= 2)
+// threads, one per cruncher instance left
+int hybrid_split_create(hybrid_split *split, uint32_t cores, uint32_t slots, tasks_buffers *gpu_buffs,
+                        tasks_buffers *cpu_buffs, volatile uint32_t *l0_counter, uint32_t l0_num);
+void hybrid_split_free(hybrid_split *split);
+
+// Where an enumerator queues a full buffer of N permutable words
+static inline tasks_buffers *hybrid_route(hybrid_split *split, int n) {
+    return n <= (int) split->small_n_max ? split->cpu_buffs : split->gpu_buffs;
+}
+
+// Block while core id runs the other kind of thread
+void hybrid_enumerator_wait(hybrid_split *split, uint32_t id);
+void hybrid_enumerator_done(hybrid_split *split, uint32_t id);
+void hybrid_cruncher_wait(hybrid_split *split, uint32_t id);
+// Wakes everyone waiting, after closing or cancelling the queues
+void hybrid_release(hybrid_split *split);
+
+/*
+ * Moves the split towards the enumerators that keep all crunchers fed
+ * (e * produced = gpu + (threads - e) * cpu), corrected by the queues: more
+ * than half full, the enumerators are ahead and give up a core; under an
+ * eighth, they take one. At most threads/8 cores (>= 1) move at a time. The
+ * cutoff follows the queue the crunchers fall behind on: a fuller CPU queue
+ * lowers it, a fuller GPU queue raises it.
+ */
+void hybrid_rebalance(hybrid_split *split, const hybrid_rates *rates);
+
+#endif //ANABRUTE_HYBRID_H
@@ -71,7 +71,29 @@ tasks_buffer *create_and_fill_task_buffer2() {
     return buf;
 }
 
+// Expected reversal of each line of input.hashes.debug, see the task comments above
+static const char *expected_strs[] = {
+    "x y t z a t b c d e",
+    "a z t x y t e d c b",
+    "b c t d e t z a x y",
+    "d b t e c t y x a z",
+    "e d t c b t a z y x",
+    "x y z s a b f s g h",
+    "y x a s b z f s g h",
+    "a b z s h g f s y x",
+    "f y z s a b x s g h",
+    "h x z s a b f s g y",
+};
+
+/*
+ * Runs the debug tasks through the OpenCL kernel on the first device found (any
+ * type, so PoCL on CPU-only machines works) and checks every hash was reversed.
+ * An optional argument adds that many full buffers of 8-word tasks for a
+ * throughput reading.
+ */
 int main(int argc, char *argv[]) {
+    uint32_t extra_bufs = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 0;
+
     cl_platform_id platform_id;
     cl_uint num_platforms;
     clGetPlatformIDs (1, &platform_id, &num_platforms);
@@ -99,6 +121,7 @@ int main(int argc, char *argv[]) {
     const uint32_t hashes_num = read_hashes("input.hashes.debug", &hashes);
     ret_iferr(!hashes_num, "failed to read hashes");
     ret_iferr(!hashes, "failed to allocate hashes");
+    ret_iferr(hashes_num != sizeof(expected_strs)/sizeof(expected_strs[0]), "unexpected input.hashes.debug");
 
     tasks_buffers tasks_bufs;
     tasks_buffers_create(&tasks_bufs);
@@ -113,9 +136,15 @@ int main(int argc, char *argv[]) {
     int err = pthread_create(&gpu_thread, NULL, run_gpu_cruncher_thread, &ctx);
     ret_iferr(err, "failed to create gpu thread");
 
-    for (int i=0; i<1; i++) {
-        tasks_buffers_add_buffer(&tasks_bufs, create_and_fill_task_buffer());
-        tasks_buffers_add_buffer(&tasks_bufs, create_and_fill_task_buffer2());
+    tasks_buffers_add_buffer(&tasks_bufs, create_and_fill_task_buffer());
+    tasks_buffers_add_buffer(&tasks_bufs, create_and_fill_task_buffer2());
+    for (uint32_t i=0; i<extra_bufs; i++) {
+        tasks_buffer *buf = create_and_fill_task_buffer();
+        while (!tasks_buffer_isfull(buf)) {
+            buf->permut_tasks[buf->num_tasks] = buf->permut_tasks[0];
+            buf->num_tasks++;
+        }
+        tasks_buffers_add_buffer(&tasks_bufs, buf);
     }
     tasks_buffers_close(&tasks_bufs);
 
@@ -125,10 +154,14 @@ int main(int argc, char *argv[]) {
     errcode = gpu_cruncher_ctx_read_hashes_reversed(&ctx);
     ret_iferr(errcode, "failed to read hashes_reversed");
 
+    uint32_t mismatches = 0;
     for(int i=0; i<hashes_num; i++) {
         char hash_ascii[33];
         hash_to_ascii(&hashes[i*4], hash_ascii);
-        printf("%s:  %s\n", hash_ascii, (char*)(ctx.hashes_reversed + i*MAX_STR_LENGTH/4));
+        const char *reversed = (char*)(ctx.hashes_reversed + i*MAX_STR_LENGTH/4);
+        bool ok = !strcmp(reversed, expected_strs[i]);
+        printf("%s:  %s%s\n", hash_ascii, reversed, ok ? "" : "  MISMATCH");
+        if (!ok) mismatches++;
     }
 
     char strbuf[1024];
@@ -143,5 +176,10 @@ int main(int argc, char *argv[]) {
 
     gpu_cruncher_ctx_free(&ctx);
 
+    if (mismatches) {
+        printf("FAILED: %u of %u hashes not reversed\n", mismatches, hashes_num);
+        return 1;
+    }
+    printf("all %u hashes reversed\n", hashes_num);
     return 0;
 }
\ No newline at end of file
@@ -18,10 +18,6 @@
 // #pragma OPENCL EXTENSION cl_khr_byte_addressable_store : disable
 // Disabled for PoCL compatibility — CPU supports byte-addressable stores natively
 
-/* Macros for reading/writing chars from int32's (from rar_kernel.cl) */
-#define GETCHAR(buf, index) (((uchar*)(buf))[(index)])
-#define PUTCHAR(buf, index, val) (buf)[(index)>>2] = ((buf)[(index)>>2] & ~(0xffU << (((index) & 3) << 3))) + ((val) << (((index) & 3) << 3))
-
 /* The basic MD5 functions */
 #define F(x, y, z)			((z) ^ ((x) & ((y) ^ (z))))
 #define G(x, y, z)			((y) ^ ((z) & ((x) ^ (y))))
@@ -34,13 +30,31 @@
     (a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); \
     (a) += (b);
 
+/*
+ * Variants: the host may build this file with -D defines it knows hold for a
+ * whole launch, so the compiler can unroll and fold the runtime bounds:
+ *   PERMUT_N       - every task permutes exactly this many words
+ *   PERMUT_NW      - key words holding message bytes or the 0x80 pad, at most;
+ *                    the other words (but the length, 14) are known to be zero
+ *   PERMUT_HASHES  - hashes_num <= PERMUT_HASHES <= MAX_LOCAL_HASHES
+ */
+#ifdef PERMUT_NW
+#define GET(i) ((i) < PERMUT_NW || (i) == 14 ? key[(i)] : 0)
+#else
 #define GET(i) (key[(i)])
+#endif
 
 /*
+ * GPU-8: MD5 split into partial (61 steps) + finish (last 3 steps).
+ * Register `a` is last written in step 60, so a + 0x67452301 is already the
+ * final hash[0]; the last 3 steps only run when it matches a target.
+ * Both write their results through pointers: PoCL 3.x miscompiles functions
+ * containing return statements.
+ *
  * @param key - char string grouped into 16 uint's (little endian)
- * @param hash - output for MD5 hash of a key (4 uint's).
+ * @param state - output: a, b, c, d after step 60
  */
-void md5(const uint *key, uint *hash)
+void md5_partial(const uint *key, uint *state)
 {
     uint a, b, c, d;
 
@@ -103,7 +117,7 @@ void md5(const uint *key, uint *hash)
     STEP(H, c, d, a, b, GET(15), 0x1fa27cf8, 16)
     STEP(H, b, c, d, a, GET(2), 0xc4ac5665, 23)
 
-    /* Round 4 */
+    /* Round 4 — steps 48-60 (last step writing `a` is step 60) */
     STEP(I, a, b, c, d, GET(0), 0xf4292244, 6)
     STEP(I, d, a, b, c, GET(7), 0x432aff97, 10)
     STEP(I, c, d, a, b, GET(14), 0xab9423a7, 15)
@@ -117,6 +131,18 @@ void md5(const uint *key, uint *hash)
     STEP(I, c, d, a, b, GET(6), 0xa3014314, 15)
     STEP(I, b, c, d, a, GET(13), 0x4e0811a1, 21)
     STEP(I, a, b, c, d, GET(4), 0xf7537e82, 6)
+    /* Steps 61-63 deferred to md5_finish */
+
+    state[0] = a; state[1] = b; state[2] = c; state[3] = d;
+}
+
+/*
+ * Complete the last 3 MD5 steps. Only called when hash[0] matched a target.
+ */
+void md5_finish(const uint *key, const uint *state, uint *hash)
+{
+    uint a = state[0], b = state[1], c = state[2], d = state[3];
+
     STEP(I, d, a, b, c, GET(11), 0xbd3af235, 10)
     STEP(I, c, d, a, b, GET(2), 0x2ad7d2bb, 15)
     STEP(I, b, c, d, a, GET(9), 0xeb86d391, 21)
@@ -140,39 +166,175 @@ typedef struct permut_task_s {
     uchar a[MAX_OFFSETS_LENGTH];
     uchar c[MAX_OFFSETS_LENGTH];
     ushort i;
-    ushort n;
+    uchar n;
+    uchar multiset;
     uint iters_done;
 } permut_task;
 
+// Task memory of the launches. With PERMUT_TILED, tiles of PERMUT_TILE tasks
+// stored word by word (word xi of all the tile's tasks, then word xi+1), so
+// neighbouring work items load and store neighbouring words; without, an
+// array of permut_task. Tasks are only accessed through TASK_WORD.
+#define PERMUT_TILE 32
+#define TASK_WORDS (sizeof(permut_task)/4)
+#ifdef PERMUT_TILED
+#define TASK_WORD(tasks, t, xi) (((__global uint *)(tasks))[((t) / PERMUT_TILE * TASK_WORDS + (xi)) * PERMUT_TILE + (t) % PERMUT_TILE])
+#else
+#define TASK_WORD(tasks, t, xi) (((__global uint *)((tasks) + (t)))[xi])
+#endif
+
 // fact() removed — not used by kernel, and PoCL 3.x miscompiles
 // when any function in the compilation unit contains return statements.
 
-__kernel void permut(__global permut_task *tasks, const uint iters_per_task, __global const uint *hashes, const uint hashes_num, __global uint *hashes_reversed) {
+// Match ring behind the counters of a launch: counters[2] counts the matches,
+// the first MAX_MATCHES are appended at MATCHES_OFFSET as the target's index
+// and the string, so the host only reads what was found. hashes_reversed is
+// still written, for the matches that do not fit.
+#define MAX_MATCHES 64
+#define MATCHES_OFFSET 4
+#define MATCH_WORDS (1 + MAX_STR_LENGTH / 4)
+
+// GPU-4: the first MAX_LOCAL_HASHES targets are cached in local memory, the
+// rest (large target lists) are read from global memory
+#define MAX_LOCAL_HASHES 64
+#ifdef PERMUT_HASHES
+// fixed trip count, all in local memory; slots past hashes_num are skipped
+#define HASHES_BOUND PERMUT_HASHES
+#define HASH_ACTIVE(ih) ((ih) < hashes_num)
+#define TARGET(ih, j) (local_hashes[4 * (ih) + (j)])
+#else
+#define HASHES_BOUND hashes_num
+#define HASH_ACTIVE(ih) 1
+#define TARGET(ih, j) ((ih) < MAX_LOCAL_HASHES ? local_hashes[4 * (ih) + (j)] : hashes[4 * (ih) + (j)])
+#endif
+
+// Heap's and Algorithm L bound; task.n itself still tells empty slots (n = 0) apart
+#ifdef PERMUT_N
+#define TASK_N PERMUT_N
+#else
+#define TASK_N task.n
+#endif
+
+// GPU-4: cooperative load of target hashes into local memory
+#define LOAD_LOCAL_HASHES() \
+    __local uint local_hashes[MAX_LOCAL_HASHES * 4]; \
+    uint local_num = hashes_num < MAX_LOCAL_HASHES ? hashes_num : MAX_LOCAL_HASHES; \
+    for (uint i = get_local_id(0); i < local_num * 4; i += get_local_size(0)) { \
+        local_hashes[i] = hashes[i]; \
+    } \
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+// Hashes the key (str_len bytes, padded) and records it for every target it
+// matches. Macro, not a function: PoCL 3.x and the __local targets.
+#define HASH_AND_MATCH() { \
+    /* GPU-8: partial MD5 (61 steps), check hash[0] before finishing */ \
+    uint state[4]; \
+    md5_partial(key, state); \
+    uint hash0 = state[0] + 0x67452301; \
+    \
+    /* no break: a hit is rare, and unrolled variants stay branch-free */ \
+    uint need_full = 0; \
+    for (uint ih=0; ih<HASHES_BOUND; ih++) { \
+        need_full |= HASH_ACTIVE(ih) && TARGET(ih, 0) == hash0; \
+    } \
+    \
+    if (need_full) { \
+        uint computed_hash[4]; \
+        md5_finish(key, state, computed_hash); \
+        \
+        /* GPU-7: early-exit comparison, word by word; no break on a match, */ \
+        /* the same digest may be listed more than once */ \
+        for (uint ih=0; ih<HASHES_BOUND; ih++) { \
+            if (!HASH_ACTIVE(ih)) continue; \
+            if (TARGET(ih, 0) != computed_hash[0]) continue; \
+            if (TARGET(ih, 1) != computed_hash[1]) continue; \
+            if (TARGET(ih, 2) != computed_hash[2]) continue; \
+            if (TARGET(ih, 3) != computed_hash[3]) continue; \
+            \
+            key_bytes[str_len] = 0;  /* null-terminate for output */ \
+            for (uint ihr=0; ihr<MAX_STR_LENGTH/4; ihr++) { \
+                hashes_reversed[ih*(MAX_STR_LENGTH/4)+ihr]=key[ihr]; \
+            } \
+            uint match = atomic_inc(&counters[2]); \
+            if (match < MAX_MATCHES) { \
+                __global volatile uint *m = counters + MATCHES_OFFSET + match * MATCH_WORDS; \
+                m[0] = ih; \
+                for (uint ihr=0; ihr<MAX_STR_LENGTH/4; ihr++) { \
+                    m[1 + ihr] = key[ihr]; \
+                } \
+            } \
+            key_bytes[str_len] = 0x80;  /* restore padding */ \
+        } \
+    } \
+}
+
+// Unfinished tasks are appended to carry_tasks (the next launch's task buffer)
+// at atomic_inc(&counters[0]); counters[1] accumulates the permutations hashed,
+// counters[2] and the ring behind it collect the matches.
+__kernel void permut(__global permut_task *tasks, const uint iters_per_task, __global const uint *hashes, const uint hashes_num, __global uint *hashes_reversed,
+                     __global permut_task *carry_tasks, __global volatile uint *counters) {
     uint id = get_global_id(0);
 
+    LOAD_LOCAL_HASHES()
+
     permut_task task;
 
     // reading as uints for speed
-    for (uint xi=0; xi<sizeof(permut_task)/4; xi++) {
-        *(((uint*)&task)+xi) = *(((__global uint*)(tasks+id))+xi);
+    for (uint xi=0; xi<TASK_WORDS; xi++) {
+        *(((uint*)&task)+xi) = TASK_WORD(tasks, id, xi);
     }
 
     // NOTE: no early return here — PoCL 3.x hangs when a conditional branch
     // precedes nested for+while loops (work-group loop transformation bug).
-    // The Heap's loop handles the "already completed" case (i >= n) naturally.
+    // Finished tasks and empty slots (i >= n) just skip the hashing loop.
+
+    // GPU-1: precompute word lengths (constant across all permutations)
+    uchar wlen[MAX_STR_LENGTH];
+    for (uint io = 0; task.offsets[io]; io++) {
+        if (task.offsets[io] < 0) {
+            uint byte_off = -task.offsets[io] - 1;
+            uchar l = 0;
+            while (task.all_strs[byte_off + l]) l++;
+            wlen[byte_off] = l;
+        }
+    }
+    // task.n, not TASK_N: empty slots (padding, unused carry slots) have no words
+    for (uint ai = 0; ai < task.n; ai++) {
+        uint byte_off = task.a[ai] - 1;
+        uchar l = 0;
+        while (task.all_strs[byte_off + l]) l++;
+        wlen[byte_off] = l;
+    }
+
+    // Total string length (constant across permutations)
+    uint str_len = 0;
+    for (uint io = 0; task.offsets[io]; io++) {
+        int off = task.offsets[io];
+        off = off < 0 ? -off - 1 : task.a[off - 1] - 1;
+        str_len += wlen[off] + 1;  // word + space
+    }
+    str_len = str_len ? str_len - 1 : 0;
 
+    // GPU-3: zero key once and set constant MD5 padding
     uint key[16];  // stores constructed string for md5 calculation
+    for (int ik=0; ik<16; ik++) {
+        key[ik] = 0;
+    }
+    uchar *key_bytes = (uchar *)key;
+    key_bytes[str_len] = 0x80;
+    key_bytes[56] = str_len << 3;
+    key_bytes[57] = str_len >> 5;
 
     uint iter_counter=0;
-    uint computed_hash[4];
-    uint has_permutation = 1;
+    uint hashed=0;
+    uint has_permutation = task.i < task.n;
     while (has_permutation && iter_counter < iters_per_task) {
-        for (int ik=0; ik<16; ik++) {
-            key[ik] = 0;
-        }
-        // construct key
-        int wcs=0;
+        hashed++;
+
+        // GPU-1 + GPU-2: construct key with precomputed lengths + byte writes
+        uint wcs=0;
         for (int io=0; task.offsets[io]; io++) {
+            if (wcs > 0) key_bytes[wcs++] = ' ';
             int off = task.offsets[io];
             if (off < 0) {
                 off = -off-1;
@@ -180,45 +342,39 @@ __kernel void permut(__global permut_task *tasks, const uint iters_per_task, __g
                 off = task.a[off-1]-1;
             }
 
-            while (task.all_strs[off]) {
-                PUTCHAR(key, wcs, task.all_strs[off]);
-                wcs++; off++;
+            uchar len = wlen[off];
+            for (uchar j = 0; j < len; j++) {
+                key_bytes[wcs++] = task.all_strs[off + j];
             }
-            PUTCHAR(key, wcs, ' ');
-            wcs++;
         }
-        wcs--;
-        // padding code (borrowed from MD5_eq.c)
-        PUTCHAR(key, wcs, 0x80);
-        PUTCHAR(key, 56, wcs << 3);
-        PUTCHAR(key, 57, wcs >> 5);
-
-        // calculate hash
-        md5(key, computed_hash);
-
-        // is hash a match?
-        //TODO copy hashes to local mem? or screw it?
-        for(uint ih=0; ih<hashes_num; ih++) {
-            uint match = 1;
-            for(uint ihj=0; ihj<4; ihj++) {
-                if(hashes[4*ih+ihj] != computed_hash[ihj]) {
-                    match = 0;
-                    break;
-                }
-            }
 
-            if (match) {
-                PUTCHAR(key, wcs, 0);
-                for (uint ihr=0; ihr<MAX_STR_LENGTH/4; ihr++) {
-                    hashes_reversed[ih*(MAX_STR_LENGTH/4)+ihr]=key[ihr];
-                }
-                break;
-            }
-        }
+        HASH_AND_MATCH()
 
         // find next permut if possible
         has_permutation = 0;
-        while (task.i < task.n) {
+        if (task.multiset) {
+            // Algorithm L: the next ordering of a in lexicographic order, so
+            // equal words are never swapped; exhausted once a is descending
+            int j = TASK_N - 2;
+            while (j >= 0 && task.a[j] >= task.a[j + 1]) j--;
+            if (j >= 0) {
+                int l = TASK_N - 1;
+                while (task.a[j] >= task.a[l]) l--;
+                uchar t = task.a[j];
+                task.a[j] = task.a[l];
+                task.a[l] = t;
+                for (int lo = j + 1, hi = TASK_N - 1; lo < hi; lo++, hi--) {
+                    t = task.a[lo];
+                    task.a[lo] = task.a[hi];
+                    task.a[hi] = t;
+                }
+                iter_counter++;
+                has_permutation = 1;
+            } else {
+                task.i = task.n;
+            }
+        }
+        while (!task.multiset && task.i < TASK_N) {
             if (task.c[task.i] < task.i) {
                 if (task.i%2 == 0) {
                     task.a[0] ^= task.a[task.i];
@@ -244,10 +400,418 @@ __kernel void permut(__global permut_task *tasks, const uint iters_per_task, __g
 
     task.iters_done += iter_counter;
 
-    // write out state (to resume or signal completion)
-    // skip offsets and all_strs, as those never change
-    for (uint xi=MAX_STR_LENGTH/4+MAX_OFFSETS_LENGTH/4; xi<sizeof(permut_task)/4; xi++) {
-        *(((__global uint*)(tasks+id))+xi) = *(((uint*)&task)+xi);
+    // queue the task on the device to resume it in the next launch,
+    // finished ones are dropped without writing anything back
+    if (has_permutation) {
+        uint slot = atomic_inc(&counters[0]);
+        for (uint xi=0; xi<TASK_WORDS; xi++) {
+            TASK_WORD(carry_tasks, slot, xi) = *(((uint*)&task)+xi);
+        }
+    }
+    if (hashed) {
+        atomic_add(&counters[1], hashed);
+    }
+
+}
+
+// ======================================
+// === thread-per-permutation variant ===
+// ======================================
+
+// Rows of the permutation tables: the table for n starts at perms_base and
+// holds n! rows of n indexes into task.a (built by the host, <= 64 KB in all)
+#define PERMUT_FLAT_MAX_N 7
+
+// One work item per candidate: item id hashes row id % perms_num of task
+// id / perms_num, so no lane waits on another task's Heap loop. Only launched
+// on fresh tasks that all permute n words, with perms_num = n!: nothing is
+// left to carry over, counters[1] still accumulates the permutations hashed.
+__kernel void permut_flat(__global const permut_task *tasks, __constant uchar *perms, const uint perms_base, const uint perms_num,
+                          __global const uint *hashes, const uint hashes_num, __global uint *hashes_reversed, __global volatile uint *counters) {
+    uint id = get_global_id(0);
+    uint row = id % perms_num;
+
+    LOAD_LOCAL_HASHES()
+
+    permut_task task;
+    for (uint xi=0; xi<TASK_WORDS; xi++) {
+        *(((uint*)&task)+xi) = TASK_WORD(tasks, id / perms_num, xi);
+    }
+
+    uchar a[MAX_OFFSETS_LENGTH];
+    for (uint ai = 0; ai < TASK_N; ai++) {
+        a[ai] = task.a[perms[perms_base + row * TASK_N + ai]];
+    }
+
+    uint key[16];
+    for (int ik=0; ik<16; ik++) {
+        key[ik] = 0;
+    }
+    uchar *key_bytes = (uchar *)key;
+    uint wcs=0;
+    for (int io=0; task.offsets[io]; io++) {
+        if (wcs > 0) key_bytes[wcs++] = ' ';
+        int off = task.offsets[io];
+        off = off < 0 ? -off - 1 : a[off - 1] - 1;
+        for (uint j = 0; task.all_strs[off + j]; j++) {
+            key_bytes[wcs++] = task.all_strs[off + j];
+        }
+    }
+    uint str_len = wcs;
+    key_bytes[str_len] = 0x80;
+    key_bytes[56] = str_len << 3;
+    key_bytes[57] = str_len >> 5;
+
+    HASH_AND_MATCH()
+
+    if (row == 0) {
+        atomic_add(&counters[1], perms_num);
+    }
+}
+
+// ==============================
+// === on-device enumeration ===
+// ==============================
+
+// Layouts and constants of enum_tasks.h (CHARCOUNT of seedphrase.h)
+#define MAX_WORD_LENGTH 8
+#define CHARCOUNT 12
+#define ENUM_MAX_FRAMES 12
+#define ENUM_MAX_STRINGS 48
+
+#define ENUM_DESCEND 0
+#define ENUM_EXPAND 1
+#define ENUM_ADVANCE 2
+#define ENUM_DONE 3
+
+typedef struct {
+    uchar counts[CHARCOUNT];
+    uchar length;
+    uchar strings_num;
+    ushort strings_off;
+} enum_entry;
+
+typedef struct {
+    uchar depth;
+    uchar prefix_depth;
+    uchar status;
+    uchar words;
+    uchar rem[16];
+    uchar chr[ENUM_MAX_FRAMES];
+    uchar cnt[ENUM_MAX_FRAMES];
+    ushort idx[ENUM_MAX_FRAMES];
+    uchar dist[ENUM_MAX_STRINGS];
+    uint tasks;
+} enum_state;
+
+// Takes entry e once more from the letters left, *taken = 0 if they run short
+void enum_take(uchar *rem, __global const enum_entry *e, uint *taken)
+{
+    uint fits = rem[CHARCOUNT] >= e->length;
+    for (uint i = 0; i < CHARCOUNT; i++) {
+        fits &= rem[i] >= e->counts[i];
+    }
+    if (fits) {
+        for (uint i = 0; i < CHARCOUNT; i++) {
+            rem[i] -= e->counts[i];
+        }
+        rem[CHARCOUNT] -= e->length;
+    }
+    *taken = fits;
+}
+
+/*
+ * recurse_dict_words as a loop over the frames: stops at the next multiset
+ * using up all letters (ENUM_EXPAND) or once the prefix frames would have to
+ * change (ENUM_DONE). Entries of a bucket all hold its letter and none of the
+ * earlier ones, so a frame takes the words after the one below it while that
+ * letter is left, else the words of the next bucket with letters left.
+ */
+void enum_walk(enum_state *st, __global const enum_entry *dict, __global const ushort *bucket)
+{
+    while (st->status == ENUM_DESCEND || st->status == ENUM_ADVANCE) {
+        uint t = st->depth - 1;
+        if (st->status == ENUM_DESCEND) {
+            if (st->words > MAX_WORD_LENGTH) {
+                st->status = ENUM_ADVANCE;
+            } else if (!st->rem[CHARCOUNT]) {
+                st->status = ENUM_EXPAND;
+            } else {
+                uint c = st->chr[t];
+                uint start = st->idx[t] + 1;
+                if (!st->rem[c]) {
+                    while (!st->rem[c]) c++;
+                    start = bucket[c];
+                }
+                st->chr[t + 1] = c;
+                st->idx[t + 1] = start;
+                st->cnt[t + 1] = 0;
+                st->depth++;
+                st->status = ENUM_ADVANCE;
+            }
+        } else if (st->depth == st->prefix_depth) {
+            st->status = ENUM_DONE;
+        } else {
+            // the same word once more, else the next one that fits
+            uint taken = 0;
+            if (st->cnt[t]) {
+                __global const enum_entry *e = dict + st->idx[t];
+                enum_take(st->rem, e, &taken);
+                if (!taken) {
+                    for (uint i = 0; i < CHARCOUNT; i++) {
+                        st->rem[i] += st->cnt[t] * e->counts[i];
+                    }
+                    st->rem[CHARCOUNT] += st->cnt[t] * e->length;
+                    st->words -= st->cnt[t];
+                    st->cnt[t] = 0;
+                    st->idx[t]++;
+                }
+            }
+            while (!taken && st->idx[t] < bucket[st->chr[t] + 1]) {
+                enum_take(st->rem, dict + st->idx[t], &taken);
+                if (!taken) st->idx[t]++;
+            }
+            if (taken) {
+                st->cnt[t]++;
+                st->words++;
+                st->status = ENUM_DESCEND;
+            } else {
+                st->depth--;
+            }
+        }
+    }
+}
+
+// recurse_string_combs: every frame starts with all its copies on its first string
+void enum_first_dist(enum_state *st, __global const enum_entry *dict)
+{
+    uint base = 0;
+    for (uint j = 0; j < st->depth; j++) {
+        uint k = dict[st->idx[j]].strings_num;
+        for (uint s = 0; s < k; s++) {
+            st->dist[base + s] = s ? 0 : st->cnt[j];
+        }
+        base += k;
+    }
+}
+
+// Next way to spread the copies of each frame over its strings, last frame first
+void enum_next_dist(enum_state *st, __global const enum_entry *dict, uint *more)
+{
+    uint base[ENUM_MAX_FRAMES];
+    uint total = 0;
+    for (uint j = 0; j < st->depth; j++) {
+        base[j] = total;
+        total += dict[st->idx[j]].strings_num;
+    }
+
+    *more = 0;
+    for (uint j = st->depth; j-- > 0 && !*more; ) {
+        uint k = dict[st->idx[j]].strings_num;
+        uchar *d = st->dist + base[j];
+
+        // next composition: move one copy from the first non-empty string up
+        // and the rest of it back to the first string
+        uint t = 0;
+        while (t + 1 < k && !d[t]) t++;
+        if (t + 1 < k) {
+            uchar v = d[t];
+            d[t] = 0;
+            d[t + 1]++;
+            d[0] = v - 1;
+            *more = 1;
+        } else {
+            d[k - 1] = 0;
+            d[0] = st->cnt[j];
+        }
+    }
+}
+
+// The task recurse_string_combs would submit for the current multiset and
+// strings: each string copied once, a permutable slot per copy, numbered the
+// way tasks_buffer_add_task does (offsets come ascending, so a multiset task
+// takes them left to right as they are)
+void enum_build_task(const enum_state *st, __global const enum_entry *dict, __global const char *strings,
+                     permut_task *out)
+{
+    permut_task task;
+    for (uint xi=0; xi<sizeof(permut_task)/4; xi++) {
+        *(((uint*)&task)+xi) = 0;
+    }
+
+    uint off = 0, base = 0, slot = 0, repeats = 0;
+    for (uint j = 0; j < st->depth; j++) {
+        __global const enum_entry *e = dict + st->idx[j];
+        for (uint s = 0; s < e->strings_num; s++) {
+            uint copies = st->dist[base + s];
+            if (copies) {
+                __global const char *str = strings + e->strings_off + s * (e->length + 1);
+                for (uint l = 0; l < e->length; l++) {
+                    task.all_strs[off + l] = str[l];
+                }
+                for (uint q = 0; q < copies; q++) {
+                    task.offsets[slot++] = off + 1;
+                }
+                repeats |= copies > 1;
+                off += e->length + 1;
+            }
+        }
+        base += e->strings_num;
+    }
+
+    uint n = st->words;
+    for (uint io = 0; io < n; io++) {
+        if (repeats) {
+            task.a[io] = task.offsets[io];
+            task.offsets[io] = io + 1;
+        } else {
+            task.a[n - 1 - io] = task.offsets[io];
+            task.offsets[io] = n - io;
+        }
+    }
+    task.n = n;
+    task.multiset = repeats;
+    *out = task;
+}
+
+// One work item per subtree: writes its next tasks at atomic_inc(&counters[0])
+// and saves where it stopped. It stops after tasks_per_state of them or before
+// their permutations add up to more than anas_per_state, but writes at least
+// one, so the launch of permut that hashes them stays within its time budget.
+__kernel void enum_tasks(__global const enum_entry *dict, __global const ushort *bucket, __global const char *strings,
+                         __global enum_state *states, const uint tasks_per_state, const uint anas_per_state,
+                         __global permut_task *tasks, __global volatile uint *counters) {
+    uint id = get_global_id(0);
+
+    enum_state st;
+    for (uint xi=0; xi<sizeof(enum_state)/4; xi++) {
+        *(((uint*)&st)+xi) = *(((__global uint*)(states+id))+xi);
+    }
+
+    uint written = 0, anas = 0;
+    while (written < tasks_per_state && st.status != ENUM_DONE) {
+        if (st.status == ENUM_EXPAND) {
+            permut_task task;
+            enum_build_task(&st, dict, strings, &task);
+            // n!, over the factorials of the repeats (permut_task_perms)
+            uint perms = 1;
+            for (uint k = 0; k < task.n; k++) {
+                uint same = 1;
+                for (uint j = 0; j < k; j++) {
+                    same += task.a[j] == task.a[k];
+                }
+                perms = perms * (k + 1) / same;
+            }
+            if (written && anas + perms > anas_per_state) break;
+
+            uint slot = atomic_inc(&counters[0]);
+            for (uint xi=0; xi<TASK_WORDS; xi++) {
+                TASK_WORD(tasks, slot, xi) = *(((uint*)&task)+xi);
+            }
+            written++;
+            anas += perms;
+
+            uint more;
+            enum_next_dist(&st, dict, &more);
+            if (!more) st.status = ENUM_ADVANCE;
+        } else {
+            enum_walk(&st, dict, bucket);
+            if (st.status == ENUM_EXPAND) {
+                enum_first_dist(&st, dict);
+            }
+        }
     }
+    st.tasks += written;
 
+    for (uint xi=0; xi<sizeof(enum_state)/4; xi++) {
+        *(((__global uint*)(states+id))+xi) = *(((uint*)&st)+xi);
+    }
+}
+
+// =================
+// === new tasks ===
+// =================
+
+// One work item per slot of [base, base + the global size): copies the new
+// tasks src[0..num) in, and clears the slots after them (padding up to the
+// work-group size), in the layout of TASK_WORD
+__kernel void load_tasks(__global const permut_task *src, const uint base, const uint num, __global permut_task *tasks) {
+    uint id = get_global_id(0);
+    uint valid = id < num;
+    for (uint xi=0; xi<TASK_WORDS; xi++) {
+        TASK_WORD(tasks, base + id, xi) = valid ? *(((__global const uint*)(src + id))+xi) : 0;
+    }
+}
+
+// =====================
+// === compact tasks ===
+// =====================
+
+// Layout of compact_task (task_buffers.h): word ids into the word table,
+// whose entries are the offset of a word's bytes << 8 | its length
+typedef struct {
+    ushort words[MAX_WORD_LENGTH];
+    uchar permutable;
+    uchar n;
+    uchar multiset;
+    uchar reserved;
+} compact_task;
+
+// Same as load_tasks for compact tasks: writes the permut_task compact[id]
+// stands for, laid out as word_table_expand does on the host
+__kernel void expand_tasks(__global const compact_task *compact, __global const uint *entries, __global const char *bytes,
+                           const uint base, const uint num, __global permut_task *tasks) {
+    uint id = get_global_id(0);
+    uint valid = id < num;
+
+    compact_task ct;
+    for (uint xi=0; xi<sizeof(compact_task)/4; xi++) {
+        *(((uint*)&ct)+xi) = valid ? *(((__global const uint*)(compact+id))+xi) : 0;
+    }
+    permut_task task;
+    for (uint xi=0; xi<sizeof(permut_task)/4; xi++) {
+        *(((uint*)&task)+xi) = 0;
+    }
+
+    // a word used more than once is copied once; permutable slots are
+    // numbered as on the host: right to left, or left to right over the
+    // sorted a of a multiset task
+    uint pos = 0, a_idx = ct.multiset ? 0 : ct.n;
+    uint word_pos[MAX_WORD_LENGTH];
+    for (uint slot = 0; slot < MAX_WORD_LENGTH && ct.words[slot]; slot++) {
+        uint prev = 0;
+        while (prev < slot && ct.words[prev] != ct.words[slot]) prev++;
+        if (prev < slot) {
+            word_pos[slot] = word_pos[prev];
+        } else {
+            uint entry = entries[ct.words[slot]];
+            uint len = entry & 0xff;
+            for (uint j = 0; j < len; j++) {
+                task.all_strs[pos + j] = bytes[(entry >> 8) + j];
+            }
+            word_pos[slot] = pos;
+            pos += len + 1;
+        }
+        uchar off = word_pos[slot] + 1;
+        if (!(ct.permutable & (1u << slot))) {
+            task.offsets[slot] = -(int)word_pos[slot] - 1;
+        } else if (ct.multiset) {
+            uint k = a_idx++;
+            for (; k > 0 && task.a[k - 1] > off; k--) {
+                task.a[k] = task.a[k - 1];
+            }
+            task.a[k] = off;
+            task.offsets[slot] = a_idx;
+        } else {
+            a_idx--;
+            task.a[a_idx] = off;
+            task.offsets[slot] = a_idx + 1;
+        }
+    }
+    task.n = ct.n;
+    task.multiset = ct.multiset;
+
+    for (uint xi=0; xi<TASK_WORDS; xi++) {
+        TASK_WORD(tasks, base + id, xi) = *(((uint*)&task)+xi);
+    }
 }
@@ -158,7 +158,8 @@ typedef struct permut_task_s {
     uint8_t a[MAX_OFFSETS_LENGTH];
     uint8_t c[MAX_OFFSETS_LENGTH];
     uint16_t i;
-    uint16_t n;
+    uint8_t n;
+    uint8_t multiset;
     uint32_t iters_done;
 } permut_task;
 
@@ -303,9 +304,32 @@ kernel void permut(
             }
         }
 
-        // Heap's algorithm: find next permutation
         bool found_next = false;
-        while (task.i < task.n) {
+        if (task.multiset) {
+            // Algorithm L: the next ordering of a in lexicographic order, so
+            // equal words are never swapped; exhausted once a is descending
+            int j = task.n - 2;
+            while (j >= 0 && task.a[j] >= task.a[j + 1]) j--;
+            if (j >= 0) {
+                int l = task.n - 1;
+                while (task.a[j] >= task.a[l]) l--;
+                uint8_t t = task.a[j];
+                task.a[j] = task.a[l];
+                task.a[l] = t;
+                for (int lo = j + 1, hi = task.n - 1; lo < hi; lo++, hi--) {
+                    t = task.a[lo];
+                    task.a[lo] = task.a[hi];
+                    task.a[hi] = t;
+                }
+                iter_counter++;
+                found_next = true;
+            } else {
+                task.i = task.n;
+            }
+        }
+
+        // Heap's algorithm: find next permutation
+        while (!task.multiset && task.i < task.n) {
             if (task.c[task.i] < task.i) {
                 if (task.i % 2 == 0) {
                     task.a[0] ^= task.a[task.i];
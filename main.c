@@ -1,4 +1,3 @@
-#include <math.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include "common.h"
@@ -10,10 +9,13 @@
 #include "metal_cruncher.h"
 #endif
 #include "dict.h"
+#include "enum_tasks.h"
 #include "fact.h"
 #include "hashes.h"
 #include "os.h"
 #include "permut_types.h"
+#include "search_index.h"
+#include "word_table.h"
 
 static const char* size_suffixes[] = {"", "K", "M", "G", "T", "P"};
 void format_bignum(uint64_t value, char *dst, uint16_t div) {
@@ -35,6 +37,38 @@ static int cmp_ccs_length_desc(const void *a, const void *b) {
     return (int)cb->counts.length - (int)ca->counts.length;
 }
 
+/* Prints the hashes found since the last call, in the order they were found, with their ranks */
+static void print_found(const target_set *targets, const uint32_t *hashes, const uint32_t *hashes_reversed,
+                        const search_index *space, uint32_t *printed, char *strbuf) {
+    uint32_t found_num = targets->found_num;
+    __sync_synchronize();  // pairs with target_set_mark_found: log entries first
+    for (; *printed < found_num; (*printed)++) {
+        uint32_t hi = targets->found_log[*printed];
+        const char *sentence = (const char *)(hashes_reversed + hi * MAX_STR_LENGTH / 4);
+        hash_to_ascii(hashes + hi * 4, strbuf);
+        printf("\033[2K\r%s:  %s  (#%llu)\n", strbuf, sentence,
+               (unsigned long long) search_index_rank(space, sentence));
+    }
+}
+
+/*
+ * --stop-when policy: "all" (default), "any" or a number of hashes. Sets the
+ * number of finds after which the search stops; -1 on a malformed value.
+ */
+static int parse_stop_when(const char *policy, uint32_t hashes_num, uint32_t *stop_after) {
+    if (strcmp(policy, "all") == 0) {
+        *stop_after = hashes_num;
+    } else if (strcmp(policy, "any") == 0) {
+        *stop_after = 1;
+    } else {
+        char *end;
+        unsigned long n = strtoul(policy, &end, 10);
+        if (*policy < '0' || *policy > '9' || *end || n == 0) return -1;
+        *stop_after = n < hashes_num ? (uint32_t)n : hashes_num;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 
     // === read dict
@@ -65,17 +99,11 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // === precompute per-L0-entry weights for ETA estimation
-    // Weight reflects exponential growth of sub-combinations with remaining chars.
-    // Actual anagram counts calibrate the scale; weights provide the shape.
-    int l0_len = dict_by_char_len[0];
-    double *l0_cum_weight = malloc((l0_len + 1) * sizeof(double));
-    l0_cum_weight[0] = 0.0;
-    for (int i = 0; i < l0_len; i++) {
-        int remaining = seed_phrase.length - dict_by_char[0][i]->counts.length;
-        l0_cum_weight[i + 1] = l0_cum_weight[i] + pow(3.0, remaining);
-    }
-    double l0_total_weight = l0_cum_weight[l0_len];
+    // === count the search space, for exact progress and the ranks of what is found
+
+    search_index space;
+    ret_iferr(search_index_create(&space, &seed_phrase, &dict_by_char, dict_by_char_len),
+              "failed to index the search space");
 
     // === setup shared cpu/gpu cruncher stuff
 
@@ -90,8 +118,16 @@ int main(int argc, char *argv[]) {
     // === parse CLI flags ===
 
     cruncher_ops *forced_backend = NULL;
+    bool gpu_enum = false;
+    bool no_hybrid = false;
+    bool no_compact = false;
+    const char *stop_when = "all";
+    uint32_t stop_after = hashes_num;
     for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-avx2") == 0) {
+        if (strncmp(argv[i], "--stop-when=", 12) == 0 &&
+            parse_stop_when(argv[i] + 12, hashes_num, &stop_after) == 0) {
+            stop_when = argv[i] + 12;
+        } else if (strcmp(argv[i], "-avx2") == 0) {
             forced_backend = &avx2_cruncher_ops;
         } else if (strcmp(argv[i], "-avx512") == 0) {
             forced_backend = &avx512_cruncher_ops;
@@ -99,6 +135,16 @@ int main(int argc, char *argv[]) {
             forced_backend = &scalar_cruncher_ops;
         } else if (strcmp(argv[i], "-opencl") == 0) {
             forced_backend = &opencl_cruncher_ops;
+        } else if (strcmp(argv[i], "--gpu-enum") == 0) {
+            // the OpenCL devices enumerate the anagrams themselves
+            forced_backend = &opencl_cruncher_ops;
+            gpu_enum = true;
+        } else if (strcmp(argv[i], "--no-hybrid") == 0) {
+            // GPU crunchers only, every core enumerates
+            no_hybrid = true;
+        } else if (strcmp(argv[i], "--no-compact") == 0) {
+            // queue tasks with their strings, not as ids into the word table
+            no_compact = true;
 #ifdef __APPLE__
         } else if (strcmp(argv[i], "-metal") == 0) {
             forced_backend = &metal_cruncher_ops;
@@ -108,7 +154,7 @@ int main(int argc, char *argv[]) {
 #ifdef __APPLE__
                     " [-metal]"
 #endif
-                    "\n", argv[0]);
+                    " [--gpu-enum] [--no-hybrid] [--no-compact] [--stop-when=all|any|N]\n", argv[0]);
             return 1;
         }
     }
@@ -130,13 +176,31 @@ int main(int argc, char *argv[]) {
     uint32_t *hashes_reversed = calloc(hashes_num, MAX_STR_LENGTH);
     ret_iferr(!hashes_reversed, "failed to allocate hashes_reversed");
 
+    // Targets not found yet, crunchers drop the others from their compares
+    target_set targets;
+    ret_iferr(target_set_create(&targets, hashes, hashes_num), "failed to create target set");
+
+    volatile uint32_t shared_l0_counter = 0;
+    volatile uint64_t shared_anas_produced = 0;
+
     cruncher_config cruncher_cfg = {
         .tasks_buffs = &tasks_buffs,
         .hashes = hashes,
         .hashes_num = hashes_num,
         .hashes_reversed = hashes_reversed,
+        .targets = &targets,
     };
 
+    // On-device enumeration: the dictionary goes to the devices, which take
+    // L0 words from the shared counter, and no CPU enumerators run
+    enum_dict edict = {0};
+    if (gpu_enum) {
+        ret_iferr(enum_dict_create(&edict, &seed_phrase, &dict_by_char, dict_by_char_len),
+                  "dictionary does not fit on-device enumeration");
+        cruncher_cfg.enum_dict = &edict;
+        cruncher_cfg.enum_l0_counter = &shared_l0_counter;
+    }
+
     #define MAX_CRUNCHER_INSTANCES 64
     typedef struct {
         cruncher_ops *ops;
@@ -147,6 +211,16 @@ int main(int argc, char *argv[]) {
     cruncher_instance crunchers[MAX_CRUNCHER_INSTANCES];
     uint32_t num_crunchers = 0;
 
+    // Hybrid runs: AVX crunchers next to the GPU ones, on cores the enumerators
+    // leave them (hybrid.h), reading small-N buffers from a queue of their own
+    hybrid_split split;
+    tasks_buffers cpu_tasks_buffs;
+    cruncher_config cpu_cruncher_cfg = cruncher_cfg;
+    cpu_cruncher_cfg.tasks_buffs = &cpu_tasks_buffs;
+    cpu_cruncher_cfg.split = &split;
+    bool hybrid = false;
+    uint32_t num_hybrid_crunchers = 0;
+
     bool have_gpu = false;
     bool have_cpu_accel = false;
 
@@ -185,8 +259,11 @@ int main(int argc, char *argv[]) {
                 continue;
             }
 
-            // Skip CPU-bound backends if GPU is available (they'd just contend)
-            if (have_gpu && !is_gpu) {
+            // Next to a GPU, the fastest AVX backend takes the cores the
+            // enumerators can spare; other CPU-bound ones would just contend
+            bool hybrid_ops = have_gpu && !gpu_enum && !no_hybrid && !have_cpu_accel &&
+                              (ops == &avx512_cruncher_ops || ops == &avx2_cruncher_ops);
+            if (have_gpu && !is_gpu && !hybrid_ops) {
                 printf("  %s: skipped (GPU backend active)\n", ops->name);
                 continue;
             }
@@ -200,44 +277,88 @@ int main(int argc, char *argv[]) {
             uint32_t count = ops->probe();
             if (!count) continue;
 
+            // a hybrid run pairs each AVX thread with an enumerator, so it
+            // only fits in what is left of crunchers[]
+            uint32_t free_slots = MAX_CRUNCHER_INSTANCES - num_crunchers;
+            if (hybrid_ops && free_slots < 2) {
+                printf("  %s: skipped (no cruncher slots left)\n", ops->name);
+                continue;
+            }
+
             printf("  %s: %d instance(s)\n", ops->name, count);
 
             if (is_gpu) have_gpu = true;
             if (ops == &avx512_cruncher_ops || ops == &avx2_cruncher_ops) have_cpu_accel = true;
 
+            cruncher_config *cfg = &cruncher_cfg;
+            if (hybrid_ops) {
+                ret_iferr(hybrid_split_create(&split, count, free_slots, &tasks_buffs, &cpu_tasks_buffs, &shared_l0_counter,
+                                              dict_by_char_len[0]), "failed to set up hybrid run");
+                hybrid = true;
+                count = split.threads;
+                cfg = &cpu_cruncher_cfg;
+                printf("  %s: hybrid, sharing %d threads with the enumerators\n", ops->name, count);
+            }
             for (uint32_t i = 0; i < count && num_crunchers < MAX_CRUNCHER_INSTANCES; i++) {
                 cruncher_instance *ci = &crunchers[num_crunchers];
                 ci->ops = ops;
                 ci->ctx = calloc(1, ops->ctx_size);
-                int err = ops->create(ci->ctx, &cruncher_cfg, i);
+                int err = ops->create(ci->ctx, cfg, i);
                 ret_iferr(err, "failed to create cruncher instance");
                 num_crunchers++;
+                if (hybrid_ops) num_hybrid_crunchers++;
             }
         }
     }
-    printf("%d cruncher instance(s) total\n\n", num_crunchers);
+    printf("%d cruncher instance(s) total\n", num_crunchers);
+
+    // Compact tasks: the enumerators queue word ids (word_table.h) when every
+    // cruncher reading the queues expands them; both queues of a hybrid run
+    // share buffers, so they are of one kind
+    word_table words = {0};
+    bool compact = !gpu_enum && !no_compact && num_crunchers;
+    for (uint32_t i = 0; i < num_crunchers; i++) {
+        if (!crunchers[i].ops->compact_tasks) compact = false;
+    }
+    if (compact && word_table_create(&words, &seed_phrase, &dict_by_char, dict_by_char_len) == 0) {
+        tasks_buffs.words = &words;
+        if (hybrid) cpu_tasks_buffs.words = &words;
+        printf("queueing compact tasks (%u words, %u bytes)\n", words.num - 1, words.bytes_size);
+    }
+    printf("\n");
 
     // === create cpu cruncher contexts
     // GPU backends don't compete for CPU — use all cores for enumeration.
     // CPU-bound crunchers (AVX-512, AVX2, scalar) share cores — limit enumerators to 2.
     uint32_t total_cores = num_cpu_cores();
-    uint32_t num_cpu_crunchers = have_gpu ? total_cores : 2;
-    volatile uint32_t shared_l0_counter = 0;
-    volatile uint64_t shared_anas_produced = 0;
-    cpu_cruncher_ctx cpu_cruncher_ctxs[num_cpu_crunchers];
+    uint32_t num_cpu_crunchers = gpu_enum ? 0 : hybrid ? num_hybrid_crunchers : have_gpu ? total_cores : 2;
+    // OpenCL crunchers upload the enumerators' buffers as they are, so those
+    // are allocated in pinned memory the driver can DMA from
+    tasks_buffer_allocator *pinned_allocator = NULL;
+    for (uint32_t i = 0; i < num_crunchers && num_cpu_crunchers; i++) {
+        if (crunchers[i].ops == &opencl_cruncher_ops) {
+            pinned_allocator = opencl_tasks_buffer_allocator_create();
+            tasks_buffs.allocator = pinned_allocator;
+            break;
+        }
+    }
+    cpu_cruncher_ctx cpu_cruncher_ctxs[num_cpu_crunchers ? num_cpu_crunchers : 1];
     for (uint32_t id=0; id<num_cpu_crunchers; id++) {
         cpu_cruncher_ctx_create(cpu_cruncher_ctxs+id, id, num_cpu_crunchers, &seed_phrase, &dict_by_char, dict_by_char_len, &tasks_buffs, &shared_l0_counter, &shared_anas_produced);
+        if (hybrid) cpu_cruncher_ctxs[id].split = &split;
     }
 
     // === create and start cruncher threads
 
-    printf("searching through anas up to %d words\n", MAX_WORD_LENGTH);
+    char space_str[32];
+    format_bignum(space.total, space_str, 1024);
+    printf("searching through %s anas up to %d words\n", space_str, MAX_WORD_LENGTH);
 
     struct timeval t0, t1;
     gettimeofday(&t0, 0);
 
     // Start CPU (dict enumeration) threads — priority set inside run_cpu_cruncher_thread
-    pthread_t cpu_threads[num_cpu_crunchers];
+    pthread_t cpu_threads[num_cpu_crunchers ? num_cpu_crunchers : 1];
     for (int i=0; i<num_cpu_crunchers; i++) {
         int err = pthread_create(cpu_threads+i, NULL, run_cpu_cruncher_thread, cpu_cruncher_ctxs+i);
         ret_iferr(err, "failed to create cpu thread");
@@ -251,9 +372,9 @@ int main(int argc, char *argv[]) {
 
     // === monitor and display progress
 
-    bool hash_is_printed[hashes_num];
-    memset(hash_is_printed, 0, sizeof(bool) * hashes_num);
+    uint32_t found_printed = 0;
     char strbuf[1024];
+    uint64_t last_produced = 0, last_cpu_consumed = 0;
 
     while (1) {
         sleep(1);
@@ -265,13 +386,7 @@ int main(int argc, char *argv[]) {
         }
 
         // Print newly found hashes from shared buffer
-        for (int hi = 0; hi < hashes_num; hi++) {
-            if (!hash_is_printed[hi] && hashes_reversed[hi * MAX_STR_LENGTH / 4]) {
-                hash_to_ascii(hashes + hi * 4, strbuf);
-                printf("\033[2K\r%s:  %s\n", strbuf, (char *)(hashes_reversed + hi * MAX_STR_LENGTH / 4));
-                hash_is_printed[hi] = true;
-            }
-        }
+        print_found(&targets, hashes, hashes_reversed, &space, &found_printed, strbuf);
 
         // CPU progress (shared atomic counter)
         uint32_t cpu_progress = shared_l0_counter;
@@ -285,6 +400,10 @@ int main(int argc, char *argv[]) {
                elapsed_secs/3600, (elapsed_secs/60)%60, elapsed_secs%60,
                num_cpu_crunchers, cpu_progress, dict_by_char_len[0],
                tasks_buffs.ring_count);
+        if (hybrid) {
+            pos += sprintf(strbuf + pos, "+%d | %u enum, N<=%u to cpu", cpu_tasks_buffs.ring_count,
+                           split.enumerators, split.small_n_max);
+        }
 
         float total_aps = 0;
         uint64_t total_consumed = 0;
@@ -321,15 +440,13 @@ int main(int argc, char *argv[]) {
             total_aps += backend_aps;
         }
 
-        // ETA: weighted progress (theoretical shape) calibrated by actual anas_produced (scale)
-        uint64_t anas_produced = shared_anas_produced;
-        double done_weight = l0_cum_weight[cpu_progress < l0_len ? cpu_progress : l0_len];
-        if (done_weight > 0 && total_aps > 0 && elapsed_secs > 2) {
-            double scale = (double)anas_produced / done_weight;
-            double estimated_total = scale * l0_total_weight;
-            double remaining_anas = estimated_total - (double)total_consumed;
-            if (remaining_anas < 0) remaining_anas = 0;
-            long eta_secs = (long)(remaining_anas / total_aps);
+        // Progress and ETA: hashed anas out of the counted search space
+        if (space.total > 0) {
+            pos += sprintf(strbuf + pos, " | %.2f%%", 100.0 * (double)total_consumed / (double)space.total);
+        }
+        if (total_aps > 0 && elapsed_secs > 2) {
+            uint64_t remaining_anas = total_consumed < space.total ? space.total - total_consumed : 0;
+            long eta_secs = (long)((double)remaining_anas / total_aps);
             pos += sprintf(strbuf + pos, " | ETA %02ld:%02ld:%02ld",
                            eta_secs/3600, (eta_secs/60)%60, eta_secs%60);
         }
@@ -351,18 +468,43 @@ int main(int argc, char *argv[]) {
         }
         if (cpus_done) {
             tasks_buffers_close(&tasks_buffs);
+            if (hybrid) tasks_buffers_close(&cpu_tasks_buffs);
+        }
+
+        // Stop policy met - drop queued work, enumerators unwind, crunchers
+        // finish their current task and merge what they found
+        if (targets.found_num >= stop_after && !tasks_buffs.is_cancelled) {
+            tasks_buffers_cancel(&tasks_buffs);
+            if (hybrid) tasks_buffers_cancel(&cpu_tasks_buffs);
+        }
+
+        // Hybrid: move cores between enumerators and AVX crunchers and the
+        // N cutoff from what the last second produced and consumed
+        if (hybrid) {
+            hybrid_rates rates = {0};
+            uint64_t produced = shared_anas_produced, cpu_consumed = 0;
+            for (uint32_t i = 0; i < num_crunchers; i++) {
+                if (crunchers[i].ops == &avx512_cruncher_ops || crunchers[i].ops == &avx2_cruncher_ops) {
+                    cpu_consumed += crunchers[i].ops->get_total_anas(crunchers[i].ctx);
+                } else {
+                    float busy, aps;
+                    crunchers[i].ops->get_stats(crunchers[i].ctx, &busy, &aps);
+                    rates.gpu_consumed += aps;
+                }
+            }
+            uint32_t enumerators = split.enumerators;
+            rates.produced_per_enumerator = (double) (produced - last_produced) / enumerators;
+            rates.cpu_consumed_per_cruncher = (double) (cpu_consumed - last_cpu_consumed) / (split.threads - enumerators);
+            last_produced = produced;
+            last_cpu_consumed = cpu_consumed;
+            if (tasks_buffs.is_closed) hybrid_release(&split);
+            else hybrid_rebalance(&split, &rates);
         }
 
         if (!any_running) {
             // Final hash scan — crunchers merge results before setting is_running=false,
             // so the shared buffer is up to date by the time we get here
-            for (int hi = 0; hi < hashes_num; hi++) {
-                if (!hash_is_printed[hi] && hashes_reversed[hi * MAX_STR_LENGTH / 4]) {
-                    hash_to_ascii(hashes + hi * 4, strbuf);
-                    printf("\033[2K\r%s:  %s\n", strbuf, (char *)(hashes_reversed + hi * MAX_STR_LENGTH / 4));
-                    hash_is_printed[hi] = true;
-                }
-            }
+            print_found(&targets, hashes, hashes_reversed, &space, &found_printed, strbuf);
             printf("\033[2K\r\n");
             break;
         }
@@ -414,11 +556,24 @@ int main(int argc, char *argv[]) {
     format_bignum(grand_total_anas, total_str, 1024);
     format_bignum((uint64_t)(grand_total_anas / wall_secs), total_aps_str, 1000);
     printf("  total: %s anas in %.1fs, %sAna/s effective\n", total_str, wall_secs, total_aps_str);
+    const char *stop_state = targets.found_num < stop_after ? "not met, search exhausted"
+                           : tasks_buffs.is_cancelled ? "met, stopped early" : "met";
+    printf("  found %u of %u hashes, --stop-when=%s %s\n", targets.found_num, hashes_num, stop_when,
+           stop_state);
+    for (uint32_t i = 0; i < num_crunchers; i++) {
+        if (crunchers[i].ops->print_timings) crunchers[i].ops->print_timings(crunchers[i].ctx);
+    }
 
     for (uint32_t i = 0; i < num_crunchers; i++) {
         crunchers[i].ops->destroy(crunchers[i].ctx);
         free(crunchers[i].ctx);
     }
+    if (hybrid) hybrid_split_free(&split);
+    tasks_buffers_free(&tasks_buffs);
+    opencl_tasks_buffer_allocator_free(pinned_allocator);
+    enum_dict_free(&edict);
+    word_table_free(&words);
+    target_set_free(&targets);
     free(hashes_reversed);
-    free(l0_cum_weight);
+    search_index_free(&space);
 }
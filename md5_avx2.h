@@ -38,6 +38,29 @@
     (a) = _mm256_add_epi32((a), (b)); \
 } while (0)
 
+/*
+ * Length-specialized MD5 step over X interleaved 8-lane chains. Takes the key
+ * word index w instead of the word itself; expects `keys` (SoA, chain j reads
+ * word w at keys + (w * X + j) * 8), `X`, `nw` and `len_bits` in scope, and
+ * the state as arrays a[j]..d[j]. The chains are independent, so with X > 1
+ * their dependent add/rotate sequences overlap and fill the idle ALU slots.
+ * Words at index >= nw are zero for every permutation of a task, so with nw a
+ * compile-time constant the add disappears. k[14] is the message length in
+ * bits and is folded into the round constant; k[15] is always zero.
+ */
+#define MD5_AVX2_STEP_X(f, a, b, c, d, w, t, s) do { \
+    _Pragma("GCC unroll 4") \
+    for (int j_ = 0; j_ < X; j_++) { \
+        (a)[j_] = _mm256_add_epi32((a)[j_], f((b)[j_], (c)[j_], (d)[j_])); \
+        if ((w) < nw) (a)[j_] = _mm256_add_epi32((a)[j_], \
+            _mm256_load_si256((const __m256i *)(keys + ((w) * X + j_) * 8))); \
+        (a)[j_] = _mm256_add_epi32((a)[j_], \
+            _mm256_set1_epi32((int32_t)((t) + ((w) == 14 ? len_bits : 0)))); \
+        (a)[j_] = MD5_AVX2_ROTL((a)[j_], (s)); \
+        (a)[j_] = _mm256_add_epi32((a)[j_], (b)[j_]); \
+    } \
+} while (0)
+
 /*
  * Compute 8 MD5 hashes in parallel using AVX2.
  *
@@ -45,6 +45,21 @@
     (a) = _mm512_add_epi32((a), (b)); \
 } while (0)
 
+/* Interleaved length-specialized step, see MD5_AVX2_STEP_X in md5_avx2.h
+ * (16-lane chains: chain j reads word w at keys + (w * X + j) * 16) */
+#define MD5_512_STEP_X(f, a, b, c, d, w, t, s) do { \
+    _Pragma("GCC unroll 4") \
+    for (int j_ = 0; j_ < X; j_++) { \
+        (a)[j_] = _mm512_add_epi32((a)[j_], f((b)[j_], (c)[j_], (d)[j_])); \
+        if ((w) < nw) (a)[j_] = _mm512_add_epi32((a)[j_], \
+            _mm512_load_si512((const void *)(keys + ((w) * X + j_) * 16))); \
+        (a)[j_] = _mm512_add_epi32((a)[j_], \
+            _mm512_set1_epi32((int32_t)((t) + ((w) == 14 ? len_bits : 0)))); \
+        (a)[j_] = MD5_512_ROTL((a)[j_], (s)); \
+        (a)[j_] = _mm512_add_epi32((a)[j_], (b)[j_]); \
+    } \
+} while (0)
+
 /*
  * Compute 16 MD5 hashes in parallel using AVX-512.
  *
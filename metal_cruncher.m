@@ -16,6 +16,11 @@ typedef struct {
     id<MTLBuffer> buf_hashes_reversed;  // shared output (GPU writes matches)
     id<MTLBuffer> buf_tasks;            // reusable task buffer (pre-allocated at max size)
 
+    /* Targets in buf_hashes: the snapshot's active ones (all while snap is
+     * NULL); buf_hashes_reversed is indexed by position in it */
+    target_snapshot *snap;
+    uint32_t active_num;
+
     volatile bool is_running;
     volatile uint64_t consumed_bufs;
     volatile uint64_t consumed_anas;
@@ -30,14 +35,35 @@ typedef struct {
 /* ---- merge hashes_reversed from local Metal buffer to shared output ---- */
 static void merge_hashes_reversed(metal_cruncher_ctx *mctx) {
     uint32_t *local = (uint32_t *)[mctx->buf_hashes_reversed contents];
-    for (uint32_t i = 0; i < mctx->cfg->hashes_num; i++) {
+    for (uint32_t i = 0; i < mctx->active_num; i++) {
         if (local[i * MAX_STR_LENGTH / 4]) {
-            memcpy(mctx->cfg->hashes_reversed + i * MAX_STR_LENGTH / 4,
+            uint32_t ih = mctx->snap ? target_snapshot_id(mctx->snap, i) : i;
+            memcpy(mctx->cfg->hashes_reversed + ih * MAX_STR_LENGTH / 4,
                    local + i * MAX_STR_LENGTH / 4, MAX_STR_LENGTH);
+            if (mctx->cfg->targets) target_set_mark_found(mctx->cfg->targets, ih);
         }
     }
 }
 
+/* ---- drop found targets from the GPU buffers, between dispatches only ---- */
+static void update_targets(metal_cruncher_ctx *mctx) {
+    target_set *set = mctx->cfg->targets;
+    if (!set || set->version == (mctx->snap ? mctx->snap->version : 0)) return;
+
+    merge_hashes_reversed(mctx);  // finds of the old layout
+
+    target_snapshot *snap = target_set_acquire(set);
+    uint32_t *hashes = (uint32_t *)[mctx->buf_hashes contents];
+    for (uint32_t i = 0; i < snap->num; i++) {
+        memcpy(hashes + 4 * i, mctx->cfg->hashes + 4 * target_snapshot_id(snap, i), 16);
+    }
+    memset([mctx->buf_hashes_reversed contents], 0, mctx->active_num * MAX_STR_LENGTH);
+
+    if (mctx->snap) target_set_release(set, mctx->snap);
+    mctx->snap = snap;
+    mctx->active_num = snap->num;
+}
+
 /* ---- vtable functions ---- */
 
 static uint32_t metal_probe(void) {
@@ -62,6 +88,8 @@ static int metal_create(void *ctx, cruncher_config *cfg, uint32_t instance_id) {
         memset(mctx->times_end, 0, sizeof(mctx->times_end));
         memset(mctx->times_anas, 0, sizeof(mctx->times_anas));
         mctx->times_idx = 0;
+        mctx->snap = NULL;
+        mctx->active_num = cfg->hashes_num;
 
         mctx->device = MTLCreateSystemDefaultDevice();
         if (mctx->device == nil) {
@@ -147,6 +175,8 @@ static void *metal_run(void *ctx) {
             tasks_buffers_get_buffer(mctx->cfg->tasks_buffs, &buf);
             if (buf == NULL) break;
 
+            update_targets(mctx);
+
             uint32_t num_tasks = buf->num_tasks;
             uint64_t buf_num_anas = buf->num_anas;
 
@@ -164,7 +194,7 @@ static void *metal_run(void *ctx) {
                 uint32_t iters_per_task = UINT32_MAX;
                 [encoder setBytes:&iters_per_task length:sizeof(iters_per_task) atIndex:1];
                 [encoder setBuffer:mctx->buf_hashes offset:0 atIndex:2];
-                uint32_t hashes_num = mctx->cfg->hashes_num;
+                uint32_t hashes_num = mctx->active_num;
                 [encoder setBytes:&hashes_num length:sizeof(hashes_num) atIndex:3];
                 [encoder setBuffer:mctx->buf_hashes_reversed offset:0 atIndex:4];
 
@@ -244,6 +274,10 @@ static bool metal_is_running(void *ctx) {
 
 static int metal_destroy(void *ctx) {
     metal_cruncher_ctx *mctx = ctx;
+    if (mctx->snap) {
+        target_set_release(mctx->cfg->targets, mctx->snap);
+        mctx->snap = NULL;
+    }
     mctx->buf_hashes = nil;
     mctx->buf_hashes_reversed = nil;
     mctx->buf_tasks = nil;
@@ -9,6 +9,7 @@
 static cl_platform_id s_platform_ids[MAX_OPENCL_DEVICES]; // per-device platform
 static cl_device_id s_device_ids[MAX_OPENCL_DEVICES];
 static uint32_t s_num_devices = 0;
+static gpu_share s_share = {.mutex = PTHREAD_MUTEX_INITIALIZER};  // all instances pull from cfg->tasks_buffs
 
 static uint32_t opencl_probe(void) {
     cl_platform_id platforms[MAX_OPENCL_PLATFORMS];
@@ -16,15 +17,20 @@ static uint32_t opencl_probe(void) {
     clGetPlatformIDs(MAX_OPENCL_PLATFORMS, platforms, &num_platforms);
     if (!num_platforms) return 0;
 
-    // Gather all GPU devices from all platforms
+    // Gather all GPU devices from all platforms; ANABRUTE_OPENCL_CPU=1 adds CPU
+    // devices, so the kernel can be tested under PoCL on machines without a GPU
+    cl_device_type dev_type = CL_DEVICE_TYPE_GPU;
+    const char *with_cpu = getenv("ANABRUTE_OPENCL_CPU");
+    if (with_cpu && *with_cpu && strcmp(with_cpu, "0")) dev_type |= CL_DEVICE_TYPE_CPU;
+
     s_num_devices = 0;
     for (cl_uint p = 0; p < num_platforms && s_num_devices < MAX_OPENCL_DEVICES; p++) {
         cl_uint num_devs;
-        if (clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_GPU, 0, NULL, &num_devs) != CL_SUCCESS)
+        if (clGetDeviceIDs(platforms[p], dev_type, 0, NULL, &num_devs) != CL_SUCCESS)
             continue;
         cl_device_id devs[MAX_OPENCL_DEVICES];
         uint32_t to_get = num_devs > MAX_OPENCL_DEVICES ? MAX_OPENCL_DEVICES : num_devs;
-        clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_GPU, to_get, devs, &num_devs);
+        clGetDeviceIDs(platforms[p], dev_type, to_get, devs, &num_devs);
         for (cl_uint d = 0; d < num_devs && s_num_devices < MAX_OPENCL_DEVICES; d++) {
             s_platform_ids[s_num_devices] = platforms[p];
             s_device_ids[s_num_devices] = devs[d];
@@ -32,8 +38,8 @@ static uint32_t opencl_probe(void) {
         }
     }
 
-    // No GPU devices found (e.g. POCL CPU-only) — don't fall back to CPU devices,
-    // native AVX/scalar backends are always faster than OpenCL-on-CPU.
+    // No GPU devices found (e.g. POCL CPU-only) — don't fall back to CPU devices
+    // unless asked to, native AVX/scalar backends are always faster than OpenCL-on-CPU.
     if (s_num_devices == 0) return 0;
 
     // Skip integrated GPUs if any discrete GPU is present
@@ -76,6 +82,8 @@ static int opencl_create(void *ctx, cruncher_config *cfg, uint32_t instance_id)
                                        cfg->tasks_buffs, cfg->hashes, cfg->hashes_num);
     if (err) return err;
     gctx->cfg = cfg;
+    gctx->share_idx = gpu_share_join(&s_share);
+    if (gctx->share_idx >= 0) gctx->share = &s_share;
     return 0;
 }
 
@@ -95,10 +103,25 @@ static bool opencl_is_running(void *ctx) {
     return ((gpu_cruncher_ctx *)ctx)->is_running;
 }
 
+static void opencl_print_timings(void *ctx) {
+    gpu_cruncher_print_stage_stats(ctx);
+}
+
 static int opencl_destroy(void *ctx) {
+    gpu_cruncher_ctx *gctx = ctx;
+    if (gctx->share) gpu_share_leave(gctx->share, gctx->share_idx);
     return gpu_cruncher_ctx_free(ctx);
 }
 
+tasks_buffer_allocator *opencl_tasks_buffer_allocator_create(void) {
+    if (!s_num_devices) return NULL;
+    return gpu_pinned_allocator_create(s_platform_ids[0], s_device_ids[0]);
+}
+
+void opencl_tasks_buffer_allocator_free(tasks_buffer_allocator *allocator) {
+    gpu_pinned_allocator_free(allocator);
+}
+
 cruncher_ops opencl_cruncher_ops = {
     .name = "opencl",
     .probe = opencl_probe,
@@ -108,6 +131,8 @@ cruncher_ops opencl_cruncher_ops = {
     .get_total_anas = opencl_get_total_anas,
     .is_running = opencl_is_running,
     .destroy = opencl_destroy,
+    .print_timings = opencl_print_timings,
+    .compact_tasks = true,
     .ctx_size = sizeof(gpu_cruncher_ctx),
 };
 
@@ -115,6 +140,9 @@ cruncher_ops opencl_cruncher_ops = {
 
 static uint32_t opencl_probe_stub(void) { return 0; }
 
+tasks_buffer_allocator *opencl_tasks_buffer_allocator_create(void) { return NULL; }
+void opencl_tasks_buffer_allocator_free(tasks_buffer_allocator *allocator) { (void) allocator; }
+
 cruncher_ops opencl_cruncher_ops = {
     .name = "opencl",
     .probe = opencl_probe_stub,
@@ -5,4 +5,10 @@
 
 extern cruncher_ops opencl_cruncher_ops;
 
+// Pinned memory on the first device (after probe) for the task buffers the CPU
+// enumerators fill, which OpenCL crunchers then upload without staging; NULL
+// without OpenCL or when it cannot be set up. Free it after tasks_buffers_free.
+tasks_buffer_allocator *opencl_tasks_buffer_allocator_create(void);
+void opencl_tasks_buffer_allocator_free(tasks_buffer_allocator *allocator);
+
 #endif //ANABRUTE_OPENCL_CRUNCHER_H
@@ -84,6 +84,7 @@ uint8_t char_counts_equal(char_counts *l, char_counts *r) {
 
 bool char_counts_strings_create(const char *s, char_counts_strings *ccs) {
     ccs->strings_len = 0;
+    ccs->word_id = 0;
     ccs->strings = malloc(sizeof(char*)*MAX_STRINGS_SIZE);
     return char_counts_create(s, &ccs->counts);
 }
@@ -16,6 +16,7 @@ typedef struct {
     char_counts counts;
     char **strings;
     int strings_len;
+    uint16_t word_id;  /* word_table id of strings[0], the others follow; 0 without a table */
 } char_counts_strings;
 
 typedef struct {
@@ -26,13 +27,9 @@ typedef struct {
 typedef struct {
     char* str;
     int8_t count;
+    uint16_t word_id;
 } string_and_count;
 
-typedef struct {
-    int8_t offset;
-    int8_t count;
-} string_idx_and_count;
-
 bool char_counts_create(const char *s, char_counts *cc);
 uint8_t char_counts_equal(char_counts *l, char_counts *r);
 bool char_counts_contains(char_counts* cc, char_counts* subcc);
@@ -0,0 +1,382 @@
+#include "search_index.h"
+
+// counts per number of words before the subtree, 0..MAX_WORD_LENGTH
+#define WORDS_LEN (MAX_WORD_LENGTH + 1)
+
+static uint64_t binom(int n, int k) {
+    uint64_t r = 1;
+    for (int i = 0; i < k; i++) r = r * (n - i) / (i + 1);
+    return r;
+}
+
+static uint64_t power(uint64_t base, int exp) {
+    uint64_t r = 1;
+    while (exp-- > 0) r *= base;
+    return r;
+}
+
+// Distinct orderings of parts[0] copies of a word, parts[1] of another, ...
+static uint64_t multinomial(const uint8_t *parts, int n) {
+    uint64_t r = 1;
+    int words = 0;
+    for (int i = 0; i < n; i++) {
+        words += parts[i];
+        r *= binom(words, parts[i]);
+    }
+    return r;
+}
+
+static int first_char(const char_counts *rem, int ch) {
+    while (ch < CHARCOUNT && !rem->counts[ch]) ch++;
+    return ch;
+}
+
+static void count_from(const search_index *si, const char_counts *rem, int ch, int idx, uint64_t *out);
+
+/*
+ * Adds the completions through entry i of bucket ch, taken c = 1.. times as
+ * recurse_dict_words does. A multiset of W words is W! / prod(c_s!)
+ * anagrams, c_s the copies of each string; spread over the subtree, each
+ * entry contributes binom(u + c, c) for the u words before it and k^c for
+ * the ways recurse_string_combs spreads c copies over k strings (summed
+ * over them, c! / prod(c_s!) makes k^c), so out[u] counts the anagrams
+ * below for every u while its prefix only multiplies them.
+ */
+static void count_entry(const search_index *si, const char_counts *rem, int ch, int i, uint64_t *out) {
+    char_counts_strings *ccs = (*si->dict_by_char)[ch][i];
+    char_counts next = *rem;
+    uint64_t spreads = 1;
+    for (int c = 1; char_counts_subtract(&next, &ccs->counts); c++) {
+        spreads *= ccs->strings_len;
+        uint64_t sub[WORDS_LEN];
+        count_from(si, &next, next.counts[ch] ? ch : ch + 1, next.counts[ch] ? i + 1 : 0, sub);
+        for (int u = 0; u + c < WORDS_LEN; u++) {
+            out[u] += binom(u + c, c) * spreads * sub[u + c];
+        }
+    }
+}
+
+// Anagrams below a remainder, from entry idx of its first char's bucket on;
+// memoized where the enumeration enters a bucket, the branches within one
+// are few (a bucket's entries all hold its char)
+static void count_from(const search_index *si, const char_counts *rem, int ch, int idx, uint64_t *out) {
+    if (rem->length == 0) {
+        for (int u = 0; u < WORDS_LEN; u++) out[u] = 1;
+        return;
+    }
+    ch = first_char(rem, ch);
+    if (idx == 0) {
+        uint32_t r = 0;
+        for (int c = 0; c < CHARCOUNT; c++) r += rem->counts[c] * si->rem_mul[c];
+        uint64_t *memo = si->counts + (size_t) r * WORDS_LEN;
+        if (!si->counted[r]) {
+            memset(memo, 0, WORDS_LEN * sizeof(uint64_t));
+            for (int i = 0; i < si->dict_by_char_len[ch]; i++) count_entry(si, rem, ch, i, memo);
+            si->counted[r] = 1;
+        }
+        memcpy(out, memo, WORDS_LEN * sizeof(uint64_t));
+        return;
+    }
+    memset(out, 0, WORDS_LEN * sizeof(uint64_t));
+    for (int i = idx; i < si->dict_by_char_len[ch]; i++) count_entry(si, rem, ch, i, out);
+}
+
+// A branch of the enumeration tree, as recurse_dict_words' stack
+typedef struct {
+    char_counts rem;
+    int ch, idx, words;
+    uint64_t weight;  // anagrams per completion: binom(u + c, c) * k^c of the entries taken
+    int len;
+    char_counts_strings *ccs[MAX_WORD_LENGTH];
+    uint8_t count[MAX_WORD_LENGTH];
+} path;
+
+static void path_start(const search_index *si, path *p) {
+    memset(p, 0, sizeof(path));
+    p->rem = si->seed;
+    p->ch = first_char(&p->rem, 0);
+    p->weight = 1;
+}
+
+// false if c copies of entry i do not fit; else anas counts the branch's anagrams per weight
+static bool take_entry(const search_index *si, const path *p, int i, int c, char_counts *next, uint64_t *anas) {
+    char_counts_strings *ccs = (*si->dict_by_char)[p->ch][i];
+    *next = p->rem;
+    for (int t = 0; t < c; t++) {
+        if (!char_counts_subtract(next, &ccs->counts)) return false;
+    }
+    *anas = 0;
+    int words = p->words + c;
+    if (words <= MAX_WORD_LENGTH) {
+        uint64_t sub[WORDS_LEN];
+        count_from(si, next, next->counts[p->ch] ? p->ch : p->ch + 1, next->counts[p->ch] ? i + 1 : 0, sub);
+        *anas = binom(words, c) * power(ccs->strings_len, c) * sub[words];
+    }
+    return true;
+}
+
+static void path_push(const search_index *si, path *p, int i, int c, const char_counts *next) {
+    char_counts_strings *ccs = (*si->dict_by_char)[p->ch][i];
+    p->words += c;
+    p->weight *= binom(p->words, c) * power(ccs->strings_len, c);
+    p->ccs[p->len] = ccs;
+    p->count[p->len++] = c;
+    p->rem = *next;
+    p->idx = p->rem.counts[p->ch] ? i + 1 : 0;
+    p->ch = first_char(&p->rem, p->rem.counts[p->ch] ? p->ch : p->ch + 1);
+}
+
+// Anagrams of the branches through entry i, any number of copies
+static uint64_t entry_anas(const search_index *si, const path *p, int i) {
+    uint64_t sum = 0, anas;
+    char_counts next;
+    for (int c = 1; take_entry(si, p, i, c, &next, &anas); c++) sum += p->weight * anas;
+    return sum;
+}
+
+/*
+ * Anagrams of a path's multisets whose strings are settled up to string s of
+ * entry j (nonzero copies in fixed), r copies of entry j left for the
+ * strings after s and the later entries' copies free over all of theirs.
+ */
+static uint64_t strings_anas(const path *p, const uint8_t *fixed, int nfixed, int j, int s, int r) {
+    uint8_t parts[2 * MAX_WORD_LENGTH];
+    memcpy(parts, fixed, nfixed);
+    int n = nfixed;
+    parts[n++] = r;
+    uint64_t spreads = power(p->ccs[j]->strings_len - s - 1, r);
+    for (int l = j + 1; l < p->len; l++) {
+        parts[n++] = p->count[l];
+        spreads *= power(p->ccs[l]->strings_len, p->count[l]);
+    }
+    return multinomial(parts, n) * spreads;
+}
+
+int search_index_create(search_index *si, char_counts *seed, char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE],
+                        int *dict_by_char_len) {
+    memset(si, 0, sizeof(search_index));
+    si->seed = *seed;
+    si->dict_by_char = dict_by_char;
+    si->dict_by_char_len = dict_by_char_len;
+
+    uint64_t remainders = 1;
+    for (int c = 0; c < CHARCOUNT; c++) {
+        si->rem_mul[c] = (uint32_t) remainders;
+        remainders *= seed->counts[c] + 1;
+        if (remainders > SEARCH_INDEX_MAX_REMAINDERS) return -1;
+    }
+    si->l0_char = first_char(seed, 0);
+    si->l0_len = si->l0_char < CHARCOUNT ? dict_by_char_len[si->l0_char] : 0;
+
+    si->counts = malloc(remainders * WORDS_LEN * sizeof(uint64_t));
+    si->counted = calloc(remainders, 1);
+    si->l0_first = malloc((si->l0_len + 1) * sizeof(uint64_t));
+    if (!si->counts || !si->counted || !si->l0_first) {
+        search_index_free(si);
+        return -1;
+    }
+
+    path root;
+    path_start(si, &root);
+    si->l0_first[0] = 0;
+    for (uint32_t i = 0; i < si->l0_len; i++) {
+        si->l0_first[i + 1] = si->l0_first[i] + entry_anas(si, &root, i);
+    }
+    si->total = si->l0_first[si->l0_len];
+    return 0;
+}
+
+void search_index_free(search_index *si) {
+    free(si->counts);
+    free(si->counted);
+    free(si->l0_first);
+    si->counts = NULL;
+    si->counted = NULL;
+    si->l0_first = NULL;
+    si->total = 0;
+}
+
+// Takes the branch holding anagram k of p's subtree, leaving k within it
+static bool descend(const search_index *si, path *p, uint64_t *k) {
+    for (int i = p->idx; i < si->dict_by_char_len[p->ch]; i++) {
+        char_counts next;
+        uint64_t anas;
+        for (int c = 1; take_entry(si, p, i, c, &next, &anas); c++) {
+            uint64_t block = p->weight * anas;
+            if (*k < block) {
+                path_push(si, p, i, c, &next);
+                return true;
+            }
+            *k -= block;
+        }
+    }
+    return false;
+}
+
+int search_index_unrank(const search_index *si, uint64_t k, char *out) {
+    if (k >= si->total) return -1;
+
+    // the L0 word: the last one starting at or before k
+    uint32_t lo = 0, hi = si->l0_len;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (si->l0_first[mid] <= k) lo = mid; else hi = mid;
+    }
+    path p;
+    path_start(si, &p);
+    p.idx = lo;
+    k -= si->l0_first[lo];
+    while (p.rem.length) {
+        if (!descend(si, &p, &k)) return -1;
+    }
+
+    // the strings of each entry, in recurse_string_combs order
+    const char *strs[MAX_WORD_LENGTH];
+    uint8_t counts[MAX_WORD_LENGTH];
+    int nstrs = 0;
+    for (int j = 0; j < p.len; j++) {
+        int r = p.count[j];
+        for (int s = 0; r > 0 && s < p.ccs[j]->strings_len; s++) {
+            int x = 0;
+            for (; x < r; x++) {
+                counts[nstrs] = x;
+                uint64_t block = strings_anas(&p, counts, nstrs + (x > 0), j, s, r - x);
+                if (k < block) break;
+                k -= block;
+            }
+            if (x) {
+                strs[nstrs] = p.ccs[j]->strings[s];
+                counts[nstrs++] = x;
+                r -= x;
+            }
+        }
+    }
+
+    // the ordering of the words, lexicographic over strs
+    int pos = 0;
+    for (int w = 0; w < p.words; w++) {
+        int d = 0;
+        for (; d < nstrs; d++) {
+            if (!counts[d]) continue;
+            counts[d]--;
+            uint64_t block = multinomial(counts, nstrs);
+            if (k < block) break;
+            k -= block;
+            counts[d]++;
+        }
+        if (d == nstrs) return -1;
+        size_t len = strlen(strs[d]);
+        if (pos + len + 1 > MAX_STR_LENGTH) return -1;
+        if (w) out[pos++] = ' ';
+        memcpy(out + pos, strs[d], len);
+        pos += len;
+    }
+    out[pos] = '\0';
+    return 0;
+}
+
+// A sentence word: its entry's bucket and index, and which of its strings
+typedef struct {
+    int ch, i, s;
+} word_ref;
+
+static bool find_word(const search_index *si, const char *word, word_ref *ref) {
+    char_counts cc;
+    if (char_counts_create(word, &cc) || cc.length == 0) return false;  // true on a char not in the seed
+    ref->ch = first_char(&cc, 0);
+    for (ref->i = 0; ref->i < si->dict_by_char_len[ref->ch]; ref->i++) {
+        char_counts_strings *ccs = (*si->dict_by_char)[ref->ch][ref->i];
+        if (!char_counts_equal(&ccs->counts, &cc)) continue;
+        for (ref->s = 0; ref->s < ccs->strings_len; ref->s++) {
+            if (strcmp(ccs->strings[ref->s], word) == 0) return true;
+        }
+    }
+    return false;
+}
+
+uint64_t search_index_rank(const search_index *si, const char *sentence) {
+    word_ref refs[MAX_WORD_LENGTH];
+    int nwords = 0;
+    for (const char *w = sentence; ; ) {
+        const char *end = strchr(w, ' ');
+        size_t len = end ? (size_t) (end - w) : strlen(w);
+        char word[MAX_STR_LENGTH];
+        if (nwords == MAX_WORD_LENGTH || len >= MAX_STR_LENGTH) return UINT64_MAX;
+        memcpy(word, w, len);
+        word[len] = '\0';
+        if (!find_word(si, word, refs + nwords++)) return UINT64_MAX;
+        if (!end) break;
+        w = end + 1;
+    }
+
+    // the entries in the order the tree takes them
+    word_ref sorted[MAX_WORD_LENGTH];
+    for (int w = 0; w < nwords; w++) {
+        int k = w;
+        for (; k > 0 && (sorted[k - 1].ch > refs[w].ch ||
+                         (sorted[k - 1].ch == refs[w].ch && sorted[k - 1].i > refs[w].i)); k--) {
+            sorted[k] = sorted[k - 1];
+        }
+        sorted[k] = refs[w];
+    }
+
+    uint64_t rank = 0;
+    path p;
+    path_start(si, &p);
+    for (int w = 0; w < nwords; ) {
+        int ch = sorted[w].ch, i = sorted[w].i, c = 0;
+        while (w + c < nwords && sorted[w + c].ch == ch && sorted[w + c].i == i) c++;
+        w += c;
+        if (ch != p.ch || i < p.idx) return UINT64_MAX;
+        if (p.len == 0) {
+            rank += si->l0_first[i];
+        } else {
+            for (int before = p.idx; before < i; before++) rank += entry_anas(si, &p, before);
+        }
+        char_counts next;
+        uint64_t anas;
+        for (int fewer = 1; fewer < c; fewer++) {
+            take_entry(si, &p, i, fewer, &next, &anas);
+            rank += p.weight * anas;
+        }
+        if (!take_entry(si, &p, i, c, &next, &anas)) return UINT64_MAX;
+        path_push(si, &p, i, c, &next);
+    }
+    if (p.rem.length) return UINT64_MAX;
+
+    // the strings of each entry, then the ordering, as search_index_unrank picks them
+    const char *strs[MAX_WORD_LENGTH];
+    uint8_t counts[MAX_WORD_LENGTH];
+    int nstrs = 0;
+    for (int j = 0; j < p.len; j++) {
+        int r = p.count[j];
+        for (int s = 0; r > 0 && s < p.ccs[j]->strings_len; s++) {
+            int x = 0;
+            for (int w = 0; w < nwords; w++) {
+                x += (*si->dict_by_char)[refs[w].ch][refs[w].i] == p.ccs[j] && refs[w].s == s;
+            }
+            for (int fewer = 0; fewer < x; fewer++) {
+                counts[nstrs] = fewer;
+                rank += strings_anas(&p, counts, nstrs + (fewer > 0), j, s, r - fewer);
+            }
+            if (x) {
+                strs[nstrs] = p.ccs[j]->strings[s];
+                counts[nstrs++] = x;
+                r -= x;
+            }
+        }
+    }
+    for (int w = 0; w < nwords; w++) {
+        const char *str = (*si->dict_by_char)[refs[w].ch][refs[w].i]->strings[refs[w].s];
+        for (int d = 0; d < nstrs && strs[d] != str; d++) {
+            if (!counts[d]) continue;
+            counts[d]--;
+            rank += multinomial(counts, nstrs);
+            counts[d]++;
+        }
+        for (int d = 0; d < nstrs; d++) {
+            if (strs[d] == str) counts[d]--;
+        }
+    }
+    return rank;
+}
@@ -0,0 +1,45 @@
+#ifndef ANABRUTE_SEARCH_INDEX_H
+#define ANABRUTE_SEARCH_INDEX_H
+
+#include "common.h"
+#include "permut_types.h"
+
+/*
+ * The anagrams a run hashes, numbered 0..total-1 in a fixed order: multisets
+ * of dictionary entries in the order recurse_dict_words takes them, then the
+ * entries' strings in the order recurse_string_combs spreads their copies
+ * over them, then the distinct orderings of the words in lexicographic order
+ * (words compared by entry, then string, as listed). Built from counts of
+ * every subtree of the enumeration, memoized per remainder, so any rank maps
+ * to its sentence and back without enumerating what comes before it.
+ */
+#define SEARCH_INDEX_MAX_REMAINDERS (1u << 24)
+
+typedef struct {
+    char_counts seed;
+    char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE];
+    int *dict_by_char_len;
+    uint32_t rem_mul[CHARCOUNT];  // remainder index: its counts in mixed radix over the seed's
+    uint64_t *counts;             // per remainder index, see count_from in search_index.c
+    uint8_t *counted;
+    int l0_char;                  // the bucket the enumerators split by L0 word
+    uint32_t l0_len;
+    uint64_t *l0_first;           // rank of the first anagram of each L0 word, l0_first[l0_len] = total
+    uint64_t total;
+} search_index;
+
+// Counts the search space of seed over dict_by_char (both kept by reference);
+// -1 if its remainders are too many to index or allocation fails
+int search_index_create(search_index *si, char_counts *seed, char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE],
+                        int *dict_by_char_len);
+void search_index_free(search_index *si);
+
+// The anagram of rank k into out (MAX_STR_LENGTH), words separated by
+// spaces; -1 if k >= total
+int search_index_unrank(const search_index *si, uint64_t k, char *out);
+
+// Rank of a sentence of dictionary words separated by single spaces;
+// UINT64_MAX if the enumeration never produces it
+uint64_t search_index_rank(const search_index *si, const char *sentence);
+
+#endif //ANABRUTE_SEARCH_INDEX_H
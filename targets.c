@@ -0,0 +1,164 @@
+#include "targets.h"
+
+int target_filter_init(target_filter *f, uint32_t keys_num) {
+    uint64_t want = ((uint64_t)keys_num * TARGET_FILTER_BITS_PER_KEY + 31) / 32;
+    uint32_t words = 32, shift = 32 - 5;
+    while (words < want && words < TARGET_FILTER_MAX_WORDS) {
+        words <<= 1;
+        shift--;
+    }
+    f->words = calloc(words, sizeof(uint32_t));
+    f->shift = shift;
+    return f->words ? 0 : -1;
+}
+
+void target_filter_free(target_filter *f) {
+    free(f->words);
+    f->words = NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Fills the nodes in order from sorted (key << 32 | id) by an iterative walk */
+static void eytzinger_fill(target_table *t, const uint64_t *sorted) {
+    uint32_t i = 0;
+    uint64_t k = 1;
+    while (k <= t->num) k = 2 * k;
+    for (;;) {
+        k >>= __builtin_ffsll((long long)~k);  // back up to the next unvisited node
+        if (!k) return;
+        t->keys[k] = (uint32_t)(sorted[i] >> 32);
+        t->ids[k] = (uint32_t)sorted[i];
+        i++;
+        k = 2 * k + 1;
+        while (k <= t->num) k = 2 * k;
+    }
+}
+
+int target_table_init(target_table *t, const uint32_t *hashes, const uint32_t *ids, uint32_t num) {
+    t->num = num;
+    t->keys = malloc(sizeof(uint32_t) * ((size_t)num + 1));
+    t->ids = malloc(sizeof(uint32_t) * ((size_t)num + 1));
+    uint64_t *sorted = malloc(sizeof(uint64_t) * ((size_t)num + 1));
+    if (!t->keys || !t->ids || !sorted) {
+        free(sorted);
+        target_table_free(t);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        uint32_t ih = ids ? ids[i] : i;
+        sorted[i] = (uint64_t)hashes[4 * ih] << 32 | ih;
+    }
+    qsort(sorted, num, sizeof(uint64_t), cmp_u64);
+
+    eytzinger_fill(t, sorted);
+    free(sorted);
+    return 0;
+}
+
+void target_table_free(target_table *t) {
+    free(t->keys);
+    free(t->ids);
+    t->keys = NULL;
+    t->ids = NULL;
+    t->num = 0;
+}
+
+int target_set_create(target_set *s, const uint32_t *hashes, uint32_t hashes_num) {
+    s->hashes = hashes;
+    s->hashes_num = hashes_num;
+    s->found = calloc(hashes_num ? hashes_num : 1, 1);
+    s->found_log = malloc(sizeof(uint32_t) * (hashes_num ? hashes_num : 1));
+    s->current = calloc(1, sizeof(target_snapshot));
+    if (!s->found || !s->found_log || !s->current) {
+        free(s->found);
+        free(s->found_log);
+        free(s->current);
+        return -1;
+    }
+    s->found_num = 0;
+    s->version = 0;
+    s->current->num = hashes_num;
+    s->current->refs = 1;  // held by the set
+    s->found_at_current = 0;
+    return pthread_mutex_init(&s->mutex, NULL);
+}
+
+void target_set_free(target_set *s) {
+    target_set_release(s, s->current);
+    s->current = NULL;
+    free(s->found);
+    free(s->found_log);
+    s->found = NULL;
+    s->found_log = NULL;
+    pthread_mutex_destroy(&s->mutex);
+}
+
+target_snapshot *target_set_acquire(target_set *s) {
+    pthread_mutex_lock(&s->mutex);
+    target_snapshot *snap = s->current;
+    snap->refs++;
+    pthread_mutex_unlock(&s->mutex);
+    return snap;
+}
+
+static void target_snapshot_unref(target_snapshot *snap) {
+    if (--snap->refs == 0) {
+        free(snap->ids);
+        free(snap);
+    }
+}
+
+void target_set_release(target_set *s, target_snapshot *snap) {
+    pthread_mutex_lock(&s->mutex);
+    target_snapshot_unref(snap);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* Publishes a snapshot without the found targets; keeps current on failure */
+static void target_set_compact(target_set *s) {
+    target_snapshot *snap = malloc(sizeof(target_snapshot));
+    uint32_t num = s->hashes_num - s->found_num;
+    uint32_t *ids = malloc(sizeof(uint32_t) * (num ? num : 1));
+    if (!snap || !ids) {
+        free(snap);
+        free(ids);
+        return;
+    }
+    const target_snapshot *cur = s->current;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < cur->num; i++) {
+        uint32_t ih = target_snapshot_id(cur, i);
+        if (!s->found[ih]) ids[n++] = ih;
+    }
+    snap->version = cur->version + 1;
+    snap->num = n;
+    snap->ids = ids;
+    snap->refs = 1;
+    target_snapshot_unref(s->current);
+    s->current = snap;
+    s->found_at_current = s->found_num;
+    s->version = snap->version;
+}
+
+bool target_set_mark_found(target_set *s, uint32_t ih) {
+    if (s->found[ih]) return false;  // racy peek, rechecked below
+    pthread_mutex_lock(&s->mutex);
+    bool is_new = !s->found[ih];
+    if (is_new) {
+        s->found[ih] = 1;
+        s->found_log[s->found_num] = ih;
+        __sync_synchronize();  // log entry before the count readers poll
+        s->found_num++;
+        uint32_t stale = s->found_num - s->found_at_current;
+        if (s->current->num <= TARGET_SET_EAGER_MAX ||
+            (uint64_t)stale * TARGET_SET_REBUILD_DIV >= s->current->num)
+            target_set_compact(s);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return is_new;
+}
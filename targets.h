@@ -0,0 +1,119 @@
+#ifndef ANABRUTE_TARGETS_H
+#define ANABRUTE_TARGETS_H
+
+#include "common.h"
+
+/*
+ * Lookup structures for large target hash lists (10^5..10^8 hashes), where
+ * comparing every candidate against every target is no longer an option.
+ */
+
+/*
+ * Blocked Bloom filter over 32-bit keys: a key selects one 32-bit word by the
+ * top bits of key * TARGET_FILTER_MUL and sets two bits in it, picked by the
+ * low 10 bits of the key. A probe is one load (one SIMD gather per vector).
+ */
+#define TARGET_FILTER_MUL 0x9e3779b1u
+#define TARGET_FILTER_BITS_PER_KEY 16
+#define TARGET_FILTER_MAX_WORDS (1u << 25)  // 128 MB
+
+typedef struct {
+    uint32_t *words;
+    uint32_t shift;  // word index = (key * TARGET_FILTER_MUL) >> shift
+} target_filter;
+
+int target_filter_init(target_filter *f, uint32_t keys_num);
+void target_filter_free(target_filter *f);
+
+static inline uint32_t target_filter_bits(uint32_t key) {
+    return (1u << (key & 31)) | (1u << ((key >> 5) & 31));
+}
+
+static inline void target_filter_add(target_filter *f, uint32_t key) {
+    f->words[(key * TARGET_FILTER_MUL) >> f->shift] |= target_filter_bits(key);
+}
+
+static inline bool target_filter_maybe(const target_filter *f, uint32_t key) {
+    uint32_t bits = target_filter_bits(key);
+    return (f->words[(key * TARGET_FILTER_MUL) >> f->shift] & bits) == bits;
+}
+
+/*
+ * Target digests ordered by hash[0] in Eytzinger (BFS) layout: node k has
+ * children 2k and 2k+1, so the first levels of every search share a few cache
+ * lines. keys[k] is hash[0] of target ids[k]; slot 0 is unused.
+ */
+typedef struct {
+    uint32_t num;
+    uint32_t *keys;
+    uint32_t *ids;
+} target_table;
+
+/* Indexes targets ids[0..num) of hashes (targets 0..num if ids is NULL) */
+int target_table_init(target_table *t, const uint32_t *hashes, const uint32_t *ids, uint32_t num);
+void target_table_free(target_table *t);
+
+/* Node of the first key >= key in sorted order, 0 if there is none */
+static inline uint32_t target_table_lower(const target_table *t, uint32_t key) {
+    uint64_t k = 1;
+    while (k <= t->num) k = 2 * k + (t->keys[k] < key);
+    return (uint32_t)(k >> __builtin_ffsll((long long)~k));
+}
+
+/* In-order successor of node k, 0 past the last one */
+static inline uint32_t target_table_next(const target_table *t, uint32_t k) {
+    uint64_t n = k;
+    if (2 * n + 1 <= t->num) {
+        n = 2 * n + 1;
+        while (2 * n <= t->num) n = 2 * n;
+        return (uint32_t)n;
+    }
+    return (uint32_t)(n >> __builtin_ffsll((long long)~n));
+}
+
+/*
+ * Versioned set of the targets not found yet, RCU style: crunchers hold a
+ * reference to a snapshot and check `version` between buffers to reload it.
+ * Found targets are flagged at once and dropped by publishing a new snapshot;
+ * the old one is freed when its last reader releases it. A stale snapshot is
+ * still correct, it only keeps comparing against found targets, so large
+ * sets are only compacted once a fair share of them is found.
+ */
+#define TARGET_SET_EAGER_MAX 4096   // smaller snapshots are rebuilt on every find
+#define TARGET_SET_REBUILD_DIV 64   // larger ones once 1/64 of them is found
+
+typedef struct target_snapshot_s {
+    uint32_t version;
+    uint32_t num;
+    uint32_t *ids;   // indexes into the full hash list, NULL: 0..num-1
+    uint32_t refs;
+} target_snapshot;
+
+static inline uint32_t target_snapshot_id(const target_snapshot *snap, uint32_t i) {
+    return snap->ids ? snap->ids[i] : i;
+}
+
+typedef struct target_set_s {
+    const uint32_t *hashes;
+    uint32_t hashes_num;
+    uint8_t *found;                // per target
+    uint32_t *found_log;           // ids in the order they were found
+    volatile uint32_t found_num;
+    volatile uint32_t version;     // of current
+    target_snapshot *current;
+    uint32_t found_at_current;     // found_num when current was published
+    pthread_mutex_t mutex;
+} target_set;
+
+int target_set_create(target_set *s, const uint32_t *hashes, uint32_t hashes_num);
+void target_set_free(target_set *s);
+target_snapshot *target_set_acquire(target_set *s);
+void target_set_release(target_set *s, target_snapshot *snap);
+/* Returns true if ih was not found before */
+bool target_set_mark_found(target_set *s, uint32_t ih);
+
+static inline uint32_t target_set_remaining(const target_set *s) {
+    return s->hashes_num - s->found_num;
+}
+
+#endif //ANABRUTE_TARGETS_H
@@ -2,18 +2,57 @@
 #include "fact.h"
 
 tasks_buffer* tasks_buffer_allocate() {
+    return tasks_buffer_allocate_with(NULL);
+}
+
+// Helper: a buffer with room for PERMUT_TASKS_IN_KERNEL_TASK tasks of task_size bytes
+static tasks_buffer* allocate_buffer(tasks_buffer_allocator *allocator, size_t task_size, void **tasks) {
     tasks_buffer* buffer = calloc(1, sizeof(tasks_buffer));
     if(!buffer) return NULL;
 
-    buffer->permut_tasks = calloc(PERMUT_TASKS_IN_KERNEL_TASK, sizeof(permut_task));
+    const size_t size = PERMUT_TASKS_IN_KERNEL_TASK * task_size;
+    *tasks = NULL;
+    if (allocator) {
+        *tasks = allocator->alloc(allocator->ctx, size, &buffer->handle);
+        if (*tasks) {
+            buffer->allocator = allocator;
+            memset(*tasks, 0, size);
+        }
+    }
+    if (!*tasks) {
+        *tasks = calloc(PERMUT_TASKS_IN_KERNEL_TASK, task_size);
+        if (!*tasks) {
+            free(buffer);
+            return NULL;
+        }
+    }
     buffer->num_tasks = 0;
     buffer->num_anas = 0;
     return buffer;
 }
 
+tasks_buffer* tasks_buffer_allocate_with(tasks_buffer_allocator *allocator) {
+    void *tasks;
+    tasks_buffer* buffer = allocate_buffer(allocator, sizeof(permut_task), &tasks);
+    if (buffer) buffer->permut_tasks = tasks;
+    return buffer;
+}
+
+tasks_buffer* tasks_buffer_allocate_compact_with(tasks_buffer_allocator *allocator) {
+    void *tasks;
+    tasks_buffer* buffer = allocate_buffer(allocator, sizeof(compact_task), &tasks);
+    if (buffer) buffer->compact_tasks = tasks;
+    return buffer;
+}
+
 void tasks_buffer_free(tasks_buffer* buf) {
     if (buf) {
-        free(buf->permut_tasks);
+        void *tasks = buf->compact_tasks ? (void *) buf->compact_tasks : (void *) buf->permut_tasks;
+        if (buf->allocator) {
+            buf->allocator->free(buf->allocator->ctx, tasks, buf->handle);
+        } else {
+            free(tasks);
+        }
         free(buf);
     }
 }
@@ -27,22 +66,75 @@ bool tasks_buffer_isfull(tasks_buffer* buf) {
     return buf->num_tasks >= PERMUT_TASKS_IN_KERNEL_TASK;
 }
 
+// Helper: orderings of n values that only tell unequal ones apart, built up
+// one value at a time (exact at every step: it counts the first k+1 values)
+static uint64_t distinct_orderings(const uint16_t *values, int n) {
+    uint64_t perms = 1;
+    for (int k = 0; k < n; k++) {
+        int same = 1;
+        for (int j = 0; j < k; j++) same += values[j] == values[k];
+        perms = perms * (k + 1) / same;
+    }
+    return perms;
+}
+
+uint64_t permut_task_perms(const permut_task* task) {
+    if (!task->multiset) return fact(task->n);
+    uint16_t values[MAX_OFFSETS_LENGTH];
+    for (int k = 0; k < task->n; k++) values[k] = task->a[k];
+    return distinct_orderings(values, task->n);
+}
+
+uint64_t compact_task_perms(const compact_task* task) {
+    if (!task->multiset) return fact(task->n);
+    uint16_t values[MAX_WORD_LENGTH];
+    int n = 0;
+    for (int k = 0; k < MAX_WORD_LENGTH; k++) {
+        if (task->permutable & (1u << k)) values[n++] = task->words[k];
+    }
+    return distinct_orderings(values, n);
+}
+
 void tasks_buffer_add_task(tasks_buffer* buf, char* all_strs, int8_t* offsets) {
     permut_task *dst_task = buf->permut_tasks + buf->num_tasks;
 
     int permutable_count = 0;
-    int a_idx = 0;
+    bool multiset = false;
     for (int i=0; offsets[i]; i++) {
         if (offsets[i] > 0) {
+            for (int j=0; j<i; j++) multiset |= offsets[j] == offsets[i];
             permutable_count++;
+        }
+    }
 
-            dst_task->a[a_idx] = offsets[i];
-            offsets[i] = a_idx+1;
-            a_idx++;
+    if (multiset) {
+        // Sort a[] and number the slots left to right: Algorithm L walks a[]
+        // from ascending to descending order and changes a[0] slowest
+        int a_idx = 0;
+        for (int i=0; offsets[i]; i++) {
+            if (offsets[i] > 0) {
+                int k = a_idx++;
+                for (; k > 0 && dst_task->a[k-1] > offsets[i]; k--) dst_task->a[k] = dst_task->a[k-1];
+                dst_task->a[k] = offsets[i];
+                offsets[i] = a_idx;
+            }
+        }
+    } else {
+        // Number permutable slots right to left: the leftmost one gets a[n-1],
+        // which Heap's algorithm changes slowest, so consecutive permutations
+        // share their leading words (see md5_prefix_cache in avx_cruncher.c)
+        int a_idx = permutable_count;
+        for (int i=0; offsets[i]; i++) {
+            if (offsets[i] > 0) {
+                a_idx--;
+                dst_task->a[a_idx] = offsets[i];
+                offsets[i] = a_idx+1;
+            }
         }
     }
 
     dst_task->n = permutable_count;
+    dst_task->multiset = multiset;
     dst_task->i = 0;
     dst_task->iters_done = 0;
 
@@ -52,15 +144,49 @@ void tasks_buffer_add_task(tasks_buffer* buf, char* all_strs, int8_t* offsets) {
     memset(&dst_task->c, 0, MAX_OFFSETS_LENGTH);
 
     buf->num_tasks++;
-    buf->num_anas += fact(permutable_count);
+    buf->num_anas += permut_task_perms(dst_task);
+}
+
+void tasks_buffer_add_compact_task(tasks_buffer* buf, const uint16_t* word_ids, const int8_t* offsets) {
+    compact_task *dst_task = buf->compact_tasks + buf->num_tasks;
+    memset(dst_task, 0, sizeof(compact_task));
+
+    int permutable_count = 0;
+    for (int i=0; i<MAX_WORD_LENGTH && offsets[i]; i++) {
+        if (offsets[i] > 0) {
+            dst_task->words[i] = word_ids[offsets[i]-1];
+            dst_task->permutable |= 1u << i;
+            permutable_count++;
+        } else {
+            dst_task->words[i] = word_ids[-offsets[i]-1];
+        }
+    }
+    dst_task->n = permutable_count;
+
+    for (int i=0; i<MAX_WORD_LENGTH; i++) {
+        for (int j=0; j<i; j++) {
+            if (dst_task->permutable & (1u << i) && dst_task->permutable & (1u << j) &&
+                dst_task->words[j] == dst_task->words[i]) {
+                dst_task->multiset = 1;
+            }
+        }
+    }
+
+    buf->num_tasks++;
+    buf->num_anas += compact_task_perms(dst_task);
 }
 
 int tasks_buffers_create(tasks_buffers* buffs) {
     buffs->ring_head = 0;
     buffs->ring_tail = 0;
     buffs->ring_count = 0;
+    buffs->queued_anas = 0;
     buffs->num_free = 0;
+    buffs->allocator = NULL;
+    buffs->pool = NULL;
+    buffs->words = NULL;
     buffs->is_closed = false;
+    buffs->is_cancelled = false;
 
     for (int i=0; i<TASKS_BUFFERS_SIZE; i++) {
         buffs->ring[i] = NULL;
@@ -106,7 +232,7 @@ int tasks_buffers_add_buffer(tasks_buffers* buffs, tasks_buffer* buf) {
     errcode = pthread_mutex_lock(&buffs->mutex);
     ret_iferr(errcode, "failed to lock mutex while adding buffer");
 
-    while (buffs->ring_count >= TASKS_BUFFERS_SIZE) {
+    while (buffs->ring_count >= TASKS_BUFFERS_SIZE && !buffs->is_cancelled) {
         errcode = pthread_cond_wait(&buffs->not_full, &buffs->mutex);
         if (errcode) {
             pthread_mutex_unlock(&buffs->mutex);
@@ -114,9 +240,16 @@ int tasks_buffers_add_buffer(tasks_buffers* buffs, tasks_buffer* buf) {
         }
     }
 
+    if (buffs->is_cancelled) {
+        pthread_mutex_unlock(&buffs->mutex);
+        tasks_buffers_recycle(buffs, buf);
+        return 0;
+    }
+
     buffs->ring[buffs->ring_head % TASKS_BUFFERS_SIZE] = buf;
     buffs->ring_head++;
     buffs->ring_count++;
+    buffs->queued_anas += buf->num_anas;
 
     errcode = pthread_cond_signal(&buffs->not_empty);
     if (errcode) {
@@ -131,6 +264,45 @@ int tasks_buffers_add_buffer(tasks_buffers* buffs, tasks_buffer* buf) {
 
 
 int tasks_buffers_get_buffer(tasks_buffers* buffs, tasks_buffer** buf) {
+    return tasks_buffers_get_part(buffs, buf, UINT64_MAX);
+}
+
+// Permutations task idx of buf has left; compact ones have not started
+static uint64_t task_anas_left(const tasks_buffer *buf, uint32_t idx) {
+    if (buf->compact_tasks) return compact_task_perms(buf->compact_tasks + idx);
+    const permut_task *task = buf->permut_tasks + idx;
+    return task->i < task->n ? permut_task_perms(task) - task->iters_done : 0;
+}
+
+// Helper: moves the last tasks of head, up to max_anas of them but at least
+// one, to part; false if that would be all of them
+static bool split_buffer(tasks_buffer *head, tasks_buffer *part, uint64_t max_anas) {
+    uint32_t from = head->num_tasks;
+    uint64_t anas = 0;
+    while (from > 0) {
+        uint64_t left = task_anas_left(head, from - 1);
+        if (from < head->num_tasks && anas + left > max_anas) break;
+        anas += left;
+        from--;
+    }
+    if (!from) return false;
+
+    part->num_tasks = head->num_tasks - from;
+    part->num_anas = anas;
+    if (head->compact_tasks) {
+        memcpy(part->compact_tasks, head->compact_tasks + from, part->num_tasks * sizeof(compact_task));
+    } else {
+        memcpy(part->permut_tasks, head->permut_tasks + from, part->num_tasks * sizeof(permut_task));
+    }
+    head->num_tasks = from;
+    head->num_anas = head->num_anas > anas ? head->num_anas - anas : 0;
+    return true;
+}
+
+int tasks_buffers_get_part(tasks_buffers* buffs, tasks_buffer** buf, uint64_t max_anas) {
+    // the buffer a split goes to, obtained up front: the allocator may be slow
+    tasks_buffer *part = max_anas < UINT64_MAX && buffs->is_closed ? tasks_buffers_obtain(buffs) : NULL;
+
     int errcode=0;
     errcode = pthread_mutex_lock(&buffs->mutex);
     ret_iferr(errcode, "failed to lock mutex while removing buffer");
@@ -138,6 +310,7 @@ int tasks_buffers_get_buffer(tasks_buffers* buffs, tasks_buffer** buf) {
     while (buffs->ring_count == 0) {
         if (buffs->is_closed) {
             pthread_mutex_unlock(&buffs->mutex);
+            if (part) tasks_buffers_recycle(buffs, part);
             *buf = NULL;
             return 0;
         }
@@ -149,10 +322,19 @@ int tasks_buffers_get_buffer(tasks_buffers* buffs, tasks_buffer** buf) {
         }
     }
 
-    *buf = buffs->ring[buffs->ring_tail % TASKS_BUFFERS_SIZE];
+    tasks_buffer *head = buffs->ring[buffs->ring_tail % TASKS_BUFFERS_SIZE];
+    if (part && buffs->is_closed && head->num_anas > max_anas && split_buffer(head, part, max_anas)) {
+        buffs->queued_anas -= part->num_anas;
+        pthread_mutex_unlock(&buffs->mutex);
+        *buf = part;
+        return 0;
+    }
+
+    *buf = head;
     buffs->ring[buffs->ring_tail % TASKS_BUFFERS_SIZE] = NULL;
     buffs->ring_tail++;
     buffs->ring_count--;
+    buffs->queued_anas -= head->num_anas;
 
     errcode = pthread_cond_signal(&buffs->not_full);
     if (errcode) {
@@ -161,6 +343,7 @@ int tasks_buffers_get_buffer(tasks_buffers* buffs, tasks_buffer** buf) {
     }
 
     pthread_mutex_unlock(&buffs->mutex);
+    if (part) tasks_buffers_recycle(buffs, part);
 
     return 0;
 }
@@ -183,6 +366,39 @@ int tasks_buffers_close(tasks_buffers* buffs) {
     return 0;
 }
 
+int tasks_buffers_cancel(tasks_buffers* buffs) {
+    int errcode=0;
+    errcode = pthread_mutex_lock(&buffs->mutex);
+    ret_iferr(errcode, "failed to lock mutex while cancelling buffers");
+
+    buffs->is_closed = true;
+    buffs->is_cancelled = true;
+
+    while (buffs->ring_count > 0) {
+        uint32_t idx = buffs->ring_tail % TASKS_BUFFERS_SIZE;
+        if (buffs->num_free < TASKS_BUFFERS_SIZE) {
+            buffs->free_arr[buffs->num_free++] = buffs->ring[idx];
+        } else {
+            tasks_buffer_free(buffs->ring[idx]);
+        }
+        buffs->ring[idx] = NULL;
+        buffs->ring_tail++;
+        buffs->ring_count--;
+    }
+    buffs->queued_anas = 0;
+
+    errcode = pthread_cond_broadcast(&buffs->not_empty);
+    errcode |= pthread_cond_broadcast(&buffs->not_full);
+    if (errcode) {
+        pthread_mutex_unlock(&buffs->mutex);
+        ret_iferr(errcode, "failed to broadcast cancel");
+    }
+
+    pthread_mutex_unlock(&buffs->mutex);
+
+    return 0;
+}
+
 int tasks_buffers_num_ready(tasks_buffers* buffs) {
     // opportunistically peek
     if (buffs->is_closed) {
@@ -193,6 +409,7 @@ int tasks_buffers_num_ready(tasks_buffers* buffs) {
 }
 
 tasks_buffer* tasks_buffers_obtain(tasks_buffers* buffs) {
+    if (buffs->pool) return tasks_buffers_obtain(buffs->pool);
     pthread_mutex_lock(&buffs->mutex);
     tasks_buffer *buf = NULL;
     if (buffs->num_free > 0) {
@@ -204,17 +421,26 @@ tasks_buffer* tasks_buffers_obtain(tasks_buffers* buffs) {
         tasks_buffer_reset(buf);
         return buf;
     }
-    return tasks_buffer_allocate();
+    return tasks_buffers_allocate(buffs);
+}
+
+tasks_buffer* tasks_buffers_allocate(tasks_buffers* buffs) {
+    if (buffs->pool) return tasks_buffers_allocate(buffs->pool);
+    return buffs->words ? tasks_buffer_allocate_compact_with(buffs->allocator)
+                        : tasks_buffer_allocate_with(buffs->allocator);
 }
 
 void tasks_buffers_recycle(tasks_buffers* buffs, tasks_buffer* buf) {
+    if (buffs->pool) {
+        tasks_buffers_recycle(buffs->pool, buf);
+        return;
+    }
     pthread_mutex_lock(&buffs->mutex);
     if (buffs->num_free < TASKS_BUFFERS_SIZE) {
         buffs->free_arr[buffs->num_free++] = buf;
         pthread_mutex_unlock(&buffs->mutex);
     } else {
         pthread_mutex_unlock(&buffs->mutex);
-        free(buf->permut_tasks);
-        free(buf);
+        tasks_buffer_free(buf);
     }
 }
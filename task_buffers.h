@@ -9,21 +9,56 @@ typedef struct permut_task_s {
     uint8_t a[MAX_OFFSETS_LENGTH];
     uint8_t c[MAX_OFFSETS_LENGTH];
     uint16_t i;     // 32_t to align structure to longs
-    uint16_t n;
+    uint8_t n;
+    uint8_t multiset;  // a[] repeats words: stepped in lexicographic order (Algorithm L), not by Heap's
     uint32_t iters_done;
 } permut_task;
 
+// Compact form of a fresh task (20 bytes, against 96): the ids of its words in
+// a word table (word_table.h) instead of their bytes, and which of them are
+// permuted; consumers expand it into the permut_task tasks_buffer_add_task
+// would have written (word_table_expand, expand_tasks in permut.cl)
+typedef struct compact_task_s {
+    uint16_t words[MAX_WORD_LENGTH];  // word ids in sentence order, 0-terminated unless all are used
+    uint8_t permutable;               // bit k: words[k] is permuted, the others stay in place
+    uint8_t n;                        // permuted words
+    uint8_t multiset;                 // some permuted word is used more than once, see permut_task
+    uint8_t reserved;                 // keeps tasks 4-byte aligned on the devices
+} compact_task;
+
+// Where task storage comes from when not the heap, e.g. memory a GPU backend
+// uploads from without staging it (opencl_tasks_buffer_allocator_create)
+typedef struct tasks_buffer_allocator_s {
+    void *(*alloc)(void *ctx, size_t size, void **handle);  // NULL on failure
+    void (*free)(void *ctx, void *ptr, void *handle);
+    void *ctx;
+} tasks_buffer_allocator;
+
+// Holds either permut_tasks or compact_tasks, as its queue's words say
 typedef struct tasks_buffer_s {
-    permut_task *permut_tasks;
+    permut_task *permut_tasks;    // NULL in a compact buffer
+    compact_task *compact_tasks;  // NULL in a full one
     uint32_t num_tasks;
     uint64_t num_anas;
+    tasks_buffer_allocator *allocator;  // of the tasks, NULL for the heap
+    void *handle;
 } tasks_buffer;
 
 tasks_buffer* tasks_buffer_allocate();
+tasks_buffer* tasks_buffer_allocate_with(tasks_buffer_allocator *allocator);  // heap if it fails
+tasks_buffer* tasks_buffer_allocate_compact_with(tasks_buffer_allocator *allocator);
 void tasks_buffer_free(tasks_buffer* buf);
 void tasks_buffer_reset(tasks_buffer* buf);
 bool tasks_buffer_isfull(tasks_buffer* buf);
+// A positive offset used by more than one slot is a word used that many times:
+// the task then stands for the distinct orderings of its permutable words only
 void tasks_buffer_add_task(tasks_buffer* buf, char* all_strs, int8_t* offsets);
+// Same task in a compact buffer: word_ids[k] is the id of the word at all_strs+k
+void tasks_buffer_add_compact_task(tasks_buffer* buf, const uint16_t* word_ids, const int8_t* offsets);
+
+// Permutations a fresh task runs: n!, over the factorials of the repeats of a multiset task
+uint64_t permut_task_perms(const permut_task* task);
+uint64_t compact_task_perms(const compact_task* task);
 
 typedef struct tasks_buffers_s {
     // Ring buffer for ready tasks (O(1) insert/remove)
@@ -31,11 +66,16 @@ typedef struct tasks_buffers_s {
     uint32_t ring_head;    // producer writes at ring[head % SIZE]
     uint32_t ring_tail;    // consumer reads at ring[tail % SIZE]
     volatile uint32_t ring_count;  // occupied slots (volatile for lock-free peek)
+    volatile uint64_t queued_anas; // num_anas of the queued buffers
     volatile bool is_closed;
+    volatile bool is_cancelled;  // closed early: queued work is dropped, producers should stop
 
     // Free-list: returned buffers available for reuse (no malloc/free after warmup)
     tasks_buffer* free_arr[TASKS_BUFFERS_SIZE];
     uint32_t num_free;
+    tasks_buffer_allocator *allocator;  // for new buffers, NULL for the heap; must outlive them
+    struct tasks_buffers_s *pool;       // obtain and recycle through this queue's free-list, NULL: own
+    const struct word_table_s *words;   // compact buffers' word table, NULL: full buffers; must outlive them
 
     pthread_mutex_t mutex;
     pthread_cond_t not_full;
@@ -46,9 +86,15 @@ int tasks_buffers_create(tasks_buffers* buffs);
 int tasks_buffers_free(tasks_buffers* buffs);
 int tasks_buffers_add_buffer(tasks_buffers* buffs, tasks_buffer* buf);
 int tasks_buffers_get_buffer(tasks_buffers* buffs, tasks_buffer** buf);
+// Like tasks_buffers_get_buffer, but once the queue is closed a buffer of more
+// than max_anas permutations is split: the caller gets its last tasks (at
+// least one, up to max_anas) and the rest stays queued for the other consumers
+int tasks_buffers_get_part(tasks_buffers* buffs, tasks_buffer** buf, uint64_t max_anas);
 int tasks_buffers_close(tasks_buffers* buffs);
+int tasks_buffers_cancel(tasks_buffers* buffs);  // close, drop queued buffers, unblock producers
 int tasks_buffers_num_ready(tasks_buffers* buffs);
 tasks_buffer* tasks_buffers_obtain(tasks_buffers* buffs);   // get from free-list or allocate
+tasks_buffer* tasks_buffers_allocate(tasks_buffers* buffs);  // a new buffer of the queue's kind
 void tasks_buffers_recycle(tasks_buffers* buffs, tasks_buffer* buf);  // return to free-list
 
 #endif //ANABRUTE_TASK_BUFFERS_H
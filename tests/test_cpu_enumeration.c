@@ -1,10 +1,20 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include "cpu_cruncher.h"
 #include "dict.h"
 #include "seedphrase.h"
+#include "word_table.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
 
 static int cmp_ccs_length_desc(const void *a, const void *b) {
     const char_counts_strings *ca = *(const char_counts_strings *const *)a;
@@ -21,10 +31,11 @@ static void write_file(const char *path, const char *content) {
 
 /*
  * Helper: loads dict, organizes into dict_by_char, runs single-threaded
- * CPU cruncher, collects all produced tasks.
+ * CPU cruncher, collects all produced tasks. With compact set, the queue
+ * takes compact tasks and they are expanded against the word table.
  * Returns total number of tasks. Caller must free(*out_tasks) if non-NULL.
  */
-static uint32_t run_cruncher_with_dict(const char *dict_path, permut_task **out_tasks) {
+static uint32_t run_cruncher_with_dict_as(const char *dict_path, bool compact, permut_task **out_tasks) {
     char_counts seed;
     char_counts_create(seed_phrase_str, &seed);
 
@@ -55,6 +66,12 @@ static uint32_t run_cruncher_with_dict(const char *dict_path, permut_task **out_
     /* Create tasks_buffers */
     tasks_buffers tasks_buffs;
     tasks_buffers_create(&tasks_buffs);
+    word_table words = {0};
+    if (compact) {
+        TEST_ASSERT(word_table_create(&words, &seed, &dict_by_char, dict_by_char_len) == 0,
+                    "failed to create word table");
+        tasks_buffs.words = &words;
+    }
 
     /* Run CPU cruncher single-threaded */
     volatile uint32_t shared_l0_counter = 0;
@@ -80,13 +97,21 @@ static uint32_t run_cruncher_with_dict(const char *dict_path, permut_task **out_
             tasks_capacity = total_tasks + buf->num_tasks + 64;
             *out_tasks = realloc(*out_tasks, tasks_capacity * sizeof(permut_task));
         }
-        memcpy(*out_tasks + total_tasks, buf->permut_tasks,
-               buf->num_tasks * sizeof(permut_task));
+        if (compact) {
+            TEST_ASSERT(buf->compact_tasks, "should queue compact tasks");
+            for (uint32_t i = 0; i < buf->num_tasks; i++) {
+                word_table_expand(&words, &buf->compact_tasks[i], *out_tasks + total_tasks + i);
+            }
+        } else {
+            memcpy(*out_tasks + total_tasks, buf->permut_tasks,
+                   buf->num_tasks * sizeof(permut_task));
+        }
         total_tasks += buf->num_tasks;
         tasks_buffers_recycle(&tasks_buffs, buf);
     }
 
     tasks_buffers_free(&tasks_buffs);
+    word_table_free(&words);
 
     for (uint32_t i = 0; i < dict_length; i++) {
         char_counts_strings_free(&dict[i]);
@@ -95,6 +120,25 @@ static uint32_t run_cruncher_with_dict(const char *dict_path, permut_task **out_
     return total_tasks;
 }
 
+static uint32_t run_cruncher_with_dict(const char *dict_path, permut_task **out_tasks) {
+    return run_cruncher_with_dict_as(dict_path, false, out_tasks);
+}
+
+/*
+ * Helper: a task's sentence as enumerated, words in slot order, each
+ * permuted one marked with '*' (the layout of all_strs does not matter)
+ */
+static void render_task(const permut_task *task, char *out) {
+    out[0] = 0;
+    for (int io = 0; io < MAX_OFFSETS_LENGTH && task->offsets[io]; io++) {
+        int off = task->offsets[io];
+        bool permuted = off > 0;
+        off = permuted ? task->a[off - 1] - 1 : -off - 1;
+        strcat(out, task->all_strs + off);
+        strcat(out, permuted ? "* " : " ");
+    }
+}
+
 /*
  * Test 1: Single word that IS the seed phrase.
  * "tyranousplutotwits" is an exact anagram → 1 task with n=1.
@@ -175,12 +219,115 @@ void test_no_valid_anagrams(void) {
     printf("  PASS: test_no_valid_anagrams\n");
 }
 
+/*
+ * Test 5: a multiset of words, one of them used three times, is one task
+ * whose slots all permute: "tyranous wiso t t t plu", 6!/3! = 120 orderings
+ * (not the C(6,3) placements of the t's, each with the other words permuted).
+ */
+void test_one_task_per_multiset(void) {
+    const char *path = "/tmp/anabrute_test_cpu_multiset.txt";
+    write_file(path, "tyranous\nplu\nwiso\nt\n");
+
+    permut_task *tasks = NULL;
+    uint32_t count = run_cruncher_with_dict(path, &tasks);
+    TEST_ASSERT(count == 1, "should queue one task for the multiset");
+    TEST_ASSERT(tasks[0].n == 6 && tasks[0].multiset, "every word should be permuted");
+    TEST_ASSERT(permut_task_perms(&tasks[0]) == 120, "should count the distinct orderings");
+
+    char str[4 * MAX_STR_LENGTH];
+    render_task(&tasks[0], str);
+    TEST_ASSERT(strcmp(str, "tyranous* wiso* t* t* t* plu* ") == 0, "should start with the words in all_strs order");
+
+    free(tasks);
+    unlink(path);
+    printf("  PASS: test_one_task_per_multiset\n");
+}
+
+/*
+ * Test 6: compact tasks expand to the tasks the full queue gets, in the same
+ * order, on a dictionary with anagrams and repeated words (multiset tasks).
+ */
+void test_compact_tasks(void) {
+    const char *path = "/tmp/anabrute_test_cpu_compact.txt";
+    write_file(path, "tyranous\nsutonary\npluto\ntwits\nwitts\nto\nt\nsy\nur\nan\nplu\nwi\n");
+
+    permut_task *full = NULL, *compact = NULL;
+    uint32_t full_count = run_cruncher_with_dict(path, &full);
+    uint32_t compact_count = run_cruncher_with_dict_as(path, true, &compact);
+    TEST_ASSERT(full_count > 0 && compact_count == full_count, "should queue as many tasks");
+
+    uint32_t multisets = 0;
+    for (uint32_t i = 0; i < full_count; i++) {
+        char full_str[4 * MAX_STR_LENGTH], compact_str[4 * MAX_STR_LENGTH];
+        render_task(full + i, full_str);
+        render_task(compact + i, compact_str);
+        TEST_ASSERT(strcmp(full_str, compact_str) == 0, "compact task should expand to the full one");
+        TEST_ASSERT(compact[i].n == full[i].n && compact[i].i == 0, "should permute the same words");
+        TEST_ASSERT(compact[i].multiset == full[i].multiset &&
+                    !memcmp(compact[i].a, full[i].a, full[i].n), "should lay out the same a[]");
+        multisets += full[i].multiset;
+    }
+    TEST_ASSERT(multisets > 0, "should cover multiset tasks");
+
+    free(full);
+    free(compact);
+    unlink(path);
+    printf("  PASS: test_compact_tasks (%u tasks)\n", full_count);
+}
+
+static void *add_one_buffer(void *ptr) {
+    tasks_buffers *tasks_buffs = ptr;
+    tasks_buffer *buf = calloc(1, sizeof(tasks_buffer));
+    tasks_buffers_add_buffer(tasks_buffs, buf);  /* blocks: the ring is full */
+    return NULL;
+}
+
+/*
+ * Test 7: cancelling the pipeline unblocks a producer waiting on a full ring,
+ * drops the queued buffers and makes enumerators unwind with ECANCELED.
+ * Buffers carry no tasks, only the ring bookkeeping is exercised.
+ */
+void test_cancel(void) {
+    tasks_buffers tasks_buffs;
+    TEST_ASSERT(tasks_buffers_create(&tasks_buffs) == 0, "failed to create buffers");
+    for (int i = 0; i < TASKS_BUFFERS_SIZE; i++)
+        tasks_buffers_add_buffer(&tasks_buffs, calloc(1, sizeof(tasks_buffer)));
+
+    pthread_t producer;
+    TEST_ASSERT(pthread_create(&producer, NULL, add_one_buffer, &tasks_buffs) == 0,
+                "failed to start producer");
+    usleep(10000);
+    TEST_ASSERT(tasks_buffers_cancel(&tasks_buffs) == 0, "failed to cancel");
+    pthread_join(producer, NULL);
+
+    TEST_ASSERT(tasks_buffs.ring_count == 0, "queued buffers should be dropped");
+    tasks_buffer *buf;
+    tasks_buffers_get_buffer(&tasks_buffs, &buf);
+    TEST_ASSERT(buf == NULL, "consumers should get no more buffers");
+
+    cpu_cruncher_ctx ctx;
+    volatile uint32_t l0 = 0;
+    volatile uint64_t anas = 0;
+    cpu_cruncher_ctx_create(&ctx, 0, 1, NULL, NULL, NULL, &tasks_buffs, &l0, &anas);
+    int8_t permut[MAX_OFFSETS_LENGTH] = {1};
+    char all_strs[MAX_STR_LENGTH] = "tyranousplutotwits";
+    TEST_ASSERT(submit_tasks(&ctx, permut, 1, all_strs) == ECANCELED,
+                "enumerators should stop submitting");
+    TEST_ASSERT(anas == 0, "nothing should be produced after cancel");
+
+    tasks_buffers_free(&tasks_buffs);
+    printf("  PASS: test_cancel\n");
+}
+
 int main(void) {
     printf("test_cpu_enumeration:\n");
     test_single_word_anagram();
     test_two_word_anagram();
     test_three_word_anagram();
     test_no_valid_anagrams();
+    test_one_task_per_multiset();
+    test_compact_tasks();
+    test_cancel();
     printf("All CPU enumeration tests passed!\n");
     return 0;
 }
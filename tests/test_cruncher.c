@@ -9,6 +9,7 @@
 #endif
 #include "hashes.h"
 #include "task_buffers.h"
+#include "word_table.h"
 #include "fact.h"
 #include "os.h"
 
@@ -59,9 +60,9 @@ static tasks_buffer *make_task_buffer(const char *words[], int num_words) {
  * Helper: run a cruncher backend on given tasks, check hashes_reversed for matches.
  * The caller is responsible for allocating hashes_reversed (hashes_num * MAX_STR_LENGTH bytes).
  */
-static void run_cruncher_on_tasks(cruncher_ops *ops, tasks_buffer *buf,
-                                   uint32_t *hashes, uint32_t hashes_num,
-                                   uint32_t *hashes_reversed) {
+static void run_cruncher_on_buffers(cruncher_ops *ops, tasks_buffer **bufs, int num_bufs,
+                                    uint32_t *hashes, uint32_t hashes_num,
+                                    uint32_t *hashes_reversed, target_set *targets) {
     tasks_buffers tasks_buffs;
     tasks_buffers_create(&tasks_buffs);
 
@@ -71,6 +72,7 @@ static void run_cruncher_on_tasks(cruncher_ops *ops, tasks_buffer *buf,
         .hashes = hashes,
         .hashes_num = hashes_num,
         .hashes_reversed = hashes_reversed,
+        .targets = targets,
     };
 
     void *ctx = calloc(1, ops->ctx_size);
@@ -78,10 +80,11 @@ static void run_cruncher_on_tasks(cruncher_ops *ops, tasks_buffer *buf,
     int err = ops->create(ctx, &cfg, 0);
     TEST_ASSERT(err == 0, "failed to create cruncher");
 
-    /* Add the buffer and close the queue before running, so the cruncher
-     * thread will consume the buffer and then exit when it finds the queue
+    /* Add the buffers and close the queue before running, so the cruncher
+     * thread will consume them and then exit when it finds the queue
      * closed with nothing remaining. */
-    tasks_buffers_add_buffer(&tasks_buffs, buf);
+    for (int i = 0; i < num_bufs; i++)
+        tasks_buffers_add_buffer(&tasks_buffs, bufs[i]);
     tasks_buffers_close(&tasks_buffs);
 
     ops->run(ctx);
@@ -91,6 +94,12 @@ static void run_cruncher_on_tasks(cruncher_ops *ops, tasks_buffer *buf,
     tasks_buffers_free(&tasks_buffs);
 }
 
+static void run_cruncher_on_tasks(cruncher_ops *ops, tasks_buffer *buf,
+                                   uint32_t *hashes, uint32_t hashes_num,
+                                   uint32_t *hashes_reversed) {
+    run_cruncher_on_buffers(ops, &buf, 1, hashes, hashes_num, hashes_reversed, NULL);
+}
+
 /*
  * Test 1: single word "tyranousplutotwits" with n=1.
  * MD5("tyranousplutotwits") = 896304cdb1add2652c6445f245cfd3b2
@@ -213,6 +222,366 @@ static void test_multiple_hashes_selective(cruncher_ops *ops) {
     printf("    PASS: multiple hashes, only correct matches\n");
 }
 
+/*
+ * Test 6: fixed leading word + 5 permutable words (120 permutations), built
+ * through tasks_buffer_add_task like production tasks. Runs of permutations
+ * share the leading words, so the AVX kernels start from cached midstates.
+ * MD5("tyranous twits c pluto a b") = efbc77c1a4006cc7abf4f7a2778a50d2
+ * MD5("tyranous b a c twits pluto") = cbf3346204f42fd625cc5057ab7da86c
+ */
+static void test_fixed_prefix_match(cruncher_ops *ops) {
+    const char *hash_hexes[] = {
+        "efbc77c1a4006cc7abf4f7a2778a50d2",
+        "cbf3346204f42fd625cc5057ab7da86c",
+    };
+    uint32_t hashes[8];
+    ascii_to_hash(hash_hexes[0], hashes);
+    ascii_to_hash(hash_hexes[1], hashes + 4);
+
+    uint32_t hashes_reversed[2 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, 2 * MAX_STR_LENGTH);
+
+    const char *words[] = {"tyranous", "pluto", "twits", "a", "b", "c"};
+    char all_strs[MAX_STR_LENGTH] = {0};
+    int8_t offsets[MAX_OFFSETS_LENGTH] = {0};
+    uint8_t off = 0;
+    for (int i = 0; i < 6; i++) {
+        /* word 0 is fixed (negative offset), the rest are permutable */
+        offsets[i] = i == 0 ? -(off + 1) : off + 1;
+        int len = strlen(words[i]);
+        memcpy(all_strs + off, words[i], len + 1);
+        off += len + 1;
+    }
+
+    tasks_buffer *buf = tasks_buffer_allocate();
+    tasks_buffer_add_task(buf, all_strs, offsets);
+    TEST_ASSERT(buf->num_anas == 120, "should have 5! permutations");
+
+    run_cruncher_on_tasks(ops, buf, hashes, 2, hashes_reversed);
+
+    TEST_ASSERT(hashes_reversed[0] != 0, "should find first fixed-prefix ordering");
+    TEST_ASSERT(hashes_reversed[MAX_STR_LENGTH / 4] != 0, "should find second fixed-prefix ordering");
+    printf("    PASS: fixed prefix match\n");
+}
+
+/*
+ * Test 7: large target list (decoys plus two real hashes, one listed twice),
+ * above the AVX threshold for the Bloom filter + Eytzinger table path.
+ * MD5("lot twits pluto tyranous a") = ab1b9be079b489fb67d2194c40846f32
+ * MD5("a tyranous twits pluto lot") = c79993e6bd1768b3f35ccdbe890abd6c
+ */
+static void test_many_hashes(cruncher_ops *ops) {
+    enum { NUM = 4096, REAL1 = 1234, REAL2 = 4000, DUP1 = 17 };
+    uint32_t *hashes = malloc(NUM * 16);
+    uint32_t *hashes_reversed = calloc(NUM, MAX_STR_LENGTH);
+    TEST_ASSERT(hashes && hashes_reversed, "failed to allocate hashes");
+
+    uint32_t x = 12345;
+    for (int i = 0; i < NUM * 4; i++) {
+        x = x * 1103515245u + 12345u;
+        hashes[i] = x;
+    }
+    ascii_to_hash("ab1b9be079b489fb67d2194c40846f32", hashes + 4 * REAL1);
+    ascii_to_hash("ab1b9be079b489fb67d2194c40846f32", hashes + 4 * DUP1);
+    ascii_to_hash("c79993e6bd1768b3f35ccdbe890abd6c", hashes + 4 * REAL2);
+
+    const char *words[] = {"tyranous", "pluto", "twits", "lot", "a"};
+    tasks_buffer *buf = make_task_buffer(words, 5);
+
+    run_cruncher_on_tasks(ops, buf, hashes, NUM, hashes_reversed);
+
+    int found = 0;
+    for (int i = 0; i < NUM; i++)
+        if (hashes_reversed[i * MAX_STR_LENGTH / 4]) found++;
+    TEST_ASSERT(found == 3, "should find exactly the real hashes");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + REAL1 * MAX_STR_LENGTH / 4),
+                        "lot twits pluto tyranous a"), "should reverse first real hash");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + DUP1 * MAX_STR_LENGTH / 4),
+                        "lot twits pluto tyranous a"), "should reverse duplicated hash");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + REAL2 * MAX_STR_LENGTH / 4),
+                        "a tyranous twits pluto lot"), "should reverse second real hash");
+    free(hashes);
+    free(hashes_reversed);
+    printf("    PASS: many hashes\n");
+}
+
+/*
+ * Test 8: found targets drop out of the active set. Target 1 is already found
+ * (by another backend, say) and must not be compared against any more; target
+ * 0 is found in the first buffer and logged once although the second buffer
+ * holds the same task. The zero hash keeps the set from running empty.
+ */
+static void test_found_targets_dropped(cruncher_ops *ops) {
+    uint32_t hashes[12] = {0};
+    ascii_to_hash("ab1b9be079b489fb67d2194c40846f32", hashes);      /* lot twits pluto tyranous a */
+    ascii_to_hash("c79993e6bd1768b3f35ccdbe890abd6c", hashes + 4);  /* a tyranous twits pluto lot */
+
+    uint32_t hashes_reversed[3 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+    target_set targets;
+    TEST_ASSERT(target_set_create(&targets, hashes, 3) == 0, "failed to create target set");
+    target_set_mark_found(&targets, 1);
+
+    const char *words[] = {"tyranous", "pluto", "twits", "lot", "a"};
+    tasks_buffer *bufs[2] = {make_task_buffer(words, 5), make_task_buffer(words, 5)};
+    run_cruncher_on_buffers(ops, bufs, 2, hashes, 3, hashes_reversed, &targets);
+
+    TEST_ASSERT(!strcmp((char *)hashes_reversed, "lot twits pluto tyranous a"),
+                "should find active target");
+    TEST_ASSERT(hashes_reversed[MAX_STR_LENGTH / 4] == 0, "should skip found target");
+    TEST_ASSERT(targets.found_num == 2 && targets.found_log[1] == 0, "should log the find once");
+    TEST_ASSERT(targets.version == 2 && targets.current->num == 1, "should drop found targets");
+    target_set_free(&targets);
+    printf("    PASS: found targets dropped\n");
+}
+
+/*
+ * Test 9: one candidate matching a digest listed many times, once below and
+ * once above the 64 matches a launch of the OpenCL backend reports directly.
+ * MD5("lot twits pluto tyranous a") = ab1b9be079b489fb67d2194c40846f32
+ */
+static void test_many_matches(cruncher_ops *ops) {
+    const int nums[] = {40, 100};
+    for (int t = 0; t < 2; t++) {
+        const int num = nums[t];
+        uint32_t *hashes = malloc(num * 16);
+        uint32_t *hashes_reversed = calloc(num, MAX_STR_LENGTH);
+        TEST_ASSERT(hashes && hashes_reversed, "failed to allocate hashes");
+        for (int i = 0; i < num; i++)
+            ascii_to_hash("ab1b9be079b489fb67d2194c40846f32", hashes + 4 * i);
+
+        const char *words[] = {"tyranous", "pluto", "twits", "lot", "a"};
+        tasks_buffer *buf = make_task_buffer(words, 5);
+
+        run_cruncher_on_tasks(ops, buf, hashes, num, hashes_reversed);
+
+        for (int i = 0; i < num; i++)
+            TEST_ASSERT(!strcmp((char *)(hashes_reversed + i * MAX_STR_LENGTH / 4), "lot twits pluto tyranous a"),
+                        "should reverse every listing");
+        free(hashes);
+        free(hashes_reversed);
+    }
+    printf("    PASS: many matches\n");
+}
+
+/*
+ * Test 10: buffers from the pinned allocator main.c installs for OpenCL,
+ * obtained from the queue as the enumerators do. Finished tasks in between
+ * split the OpenCL uploads into runs; all the others are hashed once.
+ * MD5("tyranous plutotwits") = 04b386be280077bbb71bf72ebc17b92d
+ * MD5("plutotwits tyranous") = 8c4232547ac7fdf9e3f130784147815a
+ */
+static void add_tasks(tasks_buffer *buf, const char *words[], int num_words, int num, int finished_every) {
+    for (int t = 0; t < num; t++) {
+        char all_strs[MAX_STR_LENGTH] = {0};
+        int8_t offsets[MAX_OFFSETS_LENGTH] = {0};
+        int off = 0;
+        for (int w = 0; w < num_words; w++) {
+            offsets[w] = (int8_t) (off + 1);
+            memcpy(all_strs + off, words[w], strlen(words[w]) + 1);
+            off += strlen(words[w]) + 1;
+        }
+        tasks_buffer_add_task(buf, all_strs, offsets);
+        if (finished_every && t % finished_every == 0) {
+            permut_task *task = buf->permut_tasks + buf->num_tasks - 1;
+            task->i = task->n;
+            buf->num_anas -= fact(task->n);
+        }
+    }
+}
+
+static void test_pinned_buffers(cruncher_ops *ops) {
+    uint32_t hashes[8];
+    ascii_to_hash("04b386be280077bbb71bf72ebc17b92d", hashes);
+    ascii_to_hash("8c4232547ac7fdf9e3f130784147815a", hashes + 4);
+    uint32_t hashes_reversed[2 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    tasks_buffs.allocator = opencl_tasks_buffer_allocator_create();
+    if (ops == &opencl_cruncher_ops)
+        TEST_ASSERT(tasks_buffs.allocator, "should set up pinned memory");
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 2,
+        .hashes_reversed = hashes_reversed,
+    };
+    void *ctx = calloc(1, ops->ctx_size);
+    TEST_ASSERT(ctx && ops->create(ctx, &cfg, 0) == 0, "failed to create cruncher");
+
+    const char *abc[] = {"a", "b", "c", "d"};
+    const char *sentence[] = {"tyranous", "plutotwits"};
+    uint64_t expected_anas = 0;
+    for (int b = 0; b < 3; b++) {
+        tasks_buffer *buf = tasks_buffers_obtain(&tasks_buffs);
+        TEST_ASSERT(buf && buf->allocator == tasks_buffs.allocator, "should allocate from the queue's allocator");
+        if (b == 0) add_tasks(buf, abc, 3, 300, 7);
+        if (b == 1) add_tasks(buf, sentence, 2, 1, 0);
+        if (b == 2) add_tasks(buf, abc, 4, 200, 50);
+        expected_anas += buf->num_anas;
+        tasks_buffers_add_buffer(&tasks_buffs, buf);
+    }
+    tasks_buffers_close(&tasks_buffs);
+    ops->run(ctx);
+
+    TEST_ASSERT(!strcmp((char *)hashes_reversed, "tyranous plutotwits"), "should find first sentence");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + MAX_STR_LENGTH / 4), "plutotwits tyranous"),
+                "should find second sentence");
+    TEST_ASSERT(ops->get_total_anas(ctx) == expected_anas, "should hash every unfinished task once");
+
+    ops->destroy(ctx);
+    free(ctx);
+    tasks_buffer_allocator *allocator = tasks_buffs.allocator;
+    tasks_buffers_free(&tasks_buffs);
+    opencl_tasks_buffer_allocator_free(allocator);
+    printf("    PASS: pinned buffers\n");
+}
+
+/*
+ * Test 11: a queue of compact tasks (tasks_buffers.words), with a fixed word
+ * between permuted ones or a word used twice; the backend expands them
+ * against the word table.
+ * MD5("tyranous plutotwits") = 04b386be280077bbb71bf72ebc17b92d
+ * MD5("plutotwits tyranous") = 8c4232547ac7fdf9e3f130784147815a
+ * MD5("c a b")               = 1c1b6efa704b7d5de080f4d3bbdb3203
+ * MD5("b a a")               = 3ee467099ff8111efe04c61e9548141e
+ */
+static void add_compact_tasks(tasks_buffer *buf, const uint16_t ids[], int num_words, int fixed, int num) {
+    for (int t = 0; t < num; t++) {
+        uint16_t word_ids[MAX_STR_LENGTH] = {0};
+        int8_t offsets[MAX_OFFSETS_LENGTH] = {0};
+        int off = 0;
+        for (int w = 0; w < num_words; w++) {
+            offsets[w] = (int8_t) (w == fixed ? -(off + 1) : off + 1);
+            word_ids[off] = ids[w];
+            off += 8;
+        }
+        tasks_buffer_add_compact_task(buf, word_ids, offsets);
+    }
+}
+
+static void test_compact_tasks(cruncher_ops *ops) {
+    uint32_t hashes[16];
+    ascii_to_hash("04b386be280077bbb71bf72ebc17b92d", hashes);
+    ascii_to_hash("8c4232547ac7fdf9e3f130784147815a", hashes + 4);
+    ascii_to_hash("1c1b6efa704b7d5de080f4d3bbdb3203", hashes + 8);
+    ascii_to_hash("3ee467099ff8111efe04c61e9548141e", hashes + 12);
+    uint32_t hashes_reversed[4 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+
+    // ids 1..5: tyranous, plutotwits, a, b, c
+    uint32_t entries[] = {0, 0 << 8 | 8, 8 << 8 | 10, 18 << 8 | 1, 19 << 8 | 1, 20 << 8 | 1};
+    char bytes[] = "tyranousplutotwitsabc";
+    word_table words = {.entries = entries, .num = 6, .bytes = bytes, .bytes_size = 21};
+
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    tasks_buffs.words = &words;
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 4,
+        .hashes_reversed = hashes_reversed,
+    };
+    void *ctx = calloc(1, ops->ctx_size);
+    TEST_ASSERT(ctx && ops->create(ctx, &cfg, 0) == 0, "failed to create cruncher");
+
+    const uint16_t abc[] = {3, 4, 5}, cab[] = {5, 3, 4}, sentence[] = {1, 2}, aba[] = {3, 4, 3};
+    uint64_t expected_anas = 0;
+    for (int b = 0; b < 4; b++) {
+        tasks_buffer *buf = tasks_buffers_obtain(&tasks_buffs);
+        TEST_ASSERT(buf && buf->compact_tasks && !buf->permut_tasks, "should obtain compact buffers");
+        if (b == 0) add_compact_tasks(buf, abc, 3, -1, 300);
+        if (b == 1) add_compact_tasks(buf, sentence, 2, -1, 1);
+        if (b == 2) add_compact_tasks(buf, cab, 3, 1, 200);
+        if (b == 3) add_compact_tasks(buf, aba, 3, -1, 100);
+        expected_anas += buf->num_anas;
+        tasks_buffers_add_buffer(&tasks_buffs, buf);
+    }
+    TEST_ASSERT(expected_anas == 300 * 6 + 2 + 200 * 2 + 100 * 3, "should count the distinct orderings only");
+    tasks_buffers_close(&tasks_buffs);
+    ops->run(ctx);
+
+    TEST_ASSERT(!strcmp((char *)hashes_reversed, "tyranous plutotwits"), "should find first sentence");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + MAX_STR_LENGTH / 4), "plutotwits tyranous"),
+                "should find second sentence");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + 2 * MAX_STR_LENGTH / 4), "c a b"),
+                "should keep the fixed word in place");
+    TEST_ASSERT(!strcmp((char *)(hashes_reversed + 3 * MAX_STR_LENGTH / 4), "b a a"),
+                "should permute the repeated word");
+    TEST_ASSERT(ops->get_total_anas(ctx) == expected_anas, "should hash every task once");
+
+    ops->destroy(ctx);
+    free(ctx);
+    tasks_buffers_free(&tasks_buffs);
+    printf("    PASS: compact tasks\n");
+}
+
+/*
+ * Test 12: multiset tasks, a word used twice: 4!/2! = 12 orderings of
+ * "a a b c" per task, every one a target, so all of them have to be found and
+ * none hashed twice. Tasks of 4 fresh words, so not a flat launch either.
+ */
+static void test_multiset_tasks(cruncher_ops *ops) {
+    static const char *expected[12][2] = {
+        {"a a b c", "a2816d20fb7414f0396bff30e209d030"},
+        {"a a c b", "b4d02830c5f223e0d688baf08ac02acf"},
+        {"a b a c", "fdb1d10caee2069ba0f8385c401f3a59"},
+        {"a b c a", "72e3183c6184ece1a58d52c22220a1cf"},
+        {"a c a b", "72402e28e66d67d1712be674a8e3878c"},
+        {"a c b a", "744a4408ca16b882ada1cbda991a2adf"},
+        {"b a a c", "d50990a91823a4148520dd06a97ccf5e"},
+        {"b a c a", "a5b8affa0ed2a63853c5f0704b662108"},
+        {"b c a a", "423df08e92eca0b1a8a8cb1b01f17712"},
+        {"c a a b", "250cf485396e49d3c5abe6003810de7c"},
+        {"c a b a", "24a99ea03cc63e3727e58e889a0ecb50"},
+        {"c b a a", "21f197ab46cfd8e85a062ad7c5b23cef"},
+    };
+    uint32_t hashes[4 * 12];
+    for (int i = 0; i < 12; i++) ascii_to_hash(expected[i][1], hashes + 4 * i);
+    uint32_t hashes_reversed[12 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 12,
+        .hashes_reversed = hashes_reversed,
+    };
+    void *ctx = calloc(1, ops->ctx_size);
+    TEST_ASSERT(ctx && ops->create(ctx, &cfg, 0) == 0, "failed to create cruncher");
+
+    tasks_buffer *buf = tasks_buffer_allocate();
+    TEST_ASSERT(buf, "failed to allocate buffer");
+    for (int t = 0; t < 100; t++) {
+        char all_strs[MAX_STR_LENGTH] = "c\0b\0a";
+        int8_t offsets[MAX_OFFSETS_LENGTH] = {5, 3, 5, 1};  // a b a c, both a's on one copy
+        tasks_buffer_add_task(buf, all_strs, offsets);
+    }
+    const permut_task *task = buf->permut_tasks;
+    TEST_ASSERT(task->multiset && task->n == 4 && permut_task_perms(task) == 12, "should be a multiset task");
+    TEST_ASSERT(buf->num_anas == 100 * 12, "should count distinct orderings only");
+    uint64_t expected_anas = buf->num_anas;
+    tasks_buffers_add_buffer(&tasks_buffs, buf);
+    tasks_buffers_close(&tasks_buffs);
+    ops->run(ctx);
+
+    for (int i = 0; i < 12; i++) {
+        TEST_ASSERT(!strcmp((char *)(hashes_reversed + i * MAX_STR_LENGTH / 4), expected[i][0]),
+                    "should find every ordering");
+    }
+    TEST_ASSERT(ops->get_total_anas(ctx) == expected_anas, "should hash every ordering once");
+
+    ops->destroy(ctx);
+    free(ctx);
+    tasks_buffers_free(&tasks_buffs);
+    printf("    PASS: multiset tasks\n");
+}
+
 static void run_backend_tests(cruncher_ops *ops) {
     printf("  Testing %s backend:\n", ops->name);
     test_single_word_match(ops);
@@ -220,6 +589,13 @@ static void run_backend_tests(cruncher_ops *ops) {
     test_three_word_match(ops);
     test_no_match(ops);
     test_multiple_hashes_selective(ops);
+    test_fixed_prefix_match(ops);
+    test_many_hashes(ops);
+    test_found_targets_dropped(ops);
+    test_many_matches(ops);
+    test_pinned_buffers(ops);
+    if (ops->compact_tasks) test_compact_tasks(ops);
+    test_multiset_tasks(ops);
 }
 
 int main(void) {
@@ -0,0 +1,180 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fact.h"
+#include "gpu_cruncher.h"
+#include "hashes.h"
+#include "opencl_cruncher.h"
+#include "task_buffers.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
+
+/* Helper: a buffer of num tasks permuting 3 words, 3! permutations each */
+static tasks_buffer *three_word_tasks(uint32_t num) {
+    tasks_buffer *buf = tasks_buffer_allocate();
+    TEST_ASSERT(buf, "failed to allocate buffer");
+    char all_strs[MAX_STR_LENGTH] = "a\0b\0c";
+    for (uint32_t i = 0; i < num; i++) {
+        int8_t offsets[MAX_OFFSETS_LENGTH] = {1, 3, 5};
+        tasks_buffer_add_task(buf, all_strs, offsets);
+    }
+    return buf;
+}
+
+/*
+ * Test: an open queue hands out whole buffers; once closed, get_part splits
+ * off the last tasks up to max_anas (at least one) and keeps the rest queued.
+ */
+static void test_split(void) {
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    tasks_buffer *buf;
+
+    tasks_buffers_add_buffer(&tasks_buffs, three_word_tasks(10));
+    TEST_ASSERT(tasks_buffs.queued_anas == 60, "should count queued permutations");
+    TEST_ASSERT(tasks_buffers_get_part(&tasks_buffs, &buf, 20) == 0 && buf, "failed to get buffer");
+    TEST_ASSERT(buf->num_tasks == 10 && tasks_buffs.queued_anas == 0, "should not split an open queue");
+    tasks_buffers_add_buffer(&tasks_buffs, buf);
+    tasks_buffers_close(&tasks_buffs);
+
+    TEST_ASSERT(tasks_buffers_get_part(&tasks_buffs, &buf, 20) == 0 && buf, "failed to get part");
+    TEST_ASSERT(buf->num_tasks == 3 && buf->num_anas == 18, "should take up to max_anas");
+    TEST_ASSERT(tasks_buffs.ring_count == 1 && tasks_buffs.queued_anas == 42, "should keep the rest queued");
+    tasks_buffers_recycle(&tasks_buffs, buf);
+
+    TEST_ASSERT(tasks_buffers_get_part(&tasks_buffs, &buf, 0) == 0 && buf, "failed to get part");
+    TEST_ASSERT(buf->num_tasks == 1 && buf->num_anas == 6, "should take at least one task");
+    tasks_buffers_recycle(&tasks_buffs, buf);
+
+    TEST_ASSERT(tasks_buffers_get_part(&tasks_buffs, &buf, 1000) == 0 && buf, "failed to get rest");
+    TEST_ASSERT(buf->num_tasks == 6 && tasks_buffs.queued_anas == 0, "should take what is left whole");
+    tasks_buffers_recycle(&tasks_buffs, buf);
+
+    TEST_ASSERT(tasks_buffers_get_part(&tasks_buffs, &buf, 1000) == 0 && !buf, "should be drained");
+    tasks_buffers_free(&tasks_buffs);
+    printf("  PASS: test_split\n");
+}
+
+/*
+ * Test: a device three times slower gets a third of the launch size and a
+ * quarter of what is left, less what it holds; unknown rates do not limit.
+ */
+static void test_shares(void) {
+    gpu_share share = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+    int fast = gpu_share_join(&share), slow = gpu_share_join(&share);
+    TEST_ASSERT(fast == 0 && slow == 1, "should join in order");
+
+    TEST_ASSERT(gpu_share_launch_anas(&share, slow, 1200) == 1200, "unmeasured should keep its size");
+    TEST_ASSERT(gpu_share_tail_anas(&share, slow, 1000) == UINT64_MAX, "unmeasured should not be limited");
+
+    share.rates[fast] = 3e9f;
+    share.rates[slow] = 1e9f;
+    TEST_ASSERT(gpu_share_launch_anas(&share, fast, 1200) == 1200, "fastest should keep its size");
+    TEST_ASSERT(gpu_share_launch_anas(&share, slow, 1200) == 400, "slower should get smaller launches");
+    share.rates[slow] = 1e6f;
+    TEST_ASSERT(gpu_share_launch_anas(&share, slow, 1200) == 1200 / GPU_SHARE_MIN_LAUNCH_DIV,
+                "launches should not shrink past the minimum");
+    share.rates[slow] = 1e9f;
+
+    share.held[fast] = 100;
+    TEST_ASSERT(gpu_share_tail_anas(&share, fast, 300) == 200, "fast should take 3/4 of what is left");
+    TEST_ASSERT(gpu_share_tail_anas(&share, slow, 300) == 100, "slow should take 1/4 of what is left");
+    share.held[slow] = 200;
+    TEST_ASSERT(gpu_share_tail_anas(&share, slow, 300) == 0, "should take nothing once it holds its part");
+
+    gpu_share_leave(&share, slow);
+    TEST_ASSERT(gpu_share_tail_anas(&share, fast, 300) == 300, "alone should take all that is queued");
+    TEST_ASSERT(gpu_share_join(&share) == slow, "should reuse a left slot");
+    printf("  PASS: test_shares\n");
+}
+
+/*
+ * Test: two OpenCL crunchers on one closed queue (the first two devices, or
+ * two contexts on the one there is) both get work, split between them at the
+ * tail, and hash every permutation exactly once between them.
+ * MD5("tyranous plutotwits") = 04b386be280077bbb71bf72ebc17b92d
+ * MD5("plutotwits tyranous") = 8c4232547ac7fdf9e3f130784147815a
+ */
+static void test_two_devices(uint32_t devices) {
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    uint64_t expected_anas = 0;
+    for (int b = 0; b < 8; b++) {
+        tasks_buffer *buf = three_word_tasks(2000);
+        if (b == 5) {
+            char all_strs[MAX_STR_LENGTH] = "tyranous\0plutotwits";
+            int8_t offsets[MAX_OFFSETS_LENGTH] = {1, 10};
+            tasks_buffer_add_task(buf, all_strs, offsets);
+        }
+        expected_anas += buf->num_anas;
+        tasks_buffers_add_buffer(&tasks_buffs, buf);
+    }
+    tasks_buffers_close(&tasks_buffs);
+
+    uint32_t hashes[8];
+    ascii_to_hash("04b386be280077bbb71bf72ebc17b92d", hashes);
+    ascii_to_hash("8c4232547ac7fdf9e3f130784147815a", hashes + 4);
+    uint32_t hashes_reversed[2 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 2,
+        .hashes_reversed = hashes_reversed,
+    };
+    void *ctxs[2];
+    pthread_t threads[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        ctxs[i] = calloc(1, opencl_cruncher_ops.ctx_size);
+        TEST_ASSERT(ctxs[i] && opencl_cruncher_ops.create(ctxs[i], &cfg, devices > 1 ? i : 0) == 0,
+                    "failed to create cruncher");
+        TEST_ASSERT(((gpu_cruncher_ctx *) ctxs[i])->share, "should share the queue");
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        TEST_ASSERT(pthread_create(threads + i, NULL, opencl_cruncher_ops.run, ctxs[i]) == 0,
+                    "failed to start cruncher");
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    uint64_t anas[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        anas[i] = opencl_cruncher_ops.get_total_anas(ctxs[i]);
+        TEST_ASSERT(anas[i] > 0, "both devices should get work");
+    }
+    TEST_ASSERT(anas[0] + anas[1] == expected_anas, "should hash every permutation once");
+    TEST_ASSERT(strcmp((char *)hashes_reversed, "tyranous plutotwits") == 0, "should find first sentence");
+    TEST_ASSERT(strcmp((char *)(hashes_reversed + MAX_STR_LENGTH / 4), "plutotwits tyranous") == 0,
+                "should find second sentence");
+
+    for (uint32_t i = 0; i < 2; i++) {
+        opencl_cruncher_ops.destroy(ctxs[i]);
+        free(ctxs[i]);
+    }
+    tasks_buffers_free(&tasks_buffs);
+    printf("  PASS: test_two_devices on %u device(s) (%lu + %lu anas)\n", devices > 1 ? 2 : 1,
+           (unsigned long) anas[0], (unsigned long) anas[1]);
+}
+
+int main(void) {
+    printf("test_gpu_balance:\n");
+    test_split();
+    test_shares();
+
+    uint32_t devices = opencl_cruncher_ops.probe();
+    if (!devices) {
+        printf("  opencl: not available, skipping\n");
+        return 0;
+    }
+    test_two_devices(devices);
+    printf("All GPU balancing tests passed!\n");
+    return 0;
+}
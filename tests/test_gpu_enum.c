@@ -0,0 +1,234 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu_cruncher.h"
+#include "dict.h"
+#include "enum_tasks.h"
+#include "gpu_cruncher.h"
+#include "hashes.h"
+#include "opencl_cruncher.h"
+#include "seedphrase.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
+
+typedef struct {
+    char_counts seed;
+    char_counts_strings dict[MAX_DICT_SIZE];
+    uint32_t dict_length;
+    char_counts_strings *dict_by_char[CHARCOUNT][MAX_DICT_SIZE];
+    int dict_by_char_len[CHARCOUNT];
+} test_dict;
+
+static int cmp_ccs_length_desc(const void *a, const void *b) {
+    const char_counts_strings *ca = *(const char_counts_strings *const *)a;
+    const char_counts_strings *cb = *(const char_counts_strings *const *)b;
+    return (int)cb->counts.length - (int)ca->counts.length;
+}
+
+/* Helper: writes words to a dict file and organizes it as main.c does */
+static void load_dict(test_dict *td, const char *path, const char *words) {
+    FILE *f = fopen(path, "w");
+    assert(f && "failed to create test file");
+    fputs(words, f);
+    fclose(f);
+
+    memset(td, 0, sizeof(test_dict));
+    char_counts_create(seed_phrase_str, &td->seed);
+    int err = read_dict(path, td->dict, &td->dict_length, &td->seed);
+    TEST_ASSERT(err == 0, "failed to read dict");
+    unlink(path);
+
+    for (uint32_t i = 0; i < td->dict_length; i++) {
+        for (int ci = 0; ci < CHARCOUNT; ci++) {
+            if (td->dict[i].counts.counts[ci]) {
+                td->dict_by_char[ci][td->dict_by_char_len[ci]++] = &td->dict[i];
+                break;
+            }
+        }
+    }
+    for (int ci = 0; ci < CHARCOUNT; ci++) {
+        if (td->dict_by_char_len[ci] > 1) {
+            qsort(td->dict_by_char[ci], td->dict_by_char_len[ci], sizeof(char_counts_strings*), cmp_ccs_length_desc);
+        }
+    }
+}
+
+static void free_dict(test_dict *td) {
+    for (uint32_t i = 0; i < td->dict_length; i++) {
+        char_counts_strings_free(&td->dict[i]);
+    }
+}
+
+/* Helper: all tasks of the single-threaded CPU enumerator */
+static uint32_t cpu_tasks(test_dict *td, permut_task **out_tasks) {
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+
+    volatile uint32_t shared_l0_counter = 0;
+    volatile uint64_t shared_anas_produced = 0;
+    cpu_cruncher_ctx ctx;
+    cpu_cruncher_ctx_create(&ctx, 0, 1, &td->seed, &td->dict_by_char, td->dict_by_char_len, &tasks_buffs,
+                            &shared_l0_counter, &shared_anas_produced);
+    run_cpu_cruncher_thread(&ctx);
+    tasks_buffers_close(&tasks_buffs);
+
+    uint32_t total = 0;
+    *out_tasks = NULL;
+    tasks_buffer *buf;
+    while (tasks_buffers_get_buffer(&tasks_buffs, &buf) == 0 && buf) {
+        *out_tasks = realloc(*out_tasks, (total + buf->num_tasks) * sizeof(permut_task));
+        TEST_ASSERT(*out_tasks, "failed to grow tasks");
+        memcpy(*out_tasks + total, buf->permut_tasks, buf->num_tasks * sizeof(permut_task));
+        total += buf->num_tasks;
+        tasks_buffers_recycle(&tasks_buffs, buf);
+    }
+    tasks_buffers_free(&tasks_buffs);
+    return total;
+}
+
+/* Clears what a task leaves undefined (a[] past n), so equal tasks compare equal */
+static void canonicalize(permut_task *tasks, uint32_t num) {
+    for (uint32_t i = 0; i < num; i++) {
+        memset(tasks[i].a + tasks[i].n, 0, MAX_OFFSETS_LENGTH - tasks[i].n);
+    }
+}
+
+static int cmp_task(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(permut_task));
+}
+
+/*
+ * Test: the device writes exactly the tasks the CPU enumerator queues, in
+ * any order: the same words and slots, multiset tasks included.
+ */
+static void test_same_tasks(const char *name, const char *words) {
+    test_dict td;
+    load_dict(&td, "/tmp/anabrute_test_gpu_enum.txt", words);
+
+    permut_task *expected;
+    uint32_t expected_num = cpu_tasks(&td, &expected);
+
+    enum_dict edict;
+    TEST_ASSERT(enum_dict_create(&edict, &td.seed, &td.dict_by_char, td.dict_by_char_len) == 0,
+                "failed to flatten dict");
+    volatile uint32_t l0_counter = 0;
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    uint32_t hashes[4] = {0};
+    uint32_t hashes_reversed[MAX_STR_LENGTH / 4];
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 1,
+        .hashes_reversed = hashes_reversed,
+        .enum_dict = &edict,
+        .enum_l0_counter = &l0_counter,
+    };
+    void *ctx = calloc(1, opencl_cruncher_ops.ctx_size);
+    TEST_ASSERT(ctx && opencl_cruncher_ops.create(ctx, &cfg, 0) == 0, "failed to create cruncher");
+
+    permut_task *got;
+    uint32_t got_num;
+    TEST_ASSERT(gpu_cruncher_ctx_collect_enum_tasks(ctx, &got, &got_num) == CL_SUCCESS, "device enumeration failed");
+    TEST_ASSERT(got_num == expected_num, "device and CPU task counts differ");
+
+    if (got_num) {
+        canonicalize(expected, expected_num);
+        canonicalize(got, got_num);
+        qsort(expected, expected_num, sizeof(permut_task), cmp_task);
+        qsort(got, got_num, sizeof(permut_task), cmp_task);
+        TEST_ASSERT(memcmp(got, expected, got_num * sizeof(permut_task)) == 0, "device and CPU tasks differ");
+    }
+
+    opencl_cruncher_ops.destroy(ctx);
+    free(ctx);
+    free(got);
+    free(expected);
+    tasks_buffers_free(&tasks_buffs);
+    enum_dict_free(&edict);
+    free_dict(&td);
+    printf("  PASS: test_same_tasks %s (%u tasks)\n", name, expected_num);
+}
+
+/*
+ * Test: a full on-device run finds a sentence and hashes as many
+ * permutations as the CPU enumerator's tasks hold.
+ * MD5("tyranous plutotwits") = 04b386be280077bbb71bf72ebc17b92d
+ * MD5("plutotwits tyranous") = 8c4232547ac7fdf9e3f130784147815a
+ */
+static void test_finds_sentence(void) {
+    test_dict td;
+    load_dict(&td, "/tmp/anabrute_test_gpu_enum_run.txt", "tyranous\nplutotwits\npluto\ntwits\nsout\nstout\n");
+
+    permut_task *expected;
+    uint32_t expected_num = cpu_tasks(&td, &expected);
+    uint64_t expected_anas = 0;
+    for (uint32_t i = 0; i < expected_num; i++) {
+        expected_anas += permut_task_perms(expected + i);
+    }
+    free(expected);
+
+    enum_dict edict;
+    TEST_ASSERT(enum_dict_create(&edict, &td.seed, &td.dict_by_char, td.dict_by_char_len) == 0,
+                "failed to flatten dict");
+    volatile uint32_t l0_counter = 0;
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    tasks_buffers_close(&tasks_buffs);  // not read in this mode
+    uint32_t hashes[8];
+    ascii_to_hash("04b386be280077bbb71bf72ebc17b92d", hashes);
+    ascii_to_hash("8c4232547ac7fdf9e3f130784147815a", hashes + 4);
+    uint32_t hashes_reversed[2 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 2,
+        .hashes_reversed = hashes_reversed,
+        .enum_dict = &edict,
+        .enum_l0_counter = &l0_counter,
+    };
+    void *ctx = calloc(1, opencl_cruncher_ops.ctx_size);
+    TEST_ASSERT(ctx && opencl_cruncher_ops.create(ctx, &cfg, 0) == 0, "failed to create cruncher");
+    opencl_cruncher_ops.run(ctx);
+
+    TEST_ASSERT(strcmp((char *)hashes_reversed, "tyranous plutotwits") == 0, "should find first sentence");
+    TEST_ASSERT(strcmp((char *)(hashes_reversed + MAX_STR_LENGTH / 4), "plutotwits tyranous") == 0,
+                "should find second sentence");
+    TEST_ASSERT(opencl_cruncher_ops.get_total_anas(ctx) == expected_anas, "should hash every permutation once");
+    TEST_ASSERT(!opencl_cruncher_ops.is_running(ctx), "should be done");
+
+    opencl_cruncher_ops.destroy(ctx);
+    free(ctx);
+    tasks_buffers_free(&tasks_buffs);
+    enum_dict_free(&edict);
+    free_dict(&td);
+    printf("  PASS: test_finds_sentence (%lu anas)\n", (unsigned long) expected_anas);
+}
+
+int main(void) {
+    printf("test_gpu_enum:\n");
+    if (!opencl_cruncher_ops.probe()) {
+        printf("  opencl: not available, skipping\n");
+        return 0;
+    }
+
+    test_same_tasks("single word", "tyranousplutotwits\n");
+    test_same_tasks("three words", "tyranous\nplutotwits\npluto\ntwits\n");
+    test_same_tasks("none", "xyz\nabc\n");
+    // anagram classes (yarn/nary, its/sit/tis, ...) and repeated words (t, to, ...)
+    test_same_tasks("anagrams and repeats",
+                    "tyranous\nplutotwits\npluto\ntwits\nyarn\nnary\nits\nsit\ntis\npot\ntop\nopt\n"
+                    "two\ntow\nwot\nlust\nslut\nup\nto\not\nt\ns\nyo\nsou\nus\nit\nwit\n");
+    test_finds_sentence();
+    printf("All GPU enumeration tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fact.h"
+#include "gpu_cruncher.h"
+#include "hashes.h"
+#include "opencl_cruncher.h"
+#include "task_buffers.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
+
+static char cache_dir[] = "/tmp/anabrute_test_gpu_tune_XXXXXX";
+static char tune_path[1024];
+
+/* Helper: the one tuning file in cache_dir, "" if there is none */
+static const char *find_tune_file(void) {
+    tune_path[0] = 0;
+    DIR *dir = opendir(cache_dir);
+    TEST_ASSERT(dir, "failed to open cache dir");
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (!strncmp(e->d_name, "tune-", 5)) {
+            TEST_ASSERT(!tune_path[0], "should write one tuning file per device");
+            snprintf(tune_path, sizeof(tune_path), "%s/%s", cache_dir, e->d_name);
+        }
+    }
+    closedir(dir);
+    return tune_path;
+}
+
+static void write_tune_file(const char *content) {
+    FILE *f = fopen(tune_path, "w");
+    TEST_ASSERT(f, "failed to write tuning file");
+    fputs(content, f);
+    fclose(f);
+}
+
+static bool is_power_of_two(uint32_t v) {
+    return !(v & (v - 1));
+}
+
+/* Helper: creates an OpenCL cruncher on cfg and returns its tuning */
+static gpu_tuning create_tuned(cruncher_config *cfg, void **ctx) {
+    *ctx = calloc(1, opencl_cruncher_ops.ctx_size);
+    TEST_ASSERT(*ctx && opencl_cruncher_ops.create(*ctx, cfg, 0) == 0, "failed to create cruncher");
+    return ((gpu_cruncher_ctx *) *ctx)->tune;
+}
+
+static gpu_tuning tuning_of_new_cruncher(void) {
+    uint32_t hashes[4] = {0};
+    uint32_t hashes_reversed[MAX_STR_LENGTH / 4];
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 1,
+        .hashes_reversed = hashes_reversed,
+    };
+    void *ctx;
+    gpu_tuning tune = create_tuned(&cfg, &ctx);
+    opencl_cruncher_ops.destroy(ctx);
+    free(ctx);
+    tasks_buffers_free(&tasks_buffs);
+    return tune;
+}
+
+/*
+ * Test: the first start sweeps and saves a geometry within the compile-time
+ * limits, the next one loads it.
+ */
+static void test_tunes_and_caches(void) {
+    gpu_tuning tune = tuning_of_new_cruncher();
+    TEST_ASSERT(is_power_of_two(tune.local_size) && tune.local_size <= GPU_TUNE_MAX_LOCAL, "bad local size");
+    TEST_ASSERT(is_power_of_two(tune.tasks) && tune.tasks >= GPU_TUNE_MIN_TASKS
+                && tune.tasks <= PERMUT_TASKS_IN_KERNEL_TASK, "bad tasks per launch");
+    TEST_ASSERT(is_power_of_two(tune.iters) && tune.iters >= GPU_TUNE_MIN_ITERS
+                && tune.iters <= MAX_ITERS_IN_KERNEL_TASK, "bad iters per task");
+    TEST_ASSERT(*find_tune_file(), "should save the tuning");
+
+    FILE *f = fopen(tune_path, "r");
+    gpu_tuning saved;
+    TEST_ASSERT(f && fscanf(f, "%u %u %u", &saved.local_size, &saved.tasks, &saved.iters) == 3,
+                "should save three numbers");
+    fclose(f);
+    TEST_ASSERT(saved.local_size == tune.local_size && saved.tasks == tune.tasks && saved.iters == tune.iters,
+                "should save what it picked");
+
+    // something the sweep would hardly pick, so it is known to be loaded
+    write_tune_file("32 2048 512\n");
+    tune = tuning_of_new_cruncher();
+    TEST_ASSERT(tune.local_size == 32 && tune.tasks == 2048 && tune.iters == 512, "should load the tuning");
+    printf("  PASS: test_tunes_and_caches (%u x %u)\n", saved.tasks, saved.iters);
+}
+
+/*
+ * Test: a cache entry a launch could not run with is swept again and replaced.
+ */
+static void test_invalid_cache_retuned(void) {
+    const char *invalid[] = {"48 2048 512\n", "64 1000 512\n", "64 2048 0\n", "64 1048576 512\n", "garbage\n"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        write_tune_file(invalid[i]);
+        gpu_tuning tune = tuning_of_new_cruncher();
+        TEST_ASSERT(is_power_of_two(tune.local_size) && is_power_of_two(tune.tasks) && tune.iters,
+                    "should sweep again");
+        TEST_ASSERT(tune.tasks >= GPU_TUNE_MIN_TASKS && tune.tasks <= PERMUT_TASKS_IN_KERNEL_TASK,
+                    "should sweep again within limits");
+        FILE *f = fopen(tune_path, "r");
+        uint32_t local_size, tasks, iters;
+        TEST_ASSERT(f && fscanf(f, "%u %u %u", &local_size, &tasks, &iters) == 3 && tasks == tune.tasks,
+                    "should replace the entry");
+        fclose(f);
+    }
+    printf("  PASS: test_invalid_cache_retuned\n");
+}
+
+/*
+ * Test: ANABRUTE_OPENCL_TUNE=0 keeps the compile-time defaults.
+ */
+static void test_disabled(void) {
+    write_tune_file("32 2048 512\n");
+    setenv("ANABRUTE_OPENCL_TUNE", "0", 1);
+    gpu_tuning tune = tuning_of_new_cruncher();
+    unsetenv("ANABRUTE_OPENCL_TUNE");
+    TEST_ASSERT(tune.local_size == 0 && tune.tasks == PERMUT_TASKS_IN_KERNEL_TASK
+                && tune.iters == MAX_ITERS_IN_KERNEL_TASK, "should use the defaults");
+    printf("  PASS: test_disabled\n");
+}
+
+/* Helper: occurrences of needle in the file at path */
+static int count_in_file(const char *path, const char *needle, char *last_chars) {
+    FILE *f = fopen(path, "r");
+    TEST_ASSERT(f, "failed to open file");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = calloc(1, size + 1);
+    TEST_ASSERT(text && fread(text, 1, size, f) == (size_t) size, "failed to read file");
+    fclose(f);
+    int count = 0;
+    for (const char *p = text; (p = strstr(p, needle)); p++) count++;
+    if (last_chars) strcpy(last_chars, size >= 3 ? text + size - 3 : text);
+    free(text);
+    return count;
+}
+
+/*
+ * Test: a small tuned geometry still hashes every permutation once: more new
+ * tasks than a launch takes, a task split into launches of 256 iterations,
+ * launches padded to the work-group size. Runs with 1 to 4 launches in flight;
+ * traced, every launch shows up with its kernel and counter readback.
+ * MD5("tyranous plutotwits") = 04b386be280077bbb71bf72ebc17b92d
+ * MD5("plutotwits tyranous") = 8c4232547ac7fdf9e3f130784147815a
+ */
+static void test_tuned_run(const char *in_flight, bool traced) {
+    write_tune_file("64 1024 256\n");
+    setenv("ANABRUTE_OPENCL_INFLIGHT", in_flight, 1);
+    char trace_prefix[1024];
+    snprintf(trace_prefix, sizeof(trace_prefix), "%s/trace", cache_dir);
+    if (traced) setenv("ANABRUTE_OPENCL_TRACE", trace_prefix, 1);
+
+    tasks_buffer *buf = tasks_buffer_allocate();
+    TEST_ASSERT(buf, "failed to allocate buffer");
+    char all_strs[MAX_STR_LENGTH] = "tyranous\0plutotwits";
+    int8_t offsets[MAX_OFFSETS_LENGTH] = {1, 10};
+    tasks_buffer_add_task(buf, all_strs, offsets);
+    memcpy(all_strs, "a\0b\0c\0d\0e\0f\0g\0h", 16);
+    for (int i = 0; i < 1500; i++) {
+        int8_t small[MAX_OFFSETS_LENGTH] = {1, 3, 5};
+        tasks_buffer_add_task(buf, all_strs, small);
+    }
+    int8_t eight[MAX_OFFSETS_LENGTH] = {1, 3, 5, 7, 9, 11, 13, 15};
+    tasks_buffer_add_task(buf, all_strs, eight);
+    const uint64_t expected_anas = buf->num_anas;
+
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    uint32_t hashes[8];
+    ascii_to_hash("04b386be280077bbb71bf72ebc17b92d", hashes);
+    ascii_to_hash("8c4232547ac7fdf9e3f130784147815a", hashes + 4);
+    uint32_t hashes_reversed[2 * MAX_STR_LENGTH / 4];
+    memset(hashes_reversed, 0, sizeof(hashes_reversed));
+    cruncher_config cfg = {
+        .tasks_buffs = &tasks_buffs,
+        .hashes = hashes,
+        .hashes_num = 2,
+        .hashes_reversed = hashes_reversed,
+    };
+    void *ctx;
+    gpu_tuning tune = create_tuned(&cfg, &ctx);
+    TEST_ASSERT(tune.local_size == 64 && tune.tasks == 1024 && tune.iters == 256, "should load the tuning");
+    float busy = -1, anas_per_sec = -1;
+    opencl_cruncher_ops.get_stats(ctx, &busy, &anas_per_sec);
+    TEST_ASSERT(busy == 0 && anas_per_sec == 0, "no launches yet should report zeros");
+    tasks_buffers_add_buffer(&tasks_buffs, buf);
+    tasks_buffers_close(&tasks_buffs);
+    opencl_cruncher_ops.run(ctx);
+    unsetenv("ANABRUTE_OPENCL_INFLIGHT");
+    unsetenv("ANABRUTE_OPENCL_TRACE");
+
+    TEST_ASSERT(strcmp((char *)hashes_reversed, "tyranous plutotwits") == 0, "should find first sentence");
+    TEST_ASSERT(strcmp((char *)(hashes_reversed + MAX_STR_LENGTH / 4), "plutotwits tyranous") == 0,
+                "should find second sentence");
+    TEST_ASSERT(opencl_cruncher_ops.get_total_anas(ctx) == expected_anas, "should hash every permutation once");
+
+    // every launch is timed by the device
+    opencl_cruncher_ops.get_stats(ctx, &busy, &anas_per_sec);
+    TEST_ASSERT(busy > 0 && busy <= 100 && anas_per_sec > 0, "should report launch stats");
+    gpu_stage_stats kernel, upload, readback;
+    gpu_cruncher_get_stage_stats(ctx, GPU_STAGE_KERNEL, &kernel);
+    gpu_cruncher_get_stage_stats(ctx, GPU_STAGE_UPLOAD, &upload);
+    gpu_cruncher_get_stage_stats(ctx, GPU_STAGE_READBACK, &readback);
+    TEST_ASSERT(kernel.samples > 2 && readback.samples == kernel.samples, "should time every kernel and readback");
+    TEST_ASSERT(upload.samples >= 1, "should time uploads");
+    TEST_ASSERT(kernel.p50_micros <= kernel.p95_micros && kernel.p95_micros <= kernel.max_micros,
+                "percentiles should be ordered");
+    opencl_cruncher_ops.print_timings(ctx);
+
+    opencl_cruncher_ops.destroy(ctx);
+    free(ctx);
+    tasks_buffers_free(&tasks_buffs);
+
+    int launches = 0;
+    if (traced) {
+        char trace_path[1100], tail[4];
+        snprintf(trace_path, sizeof(trace_path), "%s-0.json", trace_prefix);
+        launches = count_in_file(trace_path, "\"name\":\"permut", tail);
+        TEST_ASSERT(launches > 2, "should trace every launch");
+        TEST_ASSERT(count_in_file(trace_path, "\"name\":\"counters\"", NULL) == launches,
+                    "should trace every readback");
+        TEST_ASSERT(count_in_file(trace_path, "\"name\":\"upload\"", NULL) >= 2, "should trace uploads");
+        TEST_ASSERT(!strcmp(tail, "]}\n"), "should close the trace");
+        unlink(trace_path);
+    }
+    printf("  PASS: test_tuned_run in flight %s (%lu anas", in_flight, (unsigned long) expected_anas);
+    if (traced) printf(", %d launches traced", launches);
+    printf(")\n");
+}
+
+int main(void) {
+    printf("test_gpu_tune:\n");
+    if (!opencl_cruncher_ops.probe()) {
+        printf("  opencl: not available, skipping\n");
+        return 0;
+    }
+
+    // a fresh cache, so the first start has to sweep
+    TEST_ASSERT(mkdtemp(cache_dir), "failed to create cache dir");
+    setenv("ANABRUTE_CACHE_DIR", cache_dir, 1);
+
+    test_tunes_and_caches();
+    test_invalid_cache_retuned();
+    test_disabled();
+    test_tuned_run("1", false);
+    test_tuned_run("2", false);
+    test_tuned_run("4", true);
+
+    // the program binaries saved next to it go too
+    DIR *dir = opendir(cache_dir);
+    struct dirent *e;
+    while (dir && (e = readdir(dir))) {
+        if (e->d_name[0] == '.') continue;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, e->d_name);
+        unlink(path);
+    }
+    if (dir) closedir(dir);
+    rmdir(cache_dir);
+    printf("All GPU tuning tests passed!\n");
+    return 0;
+}
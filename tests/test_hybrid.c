@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "hybrid.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
+
+static tasks_buffers gpu_buffs, cpu_buffs;
+static volatile uint32_t l0_counter;
+static hybrid_split split;
+
+static void setup_slots(uint32_t cores, uint32_t slots) {
+    tasks_buffers_create(&gpu_buffs);
+    l0_counter = 0;
+    TEST_ASSERT(hybrid_split_create(&split, cores, slots, &gpu_buffs, &cpu_buffs, &l0_counter, 10) == 0,
+                "failed to create split");
+}
+
+static void setup(uint32_t cores) {
+    setup_slots(cores, MAX_HYBRID_THREADS);
+}
+
+static void teardown(void) {
+    gpu_buffs.ring_count = cpu_buffs.ring_count = 0;  // faked depths hold no buffers
+    hybrid_split_free(&split);
+    tasks_buffers_free(&gpu_buffs);
+}
+
+/*
+ * Test: half the cores start enumerating, small N goes to the CPU queue, and
+ * the CPU queue hands out and takes back buffers of the GPU one's free-list.
+ */
+static void test_create_and_route(void) {
+    setup(8);
+    TEST_ASSERT(split.threads == 8 && split.enumerators == 4, "should start half and half");
+    TEST_ASSERT(hybrid_route(&split, HYBRID_SMALL_N_MAX) == &cpu_buffs, "small N should go to the CPU");
+    TEST_ASSERT(hybrid_route(&split, HYBRID_SMALL_N_MAX + 1) == &gpu_buffs, "large N should go to the GPU");
+
+    tasks_buffer *buf = tasks_buffers_obtain(&cpu_buffs);
+    TEST_ASSERT(buf, "failed to obtain buffer");
+    tasks_buffers_recycle(&cpu_buffs, buf);
+    TEST_ASSERT(gpu_buffs.num_free == 1 && cpu_buffs.num_free == 0, "should recycle into the GPU free-list");
+    TEST_ASSERT(tasks_buffers_obtain(&cpu_buffs) == buf, "should reuse the GPU free-list");
+    tasks_buffers_recycle(&gpu_buffs, buf);
+    teardown();
+
+    setup(1);
+    TEST_ASSERT(split.threads == 2 && split.enumerators == 1, "one core should still run both");
+    teardown();
+    printf("  PASS: test_create_and_route\n");
+}
+
+/*
+ * Test: the split moves towards the enumerators that feed everyone, one step
+ * at a time, queues deeper than half give a core to the crunchers, and the
+ * cutoff follows the fuller queue.
+ */
+static void test_rebalance(void) {
+    setup(8);
+    // 5 enumerators feed the GPU and 3 crunchers: 5 * 100 = 200 + 3 * 100
+    hybrid_rates rates = {.produced_per_enumerator = 100, .gpu_consumed = 200, .cpu_consumed_per_cruncher = 100};
+    gpu_buffs.ring_count = cpu_buffs.ring_count = 10;
+    hybrid_rebalance(&split, &rates);
+    TEST_ASSERT(split.enumerators == 5 && split.small_n_max == HYBRID_SMALL_N_MAX, "should move towards the rates");
+    hybrid_rebalance(&split, &rates);
+    TEST_ASSERT(split.enumerators == 5, "should stay where the rates balance");
+
+    gpu_buffs.ring_count = 60;
+    hybrid_rebalance(&split, &rates);
+    TEST_ASSERT(split.enumerators == 4, "deep queues should give a core to the crunchers");
+    TEST_ASSERT(split.small_n_max == HYBRID_SMALL_N_MAX + 1, "a fuller GPU queue should raise the cutoff");
+
+    gpu_buffs.ring_count = 2;
+    cpu_buffs.ring_count = 2;
+    hybrid_rates unknown = {0};
+    hybrid_rebalance(&split, &unknown);
+    TEST_ASSERT(split.enumerators == 5, "starved crunchers should get an enumerator");
+
+    cpu_buffs.ring_count = 70;
+    for (int i = 0; i < 20; i++) hybrid_rebalance(&split, &unknown);
+    TEST_ASSERT(split.enumerators == 1, "should keep one enumerator");
+    TEST_ASSERT(split.small_n_max == 0, "a fuller CPU queue should lower the cutoff");
+
+    cpu_buffs.ring_count = 0;
+    for (int i = 0; i < 20; i++) hybrid_rebalance(&split, &unknown);
+    TEST_ASSERT(split.enumerators == 7, "should keep one cruncher");
+    teardown();
+    printf("  PASS: test_rebalance\n");
+}
+
+/*
+ * Test: with few cruncher instances left (next to many GPUs), the split takes
+ * one thread per slot instead of one per core, and the rebalancer keeps to it.
+ */
+static void test_slots_cap(void) {
+    setup_slots(16, 3);
+    TEST_ASSERT(split.threads == 3 && split.enumerators == 1, "should take one thread per slot");
+    hybrid_rates unknown = {0};
+    for (int i = 0; i < 20; i++) hybrid_rebalance(&split, &unknown);
+    TEST_ASSERT(split.enumerators == 2, "should keep one cruncher within the slots");
+    teardown();
+
+    tasks_buffers_create(&gpu_buffs);
+    TEST_ASSERT(hybrid_split_create(&split, 16, 1, &gpu_buffs, &cpu_buffs, &l0_counter, 10) != 0,
+                "should need a slot for each kind");
+    tasks_buffers_free(&gpu_buffs);
+    printf("  PASS: test_slots_cap\n");
+}
+
+static volatile bool cruncher_woke;
+
+static void *cruncher_thread(void *arg) {
+    hybrid_cruncher_wait(&split, (uint32_t) (uintptr_t) arg);
+    cruncher_woke = true;
+    return NULL;
+}
+
+/*
+ * Test: a core's cruncher waits while its enumerator runs and wakes when the
+ * enumerator is done; parked enumerators run once every L0 word is taken.
+ */
+static void test_parking(void) {
+    setup(4);
+    TEST_ASSERT(split.enumerators == 2, "should start with two enumerators");
+    hybrid_cruncher_wait(&split, 3);  // past the split: returns right away
+    hybrid_enumerator_wait(&split, 1);
+
+    cruncher_woke = false;
+    pthread_t thread;
+    TEST_ASSERT(pthread_create(&thread, NULL, cruncher_thread, (void *) (uintptr_t) 1) == 0, "failed to start");
+    usleep(50000);
+    TEST_ASSERT(!cruncher_woke, "should wait while its enumerator runs");
+    hybrid_enumerator_done(&split, 1);
+    pthread_join(thread, NULL);
+    TEST_ASSERT(cruncher_woke, "should run once its enumerator is done");
+
+    l0_counter = 10;
+    hybrid_enumerator_wait(&split, 3);  // would park, but there is nothing left to take
+    teardown();
+    printf("  PASS: test_parking\n");
+}
+
+int main(void) {
+    printf("test_hybrid:\n");
+    test_create_and_route();
+    test_rebalance();
+    test_slots_cap();
+    test_parking();
+    printf("All hybrid tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu_cruncher.h"
+#include "dict.h"
+#include "search_index.h"
+#include "seedphrase.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
+
+static int cmp_ccs_length_desc(const void *a, const void *b) {
+    const char_counts_strings *ca = *(const char_counts_strings *const *)a;
+    const char_counts_strings *cb = *(const char_counts_strings *const *)b;
+    return (int)cb->counts.length - (int)ca->counts.length;
+}
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    assert(f && "failed to create test file");
+    fputs(content, f);
+    fclose(f);
+}
+
+static char_counts seed;
+static char_counts_strings dict[MAX_DICT_SIZE];
+static uint32_t dict_length;
+static char_counts_strings *dict_by_char[CHARCOUNT][MAX_DICT_SIZE];
+static int dict_by_char_len[CHARCOUNT];
+
+/* Helper: loads dict into dict_by_char (same as main.c) */
+static void load_dict(const char *dict_path) {
+    char_counts_create(seed_phrase_str, &seed);
+    dict_length = 0;
+    TEST_ASSERT(read_dict(dict_path, dict, &dict_length, &seed) == 0, "failed to read dict");
+    memset(dict_by_char_len, 0, sizeof(dict_by_char_len));
+    for (uint32_t i = 0; i < dict_length; i++) {
+        for (int ci = 0; ci < CHARCOUNT; ci++) {
+            if (dict[i].counts.counts[ci]) {
+                dict_by_char[ci][dict_by_char_len[ci]++] = &dict[i];
+                break;
+            }
+        }
+    }
+    for (int ci = 0; ci < CHARCOUNT; ci++) {
+        if (dict_by_char_len[ci] > 1) {
+            qsort(dict_by_char[ci], dict_by_char_len[ci], sizeof(char_counts_strings*), cmp_ccs_length_desc);
+        }
+    }
+}
+
+static void free_dict(void) {
+    for (uint32_t i = 0; i < dict_length; i++) {
+        char_counts_strings_free(&dict[i]);
+    }
+}
+
+/* Helper: anagrams the single-threaded CPU enumerator queues for the loaded dict */
+static uint64_t enumerated_anas(void) {
+    tasks_buffers tasks_buffs;
+    tasks_buffers_create(&tasks_buffs);
+    volatile uint32_t shared_l0_counter = 0;
+    volatile uint64_t shared_anas_produced = 0;
+    cpu_cruncher_ctx ctx;
+    cpu_cruncher_ctx_create(&ctx, 0, 1, &seed, &dict_by_char, dict_by_char_len, &tasks_buffs, &shared_l0_counter, &shared_anas_produced);
+    run_cpu_cruncher_thread(&ctx);
+    tasks_buffers_close(&tasks_buffs);
+
+    uint64_t anas = 0;
+    tasks_buffer *buf;
+    while (1) {
+        tasks_buffers_get_buffer(&tasks_buffs, &buf);
+        if (buf == NULL) break;
+        anas += buf->num_anas;
+        tasks_buffers_recycle(&tasks_buffs, buf);
+    }
+    tasks_buffers_free(&tasks_buffs);
+    return anas;
+}
+
+/* Helper: sentence is the seed's letters with single spaces between words */
+static bool is_anagram(const char *sentence) {
+    char letters[MAX_STR_LENGTH];
+    int len = 0;
+    for (const char *c = sentence; *c; c++) {
+        if (*c == ' ' && (c == sentence || c[1] == ' ' || !c[1])) return false;
+        if (*c != ' ') letters[len++] = *c;
+    }
+    letters[len] = '\0';
+    char_counts cc;
+    return !char_counts_create(letters, &cc) && char_counts_equal(&cc, &seed);
+}
+
+/*
+ * Test: the index counts what the enumerator queues, with repeated words
+ * (t), entries of several strings (tyranous/sutonary, to/ot) and the
+ * MAX_WORD_LENGTH cut; every rank maps to a distinct anagram and back, and
+ * the L0 words cover consecutive ranks.
+ */
+static void test_small_dict(void) {
+    const char *path = "/tmp/test_search_index_small.dict";
+    write_file(path, "tyranous\nsutonary\npluto\ntwits\nwitts\nto\not\nt\nsy\nur\nan\nplu\nwi\nnu\nun\n");
+    load_dict(path);
+
+    search_index si;
+    TEST_ASSERT(search_index_create(&si, &seed, &dict_by_char, dict_by_char_len) == 0, "failed to create index");
+    uint64_t anas = enumerated_anas();
+    TEST_ASSERT(si.total == anas, "should count what the enumerator queues");
+    TEST_ASSERT(si.l0_first[0] == 0 && si.l0_len == (uint32_t) dict_by_char_len[0], "should start at the L0 words");
+
+    char sentence[MAX_STR_LENGTH], prev[MAX_STR_LENGTH] = "";
+    for (uint64_t k = 0; k < si.total; k++) {
+        TEST_ASSERT(search_index_unrank(&si, k, sentence) == 0, "failed to unrank");
+        TEST_ASSERT(is_anagram(sentence), "should unrank to an anagram of the seed");
+        TEST_ASSERT(strcmp(sentence, prev) != 0, "neighbours should differ");
+        TEST_ASSERT(search_index_rank(&si, sentence) == k, "should rank back to k");
+        strcpy(prev, sentence);
+    }
+    TEST_ASSERT(search_index_unrank(&si, si.total, sentence) == -1, "should reject ranks past the end");
+
+    TEST_ASSERT(search_index_rank(&si, "tyranous plutotwits") == UINT64_MAX, "should reject unknown words");
+    TEST_ASSERT(search_index_rank(&si, "tyranous pluto") == UINT64_MAX, "should reject short sentences");
+    TEST_ASSERT(search_index_rank(&si, "tyranous pluto twits t") == UINT64_MAX, "should reject long sentences");
+    TEST_ASSERT(search_index_rank(&si, "tyranous  pluto twits") == UINT64_MAX, "should reject empty words");
+    TEST_ASSERT(search_index_rank(&si, "t t t t sy ur an plu wi") == UINT64_MAX,
+                "should reject sentences of more than MAX_WORD_LENGTH words");
+    uint64_t first = search_index_rank(&si, "sutonary pluto twits");
+    TEST_ASSERT(first != UINT64_MAX && search_index_rank(&si, "twits sutonary pluto") != UINT64_MAX,
+                "should rank every ordering");
+
+    search_index_free(&si);
+    free_dict();
+    unlink(path);
+    printf("  PASS: test_small_dict (%lu anas)\n", (unsigned long) anas);
+}
+
+/*
+ * Test: on the full dictionary, ranks far into the 10^13 space round-trip
+ * and each L0 word's first rank unranks to a sentence holding it.
+ */
+static void test_input_dict(void) {
+    load_dict("input.dict");
+    search_index si;
+    TEST_ASSERT(search_index_create(&si, &seed, &dict_by_char, dict_by_char_len) == 0, "failed to create index");
+    TEST_ASSERT(si.total > 0, "should count the search space");
+
+    char sentence[MAX_STR_LENGTH];
+    uint64_t k = 0;
+    for (int step = 0; step < 300; step++) {
+        k = (k * 6364136223846793005ull + 1442695040888963407ull);
+        uint64_t rank = k % si.total;
+        TEST_ASSERT(search_index_unrank(&si, rank, sentence) == 0, "failed to unrank");
+        TEST_ASSERT(is_anagram(sentence), "should unrank to an anagram of the seed");
+        TEST_ASSERT(search_index_rank(&si, sentence) == rank, "should rank back");
+    }
+    for (uint32_t i = 0; i < si.l0_len; i += 37) {
+        if (si.l0_first[i] == si.l0_first[i + 1]) continue;
+        TEST_ASSERT(search_index_unrank(&si, si.l0_first[i], sentence) == 0, "failed to unrank");
+        size_t len = strcspn(sentence, " ");
+        bool holds = false;
+        for (int s = 0; s < dict_by_char[0][i]->strings_len; s++) {
+            const char *word = dict_by_char[0][i]->strings[s];
+            holds |= strlen(word) == len && strncmp(sentence, word, len) == 0;
+        }
+        TEST_ASSERT(holds, "should start with its L0 word");
+    }
+    printf("  PASS: test_input_dict (%lu anas)\n", (unsigned long) si.total);
+    search_index_free(&si);
+    free_dict();
+}
+
+int main(void) {
+    printf("test_search_index:\n");
+    test_small_dict();
+    test_input_dict();
+    printf("All search index tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "targets.h"
+
+/* Test assertion that works regardless of NDEBUG */
+#define TEST_ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+        exit(1); \
+    } \
+} while (0)
+
+static uint32_t lcg_state = 1;
+
+static uint32_t lcg_next(void) {
+    lcg_state = lcg_state * 1103515245u + 12345u;
+    return lcg_state ^ (lcg_state >> 16);
+}
+
+/*
+ * Test 1: Bloom filter has no false negatives and a low false positive rate.
+ */
+void test_filter(void) {
+    enum { NUM = 100000 };
+    uint32_t *keys = malloc(NUM * sizeof(uint32_t));
+    TEST_ASSERT(keys, "failed to allocate keys");
+    target_filter f;
+    TEST_ASSERT(target_filter_init(&f, NUM) == 0, "failed to init filter");
+    for (int i = 0; i < NUM; i++) {
+        keys[i] = lcg_next();
+        target_filter_add(&f, keys[i]);
+    }
+    for (int i = 0; i < NUM; i++)
+        TEST_ASSERT(target_filter_maybe(&f, keys[i]), "filter must not miss added keys");
+
+    int fp = 0;
+    for (int i = 0; i < NUM; i++) fp += target_filter_maybe(&f, lcg_next());
+    /* ~1.4% expected at 16 bits per key */
+    TEST_ASSERT(fp < NUM / 30, "too many false positives");
+
+    target_filter_free(&f);
+    free(keys);
+    printf("  PASS: test_filter (%.2f%% false positives)\n", 100.0 * fp / NUM);
+}
+
+/* Finds all targets with hash[0] == key through the table, by id bitmap */
+static int table_matches(const target_table *t, uint32_t key, uint8_t *seen) {
+    int n = 0;
+    for (uint32_t k = target_table_lower(t, key); k && t->keys[k] == key;
+         k = target_table_next(t, k)) {
+        seen[t->ids[k]] = 1;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Test 2: Eytzinger table finds every target, including duplicated keys,
+ * at all tree sizes around full levels.
+ */
+void test_table(void) {
+    static const uint32_t sizes[] = {0, 1, 2, 3, 6, 7, 8, 15, 16, 17, 1000};
+    for (int is = 0; is < (int)(sizeof(sizes) / sizeof(sizes[0])); is++) {
+        uint32_t num = sizes[is];
+        uint32_t *hashes = malloc(16 * (num + 1));
+        uint8_t *seen = calloc(num + 1, 1);
+        TEST_ASSERT(hashes && seen, "failed to allocate hashes");
+        for (uint32_t i = 0; i < 4 * num; i++) hashes[i] = lcg_next() % 64;
+
+        target_table t;
+        TEST_ASSERT(target_table_init(&t, hashes, NULL, num) == 0, "failed to init table");
+
+        /* in-order walk visits num keys, sorted */
+        uint32_t walked = 0, prev = 0;
+        for (uint32_t k = target_table_lower(&t, 0); k; k = target_table_next(&t, k)) {
+            TEST_ASSERT(t.keys[k] >= prev, "in-order walk should be sorted");
+            prev = t.keys[k];
+            walked++;
+        }
+        TEST_ASSERT(walked == num, "in-order walk should visit every node");
+
+        for (uint32_t key = 0; key < 64; key++) {
+            int expect = 0;
+            for (uint32_t i = 0; i < num; i++) expect += hashes[4 * i] == key;
+            TEST_ASSERT(table_matches(&t, key, seen) == expect, "should find every equal key");
+        }
+        for (uint32_t i = 0; i < num; i++) TEST_ASSERT(seen[i], "should find every target");
+        TEST_ASSERT(target_table_lower(&t, 64) == 0, "no key above the maximum");
+
+        target_table_free(&t);
+        free(hashes);
+        free(seen);
+    }
+    printf("  PASS: test_table\n");
+}
+
+/* Ids of the snapshot's targets as a bitmap, checks they are distinct */
+static uint32_t snapshot_ids(const target_snapshot *snap, uint8_t *seen, uint32_t hashes_num) {
+    memset(seen, 0, hashes_num);
+    for (uint32_t i = 0; i < snap->num; i++) {
+        uint32_t ih = target_snapshot_id(snap, i);
+        TEST_ASSERT(ih < hashes_num && !seen[ih], "snapshot ids must be distinct targets");
+        seen[ih] = 1;
+    }
+    return snap->num;
+}
+
+/*
+ * Test 3: active target set drops found targets from new snapshots, keeps old
+ * snapshots intact for their readers and logs every target found once.
+ */
+void test_target_set(void) {
+    enum { SMALL = 10, LARGE = TARGET_SET_EAGER_MAX * 2 };
+    uint32_t *hashes = calloc(LARGE, 16);
+    uint8_t *seen = malloc(LARGE);
+    TEST_ASSERT(hashes && seen, "failed to allocate hashes");
+
+    target_set s;
+    TEST_ASSERT(target_set_create(&s, hashes, SMALL) == 0, "failed to create set");
+    target_snapshot *v0 = target_set_acquire(&s);
+    TEST_ASSERT(v0->version == 0 && v0->num == SMALL && !v0->ids, "starts with all targets");
+
+    TEST_ASSERT(target_set_mark_found(&s, 3), "first find is new");
+    TEST_ASSERT(!target_set_mark_found(&s, 3), "second find of the same target is not");
+    TEST_ASSERT(target_set_mark_found(&s, 7), "other target is new");
+    TEST_ASSERT(s.version == 2 && target_set_remaining(&s) == SMALL - 2,
+                "small sets publish a snapshot per find");
+    TEST_ASSERT(s.found_num == 2 && s.found_log[0] == 3 && s.found_log[1] == 7,
+                "finds are logged in order");
+
+    target_snapshot *v2 = target_set_acquire(&s);
+    TEST_ASSERT(snapshot_ids(v2, seen, SMALL) == SMALL - 2 && !seen[3] && !seen[7],
+                "found targets are dropped");
+    TEST_ASSERT(v0->num == SMALL, "old snapshot stays valid for its readers");
+    target_set_release(&s, v0);
+
+    for (uint32_t ih = 0; ih < SMALL; ih++) target_set_mark_found(&s, ih);
+    TEST_ASSERT(target_set_remaining(&s) == 0 && s.current->num == 0, "set runs empty");
+    target_set_release(&s, v2);
+    target_set_free(&s);
+
+    /* Large sets are compacted once 1/TARGET_SET_REBUILD_DIV of them is found */
+    TEST_ASSERT(target_set_create(&s, hashes, LARGE) == 0, "failed to create set");
+    uint32_t batch = LARGE / TARGET_SET_REBUILD_DIV;
+    for (uint32_t i = 0; i + 1 < batch; i++) target_set_mark_found(&s, 2 * i);
+    TEST_ASSERT(s.version == 0, "few finds keep the snapshot");
+    target_set_mark_found(&s, 2 * (batch - 1));
+    TEST_ASSERT(s.version == 1, "enough finds publish a new one");
+    target_snapshot *v1 = target_set_acquire(&s);
+    TEST_ASSERT(snapshot_ids(v1, seen, LARGE) == LARGE - batch && !seen[0] && seen[1],
+                "compacted snapshot holds exactly the remaining targets");
+    target_set_release(&s, v1);
+    target_set_free(&s);
+
+    free(hashes);
+    free(seen);
+    printf("  PASS: test_target_set\n");
+}
+
+int main(void) {
+    printf("test_targets:\n");
+    test_filter();
+    test_table();
+    test_target_set();
+    printf("All target lookup tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "word_table.h"
+
+int word_table_create(word_table *t, char_counts *seed, char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE],
+                      int *dict_by_char_len) {
+    memset(t, 0, sizeof(word_table));
+
+    // an expanded task holds each of its words and a terminator
+    if (seed->length + MAX_WORD_LENGTH > MAX_STR_LENGTH) return -1;
+
+    t->num = 1;
+    for (int c = 0; c < CHARCOUNT; c++) {
+        for (int i = 0; i < dict_by_char_len[c]; i++) {
+            const char_counts_strings *ccs = (*dict_by_char)[c][i];
+            t->num += ccs->strings_len;
+            t->bytes_size += ccs->strings_len * ccs->counts.length;
+        }
+    }
+    if (t->num - 1 > WORD_TABLE_MAX_WORDS) return -1;
+
+    t->entries = calloc(t->num, sizeof(uint32_t));
+    t->bytes = malloc(t->bytes_size ? t->bytes_size : 1);
+    if (!t->entries || !t->bytes) {
+        word_table_free(t);
+        return -1;
+    }
+
+    uint32_t id = 1, off = 0;
+    for (int c = 0; c < CHARCOUNT; c++) {
+        for (int i = 0; i < dict_by_char_len[c]; i++) {
+            char_counts_strings *ccs = (*dict_by_char)[c][i];
+            ccs->word_id = (uint16_t) id;
+            for (int s = 0; s < ccs->strings_len; s++) {
+                t->entries[id++] = off << 8 | ccs->counts.length;
+                memcpy(t->bytes + off, ccs->strings[s], ccs->counts.length);
+                off += ccs->counts.length;
+            }
+        }
+    }
+    return 0;
+}
+
+void word_table_free(word_table *t) {
+    free(t->entries);
+    free(t->bytes);
+    t->entries = NULL;
+    t->bytes = NULL;
+    t->num = 0;
+    t->bytes_size = 0;
+}
+
+void word_table_expand(const word_table *t, const compact_task *task, permut_task *out) {
+    memset(out, 0, sizeof(permut_task));
+
+    // a word used more than once is copied once; permutable slots are
+    // numbered as in tasks_buffer_add_task: right to left, or left to right
+    // over the sorted a[] of a multiset task
+    int pos = 0, a_idx = task->multiset ? 0 : task->n;
+    int word_pos[MAX_WORD_LENGTH];
+    for (int slot = 0; slot < MAX_WORD_LENGTH && task->words[slot]; slot++) {
+        int prev = 0;
+        while (prev < slot && task->words[prev] != task->words[slot]) prev++;
+        if (prev < slot) {
+            word_pos[slot] = word_pos[prev];
+        } else {
+            uint32_t entry = t->entries[task->words[slot]];
+            uint32_t len = entry & 0xff;
+            memcpy(out->all_strs + pos, t->bytes + (entry >> 8), len);
+            word_pos[slot] = pos;
+            pos += len + 1;
+        }
+        if (!(task->permutable & (1u << slot))) {
+            out->offsets[slot] = -word_pos[slot] - 1;
+        } else if (task->multiset) {
+            int k = a_idx++;
+            for (; k > 0 && out->a[k - 1] > word_pos[slot] + 1; k--) out->a[k] = out->a[k - 1];
+            out->a[k] = word_pos[slot] + 1;
+            out->offsets[slot] = a_idx;
+        } else {
+            a_idx--;
+            out->a[a_idx] = word_pos[slot] + 1;
+            out->offsets[slot] = a_idx + 1;
+        }
+    }
+    out->n = task->n;
+    out->multiset = task->multiset;
+}
+
+uint32_t word_table_key_words(const word_table *t, const compact_task *task) {
+    uint32_t str_len = 0;
+    for (int slot = 0; slot < MAX_WORD_LENGTH && task->words[slot]; slot++) {
+        str_len += (t->entries[task->words[slot]] & 0xff) + 1;  // word + space
+    }
+    return (str_len + 3) / 4;  // the last space is where the pad goes
+}
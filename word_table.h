@@ -0,0 +1,37 @@
+#ifndef ANABRUTE_WORD_TABLE_H
+#define ANABRUTE_WORD_TABLE_H
+
+#include "common.h"
+#include "permut_types.h"
+#include "task_buffers.h"
+
+/*
+ * Every dictionary word once, numbered from 1 in dict_by_char order (the
+ * strings of an entry get consecutive ids, from its word_id), so queues of
+ * compact tasks (tasks_buffers.words) can refer to words by id. The OpenCL
+ * backend uploads entries and bytes to each device once and expands tasks
+ * there (expand_tasks in permut.cl), the CPU crunchers read it in place.
+ */
+#define WORD_TABLE_MAX_WORDS UINT16_MAX
+
+typedef struct word_table_s {
+    uint32_t *entries;         // per id: offset of its bytes << 8 | length; entries[0] is unused
+    uint32_t num;              // ids, 0 included
+    char *bytes;               // the words, not terminated
+    uint32_t bytes_size;
+} word_table;
+
+// Numbers the words of dict_by_char (setting the entries' word_id); -1 if they
+// are too many for the ids or an expanded task may not fit MAX_STR_LENGTH
+int word_table_create(word_table *t, char_counts *seed, char_counts_strings *(*dict_by_char)[CHARCOUNT][MAX_DICT_SIZE],
+                      int *dict_by_char_len);
+void word_table_free(word_table *t);
+
+// The permut_task a compact task stands for, laid out and numbered like
+// tasks_buffer_add_task does, every word copied once
+void word_table_expand(const word_table *t, const compact_task *task, permut_task *out);
+
+// Key words holding the candidate string or its 0x80 pad (PERMUT_NW)
+uint32_t word_table_key_words(const word_table *t, const compact_task *task);
+
+#endif //ANABRUTE_WORD_TABLE_H